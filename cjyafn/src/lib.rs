@@ -9,7 +9,7 @@ mod test;
 use get_size::GetSize;
 use rust::{
     layout::{Layout, Struct},
-    Error, Function, Graph,
+    Error, Function, FunctionHandle, Graph,
 };
 use std::borrow::Cow;
 use std::ffi::{c_char, CStr, CString};
@@ -48,6 +48,11 @@ pub extern "C" fn n_allocated_strs() -> isize {
     N_ALLOCATED_STRS.load(Ordering::Relaxed)
 }
 
+#[no_mangle]
+pub extern "C" fn set_trust_native(trusted: bool) {
+    rust::native::set_trusted(trusted)
+}
+
 #[no_mangle]
 pub extern "C" fn transmute_as_str(s: *mut ()) -> *mut c_char {
     s as *mut c_char
@@ -302,6 +307,54 @@ pub unsafe extern "C" fn graph_load(bytes: *const u8, len: usize) -> Outcome {
     })
 }
 
+/// # Safety
+///
+/// Expects `path` to be a valid C-style string.
+#[no_mangle]
+pub unsafe extern "C" fn graph_load_lazy(path: *const c_char) -> Outcome {
+    try_panic_to_outcome(|| Graph::load_lazy(&*from_c_str(path)))
+}
+
+/// Reads up to `len` bytes into `buf` out of the data source identified by `ctx`,
+/// returning how many bytes were read, `0` at the end of the data or a negative number
+/// on errors.
+pub type ReadFn = unsafe extern "C" fn(ctx: usize, buf: *mut u8, len: usize) -> isize;
+
+/// Reads data through a [`ReadFn`] callback.
+struct CallbackReader {
+    read: ReadFn,
+    ctx: usize,
+}
+
+impl std::io::Read for CallbackReader {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let read = unsafe {
+            // Safety: the callback is correctly implemented.
+            (self.read)(self.ctx, buf.as_mut_ptr(), buf.len())
+        };
+        usize::try_from(read).map_err(|_| std::io::Error::other("read callback failed"))
+    }
+}
+
+impl CallbackReader {
+    /// The callbacks are typically expensive, so reads are buffered.
+    fn buffered(read: ReadFn, ctx: usize) -> std::io::BufReader<CallbackReader> {
+        std::io::BufReader::with_capacity(1 << 16, CallbackReader { read, ctx })
+    }
+}
+
+/// Loads a graph from the data read through `read`, as it arrives. See `ReadFn` for the
+/// contract of the callback.
+///
+/// # Safety
+///
+/// Expects `read` to be a valid function pointer and implement the contract of `ReadFn`
+/// for `ctx`.
+#[no_mangle]
+pub unsafe extern "C" fn graph_load_stream(read: ReadFn, ctx: usize) -> Outcome {
+    try_panic_to_outcome(|| Graph::load_stream(CallbackReader::buffered(read, ctx)))
+}
+
 /// # Safety
 ///
 /// Expects the `graph` parameter to be a valid pointer to a graph.
@@ -340,6 +393,14 @@ pub unsafe extern "C" fn graph_compile(graph: *const ()) -> Outcome {
     try_with(graph, |graph: &Graph| graph.compile())
 }
 
+/// # Safety
+///
+/// Expects `graph` to be a valid pointer to a graph.
+#[no_mangle]
+pub unsafe extern "C" fn graph_compile_profiled(graph: *const ()) -> Outcome {
+    try_with(graph, |graph: &Graph| graph.compile_profiled())
+}
+
 /// # Safety
 ///
 /// Expects `graph` to be a valid pointer to a graph.
@@ -713,6 +774,46 @@ pub unsafe extern "C" fn function_get_metadata_json(func: *const ()) -> *const c
     })
 }
 
+/// Returns null if the function is not compiled yet.
+///
+/// # Safety
+///
+/// Expects the `func` parameter to be a valid pointer to a jyafn function.
+#[no_mangle]
+pub unsafe extern "C" fn function_compile_stats_json(func: *const ()) -> *const c_char {
+    with_unchecked(func, |func: &Function| {
+        if let Some(stats) = func.compile_stats() {
+            new_c_str(serde_json::to_string(stats).expect("can always serialize"))
+        } else {
+            std::ptr::null()
+        }
+    })
+}
+
+/// Returns null if the function was not compiled for profiling.
+///
+/// # Safety
+///
+/// Expects the `func` parameter to be a valid pointer to a jyafn function.
+#[no_mangle]
+pub unsafe extern "C" fn function_profile_report_json(func: *const ()) -> *const c_char {
+    with_unchecked(func, |func: &Function| {
+        if let Some(report) = func.profile_report() {
+            new_c_str(serde_json::to_string(&report).expect("can always serialize"))
+        } else {
+            std::ptr::null()
+        }
+    })
+}
+
+/// # Safety
+///
+/// Expects the `func` parameter to be a valid pointer to a jyafn function.
+#[no_mangle]
+pub unsafe extern "C" fn function_reset_profile(func: *const ()) {
+    with_unchecked(func, |func: &Function| func.reset_profile())
+}
+
 /// # Safety
 ///
 /// Expects the `func` parameter to be a valid pointer to a jyafn function.
@@ -752,6 +853,26 @@ pub unsafe extern "C" fn function_load(bytes: *const u8, len: usize) -> Outcome
     })
 }
 
+/// # Safety
+///
+/// Expects `path` to be a valid C-style string.
+#[no_mangle]
+pub unsafe extern "C" fn function_load_lazy(path: *const c_char) -> Outcome {
+    try_panic_to_outcome(|| Function::load_lazy(&*from_c_str(path)))
+}
+
+/// Loads a function from the data read through `read`, as it arrives. See `ReadFn` for
+/// the contract of the callback.
+///
+/// # Safety
+///
+/// Expects `read` to be a valid function pointer and implement the contract of `ReadFn`
+/// for `ctx`.
+#[no_mangle]
+pub unsafe extern "C" fn function_load_stream(read: ReadFn, ctx: usize) -> Outcome {
+    try_panic_to_outcome(|| Function::load_stream(CallbackReader::buffered(read, ctx)))
+}
+
 /// # Safety
 ///
 /// Expects
@@ -790,6 +911,84 @@ pub unsafe extern "C" fn function_call_raw(
     })
 }
 
+/// Like `function_call_raw`, but returns the error message straight away, or null if
+/// the call succeeded. Successful calls therefore need no outcome and take a single call
+/// into this library. The message needs to be freed with `free_str`.
+///
+/// # Safety
+///
+/// Expects the same as `function_call_raw`.
+#[no_mangle]
+pub unsafe extern "C" fn function_call_raw_status(
+    func: *const (),
+    input: *const u8,
+    output: *mut u8,
+) -> *const c_char {
+    with_unchecked(func, |func: &Function| call_raw_status(func, input, output))
+}
+
+/// The body of `function_call_raw_status`, shared with `function_handle_call_raw_status`.
+unsafe fn call_raw_status(func: &Function, input: *const u8, output: *mut u8) -> *const c_char {
+    let outcome = std::panic::catch_unwind(|| {
+        let input = std::slice::from_raw_parts(input, func.input_size().in_bytes());
+        let output = std::slice::from_raw_parts_mut(output, func.output_size().in_bytes());
+
+        let fn_err = func.call_raw(input, output);
+        if fn_err.is_null() {
+            return std::ptr::null();
+        }
+
+        let fn_err = Box::from_raw(fn_err).take();
+        new_c_str(rust::Error::StatusRaised(fn_err).to_string())
+    });
+    outcome
+        .unwrap_or_else(|_le_oops| new_c_str("function raw call panicked (see stderr)".to_string()))
+}
+
+/// # Safety
+///
+/// Expects
+/// 1. the `func` parameter to be a valid pointer to a jyafn function
+/// 2. the `input` paramenter to be a valid pointer to a slice of size _at least_
+///    `n_rows` times the function input size (given by `function_input_size`).
+/// 3. the `output` paramenter to be a valid pointer to a slice of size _at least_
+///    `n_rows` times the function output size (given by `function_output_size`).
+/// 4. the `errors` parameter to be a valid pointer to an array of _at least_ `n_rows`
+///    C-style strings. Each entry is set to null if the corresponding row succeeded or
+///    to the error it raised otherwise. Errors need to be freed with `free_str`.
+#[no_mangle]
+pub unsafe extern "C" fn function_call_batch(
+    func: *const (),
+    n_rows: usize,
+    input: *const u8,
+    output: *mut u8,
+    errors: *mut *const c_char,
+) -> Outcome {
+    with_unchecked(func, |func: &Function| {
+        let outcome = std::panic::catch_unwind(|| {
+            let input = std::slice::from_raw_parts(input, n_rows * func.input_size().in_bytes());
+            let output =
+                std::slice::from_raw_parts_mut(output, n_rows * func.output_size().in_bytes());
+            let errors = std::slice::from_raw_parts_mut(errors, n_rows);
+            errors.fill(std::ptr::null());
+
+            for (row, error) in func.call_batch(input, output) {
+                errors[row] = new_c_str(error.to_string());
+            }
+
+            Outcome::from_result(Result::<(), Error>::Ok(()))
+        });
+        match outcome {
+            Ok(status) => status,
+            Err(_le_oops) => Outcome::from_result(Result::<(), Error>::Err(
+                "function batch call panicked (see stderr)"
+                    .to_string()
+                    .into(),
+            )),
+        }
+    })
+}
+
 /// # Safety
 ///
 /// Expects
@@ -814,15 +1013,62 @@ pub unsafe extern "C" fn function_eval_raw(func: *const (), input: *const u8) ->
 #[no_mangle]
 pub unsafe extern "C" fn function_eval_json(func: *const (), input: *mut c_char) -> Outcome {
     try_with(func, |func: &Function| {
-        let input_cstr = CStr::from_ptr(input);
-        let input_str = input_cstr.to_string_lossy();
-        let input_value: serde_json::Value =
-            serde_json::from_str(input_str.trim()).map_err(|e| e.to_string())?;
-        let output_value: serde_json::Value = func.eval(&input_value)?;
-        let output_str = serde_json::to_string(&output_value).expect("can serialize");
-        let output_cstr = new_c_str(output_str);
+        let input = CStr::from_ptr(input);
+        let mut output = vec![];
+        func.eval_json(input.to_bytes(), &mut output)?;
+        let output_str = String::from_utf8(output).expect("json is always utf-8");
+
+        Ok(new_c_str(output_str))
+    })
+}
+
+thread_local! {
+    /// The output of the last call to `function_eval_json_into` in this thread, reused
+    /// between calls.
+    static JSON_OUTPUT: std::cell::RefCell<Vec<u8>> = const { std::cell::RefCell::new(vec![]) };
+}
+
+/// Calls the function on a JSON input and writes the JSON output into a buffer supplied
+/// by the caller, without allocating any intermediary values. The outcome is the size
+/// of the output. If that is bigger than `output_capacity`, nothing is written and the
+/// call needs to be repeated with a buffer that is big enough.
+///
+/// # Safety
+///
+/// Expects
+/// 1. the `func` parameter to be a valid pointer to a jyafn function.
+/// 2. `input` to point to `input_len` bytes of JSON.
+/// 3. `output` to point to a writable buffer of `output_capacity` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn function_eval_json_into(
+    func: *const (),
+    input: *const u8,
+    input_len: usize,
+    output: *mut u8,
+    output_capacity: usize,
+) -> Outcome {
+    try_with(func, |func: &Function| {
+        eval_json_into(func, input, input_len, output, output_capacity)
+    })
+}
+
+/// The body of `function_eval_json_into`, shared with `function_handle_eval_json_into`.
+unsafe fn eval_json_into(
+    func: &Function,
+    input: *const u8,
+    input_len: usize,
+    output: *mut u8,
+    output_capacity: usize,
+) -> Result<usize, Error> {
+    let input = std::slice::from_raw_parts(input, input_len);
+    JSON_OUTPUT.with_borrow_mut(|json| {
+        json.clear();
+        func.eval_json(input, json)?;
+        if json.len() <= output_capacity {
+            std::slice::from_raw_parts_mut(output, json.len()).copy_from_slice(json);
+        }
 
-        Ok(output_cstr)
+        Ok(json.len())
     })
 }
 
@@ -835,6 +1081,112 @@ pub unsafe extern "C" fn function_drop(func: *mut ()) {
     let _ = Box::from_raw(func as *mut Function);
 }
 
+/// Creates a handle to a function, through which it can be called while it is swapped
+/// for new versions (see `function_handle_swap`). The handle keeps its own reference to
+/// the function, so `func` still needs to be dropped with `function_drop`.
+///
+/// # Safety
+///
+/// Expects the `func` parameter to be a valid pointer to a jyafn function.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_new(func: *const ()) -> *const () {
+    with_unchecked(func, |func: &Function| {
+        let boxed = Box::new(FunctionHandle::new(func.clone()));
+        Box::leak(boxed) as *const FunctionHandle as *const ()
+    })
+}
+
+/// The current version of the function behind the handle, which needs to be dropped with
+/// `function_drop`.
+///
+/// # Safety
+///
+/// Expects the `handle` parameter to be a valid pointer to a function handle.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_current(handle: *const ()) -> *const () {
+    with_unchecked(handle, |handle: &FunctionHandle| {
+        let boxed = Box::new(handle.current());
+        Box::leak(boxed) as *const Function as *const ()
+    })
+}
+
+/// Makes `func` the current version of the function behind the handle. This returns
+/// once all calls to the previous version that were in flight are done. New calls go to
+/// `func` right away, without waiting. As in `function_handle_new`, `func` still needs to
+/// be dropped with `function_drop`.
+///
+/// # Safety
+///
+/// Expects the `handle` parameter to be a valid pointer to a function handle and the
+/// `func` parameter to be a valid pointer to a jyafn function.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_swap(handle: *const (), func: *const ()) {
+    with_unchecked(handle, |handle: &FunctionHandle| {
+        with_unchecked(func, |func: &Function| drop(handle.swap(func.clone())))
+    })
+}
+
+/// Like `function_call_raw_status`, but calls the current version of the function behind
+/// the handle. Since versions may have different layouts, the sizes of the buffers need
+/// to be given and are checked against the sizes of the version that is called.
+///
+/// # Safety
+///
+/// Expects the `handle` parameter to be a valid pointer to a function handle, `input` to
+/// point to `input_len` bytes and `output` to a writable buffer of `output_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_call_raw_status(
+    handle: *const (),
+    input: *const u8,
+    input_len: usize,
+    output: *mut u8,
+    output_len: usize,
+) -> *const c_char {
+    with_unchecked(handle, |handle: &FunctionHandle| {
+        handle.with(|func| {
+            let input_size = func.input_size().in_bytes();
+            let output_size = func.output_size().in_bytes();
+            if input_len != input_size || output_len != output_size {
+                return new_c_str(format!(
+                    "buffers of sizes {input_len} and {output_len} do not fit a function of \
+                    input size {input_size} and output size {output_size}"
+                ));
+            }
+
+            call_raw_status(func, input, output)
+        })
+    })
+}
+
+/// Like `function_eval_json_into`, but calls the current version of the function behind
+/// the handle.
+///
+/// # Safety
+///
+/// Expects the `handle` parameter to be a valid pointer to a function handle and the rest
+/// of the parameters as in `function_eval_json_into`.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_eval_json_into(
+    handle: *const (),
+    input: *const u8,
+    input_len: usize,
+    output: *mut u8,
+    output_capacity: usize,
+) -> Outcome {
+    try_with(handle, |handle: &FunctionHandle| {
+        handle.with(|func| eval_json_into(func, input, input_len, output, output_capacity))
+    })
+}
+
+/// # Safety
+///
+/// Expects the `handle` parameter to be a valid pointer to a function handle. The
+/// pointer becomes invalid after it is passed to this function.
+#[no_mangle]
+pub unsafe extern "C" fn function_handle_drop(handle: *mut ()) {
+    let _ = Box::from_raw(handle as *mut FunctionHandle);
+}
+
 // #[no_mangle]
 // pub extern "C" fn pfunc_inscribe(
 //     name: *const c_char,
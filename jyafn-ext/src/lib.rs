@@ -12,7 +12,7 @@ pub use paste::paste;
 /// We need JSON support to zip JSON values around the FFI boundary.
 pub use serde_json;
 
-pub use io::{Input, OutputBuilder, InputReader};
+pub use io::{Input, InputReader, OutputBuilder};
 pub use layout::{Layout, Struct, ISOFORMAT};
 pub use outcome::Outcome;
 pub use resource::{Method, Resource};
@@ -38,17 +38,25 @@ pub use resource::{Method, Resource};
 ///
 /// fn my_init() -> Result<(), String> { /* ... */}
 /// ```
+/// Resources that override [`Resource::from_mapped`] have to be marked as such, to be
+/// loaded straight from memory-mapped graph files. The others are always loaded with
+/// [`Resource::from_bytes`].
+/// ```
+/// extension! {
+///     Foo, #[mapped] Bar, Baz
+/// }
+/// ```
 #[macro_export]
 macro_rules! extension {
-    ($($ty:ty),*) => {
+    ($($(#[$mapped:ident])? $ty:ty),*) => {
         fn noop() -> Result<(), String> { Ok (()) }
 
         $crate::extension! {
             init = noop;
-            $($ty),*
+            $($(#[$mapped])? $ty),*
         }
     };
-    (init = $init_fn:ident; $($ty:ty),*) => {
+    (init = $init_fn:ident; $($(#[$mapped:ident])? $ty:ty),*) => {
         use std::ffi::{c_char, CString};
         use $crate::Outcome;
 
@@ -170,13 +178,7 @@ macro_rules! extension {
                         "fn_drop": "string_drop"
                     },
                     "resources": {$(
-                        stringify!($ty): {
-                            "fn_from_bytes": stringify!($ty).to_string() + "_from_bytes",
-                            "fn_dump": stringify!($ty).to_string() + "_dump",
-                            "fn_size": stringify!($ty).to_string() + "_size",
-                            "fn_get_method_def": stringify!($ty).to_string() + "_get_method",
-                            "fn_drop": stringify!($ty).to_string() + "_drop"
-                        },
+                        stringify!($ty): $crate::resource!(@manifest $ty $(, $mapped)?),
                     )*}
                 });
 
@@ -203,15 +205,56 @@ macro_rules! extension {
         }
 
         $(
-            $crate::resource! { $ty }
+            $crate::resource! { $(#[$mapped])? $ty }
         )*
     };
 }
 
 /// Declares a single resource for this extension, given a type. This writes all the
-/// boilerplate code thar corresponds to the extension side of the API.
+/// boilerplate code thar corresponds to the extension side of the API. Types marked with
+/// `#[mapped]` also export their [`Resource::from_mapped`] (see [`extension!`]).
 #[macro_export]
 macro_rules! resource {
+    (@manifest $ty:ty) => {
+        $crate::serde_json::json!({
+            "fn_from_bytes": stringify!($ty).to_string() + "_from_bytes",
+            "fn_dump": stringify!($ty).to_string() + "_dump",
+            "fn_size": stringify!($ty).to_string() + "_size",
+            "fn_get_method_def": stringify!($ty).to_string() + "_get_method",
+            "fn_drop": stringify!($ty).to_string() + "_drop"
+        })
+    };
+    (@manifest $ty:ty, mapped) => {{
+        let mut manifest = $crate::resource!(@manifest $ty);
+        manifest["fn_from_mapped"] = (stringify!($ty).to_string() + "_from_mapped").into();
+        manifest
+    }};
+    (#[mapped] $ty:ty) => {
+        $crate::resource! { $ty }
+
+        $crate::paste! {
+            #[no_mangle]
+            pub unsafe extern "C" fn [<$ty _from_mapped>](
+                bytes_ptr: *const u8,
+                bytes_len: usize,
+            ) -> *mut $crate::Outcome {
+                std::panic::catch_unwind(|| {
+                    // Safety: jyafn keeps the mapped data alive until the resource is
+                    // dropped, which is what `Resource::from_mapped` requires from its
+                    // callers. Not using the data past that is up to the implementation.
+                    let bytes = std::slice::from_raw_parts(bytes_ptr, bytes_len);
+                    let boxed = Box::new($crate::Outcome::from($ty::from_mapped(bytes)));
+                    Box::leak(boxed) as *mut _
+                }).unwrap_or_else(|_| {
+                    eprintln!(
+                        "calling `from_mapped` on resource {:?} panicked. Will return null. See stderr.",
+                        stringify!($ty)
+                    );
+                    std::ptr::null_mut()
+                })
+            }
+        }
+    };
     ($ty:ty) => {
         $crate::paste! {
 
@@ -381,6 +424,79 @@ macro_rules! get_method_ptr {
     }
 }
 
+/// The same as [`method`], but for the batched version of a method, which computes many
+/// rows in a single call. The safe interface receives the input and the output of all
+/// rows at once, one row after the other, together with the number of rows. This saves
+/// one call per row when the same method is called for a whole batch of inputs.
+///
+/// If the batched version fails, jyafn computes the rows again, one by one, with the
+/// single-row method, so that each row gets its own error. Therefore, the error (or
+/// panic) of the batched version is never shown.
+///
+/// # Usage
+///
+/// ```
+/// impl MyResource {
+///     fn something_safe_batch(
+///         &self,
+///         input: Input,
+///         output: OutputBuilder,
+///         n_rows: usize,
+///     ) -> Result<(), String> {
+///         // ...
+///         todo!()
+///     }
+///
+///     batch_method!(something_safe_batch)
+/// }
+///
+/// ```
+#[macro_export]
+macro_rules! batch_method {
+    ($safe_interface:ident) => {
+        $crate::paste! {
+            #[allow(non_snake_case)]
+            pub unsafe extern "C" fn [<raw_batch_method__ $safe_interface>](
+                resource_ptr: *const (),
+                input_ptr: *const u8,
+                input_slots: u64,
+                output_ptr: *mut u8,
+                output_slots: u64,
+                n_rows: u64,
+            ) -> u64 {
+                match std::panic::catch_unwind(|| {
+                    unsafe {
+                        // Safety: see `method`.
+                        let resource: &Self = &*(resource_ptr as *const _);
+                        let n_rows = n_rows as usize;
+
+                        Self::$safe_interface(
+                            resource,
+                            $crate::Input::new(input_ptr, n_rows * input_slots as usize),
+                            $crate::OutputBuilder::new(
+                                output_ptr,
+                                n_rows * output_slots as usize,
+                            ),
+                            n_rows,
+                        )
+                    }
+                }) {
+                    Ok(Ok(())) => 0,
+                    Ok(Err(_)) | Err(_) => 1,
+                }
+            }
+        }
+    };
+}
+
+/// A convenience macro to get references to methods created with [`batch_method`].
+#[macro_export]
+macro_rules! get_batch_method_ptr {
+    ($safe_interface:ident) => {
+        $crate::paste!(Self::[<raw_batch_method__ $safe_interface>]) as usize
+    }
+}
+
 /// This macro provides a standard implementation for the [`Resource::get_method`]
 /// function from a list of methods.
 ///
@@ -397,22 +513,27 @@ macro_rules! get_method_ptr {
 ///                 // Use the layout notation to declare the method (an yes, you can use
 ///                 // `self` anywhere in the declaration)
 ///                 foo_method(x: scalar, y: [datetime; self.size]) -> [datetime; self.size];
+///                 // Methods with a batched version (see `batch_method`) name it last.
+///                 bar_method(x: scalar) -> scalar, batch bar_method_batch;
 ///         }
 ///     }
 /// }
 /// ```
 #[macro_export]
 macro_rules! declare_methods {
-    ($( $safe_interface:ident ($($key:tt : $ty:tt),*) -> $output:tt; )*) => {
+    (@batch) => { None };
+    (@batch $batch:ident) => { Some($crate::get_batch_method_ptr!($batch)) };
+    ($( $safe_interface:ident ($($key:tt : $ty:tt),*) -> $output:tt $(, batch $batch:ident)?; )*) => {
         $crate::declare_methods! {
-            match method:  $( $safe_interface ($($key : $ty),*) -> $output; )*
+            match method:  $( $safe_interface ($($key : $ty),*) -> $output $(, batch $batch)?; )*
         }
     };
-    ( match $method:ident : $( $safe_interface:ident ($($key:tt : $ty:tt),*) -> $output:tt; )*) => {
+    ( match $method:ident : $( $safe_interface:ident ($($key:tt : $ty:tt),*) -> $output:tt $(, batch $batch:ident)?; )*) => {
         Some(match $method {
             $(
                 stringify!($safe_interface) => $crate::Method {
                     fn_ptr: $crate::get_method_ptr!($safe_interface),
+                    batch_fn_ptr: $crate::declare_methods!(@batch $($batch)?),
                     input_layout: $crate::r#struct!($($key : $ty),*),
                     output_layout: $crate::layout!($output),
                 },
@@ -13,6 +13,21 @@ use super::{Layout, Struct};
 pub trait Resource: 'static + Sized + Send + Sync {
     /// Creates a resource out of binary data.
     fn from_bytes(bytes: &[u8]) -> Result<Self, impl ToString>;
+    /// Creates a resource out of binary data that is memory-mapped from the graph file,
+    /// which the resource may use in place instead of copying it. By default, this just
+    /// calls [`Resource::from_bytes`]. This is only ever called for resources marked
+    /// with `#[mapped]` in [`crate::extension!`].
+    ///
+    /// # Safety
+    ///
+    /// The `'static` lifetime of `bytes` is a lie: the bytes are only valid (and
+    /// unchanged) until the resource is dropped. The caller must keep them alive that
+    /// long, which jyafn does. Implementations must make sure that nothing derived from
+    /// `bytes` is used after the resource is dropped, e.g., by never storing it outside
+    /// the resource itself.
+    unsafe fn from_mapped(bytes: &'static [u8]) -> Result<Self, impl ToString> {
+        Self::from_bytes(bytes)
+    }
     /// Dumps this resource as binary data.
     fn dump(&self) -> Result<Vec<u8>, impl ToString>;
     /// The ammount of heap used by this storage.
@@ -27,6 +42,10 @@ pub trait Resource: 'static + Sized + Send + Sync {
 pub struct Method {
     /// The function pointer to be used in the jyafn code.
     pub fn_ptr: usize,
+    /// The function pointer to the batched version of the method, if any, which computes
+    /// many rows in a single call. See [`crate::batch_method`].
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub batch_fn_ptr: Option<usize>,
     /// The layout of the input parameters.
     pub input_layout: Struct,
     /// The layout of the output parameters.
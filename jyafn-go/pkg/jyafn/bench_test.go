@@ -0,0 +1,122 @@
+package jyafn
+
+import (
+	"os"
+	"testing"
+)
+
+// Benchmarks of the overhead of calling functions through the FFI. Run with
+//
+//	go test -run '^$' -bench . -benchmem -json ./pkg/jyafn
+//
+// for machine-readable output.
+
+func loadBenchFunction(b *testing.B, path string) *Function {
+	code, err := os.ReadFile(path)
+	if err != nil {
+		b.Fatal(err)
+	}
+	fn, err := LoadFunction(code)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(fn.Close)
+	return fn
+}
+
+func Benchmark_LoadFunction(b *testing.B) {
+	code, err := os.ReadFile("testdata/a_fun.jyafn")
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		fn, err := LoadFunction(code)
+		if err != nil {
+			b.Fatal(err)
+		}
+		fn.Close()
+	}
+}
+
+func Benchmark_CallJSON(b *testing.B) {
+	fn := loadBenchFunction(b, "testdata/a_fun.jyafn")
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := fn.CallJSON(`{"a": 1.0, "b": 2.0}`); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func Benchmark_AppendJSON(b *testing.B) {
+	fn := loadBenchFunction(b, "testdata/a_fun.jyafn")
+	input := []byte(`{"a": 1.0, "b": 2.0}`)
+	var output []byte
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		var err error
+		if output, err = fn.AppendJSON(output[:0], input); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func Benchmark_Call(b *testing.B) {
+	fn := loadBenchFunction(b, "testdata/a_fun.jyafn")
+	input := struct {
+		a float64
+		b float64
+	}{a: 1.0, b: 2.0}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := Call[float64](fn, input); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func Benchmark_Prepared(b *testing.B) {
+	fn := loadBenchFunction(b, "testdata/a_fun.jyafn")
+	type input struct {
+		A float64 `jyafn:"a"`
+		B float64 `jyafn:"b"`
+	}
+	prepared, err := Prepare[input, float64](fn)
+	if err != nil {
+		b.Fatal(err)
+	}
+	in := input{A: 1.0, B: 2.0}
+	var output float64
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := prepared.Call(&in, &output); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func Benchmark_CallMapping(b *testing.B) {
+	fn := loadBenchFunction(b, "testdata/silly-map.jyafn")
+	input := []byte(`{"x": "a"}`)
+	var output []byte
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		var err error
+		if output, err = fn.AppendJSON(output[:0], input); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
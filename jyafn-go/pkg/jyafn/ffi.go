@@ -2,8 +2,12 @@ package jyafn
 
 import (
 	"fmt"
+	"io"
 	"os"
 	"runtime"
+	"sync"
+	"sync/atomic"
+	"unsafe"
 
 	"github.com/ebitengine/purego"
 )
@@ -30,6 +34,58 @@ func (o OutcomePtr) getPtr() (uintptr, error) {
 	}
 }
 
+// streamReader is a reader being read by the library through `readStream`.
+type streamReader struct {
+	reader io.Reader
+	err    error
+}
+
+// streamReaders holds the readers currently being read by the library, by the id that
+// was given to it.
+var streamReaders sync.Map
+var lastStreamReader atomic.Uintptr
+
+// readStream is called by the library to read from the reader with the given id. It
+// returns the number of bytes read, 0 at the end of the data or -1 on errors.
+func readStream(id uintptr, buf *byte, size uintptr) int {
+	value, ok := streamReaders.Load(id)
+	if !ok {
+		return -1
+	}
+	stream := value.(*streamReader)
+
+	for size > 0 {
+		n, err := stream.reader.Read(unsafe.Slice(buf, size))
+		if n > 0 {
+			return n
+		} else if err == io.EOF {
+			return 0
+		} else if err != nil {
+			stream.err = err
+			return -1
+		}
+	}
+
+	return 0
+}
+
+// withStreamReader makes `reader` available to the library while `load` runs, passing
+// the callback and the id with which to read from it.
+func withStreamReader(reader io.Reader, load func(uintptr, uintptr) OutcomePtr) (uintptr, error) {
+	id := lastStreamReader.Add(1)
+	stream := &streamReader{reader: reader}
+	streamReaders.Store(id, stream)
+	defer streamReaders.Delete(id)
+
+	ptr, err := load(ffi.readStream, id).get()
+	if err != nil && stream.err != nil {
+		// More informative than whatever the library has to say.
+		return 0, stream.err
+	}
+
+	return ptr, err
+}
+
 type GraphPtr uintptr
 type LayoutPtr uintptr
 type OwnedLayoutPtr uintptr
@@ -40,14 +96,18 @@ func (l OwnedLayoutPtr) getRef() LayoutPtr {
 
 type StructPtr uintptr
 type FunctionPtr uintptr
+type FunctionHandlePtr uintptr
 type AllocatedStr uintptr
 
 type ffiType struct {
 	so uintptr
 
+	readStream uintptr
+
 	freeStr        func(AllocatedStr)
 	transmuteAsStr func(AllocatedStr) string
 	nAllocatedStrs func() uintptr // it's signed!
+	setTrustNative func(bool)
 
 	outcomeIsOk         func(OutcomePtr) bool
 	outcomeConsumeOk    func(OutcomePtr) uintptr
@@ -62,9 +122,12 @@ type ffiType struct {
 	graphGetMetadata     func(GraphPtr, string) AllocatedStr
 	graphGetMetadataJson func(GraphPtr) AllocatedStr
 	graphLoad            func([]byte, uintptr) OutcomePtr
+	graphLoadLazy        func(string) OutcomePtr
+	graphLoadStream      func(uintptr, uintptr) OutcomePtr
 	graphToJson          func(GraphPtr) AllocatedStr
 	graphRender          func(GraphPtr) AllocatedStr
 	graphCompile         func(GraphPtr) OutcomePtr
+	graphCompileProfiled func(GraphPtr) OutcomePtr
 	graphClone           func(GraphPtr) GraphPtr
 	graphDrop            func(GraphPtr)
 
@@ -94,22 +157,37 @@ type ffiType struct {
 	strctGetItemName   func(StructPtr, uintptr) AllocatedStr
 	strctGetItemLayout func(StructPtr, uintptr) LayoutPtr
 
-	functionName            func(FunctionPtr) AllocatedStr
-	functionInputSize       func(FunctionPtr) uintptr
-	functionOutputSize      func(FunctionPtr) uintptr
-	functionInputLayout     func(FunctionPtr) LayoutPtr
-	functionOutputLayout    func(FunctionPtr) LayoutPtr
-	functionSymbolsJson     func(FunctionPtr) AllocatedStr
-	functionGraph           func(FunctionPtr) GraphPtr
-	functionGetMetadata     func(FunctionPtr, string) AllocatedStr
-	functionGetMetadataJson func(FunctionPtr) AllocatedStr
-	functionFnPtr           func(FunctionPtr) uintptr
-	functionGetSize         func(FunctionPtr) uintptr
-	functionLoad            func([]byte, uintptr) OutcomePtr
-	functionCallRaw         func(FunctionPtr, []uint64, []uint64) AllocatedStr
-	functionEvalRaw         func(FunctionPtr, []byte, []byte) OutcomePtr
-	functionEvalJson        func(FunctionPtr, string) OutcomePtr
-	functionDrop            func(FunctionPtr)
+	functionName              func(FunctionPtr) AllocatedStr
+	functionInputSize         func(FunctionPtr) uintptr
+	functionOutputSize        func(FunctionPtr) uintptr
+	functionInputLayout       func(FunctionPtr) LayoutPtr
+	functionOutputLayout      func(FunctionPtr) LayoutPtr
+	functionSymbolsJson       func(FunctionPtr) AllocatedStr
+	functionGraph             func(FunctionPtr) GraphPtr
+	functionGetMetadata       func(FunctionPtr, string) AllocatedStr
+	functionGetMetadataJson   func(FunctionPtr) AllocatedStr
+	functionCompileStatsJson  func(FunctionPtr) AllocatedStr
+	functionProfileReportJson func(FunctionPtr) AllocatedStr
+	functionResetProfile      func(FunctionPtr)
+	functionFnPtr             func(FunctionPtr) uintptr
+	functionGetSize           func(FunctionPtr) uintptr
+	functionLoad              func([]byte, uintptr) OutcomePtr
+	functionLoadLazy          func(string) OutcomePtr
+	functionLoadStream        func(uintptr, uintptr) OutcomePtr
+	functionCallRaw           func(FunctionPtr, []uint64, []uint64) OutcomePtr
+	functionCallRawStatus     func(FunctionPtr, []uint64, []uint64) AllocatedStr
+	functionCallBatch         func(FunctionPtr, uintptr, []uint64, []uint64, []AllocatedStr) OutcomePtr
+	functionEvalRaw           func(FunctionPtr, []byte, []byte) OutcomePtr
+	functionEvalJson          func(FunctionPtr, string) OutcomePtr
+	functionEvalJsonInto      func(FunctionPtr, []byte, uintptr, []byte, uintptr) OutcomePtr
+	functionDrop              func(FunctionPtr)
+
+	functionHandleNew           func(FunctionPtr) FunctionHandlePtr
+	functionHandleCurrent       func(FunctionHandlePtr) FunctionPtr
+	functionHandleSwap          func(FunctionHandlePtr, FunctionPtr)
+	functionHandleCallRawStatus func(FunctionHandlePtr, []uint64, uintptr, []uint64, uintptr) AllocatedStr
+	functionHandleEvalJsonInto  func(FunctionHandlePtr, []byte, uintptr, []byte, uintptr) OutcomePtr
+	functionHandleDrop          func(FunctionHandlePtr)
 }
 
 var ffi *ffiType
@@ -145,7 +223,8 @@ func init() {
 	}
 
 	ffi = &ffiType{
-		so: so,
+		so:         so,
+		readStream: purego.NewCallback(readStream),
 	}
 
 	register := func(fptr any, name string) {
@@ -158,6 +237,7 @@ func init() {
 	register(&ffi.freeStr, "free_str")
 	register(&ffi.transmuteAsStr, "transmute_as_str")
 	register(&ffi.nAllocatedStrs, "n_allocated_strs")
+	register(&ffi.setTrustNative, "set_trust_native")
 
 	register(&ffi.outcomeIsOk, "outcome_is_ok")
 	register(&ffi.outcomeConsumeOk, "outcome_consume_ok")
@@ -172,9 +252,12 @@ func init() {
 	register(&ffi.graphGetMetadata, "graph_get_metadata")
 	register(&ffi.graphGetMetadataJson, "graph_get_metadata_json")
 	register(&ffi.graphLoad, "graph_load")
+	register(&ffi.graphLoadLazy, "graph_load_lazy")
+	register(&ffi.graphLoadStream, "graph_load_stream")
 	register(&ffi.graphToJson, "graph_to_json")
 	register(&ffi.graphRender, "graph_render")
 	register(&ffi.graphCompile, "graph_compile")
+	register(&ffi.graphCompileProfiled, "graph_compile_profiled")
 	register(&ffi.graphClone, "graph_clone")
 	register(&ffi.graphDrop, "graph_drop")
 
@@ -213,11 +296,26 @@ func init() {
 	register(&ffi.functionGraph, "function_graph")
 	register(&ffi.functionGetMetadata, "function_get_metadata")
 	register(&ffi.functionGetMetadataJson, "function_get_metadata_json")
+	register(&ffi.functionCompileStatsJson, "function_compile_stats_json")
+	register(&ffi.functionProfileReportJson, "function_profile_report_json")
+	register(&ffi.functionResetProfile, "function_reset_profile")
 	register(&ffi.functionFnPtr, "function_fn_ptr")
 	register(&ffi.functionGetSize, "function_get_size")
 	register(&ffi.functionLoad, "function_load")
+	register(&ffi.functionLoadLazy, "function_load_lazy")
+	register(&ffi.functionLoadStream, "function_load_stream")
 	register(&ffi.functionCallRaw, "function_call_raw")
+	register(&ffi.functionCallRawStatus, "function_call_raw_status")
+	register(&ffi.functionCallBatch, "function_call_batch")
 	register(&ffi.functionEvalRaw, "function_eval_raw")
 	register(&ffi.functionEvalJson, "function_eval_json")
+	register(&ffi.functionEvalJsonInto, "function_eval_json_into")
 	register(&ffi.functionDrop, "function_drop")
+
+	register(&ffi.functionHandleNew, "function_handle_new")
+	register(&ffi.functionHandleCurrent, "function_handle_current")
+	register(&ffi.functionHandleSwap, "function_handle_swap")
+	register(&ffi.functionHandleCallRawStatus, "function_handle_call_raw_status")
+	register(&ffi.functionHandleEvalJsonInto, "function_handle_eval_json_into")
+	register(&ffi.functionHandleDrop, "function_handle_drop")
 }
@@ -39,6 +39,42 @@ func Test_FFI(t *testing.T) {
 	fmt.Printf("outcome: %d\n", val)
 }
 
+func Test_LoadLazy(t *testing.T) {
+	fn, err := LoadFunctionLazy("testdata/silly-map.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	result, err := fn.CallJSON(`{"x": "a"}`)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fmt.Println(result)
+}
+
+func Test_LoadFrom(t *testing.T) {
+	f, err := os.Open("testdata/silly-map.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer f.Close()
+
+	fn, err := LoadFunctionFrom(f)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	result, err := fn.CallJSON(`{"x": "a"}`)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fmt.Println(result)
+}
+
 func Test_Simple(t *testing.T) {
 	f, err := os.Open("testdata/a_fun.jyafn")
 	if err != nil {
@@ -79,6 +115,64 @@ func Test_Simple(t *testing.T) {
 	fmt.Println(result)
 }
 
+func Test_Prepare(t *testing.T) {
+	f, err := os.Open("testdata/a_fun.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer f.Close()
+
+	code, err := io.ReadAll(f)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fn, err := LoadFunction(code)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	type input struct {
+		A float64 `jyafn:"a"`
+		B float64 `jyafn:"b"`
+	}
+
+	prepared, err := Prepare[input, float64](fn)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	expected, err := Call[float64](fn, struct {
+		a float64
+		b float64
+	}{a: 1.0, b: 2.0})
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	var output float64
+	if err := prepared.Call(&input{A: 1.0, B: 2.0}, &output); err != nil {
+		log.Fatal(err)
+	}
+	if output != expected {
+		t.Errorf("expected %v, got %v", expected, output)
+	}
+
+	inputs := []input{{A: 1.0, B: 2.0}, {A: 3.0, B: 4.0}}
+	outputs := make([]float64, len(inputs))
+	if errs := prepared.CallBatch(inputs, outputs); errs != nil {
+		log.Fatal(errs)
+	}
+	if outputs[0] != expected {
+		t.Errorf("expected %v, got %v", expected, outputs[0])
+	}
+
+	if _, err := Prepare[struct{ A float64 }, float64](fn); err == nil {
+		t.Error("expected an error for a type missing fields")
+	}
+}
+
 func Test_JSON(t *testing.T) {
 	f, err := os.Open("testdata/a_fun.jyafn")
 	if err != nil {
@@ -105,6 +199,108 @@ func Test_JSON(t *testing.T) {
 	fmt.Println(result)
 }
 
+func Test_AppendJSON(t *testing.T) {
+	f, err := os.Open("testdata/a_fun.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer f.Close()
+
+	code, err := io.ReadAll(f)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fn, err := LoadFunction(code)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	expected, err := fn.CallJSON("{\"a\": 1.0, \"b\": 2.0}")
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	var buf []byte
+	for i := 0; i < 3; i++ {
+		buf, err = fn.AppendJSON(buf[:0], []byte("{\"a\": 1.0, \"b\": 2.0}"))
+		if err != nil {
+			log.Fatal(err)
+		}
+		if string(buf) != expected {
+			t.Errorf("expected %s, got %s", expected, buf)
+		}
+	}
+
+	if _, err := fn.AppendJSON(nil, []byte("{\"a\": 1.0}")); err == nil {
+		t.Error("expected an error for a missing field")
+	}
+}
+
+func Test_FunctionHandle(t *testing.T) {
+	code, err := os.ReadFile("testdata/a_fun.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fn, err := LoadFunction(code)
+	if err != nil {
+		log.Fatal(err)
+	}
+	expected, err := fn.CallJSON("{\"a\": 1.0, \"b\": 2.0}")
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	handle := NewFunctionHandle(fn)
+	defer handle.Close()
+	// The handle keeps its own reference:
+	fn.Close()
+
+	done := make(chan struct{})
+	for i := 0; i < 4; i++ {
+		go func() {
+			defer func() { done <- struct{}{} }()
+			var buf []byte
+			var err error
+			for j := 0; j < 1000; j++ {
+				buf, err = handle.AppendJSON(buf[:0], []byte("{\"a\": 1.0, \"b\": 2.0}"))
+				if err != nil {
+					t.Error(err)
+					return
+				}
+				if string(buf) != expected {
+					t.Errorf("expected %s, got %s", expected, buf)
+					return
+				}
+			}
+		}()
+	}
+
+	for i := 0; i < 10; i++ {
+		next, err := LoadFunction(code)
+		if err != nil {
+			log.Fatal(err)
+		}
+		handle.Swap(next)
+		next.Close()
+	}
+	for i := 0; i < 4; i++ {
+		<-done
+	}
+
+	current := handle.Current()
+	defer current.Close()
+	result, err := current.CallJSON("{\"a\": 1.0, \"b\": 2.0}")
+	if err != nil {
+		log.Fatal(err)
+	}
+	if result != expected {
+		t.Errorf("expected %s, got %s", expected, result)
+	}
+}
+
 func Test_MetadataJSON(t *testing.T) {
 	f, err := os.Open("testdata/a_fun.jyafn")
 	if err != nil {
@@ -233,3 +429,90 @@ func Test_JSON2(t *testing.T) {
 	fmt.Println(result)
 	fmt.Println(NAllocatedStrs())
 }
+
+func Test_CallBatch(t *testing.T) {
+	f, err := os.Open("testdata/a_fun.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer f.Close()
+
+	code, err := io.ReadAll(f)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fn, err := LoadFunction(code)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	type args struct {
+		a float64
+		b float64
+	}
+	results, errs := CallBatch[float64](fn, []args{{a: 1.0, b: 2.0}, {a: 3.0, b: 4.0}})
+	for i := range errs {
+		if errs[i] != nil {
+			log.Fatal(errs[i])
+		}
+	}
+
+	fmt.Println(results)
+}
+
+func Test_ProfileReport(t *testing.T) {
+	fn, err := LoadFunctionLazy("testdata/silly-map.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+	if fn.ProfileReport() != nil {
+		t.Fatal("function was not compiled for profiling")
+	}
+
+	profiled, err := fn.Graph().CompileProfiled()
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer profiled.Close()
+
+	for i := 0; i < 3; i++ {
+		if _, err := profiled.CallJSON(`{"x": "a"}`); err != nil {
+			log.Fatal(err)
+		}
+	}
+
+	report := profiled.ProfileReport()
+	if report == nil || report.Entries[0].Kind != "function" || report.Entries[0].Hits != 3 {
+		t.Fatalf("bad report: %+v", report)
+	}
+	fmt.Printf("%+v\n", report)
+
+	profiled.ResetProfile()
+	if hits := profiled.ProfileReport().Entries[0].Hits; hits != 0 {
+		t.Fatalf("expected no hits after reset, got %d", hits)
+	}
+}
+
+func Test_CompileStats(t *testing.T) {
+	code, err := os.ReadFile("testdata/a_fun.jyafn")
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	fn, err := LoadFunction(code)
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer fn.Close()
+
+	stats := fn.CompileStats()
+	if stats == nil || stats.IRSize == 0 || len(stats.Passes) == 0 {
+		t.Fatalf("bad compile stats: %+v", stats)
+	}
+	if fn.GetMetadata("jyafn.compile.source") != stats.Source {
+		t.Fatalf("compile stats missing from metadata: %s", fn.GetMetadataJSON())
+	}
+}
@@ -3,6 +3,8 @@ package jyafn
 import (
 	"encoding/json"
 	"fmt"
+	"io"
+	"slices"
 )
 
 type Function struct {
@@ -11,6 +13,9 @@ type Function struct {
 	symbols  []string
 }
 
+// The space given to the output of `AppendJSON` on the first try.
+const minJSONOutput = 256
+
 func (f *Function) panicOnClosed() {
 	if f.isClosed {
 		panic(fmt.Sprintf("function %+v was already closed", f))
@@ -40,6 +45,29 @@ func LoadFunction(encoded []byte) (*Function, error) {
 	return functionFromRaw(FunctionPtr(ptr)), nil
 }
 
+// LoadFunctionLazy loads a function from the file at the given path, only reading the
+// data of each mapping when it is first used. This makes functions with big mappings
+// ready to be called much quicker, at the expense of slower first calls.
+func LoadFunctionLazy(path string) (*Function, error) {
+	ptr, err := ffi.functionLoadLazy(path).get()
+	if err != nil {
+		return nil, err
+	}
+
+	return functionFromRaw(FunctionPtr(ptr)), nil
+}
+
+// LoadFunctionFrom loads a function from the given reader, as the data arrives. See
+// `LoadGraphFrom` for details.
+func LoadFunctionFrom(reader io.Reader) (*Function, error) {
+	ptr, err := withStreamReader(reader, ffi.functionLoadStream)
+	if err != nil {
+		return nil, err
+	}
+
+	return functionFromRaw(FunctionPtr(ptr)), nil
+}
+
 func (f *Function) Close() {
 	if !f.isClosed {
 		ffi.functionDrop(f.ptr)
@@ -109,3 +137,38 @@ func (f *Function) CallJSON(json string) (string, error) {
 	defer ffi.freeStr(AllocatedStr(output))
 	return ffi.transmuteAsStr(AllocatedStr(output)), nil
 }
+
+// AppendJSON calls the function on a JSON input and appends the JSON output to dst,
+// returning the extended buffer. The JSON goes straight into and out of the function,
+// without any intermediary values, so reusing dst between calls avoids allocating.
+func (f *Function) AppendJSON(dst []byte, json []byte) ([]byte, error) {
+	f.panicOnClosed()
+	return appendJSON(dst, json, func(json, free []byte) OutcomePtr {
+		return ffi.functionEvalJsonInto(f.ptr, json, uintptr(len(json)), free, uintptr(len(free)))
+	})
+}
+
+// appendJSON runs `evalInto`, which writes the JSON output into the free space it is
+// given, until the output fits.
+func appendJSON(dst []byte, json []byte, evalInto func(json, free []byte) OutcomePtr) ([]byte, error) {
+	if len(json) == 0 {
+		return dst, fmt.Errorf("empty JSON input")
+	}
+	if cap(dst)-len(dst) < minJSONOutput {
+		dst = slices.Grow(dst, minJSONOutput)
+	}
+
+	for {
+		free := dst[len(dst):cap(dst)]
+		size, err := evalInto(json, free).getPtr()
+		if err != nil {
+			return dst, err
+		}
+		if int(size) <= len(free) {
+			return dst[:len(dst)+int(size)], nil
+		}
+
+		// Did not fit: call again with enough space.
+		dst = slices.Grow(dst, int(size))
+	}
+}
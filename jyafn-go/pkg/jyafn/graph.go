@@ -1,6 +1,9 @@
 package jyafn
 
-import "fmt"
+import (
+	"fmt"
+	"io"
+)
 
 type Graph struct {
 	ptr      GraphPtr
@@ -16,6 +19,30 @@ func LoadGraph(encoded []byte) (*Graph, error) {
 	return &Graph{ptr: GraphPtr(ptr), isClosed: false}, nil
 }
 
+// LoadGraphLazy loads a graph from the file at the given path, only reading the data
+// of each mapping when it is first accessed. This makes loading graphs with big
+// mappings much quicker.
+func LoadGraphLazy(path string) (*Graph, error) {
+	ptr, err := ffi.graphLoadLazy(path).get()
+	if err != nil {
+		return nil, err
+	}
+
+	return &Graph{ptr: GraphPtr(ptr), isClosed: false}, nil
+}
+
+// LoadGraphFrom loads a graph from the given reader, as the data arrives. Graphs dumped
+// as streams are read only once, from start to end, and are never all held in memory at
+// once, e.g., while they are downloaded. Other graphs are read to the end first.
+func LoadGraphFrom(reader io.Reader) (*Graph, error) {
+	ptr, err := withStreamReader(reader, ffi.graphLoadStream)
+	if err != nil {
+		return nil, err
+	}
+
+	return &Graph{ptr: GraphPtr(ptr), isClosed: false}, nil
+}
+
 func (g *Graph) Close() {
 	if !g.isClosed {
 		ffi.graphDrop(g.ptr)
@@ -75,3 +102,16 @@ func (g *Graph) Compile() (*Function, error) {
 	}
 	return functionFromRaw(FunctionPtr(ptr)), nil
 }
+
+// CompileProfiled compiles the graph into a function that also counts how many times
+// each call (to mappings, resources and subgraphs) and each side of each conditional
+// runs and how long it takes. This makes the function slower: it is meant for finding
+// out where the time goes, not for serving. See `Function.ProfileReport`.
+func (g *Graph) CompileProfiled() (*Function, error) {
+	g.panicOnClosed()
+	ptr, err := ffi.graphCompileProfiled(g.ptr).get()
+	if err != nil {
+		return nil, err
+	}
+	return functionFromRaw(FunctionPtr(ptr)), nil
+}
@@ -0,0 +1,93 @@
+package jyafn
+
+import (
+	"fmt"
+	"sync/atomic"
+)
+
+// FunctionHandle is a function that can be swapped for a new version while other
+// goroutines are calling it. Calls never wait for a swap: they go either to the previous
+// version or to the new one, and the previous version is only freed once all calls to it
+// are done. This is the way to reload a function without closing it under the feet of
+// its callers.
+type FunctionHandle struct {
+	ptr      FunctionHandlePtr
+	isClosed atomic.Bool
+}
+
+// NewFunctionHandle creates a handle whose first version is `f`. The handle keeps its own
+// reference to the function, so `f` can be closed independently.
+func NewFunctionHandle(f *Function) *FunctionHandle {
+	f.panicOnClosed()
+	return &FunctionHandle{ptr: ffi.functionHandleNew(f.ptr)}
+}
+
+func (h *FunctionHandle) panicOnClosed() {
+	if h.isClosed.Load() {
+		panic(fmt.Sprintf("function handle %p was already closed", h))
+	}
+}
+
+// Close frees the handle. No calls through the handle can be in flight when it is
+// closed.
+func (h *FunctionHandle) Close() {
+	if h.isClosed.CompareAndSwap(false, true) {
+		ffi.functionHandleDrop(h.ptr)
+	}
+}
+
+// Swap makes `next` the current version of the function. New calls go to `next` right
+// away and this returns once all calls to the previous version are done. As in
+// `NewFunctionHandle`, `next` can be closed independently. Loading `next` and swapping it
+// in can be done in a goroutine of its own, without ever pausing the callers.
+func (h *FunctionHandle) Swap(next *Function) {
+	h.panicOnClosed()
+	next.panicOnClosed()
+	ffi.functionHandleSwap(h.ptr, next.ptr)
+}
+
+// Current returns the current version of the function, which stays valid until it is
+// closed, even if it is swapped out of the handle.
+func (h *FunctionHandle) Current() *Function {
+	h.panicOnClosed()
+	return functionFromRaw(ffi.functionHandleCurrent(h.ptr))
+}
+
+// CallRaw calls the current version of the function with inputs and outputs already
+// encoded. The sizes of the buffers need to match the sizes of the current version.
+func (h *FunctionHandle) CallRaw(input []uint64, output []uint64) error {
+	h.panicOnClosed()
+	status := ffi.functionHandleCallRawStatus(
+		h.ptr,
+		input,
+		uintptr(len(input)*8),
+		output,
+		uintptr(len(output)*8),
+	)
+	if status != 0 {
+		defer ffi.freeStr(status)
+		return fmt.Errorf("%s", ffi.transmuteAsStr(status))
+	}
+
+	return nil
+}
+
+// AppendJSON calls the current version of the function on a JSON input and appends the
+// JSON output to dst. See `Function.AppendJSON`.
+func (h *FunctionHandle) AppendJSON(dst []byte, json []byte) ([]byte, error) {
+	h.panicOnClosed()
+	return appendJSON(dst, json, func(json, free []byte) OutcomePtr {
+		return ffi.functionHandleEvalJsonInto(h.ptr, json, uintptr(len(json)), free, uintptr(len(free)))
+	})
+}
+
+// CallJSON calls the current version of the function on a JSON input, returning the
+// JSON output.
+func (h *FunctionHandle) CallJSON(json string) (string, error) {
+	output, err := h.AppendJSON(nil, []byte(json))
+	if err != nil {
+		return "", err
+	}
+
+	return string(output), nil
+}
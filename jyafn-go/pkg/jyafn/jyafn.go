@@ -9,6 +9,14 @@ func NAllocatedStrs() int {
 	return int(ffi.nAllocatedStrs())
 }
 
+// SetTrustNative sets whether the native code stored in graph files is run when loading
+// functions, instead of compiling them. That code is only as trustworthy as the file it
+// comes from, so only set this if all files loaded come from a trusted source. This
+// overrides the JYAFN_TRUST_NATIVE environment variable. Off by default.
+func SetTrustNative(trusted bool) {
+	ffi.setTrustNative(trusted)
+}
+
 func Call[O any](f *Function, arg any) (O, error) {
 	f.panicOnClosed()
 
@@ -27,15 +35,13 @@ func Call[O any](f *Function, arg any) (O, error) {
 	}
 
 	out := make([]uint64, f.OutputSize()/8)
-	status := ffi.functionCallRaw(
+	_, err = ffi.functionCallRaw(
 		f.ptr,
 		visitor.buf,
 		out,
-	)
-	if status != 0 {
-		defer ffi.freeStr(status)
-		return *reflect.New(reflect.TypeFor[O]()).Interface().(*O),
-			fmt.Errorf("function raised status %v", ffi.transmuteAsStr(status))
+	).get()
+	if err != nil {
+		return *reflect.New(reflect.TypeFor[O]()).Interface().(*O), err
 	}
 
 	decoded := decodeValue(reflect.TypeFor[O](), f.OutputLayout(), symbols, &Visitor{buf: out})
@@ -51,3 +57,80 @@ func Call[O any](f *Function, arg any) (O, error) {
 
 	return output, nil
 }
+
+// CallBatch calls the function on each one of the supplied arguments, crossing into
+// jyafn only once for the whole batch. It returns one output and one error for each
+// argument, in the same order. The output for an argument that failed is the zero
+// value. Errors that prevent the batch from running at all are reported for every
+// argument.
+func CallBatch[O any, I any](f *Function, args []I) ([]O, []error) {
+	f.panicOnClosed()
+
+	outputs := make([]O, len(args))
+	errs := make([]error, len(args))
+	if len(args) == 0 {
+		return outputs, errs
+	}
+
+	inputSize := int(f.InputSize() / 8)
+	outputSize := int(f.OutputSize() / 8)
+	visitor := &Visitor{buf: make([]uint64, 0, len(args)*inputSize)}
+	symbols := &Symbols{top: f.symbols}
+	for i, arg := range args {
+		err := encodeValue(reflect.ValueOf(arg), f.InputLayout(), symbols, visitor)
+		if err != nil {
+			// Keep the rows aligned; this row will not be decoded anyway.
+			visitor.buf = append(visitor.buf[:i*inputSize], make([]uint64, inputSize)...)
+			errs[i] = fmt.Errorf(
+				"failed to encode %v to layout %v: %v",
+				reflect.ValueOf(arg),
+				f.InputLayout().ToString(),
+				err,
+			)
+		}
+	}
+
+	out := make([]uint64, len(args)*outputSize)
+	statuses := make([]AllocatedStr, len(args))
+	_, err := ffi.functionCallBatch(
+		f.ptr,
+		uintptr(len(args)),
+		visitor.buf,
+		out,
+		statuses,
+	).get()
+	if err != nil {
+		for i := range errs {
+			errs[i] = err
+		}
+		return outputs, errs
+	}
+
+	for i := range args {
+		if statuses[i] != 0 {
+			if errs[i] == nil {
+				errs[i] = fmt.Errorf("function raised status: %v", ffi.transmuteAsStr(statuses[i]))
+			}
+			ffi.freeStr(statuses[i])
+			continue
+		}
+		if errs[i] != nil {
+			continue
+		}
+
+		row := &Visitor{buf: out[i*outputSize : (i+1)*outputSize]}
+		decoded := decodeValue(reflect.TypeFor[O](), f.OutputLayout(), symbols, row)
+		output, isOk := decoded.Interface().(O)
+		if !isOk {
+			errs[i] = fmt.Errorf(
+				"failed to decode %v from layout %v",
+				reflect.TypeFor[O](),
+				f.OutputLayout().ToString(),
+			)
+			continue
+		}
+		outputs[i] = output
+	}
+
+	return outputs, errs
+}
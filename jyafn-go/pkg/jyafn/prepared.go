@@ -0,0 +1,497 @@
+package jyafn
+
+import (
+	"fmt"
+	"math"
+	"reflect"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+// opKind says how a slot is moved between a Go value and a jyafn buffer.
+type opKind int
+
+const (
+	opFloat64 opKind = iota
+	opFloat32
+	opBool
+	// A string, as a symbol.
+	opSymbol
+	// A `time.Time`, as a datetime.
+	opTime
+	// A string, as a datetime in the format of the layout.
+	opDateTimeString
+	// A slice, with its own operations for each element.
+	opSlice
+)
+
+// slotOp moves a single slot (or a whole slice, for `opSlice`) between a Go value and a
+// jyafn buffer.
+type slotOp struct {
+	kind opKind
+	// Where the field is, from the start of the enclosing value.
+	offset uintptr
+	// Where the slot is, from the start of the enclosing value.
+	slot int
+	// The format of `opDateTimeString`.
+	format string
+	// For `opSlice`: the slice type, its size, the size of each element in bytes and in
+	// slots and the operations of each element.
+	sliceType reflect.Type
+	size      int
+	elemSize  uintptr
+	stride    int
+	elem      []slotOp
+}
+
+var timeType = reflect.TypeFor[time.Time]()
+
+// findField finds the field of a struct type corresponding to the given name in a
+// layout, either by its `jyafn` tag or by its name.
+func findField(ty reflect.Type, name string) (reflect.StructField, bool) {
+	for i := 0; i < ty.NumField(); i++ {
+		field := ty.Field(i)
+		if field.Tag.Get("jyafn") == name || field.Name == name {
+			return field, true
+		}
+	}
+
+	return reflect.StructField{}, false
+}
+
+// compileOps appends the operations that move a value of type `ty`, found at `offset`,
+// from and to the layout `layout`, found at `slot`. It also returns the number of slots
+// of the layout.
+func compileOps(
+	ty reflect.Type,
+	layout Layout,
+	offset uintptr,
+	slot int,
+	ops []slotOp,
+) ([]slotOp, int, error) {
+	kind := ty.Kind()
+	single := func(kind opKind) ([]slotOp, int, error) {
+		return append(ops, slotOp{kind: kind, offset: offset, slot: slot}), 1, nil
+	}
+
+	switch {
+	case layout.IsUnit():
+		return ops, 0, nil
+	case layout.IsScalar() && kind == reflect.Float64:
+		return single(opFloat64)
+	case layout.IsScalar() && kind == reflect.Float32:
+		return single(opFloat32)
+	case layout.IsBool() && kind == reflect.Bool:
+		return single(opBool)
+	case layout.IsSymbol() && kind == reflect.String:
+		return single(opSymbol)
+	case layout.IsDateTime() && ty == timeType:
+		return single(opTime)
+	case layout.IsDateTime() && kind == reflect.String:
+		ops = append(ops, slotOp{
+			kind:   opDateTimeString,
+			offset: offset,
+			slot:   slot,
+			format: layout.DateTimeFormat(),
+		})
+		return ops, 1, nil
+	case layout.IsStruct() && kind == reflect.Struct:
+		strct := layout.AsStruct()
+		slots := 0
+		for i := uint(0); i < strct.Size(); i++ {
+			fieldName := strct.GetItemName(i)
+			field, found := findField(ty, fieldName)
+			if !found {
+				return nil, 0, fmt.Errorf("missing field (or tag) %v in type %v", fieldName, ty)
+			}
+
+			var fieldSlots int
+			var err error
+			ops, fieldSlots, err = compileOps(
+				field.Type,
+				strct.GetItemLayout(i),
+				offset+field.Offset,
+				slot+slots,
+				ops,
+			)
+			if err != nil {
+				return nil, 0, err
+			}
+			slots += fieldSlots
+		}
+
+		return ops, slots, nil
+	case layout.IsList() && kind == reflect.Array:
+		size := int(layout.ListSize())
+		if ty.Len() != size {
+			return nil, 0, fmt.Errorf("layout expected size %v, got %v in type %v", size, ty.Len(), ty)
+		}
+
+		slots := 0
+		for i := 0; i < size; i++ {
+			var elemSlots int
+			var err error
+			ops, elemSlots, err = compileOps(
+				ty.Elem(),
+				layout.ListElement(),
+				offset+uintptr(i)*ty.Elem().Size(),
+				slot+slots,
+				ops,
+			)
+			if err != nil {
+				return nil, 0, err
+			}
+			slots += elemSlots
+		}
+
+		return ops, slots, nil
+	case layout.IsList() && kind == reflect.Slice:
+		elem, stride, err := compileOps(ty.Elem(), layout.ListElement(), 0, 0, nil)
+		if err != nil {
+			return nil, 0, err
+		}
+
+		size := int(layout.ListSize())
+		ops = append(ops, slotOp{
+			kind:      opSlice,
+			offset:    offset,
+			slot:      slot,
+			sliceType: ty,
+			size:      size,
+			elemSize:  ty.Elem().Size(),
+			stride:    stride,
+			elem:      elem,
+		})
+		return ops, size * stride, nil
+	}
+
+	return nil, 0, fmt.Errorf("no layout rules to match %v to %v", ty, layout.ToString())
+}
+
+// callState holds the buffers of a call, reused between calls.
+type callState struct {
+	input    []uint64
+	output   []uint64
+	statuses []AllocatedStr
+	// The symbols in the input that are not in the function.
+	extra []string
+}
+
+// grow makes sure the slice has at least size `n`, keeping at least one element, so that
+// it can always be passed to the library.
+func grow[T any](s []T, n int) []T {
+	n = max(n, 1)
+	if cap(s) < n {
+		return make([]T, n)
+	}
+	return s[:n]
+}
+
+// Prepared is a function prepared to be called with Go values of type `I` and to return
+// Go values of type `O`. The types are matched against the layouts of the function once,
+// when preparing, instead of on every call, as `Call` does. Fields are then copied
+// straight from and to reused buffers, without reflection or allocations (except for
+// slices in the output and datetimes as strings).
+//
+// Supported types are `float64` and `float32` for scalars, `bool` for bools, `string`
+// for symbols, `time.Time` or `string` for datetimes, arrays or slices for lists and
+// structs for structs, whose fields are matched by their `jyafn` tag or by their name.
+type Prepared[I, O any] struct {
+	f          *Function
+	inputSize  int
+	outputSize int
+	encodeOps  []slotOp
+	decodeOps  []slotOp
+	// The symbols of the function, by their hashes.
+	symbols map[uint64]string
+	states  sync.Pool
+}
+
+// Prepare prepares the function to be called with values of type `I`, returning values
+// of type `O`. This fails if the types do not match the layouts of the function.
+func Prepare[I, O any](f *Function) (*Prepared[I, O], error) {
+	f.panicOnClosed()
+
+	encodeOps, inputSize, err := compileOps(reflect.TypeFor[I](), f.InputLayout(), 0, 0, nil)
+	if err != nil {
+		return nil, fmt.Errorf(
+			"cannot encode %v to layout %v: %v",
+			reflect.TypeFor[I](),
+			f.InputLayout().ToString(),
+			err,
+		)
+	}
+	decodeOps, outputSize, err := compileOps(reflect.TypeFor[O](), f.OutputLayout(), 0, 0, nil)
+	if err != nil {
+		return nil, fmt.Errorf(
+			"cannot decode %v from layout %v: %v",
+			reflect.TypeFor[O](),
+			f.OutputLayout().ToString(),
+			err,
+		)
+	}
+
+	symbols := make(map[uint64]string, len(f.symbols))
+	for _, symbol := range f.symbols {
+		symbols[SymbolHash(symbol)] = symbol
+	}
+
+	return &Prepared[I, O]{
+		f:          f,
+		inputSize:  inputSize,
+		outputSize: outputSize,
+		encodeOps:  encodeOps,
+		decodeOps:  decodeOps,
+		symbols:    symbols,
+		states:     sync.Pool{New: func() any { return &callState{} }},
+	}, nil
+}
+
+func (p *Prepared[I, O]) encode(ops []slotOp, base unsafe.Pointer, slots []uint64, state *callState) error {
+	for i := range ops {
+		op := &ops[i]
+		ptr := unsafe.Add(base, op.offset)
+		switch op.kind {
+		case opFloat64:
+			slots[op.slot] = math.Float64bits(*(*float64)(ptr))
+		case opFloat32:
+			slots[op.slot] = math.Float64bits(float64(*(*float32)(ptr)))
+		case opBool:
+			if *(*bool)(ptr) {
+				slots[op.slot] = 1
+			} else {
+				slots[op.slot] = 0
+			}
+		case opSymbol:
+			symbol := *(*string)(ptr)
+			hash := SymbolHash(symbol)
+			if _, isKnown := p.symbols[hash]; !isKnown {
+				state.extra = append(state.extra, symbol)
+			}
+			slots[op.slot] = hash
+		case opTime:
+			slots[op.slot] = uint64((*(*time.Time)(ptr)).UnixMicro())
+		case opDateTimeString:
+			timestamp, err := ParseDateTime(*(*string)(ptr), op.format)
+			if err != nil {
+				return err
+			}
+			slots[op.slot] = uint64(timestamp)
+		case opSlice:
+			// All slices have the same header, whatever the element type.
+			slice := *(*[]byte)(ptr)
+			if len(slice) != op.size {
+				return fmt.Errorf("layout expected size %v, got %v", op.size, len(slice))
+			}
+			data := unsafe.Pointer(unsafe.SliceData(slice))
+			for j := 0; j < op.size; j++ {
+				err := p.encode(
+					op.elem,
+					unsafe.Add(data, uintptr(j)*op.elemSize),
+					slots[op.slot+j*op.stride:],
+					state,
+				)
+				if err != nil {
+					return err
+				}
+			}
+		}
+	}
+
+	return nil
+}
+
+func (p *Prepared[I, O]) symbol(hash uint64, state *callState) (string, error) {
+	if symbol, isKnown := p.symbols[hash]; isKnown {
+		return symbol, nil
+	}
+	for _, symbol := range state.extra {
+		if SymbolHash(symbol) == hash {
+			return symbol, nil
+		}
+	}
+
+	return "", fmt.Errorf("symbol of id %v not found", hash)
+}
+
+func (p *Prepared[I, O]) decode(ops []slotOp, base unsafe.Pointer, slots []uint64, state *callState) error {
+	for i := range ops {
+		op := &ops[i]
+		ptr := unsafe.Add(base, op.offset)
+		switch op.kind {
+		case opFloat64:
+			*(*float64)(ptr) = math.Float64frombits(slots[op.slot])
+		case opFloat32:
+			*(*float32)(ptr) = float32(math.Float64frombits(slots[op.slot]))
+		case opBool:
+			*(*bool)(ptr) = slots[op.slot] != 0
+		case opSymbol:
+			symbol, err := p.symbol(slots[op.slot], state)
+			if err != nil {
+				return err
+			}
+			*(*string)(ptr) = symbol
+		case opTime:
+			*(*time.Time)(ptr) = time.UnixMicro(int64(slots[op.slot])).UTC()
+		case opDateTimeString:
+			formatted, err := FormatDateTime(int64(slots[op.slot]), op.format)
+			if err != nil {
+				return err
+			}
+			*(*string)(ptr) = formatted
+		case opSlice:
+			slice := reflect.NewAt(op.sliceType, ptr).Elem()
+			if slice.Len() != op.size {
+				slice.Set(reflect.MakeSlice(op.sliceType, op.size, op.size))
+			}
+			data := slice.UnsafePointer()
+			for j := 0; j < op.size; j++ {
+				err := p.decode(
+					op.elem,
+					unsafe.Add(data, uintptr(j)*op.elemSize),
+					slots[op.slot+j*op.stride:],
+					state,
+				)
+				if err != nil {
+					return err
+				}
+			}
+		}
+	}
+
+	return nil
+}
+
+// Call calls the function on `input`, writing the result to `output`. Slices in
+// `output` of the right size are reused.
+func (p *Prepared[I, O]) Call(input *I, output *O) error {
+	p.f.panicOnClosed()
+
+	state := p.states.Get().(*callState)
+	defer p.states.Put(state)
+	state.input = grow(state.input, p.inputSize)
+	state.output = grow(state.output, p.outputSize)
+	state.extra = state.extra[:0]
+
+	err := p.encode(p.encodeOps, unsafe.Pointer(input), state.input, state)
+	if err != nil {
+		return fmt.Errorf("failed to encode %v: %v", reflect.TypeFor[I](), err)
+	}
+
+	status := ffi.functionCallRawStatus(p.f.ptr, state.input, state.output)
+	if status != 0 {
+		defer ffi.freeStr(status)
+		return fmt.Errorf("%s", ffi.transmuteAsStr(status))
+	}
+
+	return p.decode(p.decodeOps, unsafe.Pointer(output), state.output, state)
+}
+
+// CallBatch calls the function on each one of the inputs, crossing into jyafn only once
+// for the whole batch, and writes the results to the outputs, in the same order. It
+// returns nil if all inputs succeeded and one error for each input, otherwise (nil for
+// the inputs that succeeded).
+func (p *Prepared[I, O]) CallBatch(inputs []I, outputs []O) []error {
+	p.f.panicOnClosed()
+	if len(inputs) != len(outputs) {
+		panic(fmt.Sprintf("got %v inputs, but %v outputs", len(inputs), len(outputs)))
+	}
+	if len(inputs) == 0 {
+		return nil
+	}
+
+	state := p.states.Get().(*callState)
+	defer p.states.Put(state)
+	state.input = grow(state.input, len(inputs)*p.inputSize)
+	state.output = grow(state.output, len(inputs)*p.outputSize)
+	state.statuses = grow(state.statuses, len(inputs))
+	state.extra = state.extra[:0]
+
+	var errs []error
+	fail := func(row int, err error) {
+		if errs == nil {
+			errs = make([]error, len(inputs))
+		}
+		errs[row] = err
+	}
+
+	for i := range inputs {
+		row := state.input[i*p.inputSize : (i+1)*p.inputSize]
+		err := p.encode(p.encodeOps, unsafe.Pointer(&inputs[i]), row, state)
+		if err != nil {
+			// The row still runs, but will not be decoded.
+			clear(row)
+			fail(i, fmt.Errorf("failed to encode %v: %v", reflect.TypeFor[I](), err))
+		}
+	}
+
+	_, err := ffi.functionCallBatch(
+		p.f.ptr,
+		uintptr(len(inputs)),
+		state.input,
+		state.output,
+		state.statuses,
+	).get()
+	if err != nil {
+		for i := range inputs {
+			fail(i, err)
+		}
+		return errs
+	}
+
+	for i := range inputs {
+		if status := state.statuses[i]; status != 0 {
+			if errs == nil || errs[i] == nil {
+				fail(i, fmt.Errorf("function raised status: %v", ffi.transmuteAsStr(status)))
+			}
+			ffi.freeStr(status)
+			continue
+		}
+		if errs != nil && errs[i] != nil {
+			continue
+		}
+
+		row := state.output[i*p.outputSize : (i+1)*p.outputSize]
+		if err := p.decode(p.decodeOps, unsafe.Pointer(&outputs[i]), row, state); err != nil {
+			fail(i, err)
+		}
+	}
+
+	return errs
+}
+
+// The seed of the hashes of symbols.
+const symbolHashSeed = 12345678
+
+// SymbolHash gives the id of a jyafn symbol, as used inside functions. This is the
+// Murmur-64A hash of the symbol.
+func SymbolHash(s string) uint64 {
+	const m uint64 = 0xc6a4a7935bd1e995
+	const r = 47
+
+	h := uint64(symbolHashSeed) ^ (uint64(len(s)) * m)
+
+	i := 0
+	for ; i+8 <= len(s); i += 8 {
+		k := uint64(s[i]) | uint64(s[i+1])<<8 | uint64(s[i+2])<<16 | uint64(s[i+3])<<24 |
+			uint64(s[i+4])<<32 | uint64(s[i+5])<<40 | uint64(s[i+6])<<48 | uint64(s[i+7])<<56
+		k *= m
+		k ^= k >> r
+		k *= m
+		h ^= k
+		h *= m
+	}
+
+	if over := len(s) - i; over > 0 {
+		for j := over - 1; j >= 0; j-- {
+			h ^= uint64(s[i+j]) << (8 * j)
+		}
+		h *= m
+	}
+
+	h ^= h >> r
+	h *= m
+	h ^= h >> r
+	return h
+}
@@ -0,0 +1,57 @@
+package jyafn
+
+import (
+	"encoding/json"
+)
+
+// ProfileEntry holds the counts of a site of a profiled function: the function itself,
+// a call to a mapping, resource or subgraph, or a side of a conditional.
+type ProfileEntry struct {
+	// Kind is one of "function", "call", "if_true" or "if_false".
+	Kind string `json:"kind"`
+	// NodeID is the node of the call or of the choice, in the graph as it was compiled
+	// (i.e., after all optimizations).
+	NodeID *int `json:"node_id"`
+	// Op is the name of the operation of the node.
+	Op *string `json:"op"`
+	// Name is the mapping, the resource method (as `resource.method`) or the subgraph
+	// called.
+	Name *string `json:"name"`
+	// Hits is how many times the site completed.
+	Hits uint64 `json:"hits"`
+	// Ticks is the total of clock ticks spent in the site.
+	Ticks uint64 `json:"ticks"`
+	// Misses is, for mapping calls, how many times the key was not found.
+	Misses *uint64 `json:"misses"`
+}
+
+// ProfileReport holds the counts of all sites of a profiled function. The first entry
+// is the whole function.
+type ProfileReport struct {
+	TicksPerSecond float64        `json:"ticks_per_second"`
+	Entries        []ProfileEntry `json:"entries"`
+}
+
+// ProfileReport returns the counts of each site of the function since it was compiled
+// (or since the last `ResetProfile`), or nil if the function was not compiled with
+// `Graph.CompileProfiled`.
+func (f *Function) ProfileReport() *ProfileReport {
+	f.panicOnClosed()
+	value := ffi.functionProfileReportJson(f.ptr)
+	if value == 0 {
+		return nil
+	}
+	defer ffi.freeStr(value)
+
+	report := &ProfileReport{}
+	if err := json.Unmarshal([]byte(ffi.transmuteAsStr(value)), report); err != nil {
+		panic(err)
+	}
+	return report
+}
+
+// ResetProfile sets all the counts of `ProfileReport` back to zero.
+func (f *Function) ResetProfile() {
+	f.panicOnClosed()
+	ffi.functionResetProfile(f.ptr)
+}
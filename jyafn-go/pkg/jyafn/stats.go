@@ -0,0 +1,49 @@
+package jyafn
+
+import (
+	"encoding/json"
+)
+
+// PassStats holds how long an optimization pass took and how many nodes the graph had
+// after it.
+type PassStats struct {
+	Name   string  `json:"name"`
+	TimeMs float64 `json:"time_ms"`
+	Nodes  int     `json:"nodes"`
+}
+
+// CompileStats holds how long each phase of the compilation of a function took (wall
+// time, in milliseconds) and how big what came out of each phase was (in bytes). QBE
+// and the assembler only run (and have stats) when `Source` is "compiled", as opposed to
+// "cache" or "precompiled".
+type CompileStats struct {
+	Source       string      `json:"source"`
+	Nodes        int         `json:"nodes"`
+	Passes       []PassStats `json:"passes"`
+	RenderMs     float64     `json:"render_ms"`
+	IRSize       int         `json:"ir_size"`
+	QbeMs        *float64    `json:"qbe_ms"`
+	AssemblySize *int        `json:"assembly_size"`
+	AssembleMs   *float64    `json:"assemble_ms"`
+	ObjectSize   int         `json:"object_size"`
+	LoadMs       float64     `json:"load_ms"`
+	ImageSize    int         `json:"image_size"`
+	TotalMs      float64     `json:"total_ms"`
+}
+
+// CompileStats returns how the function was compiled. The same stats are also in the
+// metadata of the function, under `jyafn.compile`.
+func (f *Function) CompileStats() *CompileStats {
+	f.panicOnClosed()
+	value := ffi.functionCompileStatsJson(f.ptr)
+	if value == 0 {
+		return nil
+	}
+	defer ffi.freeStr(value)
+
+	stats := &CompileStats{}
+	if err := json.Unmarshal([]byte(ffi.transmuteAsStr(value)), stats); err != nil {
+		panic(err)
+	}
+	return stats
+}
@@ -0,0 +1,82 @@
+"""
+Benchmarks of the overhead of calling functions from Python. Prints one JSON object per
+benchmark, with the mean and the best time of a call in nanoseconds.
+
+Run with `python benches/ffi.py [--number N] [--repeat R]`.
+"""
+
+import argparse
+import json
+import struct
+import timeit
+
+import jyafn as fn
+
+
+@fn.func
+def small(a: fn.scalar, b: fn.scalar) -> fn.scalar:
+    return 2.0 * a + b
+
+
+@fn.func
+def large(a: fn.scalar, b: fn.scalar) -> fn.scalar:
+    for _ in range(200):
+        a += 1
+        b += a
+    return b
+
+
+def mapping_fun(size: int) -> fn.Function:
+    table = fn.mapping({f"k{i}": i for i in range(size)})
+
+    @fn.func
+    def lookup(x: fn.symbol) -> fn.scalar:
+        return table.get(x, 0.0)
+
+    return lookup
+
+
+def benches():
+    raw_input = struct.pack("dd", 2.0, 3.0)
+    for name, func in [("small", small), ("large", large)]:
+        yield f"{name}/call", lambda func=func: func(2.0, 3.0)
+        yield f"{name}/eval", lambda func=func: func.eval({"a": 2.0, "b": 3.0})
+        yield f"{name}/eval_json", lambda func=func: func.eval_json(
+            '{"a": 2.0, "b": 3.0}'
+        )
+        yield f"{name}/eval_raw", lambda func=func: func.eval_raw(raw_input)
+
+    dumped = small.dump()
+    yield "small/load", lambda: fn.Function.load(dumped)
+
+    for size in [1_000, 100_000]:
+        func = mapping_fun(size)
+        yield f"mapping/{size}", lambda func=func: func(f"k{size // 2}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--number", type=int, default=10_000)
+    parser.add_argument("--repeat", type=int, default=5)
+    args = parser.parse_args()
+
+    for name, bench in benches():
+        number = args.number if not name.endswith("/load") else args.number // 100
+        times = timeit.repeat(bench, number=number, repeat=args.repeat)
+        per_call = [t / number * 1e9 for t in times]
+        print(
+            json.dumps(
+                {
+                    "name": name,
+                    "number": number,
+                    "repeat": args.repeat,
+                    "mean_ns": sum(per_call) / len(per_call),
+                    "min_ns": min(per_call),
+                }
+            ),
+            flush=True,
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -328,6 +328,7 @@ def mapping(
     key_layout: fn.Layout | type[BaseAnnotation] | types.GenericAlias | None = None,
     value_layout: fn.Layout | type[BaseAnnotation] | types.GenericAlias | None = None,
     name: str | None = None,
+    storage: str = "hashmap",
 ) -> fn.LazyMapping:
     """
     Creates a new key-value mapping to be used in a graph. Mappings in JYAFN work very
@@ -338,6 +339,15 @@ def mapping(
     times in multiple graphs. However, if you pass a Generator (or other iterable), the
     mapping will be marked as consumed and an exception will be raised on reuse. This is
     done to avoid errors stemming from already spent iterators.
+
+    The `storage` selects how the mapping is stored in memory. The default, `"hashmap"`,
+    is a plain hash table. For big mappings, `"flat"` keeps all values in a single
+    contiguous buffer, which uses less memory and makes lookups more cache-friendly.
+    With `"mapped"`, the mapping is written to disk ready to be used, so that reading
+    the function with `fn.read_fn` maps it straight from the file instead of loading it
+    into memory, sharing it among all processes reading the same file. With
+    `"perfect"`, a minimal perfect hash is built when the function is written, so that,
+    once the function is read back, every lookup takes a single probe.
     """
     match obj:
         case dict():
@@ -362,7 +372,9 @@ def mapping(
 
         it = itertools.chain([(key, value)], it)
 
-    return fn.LazyMapping(name, make_layout(key_layout), make_layout(value_layout), it)
+    return fn.LazyMapping(
+        name, make_layout(key_layout), make_layout(value_layout), it, storage
+    )
 
 
 def make_timestamp(
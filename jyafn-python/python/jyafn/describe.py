@@ -32,6 +32,8 @@ OMMITTED_METADATA: list[str] = [
     "jyafn.created_at",
     "jyafn.doc",
     "jyafn.mem_size_estimate",
+    "jyafn.mem_size_estimate.shared",
+    "jyafn.mem_size_estimate.exclusive",
 ]
 
 
@@ -45,6 +47,9 @@ def describe_fn(func: fn.Function) -> str:
 
     print("Function name:", func.name)
     print("Size in memory:", fmt_size(func.get_size()))
+    if "jyafn.mem_size_estimate.shared" in func.metadata:
+        shared = int(func.metadata["jyafn.mem_size_estimate.shared"])
+        print("    shared with other functions:", fmt_size(shared))
     print("Created at:", func.metadata.get("jyafn.created_at", "<none>"))
     print("Docstring:", fmt_text(func.metadata.get("jyafn.doc", "<none>"), indent=4))
     print("Signature:")
@@ -3,7 +3,9 @@
 ##
 
 from __future__ import annotations
-from typing import Any, Callable, Optional
+from typing import Any, BinaryIO, Callable, Optional
+
+import numpy as np
 
 class Graph:
     """
@@ -25,6 +27,18 @@ class Graph:
         """Dumps the graph as a binary data format."""
     def write(self, path: str) -> None:
         """Writes the graph as binary data to the given file path."""
+    def dump_to(self, file: BinaryIO) -> None:
+        """
+        Writes the graph to a binary file-like object (anything with a `write` method),
+        as it is serialized. The output never needs seeking, so this can be used to
+        upload the graph straight to where it is stored, without having it all in memory.
+        """
+    @staticmethod
+    def load_from(file: BinaryIO) -> Graph:
+        """
+        Loads a graph from a binary file-like object (anything with a `read` method), as
+        the data arrives. See `Graph.dump_to`.
+        """
     @staticmethod
     def load(b: bytes) -> Graph:
         """Loads a graph from the supplied binary data."""
@@ -59,9 +73,12 @@ class Graph:
         """Renders the QBE IR code associated with this graph."""
     def render_assembly(self) -> str:
         """Renders the assembly code associated with this graph."""
-    def compile(self) -> Function:
+    def compile(self, profile: bool = False) -> Function:
         """
-        Compiles the graph into a JYAFN function.
+        Compiles the graph into a JYAFN function. If `profile` is set, the function also
+        counts how many times each call (to mappings, resources and subgraphs) and each
+        side of each conditional runs and how long it takes, which makes it slower. See
+        `Function.profile_report`.
         """
 
 class Ref:
@@ -228,14 +245,29 @@ class Function:
     by the `@fn.func` decorator and contains the original Python function that the
     decorator decorated.
     """
-    def dump(self) -> bytes:
+    def dump(self, native: bool = False) -> bytes:
         """
-        Dumps the graph associated with this function as a binary data format.
+        Dumps the graph associated with this function as a binary data format. If
+        `native` is set, the machine code for the current target is included as well,
+        so that loading it with the same version of jyafn on the same target skips
+        compilation.
         """
-    def write(self, path: str) -> None:
+    def write(self, path: str, native: bool = False) -> None:
         """
         Writes the graph associated with this function as binary data to the given file
-        path.
+        path. See `Function.dump` for the meaning of `native`.
+        """
+    def dump_to(self, file: BinaryIO, native: bool = False) -> None:
+        """
+        Writes the graph associated with this function to a binary file-like object, as
+        it is serialized. See `Graph.dump_to` and, for the meaning of `native`,
+        `Function.dump`.
+        """
+    @staticmethod
+    def load_from(file: BinaryIO) -> Function:
+        """
+        Loads a function from a binary file-like object (anything with a `read` method),
+        as the data arrives. See `Graph.dump_to`.
         """
     @staticmethod
     def load(b: bytes) -> Graph:
@@ -253,6 +285,37 @@ class Function:
         of the graph, which is an expensive operation (especially if you have large
         mappings).
         """
+    def strip(self) -> None:
+        """
+        Drops the parts of the underlying graph that are only needed to build and
+        compile it, which is most of the memory a big function takes. The function can
+        still be called, but no longer dumped or have its graph accessed. This fails if
+        the function failed to compile.
+        """
+    @property
+    def is_stripped(self) -> bool:
+        """Whether `Function.strip` was called on this function."""
+    def compile_stats(self) -> Optional[dict[str, Any]]:
+        """
+        Returns how long each phase of the compilation of this function took (in
+        milliseconds) and how big what came out of each phase was (in bytes): `source`
+        (whether the code was `compiled` or taken from the `cache` or the `precompiled`
+        code), the number of `nodes` before optimizing, the optimization `passes`,
+        `render_ms`, `ir_size`, `qbe_ms`, `assembly_size`, `assemble_ms`,
+        `object_size`, `load_ms`, `image_size` and `total_ms`. The same stats are in the
+        metadata, under `jyafn.compile`.
+        """
+    def profile_report(self) -> Optional[dict[str, Any]]:
+        """
+        Returns the counts of each site of a function compiled with
+        `Graph.compile(profile=True)`, since it was compiled (or since the last
+        `Function.reset_profile`), or `None` for other functions. This is a dict with
+        `ticks_per_second` and the `entries`, starting with the whole function, each
+        with its `kind`, `node_id`, `op`, `name`, `hits`, `ticks` and, for mapping calls,
+        `misses`.
+        """
+    def reset_profile(self) -> None:
+        """Sets all counts of `Function.profile_report` back to zero."""
     @property
     def metadata(self) -> dict[str, str]:
         """
@@ -270,6 +333,35 @@ class Function:
         of _raw_ data. Although this is perfectly safe, it it very error-prone. So, just
         use this if you really, really know what you are doing.
         """
+    def eval_batch_raw(
+        self, args: np.ndarray, parallel: bool = False
+    ) -> tuple[np.ndarray, list[tuple[int, str]]]:
+        """
+        Evaluates the function on each row of a C-contiguous 2-D `float64` array of
+        _raw_ input data, of shape `(n, input_size // 8)`, in a single call. Returns the
+        array of _raw_ outputs, of shape `(n, output_size // 8)`, together with the
+        index and the message of each row that raised an error (the output of these rows
+        is garbage). If `parallel` is set, rows are spread across a pool of threads,
+        whose size can be set with the `JYAFN_NUM_THREADS` environment variable. Like
+        `eval_raw`, this is very error-prone: use it only if you really, really know
+        what you are doing.
+        """
+    def eval_batch(
+        self, columns: dict[str, np.ndarray] | Any, parallel: bool = False
+    ) -> tuple[dict[str, np.ndarray] | np.ndarray, list[tuple[int, str]]]:
+        """
+        Evaluates the function on whole columns of data, in a single call. The input
+        must be a struct and `columns` is either a dict of arrays or a `pyarrow`
+        record batch with one column per field. Scalars, booleans and datetimes are read
+        as `float64`, `bool` and `datetime64[us]` arrays, fields made only of scalars
+        (e.g. lists of scalars) as 2-D arrays of shape `(n, n_slots)` and symbols as
+        arrays of strings. Returns the output in the same way (a dict of arrays, if the
+        output is a struct, or a single array, otherwise), together with the index and
+        the message of each row that raised an error (the output of these rows is
+        garbage). The data is converted and evaluated without the GIL and without
+        creating Python objects for each value, except for symbols. If `parallel` is
+        set, rows are spread across a pool of threads, as in `eval_batch_raw`.
+        """
     def eval(self, args: dict[str, Any]) -> Any:
         """
         Runs this function on the given pythonized and returns the pythonized result back.
@@ -313,14 +405,26 @@ def read_graph(file: str, initialize: bool = True) -> Graph:
     See also: `fn.read_fn`, `fn.read_metadata`
     """
 
-def read_fn(file: str) -> Function:
+def read_fn(file: str, lazy: bool = False, strip: bool = False) -> Function:
     """
     Reas a file in disk as an `fn.Function`. This function internally loads the file as an
-    `fn.Graph` and then compiles the resulting graph.
+    `fn.Graph` and then compiles the resulting graph. The file is memory-mapped, so that
+    mappings created with `storage="mapped"` are used directly from it. If `lazy` is set,
+    the data of each mapping is only read when it is first used. If `strip` is set, the
+    graph is dropped after compilation (see `fn.Function.strip`).
 
     See also: `fn.read_graph`, `fn.read_metadata`
     """
 
+def set_trust_native(trusted: bool) -> None:
+    """
+    Sets whether the native code stored in files dumped with `native=True` is run when
+    loading functions, instead of compiling them. This code is only as trustworthy as
+    the file it comes from: only set this if all files you load come from a source you
+    trust as much as your own code. This overrides the `JYAFN_TRUST_NATIVE` environment
+    variable. Off by default.
+    """
+
 def current_graph() -> Graph:
     """
     Returns the graph for the current context.
@@ -339,6 +443,18 @@ def make(obj: Any) -> Ref:
     `fn.Ref`. Else, returns the passed object.
     """
 
+def elementwise(op: str, *operands: Any) -> list[Ref]:
+    """
+    Applies an operation to each position of the operands, inserting all the new nodes
+    in the current graph in a single call. Each operand is either a sequence of values
+    (all with the same length) or a single value, used in every position. The operation
+    is one of `"add"`, `"sub"`, `"mul"`, `"div"`, `"rem"`, `"neg"`, `"abs"`, `"min"`,
+    `"max"`, `"eq"`, `"lt"`, `"gt"`, `"le"`, `"ge"`, `"and"`, `"or"`, `"not"`,
+    `"to_float"` and `"to_bool"` or else the name of a pure function, such as `"sqrt"` or `"powf"`. This
+    is much quicker than applying the operation to each element of an `fn.tensor` in
+    Python, which is what the numpy drop-ins in `jyafn` do under the hood.
+    """
+
 def input(name: str, layout: Layout) -> Any:
     """
     Inserts a new field with a given name an a given layout (i.e., type) into the current
@@ -1,11 +1,34 @@
 from .jyafn import *
 import jyafn as fn
 
-from typing import Any, Callable
+from typing import Any, Callable, Iterator
 import numpy as np
+from contextlib import contextmanager
+from contextvars import ContextVar
 from functools import wraps
 
 
+_pytuple = tuple
+_PAIRWISE: ContextVar[bool] = ContextVar("pairwise", default=False)
+
+
+@contextmanager
+def pairwise_reductions(enabled: bool = True) -> Iterator[None]:
+    """
+    Makes reductions (`np.sum`, `np.prod`, `np.min`, `np.max`, `np.all` and `np.any`)
+    inside this context combine elements pairwise, as a balanced tree, instead of from
+    left to right. This turns a chain of `n` dependent operations into one of depth
+    `log2(n)`, which makes for much quicker code for large tensors. However, since
+    floating-point operations are not associative, the result may differ slightly from
+    numpy. Use it only if you don't need exact reproducibility.
+    """
+    token = _PAIRWISE.set(enabled)
+    try:
+        yield
+    finally:
+        _PAIRWISE.reset(token)
+
+
 def _coerce(a: Any) -> Any:
     """Forces an `np.ndarray` to become an `fn.tensor`, if it is not."""
     if isinstance(a, np.ndarray):
@@ -33,8 +56,45 @@ def reduction(
     return _reduction
 
 
+def _pairwise_reduce(u: Callable, a: Any, axis, keepdims: bool, initial) -> Any:
+    """
+    Reduces `a` along `axis` with `u` as a balanced tree: each round combines the
+    elements two by two, with a single (vectorized) call to `u`. Returns `None` if there
+    is nothing to reduce.
+    """
+    a = np.asarray(a, dtype=object)
+    if axis is None:
+        axes = _pytuple(range(a.ndim))
+    elif isinstance(axis, _pytuple):
+        axes = _pytuple(ax % a.ndim for ax in axis)
+    else:
+        axes = (axis % a.ndim,)
+    kept = _pytuple(ax for ax in range(a.ndim) if ax not in axes)
+
+    # Put the reduced axes in front, as a single one:
+    x = np.transpose(a, axes + kept).reshape((-1,) + _pytuple(a.shape[ax] for ax in kept))
+    if initial is not np._NoValue:
+        x = np.concatenate([np.full((1,) + x.shape[1:], initial, dtype=object), x])
+    if len(x) == 0:
+        return None
+
+    while len(x) > 1:
+        even = len(x) // 2 * 2
+        combined = np.asarray(u(x[0:even:2], x[1:even:2]), dtype=object)
+        x = np.concatenate([combined.reshape((-1,) + x.shape[1:]), x[even:]])
+
+    result = x[0]
+    if keepdims:
+        return np.expand_dims(np.asarray(result, dtype=object), axes)
+    else:
+        return result
+
+
 def __make_reduce(u: np.ufunc):
-    """Creates a "reduce" function that follows the numpy convensions."""
+    """
+    Creates a "reduce" function that follows the numpy convensions. Reductions are
+    pairwise inside `pairwise_reductions`.
+    """
 
     @wraps(u.reduce)
     def _reduce(
@@ -49,6 +109,10 @@ def __make_reduce(u: np.ufunc):
             keepdims = False
         if where is np._NoValue:
             where = True
+        if _PAIRWISE.get() and out is None and where is True:
+            reduced = _pairwise_reduce(u, a, axis, keepdims, initial)
+            if reduced is not None:
+                return _coerce(reduced)
         return _coerce(
             u.reduce(
                 a, axis=axis, out=out, keepdims=keepdims, initial=initial, where=where
@@ -92,6 +156,36 @@ def transformation(
     return _make_transformation
 
 
+class elementwise:
+    """
+    A drop-in for a numpy ufunc that applies a `jyafn` operation to each element of the
+    (broadcast) arguments with a single call to `fn.elementwise`, instead of one call
+    per element. Everything else (e.g., `reduce`, `accumulate` or calls with `out` or
+    `where`) is delegated to `ufunc`.
+    """
+
+    def __init__(self, op: str, ufunc: np.ufunc) -> None:
+        self.op = op
+        self.ufunc = ufunc
+
+    def __call__(self, *args, **kwargs):
+        if kwargs:
+            return _coerce(self.ufunc(*args, **kwargs))
+
+        arrays = np.broadcast_arrays(*(np.asarray(arg, dtype=object) for arg in args))
+        shape = arrays[0].shape
+        results = fn.elementwise(self.op, *(array.ravel() for array in arrays))
+        if shape == ():
+            return results[0]
+
+        out = np.empty(len(results), dtype=object)
+        out[:] = results
+        return out.reshape(shape).view(fn.tensor)
+
+    def __getattr__(self, name: str) -> Any:
+        return getattr(self.ufunc, name)
+
+
 @reduction()
 def equal(a: fn.Ref, b: fn.Ref) -> fn.Ref:
     return a == b
@@ -124,17 +218,19 @@ def less_equal(a: fn.Ref, b: fn.Ref) -> fn.Ref:
 
 @reduction()
 def minimum(a: fn.Ref, b: fn.Ref) -> fn.Ref:
-    return (a > b).choose(b, a)
+    return fn.elementwise("min", a, b)[0]
 
 
+minimum = elementwise("min", minimum)
 min = __make_reduce(minimum)
 
 
 @reduction()
 def maximum(a: fn.Ref, b: fn.Ref) -> fn.Ref:
-    return (a > b).choose(a, b)
+    return fn.elementwise("max", a, b)[0]
 
 
+maximum = elementwise("max", maximum)
 max = __make_reduce(maximum)
 
 
@@ -143,6 +239,7 @@ def logical_and(a: fn.Ref, b: fn.Ref) -> fn.Ref:
     return a & b
 
 
+logical_and = elementwise("and", logical_and)
 all = __make_reduce(logical_and)
 
 
@@ -151,6 +248,7 @@ def logical_or(a: fn.Ref, b: fn.Ref) -> fn.Ref:
     return a | b
 
 
+logical_or = elementwise("or", logical_or)
 any = __make_reduce(logical_or)
 
 
@@ -159,6 +257,7 @@ def add(a: fn.Ref, b: fn.Ref) -> fn.Ref:
     return a + b
 
 
+add = elementwise("add", add)
 sum = __make_reduce(add)
 cumsum = __make_reduce(add)
 
@@ -168,6 +267,7 @@ def multiply(a: fn.Ref, b: fn.Ref) -> fn.Ref:
     return a * b
 
 
+multiply = elementwise("mul", multiply)
 prod = __make_reduce(multiply)
 cumprod = __make_reduce(multiply)
 
@@ -211,7 +311,7 @@ nancumprod = __make_accumulate(__nanmul)
 
 @reduction(identity=-np.inf)
 def __nanmin(a: fn.Ref, b: fn.Ref) -> fn.Ref:
-    return fn.is_nan(a).choose(b, (a > b).choose(b, a))
+    return fn.is_nan(a).choose(b, minimum(a, b))
 
 
 nanmin = __make_reduce(__nanmin)
@@ -219,12 +319,33 @@ nanmin = __make_reduce(__nanmin)
 
 @reduction(identity=np.inf)
 def __nanmax(a: fn.Ref, b: fn.Ref) -> fn.Ref:
-    return fn.is_nan(a).choose(b, (a > b).choose(a, b))
+    return fn.is_nan(a).choose(b, maximum(a, b))
 
 
 nanmax = __make_reduce(__nanmax)
 
 
+equal = elementwise("eq", equal)
+greater = elementwise("gt", greater)
+greater_equal = elementwise("ge", greater_equal)
+less = elementwise("lt", less)
+less_equal = elementwise("le", less_equal)
+subtract = elementwise("sub", np.subtract)
+true_divide = elementwise("div", np.true_divide)
+remainder = elementwise("rem", np.remainder)
+negative = elementwise("neg", np.negative)
+absolute = elementwise("abs", np.absolute)
+power = elementwise("powf", np.power)
+sqrt = elementwise("sqrt", np.sqrt)
+exp = elementwise("exp", np.exp)
+log = elementwise("ln", np.log)
+sin = elementwise("sin", np.sin)
+cos = elementwise("cos", np.cos)
+tan = elementwise("tan", np.tan)
+floor = elementwise("floor", np.floor)
+ceil = elementwise("ceil", np.ceil)
+
+
 def isclose(x, y, rtol=1e-05, atol=1e-08, equal_nan=False):
     if equal_nan:
         raise NotImplementedError()
@@ -300,6 +421,20 @@ DROP_IN: dict[np.ufunc, np.ufunc] = {
     np.sum: sum,
     np.cumsum: cumsum,
     np.multiply: multiply,
+    np.subtract: subtract,
+    np.true_divide: true_divide,
+    np.remainder: remainder,
+    np.negative: negative,
+    np.absolute: absolute,
+    np.power: power,
+    np.sqrt: sqrt,
+    np.exp: exp,
+    np.log: log,
+    np.sin: sin,
+    np.cos: cos,
+    np.tan: tan,
+    np.floor: floor,
+    np.ceil: ceil,
     np.prod: prod,
     np.cumprod: cumprod,
     np.isnan: isnan,
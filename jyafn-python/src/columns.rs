@@ -0,0 +1,362 @@
+//! Evaluation of functions over whole columns of data (NumPy arrays or Arrow record
+//! batches), without going through Python objects for each value.
+//!
+//! Each field of the input struct is read from its own column and each field of the
+//! output struct is written to its own NumPy array. Columns are transposed into rows of
+//! slots (and back) in Rust, with the GIL released.
+
+use pyo3::buffer::PyBuffer;
+use pyo3::exceptions;
+use pyo3::prelude::*;
+use pyo3::types::{IntoPyDict, PyDict};
+use rust::layout::{Layout, Sym, Symbols};
+use rust::Type;
+
+/// What kind of data a column holds.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Kind {
+    /// `float64` arrays, with as many columns as the field has slots.
+    Float,
+    /// `bool` arrays.
+    Bool,
+    /// `datetime64[us]` arrays.
+    DateTime,
+    /// Arrays of strings.
+    Symbol,
+}
+
+/// A field of a struct, as a column.
+#[derive(Debug)]
+struct Column {
+    name: Option<String>,
+    /// The first slot of the field in each row.
+    offset: usize,
+    /// The number of slots of the field.
+    width: usize,
+    kind: Kind,
+}
+
+impl Column {
+    fn new(name: Option<String>, offset: usize, layout: &Layout) -> PyResult<Column> {
+        let slots = layout.slots();
+        let kind = match (layout, slots.as_slice()) {
+            (Layout::Bool, _) => Kind::Bool,
+            (Layout::DateTime(_), _) => Kind::DateTime,
+            (Layout::Symbol, _) => Kind::Symbol,
+            (_, slots) if slots.iter().all(|&slot| slot == Type::Float) => Kind::Float,
+            _ => {
+                return Err(exceptions::PyTypeError::new_err(format!(
+                    "layout {layout} cannot be represented as a column"
+                )))
+            }
+        };
+
+        Ok(Column {
+            name,
+            offset,
+            width: slots.len(),
+            kind,
+        })
+    }
+
+    /// The shape of the array for this column.
+    fn shape(&self, n_rows: usize) -> Vec<usize> {
+        if self.kind == Kind::Float && self.width != 1 {
+            vec![n_rows, self.width]
+        } else {
+            vec![n_rows]
+        }
+    }
+}
+
+/// The columns of a layout: one per field, if it is a struct, or a single one otherwise.
+fn columns(layout: &Layout) -> PyResult<Vec<Column>> {
+    let Layout::Struct(fields) = layout else {
+        return Ok(vec![Column::new(None, 0, layout)?]);
+    };
+
+    let mut offset = 0;
+    fields
+        .0
+        .iter()
+        .map(|(name, field)| {
+            let column = Column::new(Some(name.clone()), offset, field)?;
+            offset += column.width;
+            Ok(column)
+        })
+        .collect()
+}
+
+/// Data borrowed from a NumPy array, to be read or written with the GIL released.
+struct Data {
+    ptr: *mut u8,
+    /// In bytes.
+    len: usize,
+}
+
+// Safety: the arrays are kept alive until the evaluation is done and the output arrays
+// are not visible to Python before that. Each element is only touched by one thread.
+unsafe impl Send for Data {}
+unsafe impl Sync for Data {}
+
+impl Data {
+    fn of<T: pyo3::buffer::Element>(buffer: &PyBuffer<T>) -> PyResult<Data> {
+        if !buffer.is_c_contiguous() {
+            return Err(exceptions::PyValueError::new_err(
+                "columns must be contiguous",
+            ));
+        }
+
+        Ok(Data {
+            ptr: buffer.buf_ptr() as *mut u8,
+            len: buffer.len_bytes(),
+        })
+    }
+
+    /// The `i`-th element of `size` bytes, as a slot.
+    fn get(&self, i: usize, size: usize) -> u64 {
+        debug_assert!((i + 1) * size <= self.len);
+        // Safety: bounds were checked when the columns were read.
+        unsafe {
+            match size {
+                1 => *self.ptr.add(i) as u64,
+                8 => (self.ptr as *const u64).add(i).read_unaligned(),
+                _ => unreachable!("columns have elements of 1 or 8 bytes"),
+            }
+        }
+    }
+
+    /// Sets the `i`-th element of `size` bytes from a slot.
+    fn set(&self, i: usize, size: usize, slot: u64) {
+        debug_assert!((i + 1) * size <= self.len);
+        // Safety: bounds were checked when the columns were created.
+        unsafe {
+            match size {
+                1 => *self.ptr.add(i) = (slot != 0) as u8,
+                8 => (self.ptr as *mut u64).add(i).write_unaligned(slot),
+                _ => unreachable!("columns have elements of 1 or 8 bytes"),
+            }
+        }
+    }
+}
+
+/// The size in bytes of each element of a column.
+fn element_size(kind: Kind) -> usize {
+    match kind {
+        Kind::Bool => 1,
+        _ => 8,
+    }
+}
+
+/// The input column of the given name.
+fn get_column<'py>(source: &Bound<'py, PyAny>, name: &str) -> PyResult<Bound<'py, PyAny>> {
+    // Arrow record batches (and tables) are looked up by name and converted to NumPy,
+    // which is zero-copy for numbers without nulls.
+    if source.hasattr("schema")? && source.hasattr("column")? {
+        source.call_method1("column", (name,))?.call_method(
+            "to_numpy",
+            (),
+            Some(&[("zero_copy_only", false)].into_py_dict_bound(source.py())),
+        )
+    } else {
+        source.get_item(name).map_err(|_| {
+            exceptions::PyKeyError::new_err(format!("missing column {name:?} in input"))
+        })
+    }
+}
+
+/// An input column, read into something that can be used without the GIL.
+enum Source {
+    Buffer(Data),
+    /// Symbols are hashed while reading.
+    Hashes(Vec<u64>),
+}
+
+/// Evaluates `func` on every row of `source`, a dict of NumPy arrays or an Arrow record
+/// batch with one column per field of the input struct.
+pub fn eval_columns<'py>(
+    py: Python<'py>,
+    func: &rust::Function,
+    source: &Bound<'py, PyAny>,
+    parallel: bool,
+) -> PyResult<(PyObject, Vec<(usize, String)>)> {
+    let np = py.import_bound("numpy")?;
+    let Layout::Struct(_) = func.input_layout() else {
+        return Err(exceptions::PyTypeError::new_err(format!(
+            "columnar evaluation needs a struct as input, got {}",
+            func.input_layout()
+        )));
+    };
+    let input_columns = columns(func.input_layout())?;
+    let output_columns = columns(func.output_layout())?;
+    let input_slots = func.input_size().in_slots();
+    let output_slots = func.output_size().in_slots();
+
+    // Read the input columns (the arrays are kept alive in `keep`, since the buffers are
+    // released right away):
+    let mut n_rows = None;
+    let mut keep = vec![];
+    let mut symbols = Symbols::default();
+    let mut sources = Vec::with_capacity(input_columns.len());
+    for column in &input_columns {
+        let name = column.name.as_deref().expect("input is a struct");
+        let array = get_column(source, name)?;
+        let (read, len) = match column.kind {
+            Kind::Float => {
+                let array = np.call_method1("ascontiguousarray", (array, "float64"))?;
+                let buffer = PyBuffer::<f64>::get_bound(&array)?;
+                let len = buffer.item_count();
+                let data = Data::of(&buffer)?;
+                keep.push(array.clone());
+                (Source::Buffer(data), len / column.width.max(1))
+            }
+            Kind::Bool => {
+                let array = np.call_method1("ascontiguousarray", (array, "bool"))?;
+                let buffer = PyBuffer::<bool>::get_bound(&array)?;
+                let len = buffer.item_count();
+                let data = Data::of(&buffer)?;
+                keep.push(array.clone());
+                (Source::Buffer(data), len)
+            }
+            Kind::DateTime => {
+                let array = np
+                    .call_method1("asarray", (array,))?
+                    .call_method1("astype", ("datetime64[us]",))?
+                    .call_method1("view", ("int64",))?;
+                let array = np.call_method1("ascontiguousarray", (array,))?;
+                let buffer = PyBuffer::<i64>::get_bound(&array)?;
+                let len = buffer.item_count();
+                let data = Data::of(&buffer)?;
+                keep.push(array.clone());
+                (Source::Buffer(data), len)
+            }
+            Kind::Symbol => {
+                let hashes = array
+                    .iter()?
+                    .map(|item| {
+                        let item = item?;
+                        let symbol = item.str()?;
+                        let symbol = symbol.to_cow()?;
+                        Ok(symbols.find(&symbol))
+                    })
+                    .collect::<PyResult<Vec<_>>>()?;
+                let len = hashes.len();
+                (Source::Hashes(hashes), len)
+            }
+        };
+
+        match n_rows {
+            Some(n_rows) if n_rows != len => {
+                return Err(exceptions::PyValueError::new_err(format!(
+                    "column {name:?} has {len} rows, but previous columns have {n_rows}"
+                )))
+            }
+            _ => n_rows = Some(len),
+        }
+        sources.push(read);
+    }
+    let n_rows = n_rows.unwrap_or(0);
+
+    // Create the output columns:
+    let mut outputs = vec![];
+    let mut targets = vec![];
+    for column in &output_columns {
+        let dtype = match column.kind {
+            Kind::Float => "float64",
+            Kind::Bool => "bool",
+            Kind::DateTime => "datetime64[us]",
+            Kind::Symbol => "uint64",
+        };
+        let array = np.call_method1("empty", (column.shape(n_rows), dtype))?;
+        let data = match column.kind {
+            Kind::Bool => Data::of(&PyBuffer::<bool>::get_bound(&array)?)?,
+            Kind::DateTime => Data::of(&PyBuffer::<i64>::get_bound(
+                &array.call_method1("view", ("int64",))?,
+            )?)?,
+            _ => Data::of(&PyBuffer::<u64>::get_bound(
+                &array.call_method1("view", ("uint64",))?,
+            )?)?,
+        };
+        outputs.push(array);
+        targets.push(data);
+    }
+
+    let errors = py.allow_threads(|| {
+        // Transpose the columns into rows:
+        let mut input = vec![0u64; n_rows * input_slots];
+        for (column, source) in input_columns.iter().zip(&sources) {
+            let size = element_size(column.kind);
+            for row in 0..n_rows {
+                let slots = &mut input[row * input_slots + column.offset..][..column.width];
+                for (j, slot) in slots.iter_mut().enumerate() {
+                    *slot = match source {
+                        Source::Buffer(data) => data.get(row * column.width + j, size),
+                        Source::Hashes(hashes) => hashes[row],
+                    };
+                }
+            }
+        }
+
+        let mut output = vec![0u64; n_rows * output_slots];
+        let input_bytes = bytes_of(&input);
+        let output_bytes = bytes_of_mut(&mut output);
+        let errors = if parallel {
+            func.par_call_batch(input_bytes, output_bytes)
+        } else {
+            func.call_batch(input_bytes, output_bytes)
+        };
+        let errors = errors
+            .into_iter()
+            .map(|(row, error)| (row, error.to_string()))
+            .collect::<Vec<_>>();
+
+        // Transpose the rows back into columns:
+        for (column, target) in output_columns.iter().zip(&targets) {
+            let size = element_size(column.kind);
+            for row in 0..n_rows {
+                let slots = &output[row * output_slots + column.offset..][..column.width];
+                for (j, &slot) in slots.iter().enumerate() {
+                    target.set(row * column.width + j, size, slot);
+                }
+            }
+        }
+
+        errors
+    });
+    drop(keep);
+
+    // Symbols only become strings now, since that needs Python objects:
+    for (column, array) in output_columns.iter().zip(&mut outputs) {
+        if column.kind == Kind::Symbol {
+            let graph_symbols = func.graph().symbols();
+            let hashes = array.extract::<Vec<u64>>()?;
+            let strings = hashes
+                .into_iter()
+                .map(|hash| graph_symbols.get(hash).or_else(|| symbols.get(hash)))
+                .collect::<Vec<_>>();
+            *array = np.call_method1("array", (strings, "object"))?;
+        }
+    }
+
+    let outputs = if matches!(func.output_layout(), Layout::Struct(_)) {
+        let dict = PyDict::new_bound(py);
+        for (column, array) in output_columns.iter().zip(outputs) {
+            dict.set_item(column.name.as_deref().expect("output is a struct"), array)?;
+        }
+        dict.into_any().unbind()
+    } else {
+        outputs.pop().expect("there is a column").unbind()
+    };
+
+    Ok((outputs, errors))
+}
+
+fn bytes_of(slots: &[u64]) -> &[u8] {
+    // Safety: any u64 is a valid sequence of 8 bytes.
+    unsafe { std::slice::from_raw_parts(slots.as_ptr() as *const u8, slots.len() * 8) }
+}
+
+fn bytes_of_mut(slots: &mut [u64]) -> &mut [u8] {
+    // Safety: any sequence of 8 bytes is a valid u64.
+    unsafe { std::slice::from_raw_parts_mut(slots.as_mut_ptr() as *mut u8, slots.len() * 8) }
+}
@@ -1,9 +1,11 @@
+use pyo3::buffer::PyBuffer;
 use pyo3::exceptions;
 use pyo3::prelude::*;
 use pyo3::types::{PyBytes, PyDict, PyTuple};
 use std::collections::HashMap;
 use std::sync::{Arc, Mutex};
 
+use super::io::{PyReader, PyWriter};
 use super::{Graph, Layout, ToPyErr};
 
 #[pyclass(module = "jyafn")]
@@ -17,6 +19,16 @@ impl Function {
     fn inner(&self) -> &rust::Function {
         self.inner.as_ref().expect("inner not set")
     }
+
+    fn check_not_stripped(&self) -> PyResult<()> {
+        if self.inner().graph().is_stripped() {
+            return Err(exceptions::PyValueError::new_err(
+                "function was stripped of its graph and only runs as compiled code",
+            ));
+        }
+
+        Ok(())
+    }
 }
 
 #[pymethods]
@@ -103,19 +115,24 @@ impl Function {
     }
 
     #[staticmethod]
-    pub fn load(bytes: &[u8]) -> PyResult<Function> {
+    pub fn load(py: Python, bytes: &[u8]) -> PyResult<Function> {
+        let inner = py.allow_threads(|| rust::Function::load(std::io::Cursor::new(bytes)));
         Ok(Function {
-            inner: Some(rust::Function::load(std::io::Cursor::new(bytes)).map_err(ToPyErr)?),
+            inner: Some(inner.map_err(ToPyErr)?),
             original: None,
         })
     }
 
-    pub fn dump<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyBytes>> {
+    #[pyo3(signature = (native=false))]
+    pub fn dump<'py>(&self, py: Python<'py>, native: bool) -> PyResult<Bound<'py, PyBytes>> {
         let mut bytes = Vec::<u8>::new();
-        self.inner()
-            .graph()
-            .dump(std::io::Cursor::new(&mut bytes))
-            .map_err(ToPyErr)?;
+        let graph = self.inner().graph();
+        if native {
+            graph.dump_native(std::io::Cursor::new(&mut bytes))
+        } else {
+            graph.dump(std::io::Cursor::new(&mut bytes))
+        }
+        .map_err(ToPyErr)?;
         let leaked = Box::leak(bytes.into_boxed_slice());
         // Safety: leaking the box from rust and giving it to Python. Therefore, no
         // double free.
@@ -123,27 +140,68 @@ impl Function {
     }
 
     pub fn __getstate__<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyBytes>> {
-        self.dump(py)
+        self.dump(py, false)
     }
 
-    pub fn write(&self, path: &str) -> PyResult<()> {
+    #[pyo3(signature = (path, native=false))]
+    pub fn write(&self, path: &str, native: bool) -> PyResult<()> {
         let file = std::fs::File::create(path)?;
-        self.inner().graph().dump(file).map_err(ToPyErr)?;
+        let graph = self.inner().graph();
+        if native {
+            graph.dump_native(file)
+        } else {
+            graph.dump(file)
+        }
+        .map_err(ToPyErr)?;
+        Ok(())
+    }
+
+    #[pyo3(signature = (file, native=false))]
+    pub fn dump_to(&self, file: &Bound<'_, PyAny>, native: bool) -> PyResult<()> {
+        let graph = self.inner().graph();
+        if native {
+            graph.dump_stream_native(PyWriter::buffered(file))
+        } else {
+            graph.dump_stream(PyWriter::buffered(file))
+        }
+        .map_err(ToPyErr)?;
         Ok(())
     }
 
-    pub fn __setstate__(&mut self, bytes: &[u8]) -> PyResult<()> {
-        self.inner = Some(rust::Function::load(std::io::Cursor::new(bytes)).map_err(ToPyErr)?);
+    #[staticmethod]
+    pub fn load_from(file: &Bound<'_, PyAny>) -> PyResult<Function> {
+        Ok(Function {
+            inner: Some(rust::Function::load_stream(PyReader::buffered(file)).map_err(ToPyErr)?),
+            original: None,
+        })
+    }
+
+    pub fn __setstate__(&mut self, py: Python, bytes: &[u8]) -> PyResult<()> {
+        let inner = py.allow_threads(|| rust::Function::load(std::io::Cursor::new(bytes)));
+        self.inner = Some(inner.map_err(ToPyErr)?);
         self.original = None;
         Ok(())
     }
 
-    pub fn to_json(&self) -> String {
-        self.inner().graph().to_json()
+    pub fn to_json(&self) -> PyResult<String> {
+        self.check_not_stripped()?;
+        Ok(self.inner().graph().to_json())
+    }
+
+    fn get_graph(&self) -> PyResult<Graph> {
+        self.check_not_stripped()?;
+        Ok(Graph(Arc::new(Mutex::new(self.inner().graph().clone()))))
     }
 
-    fn get_graph(&self) -> Graph {
-        Graph(Arc::new(Mutex::new(self.inner().graph().clone())))
+    fn strip(&mut self, py: Python) -> PyResult<()> {
+        let func = self.inner.as_mut().expect("inner not set");
+        py.allow_threads(|| func.strip()).map_err(ToPyErr)?;
+        Ok(())
+    }
+
+    #[getter]
+    fn is_stripped(&self) -> bool {
+        self.inner().graph().is_stripped()
     }
 
     #[getter]
@@ -151,18 +209,115 @@ impl Function {
         self.inner().graph().metadata().clone()
     }
 
-    fn eval_raw(&self, args: &[u8]) -> PyResult<Vec<u8>> {
-        Ok(self
-            .inner()
-            .eval_raw(args)
+    fn compile_stats(&self, py: Python) -> PyResult<Option<PyObject>> {
+        let Some(stats) = self.inner().compile_stats() else {
+            return Ok(None);
+        };
+        let json = serde_json::to_string(stats).expect("can always serialize");
+        Ok(Some(
+            py.import_bound("json")?
+                .call_method1("loads", (json,))?
+                .unbind(),
+        ))
+    }
+
+    fn profile_report(&self, py: Python) -> PyResult<Option<PyObject>> {
+        let Some(report) = self.inner().profile_report() else {
+            return Ok(None);
+        };
+        let json = serde_json::to_string(&report).expect("can always serialize");
+        Ok(Some(
+            py.import_bound("json")?
+                .call_method1("loads", (json,))?
+                .unbind(),
+        ))
+    }
+
+    fn reset_profile(&self) {
+        self.inner().reset_profile()
+    }
+
+    fn eval_raw(&self, py: Python, args: &[u8]) -> PyResult<Vec<u8>> {
+        let func = self.inner();
+        Ok(py
+            .allow_threads(|| func.eval_raw(args))
             .map_err(ToPyErr)
             .map(|o| o.into_vec())?)
     }
 
+    #[pyo3(signature = (args, parallel=false))]
+    fn eval_batch_raw<'py>(
+        &self,
+        py: Python<'py>,
+        args: PyBuffer<f64>,
+        parallel: bool,
+    ) -> PyResult<(Bound<'py, PyAny>, Vec<(usize, String)>)> {
+        let func = self.inner();
+        let input_slots = func.input_size().in_bytes() / 8;
+        let output_slots = func.output_size().in_bytes() / 8;
+
+        if !args.is_c_contiguous() {
+            return Err(exceptions::PyValueError::new_err(
+                "batch input must be C-contiguous",
+            ));
+        }
+        let n_rows = match *args.shape() {
+            [n_rows, n_cols] if n_cols == input_slots => n_rows,
+            ref shape => {
+                return Err(exceptions::PyValueError::new_err(format!(
+                    "batch input must have shape (n, {input_slots}), got {shape:?}"
+                )))
+            }
+        };
+
+        let output = py
+            .import_bound("numpy")?
+            .call_method1("empty", ((n_rows, output_slots),))?;
+        let output_buffer = PyBuffer::<f64>::get_bound(&output)?;
+
+        // Safety: both buffers are C-contiguous and have the sizes checked above. The
+        // output was just created and so nobody else can be using it.
+        let (input, output_bytes) = unsafe {
+            (
+                std::slice::from_raw_parts(args.buf_ptr() as *const u8, args.len_bytes()),
+                std::slice::from_raw_parts_mut(
+                    output_buffer.buf_ptr() as *mut u8,
+                    output_buffer.len_bytes(),
+                ),
+            )
+        };
+        let errors = py.allow_threads(|| {
+            let errors = if parallel {
+                func.par_call_batch(input, output_bytes)
+            } else {
+                func.call_batch(input, output_bytes)
+            };
+            errors
+                .into_iter()
+                .map(|(row, error)| (row, error.to_string()))
+                .collect()
+        });
+
+        Ok((output, errors))
+    }
+
+    #[pyo3(signature = (columns, parallel=false))]
+    fn eval_batch(
+        &self,
+        py: Python,
+        columns: &Bound<'_, PyAny>,
+        parallel: bool,
+    ) -> PyResult<(PyObject, Vec<(usize, String)>)> {
+        crate::columns::eval_columns(py, self.inner(), columns, parallel)
+    }
+
     fn eval(&self, val: &Bound<'_, PyAny>) -> PyResult<PyObject> {
-        let outcome = self.inner().eval_with_decoder(
+        // Encoding and decoding need the GIL, but the computation itself does not.
+        let py = val.py();
+        let outcome = self.inner().eval_with_decoder_around(
             &crate::layout::Obj(val.clone()),
-            crate::layout::PyDecoder(val.py()),
+            crate::layout::PyDecoder(py),
+            |call| py.allow_threads(|| call.run()),
         );
 
         if let Err(rust::Error::EncodeError(inner)) = &outcome {
@@ -205,16 +360,21 @@ impl Function {
     }
 
     #[pyo3(signature = (json, pretty=None))]
-    fn eval_json(&self, json: &str, pretty: Option<bool>) -> PyResult<String> {
-        let value: serde_json::Value =
-            serde_json::from_str(json).map_err(|e| ToPyErr(e.to_string().into()))?;
-        let output: serde_json::Value = self.inner().eval(&value).map_err(ToPyErr)?;
-
-        Ok(if pretty.unwrap_or(false) {
-            serde_json::to_string_pretty(&output)
-        } else {
-            serde_json::to_string(&output)
+    fn eval_json(&self, py: Python, json: &str, pretty: Option<bool>) -> PyResult<String> {
+        let func = self.inner();
+        if !pretty.unwrap_or(false) {
+            let mut output = vec![];
+            py.allow_threads(|| func.eval_json(json.as_bytes(), &mut output))
+                .map_err(ToPyErr)?;
+            return Ok(String::from_utf8(output).expect("json is always utf-8"));
         }
-        .expect("can always serialize"))
+
+        let output = py.allow_threads(|| {
+            let value: serde_json::Value =
+                serde_json::from_str(json).map_err(|e| rust::Error::from(e.to_string()))?;
+            func.eval::<_, serde_json::Value>(&value)
+        });
+
+        Ok(serde_json::to_string_pretty(&output.map_err(ToPyErr)?).expect("can always serialize"))
     }
 }
@@ -0,0 +1,112 @@
+use pyo3::prelude::*;
+use pyo3::types::PyTuple;
+
+use super::{try_with_current, Ref, ToPyErr};
+
+/// An argument of an elementwise operation.
+enum Operand {
+    /// The same reference for every position.
+    Repeated(rust::Ref),
+    /// One reference per position.
+    Each(Vec<rust::Ref>),
+}
+
+impl Operand {
+    fn new(obj: &Bound<PyAny>) -> PyResult<Operand> {
+        if obj.is_instance_of::<Ref>() {
+            return Ok(Operand::Repeated(Ref::make(obj)?.0));
+        }
+
+        let Ok(items) = obj.iter() else {
+            return Ok(Operand::Repeated(Ref::make(obj)?.0));
+        };
+
+        Ok(Operand::Each(
+            items
+                .map(|item| Ok(Ref::make(&item?)?.0))
+                .collect::<PyResult<_>>()?,
+        ))
+    }
+
+    fn get(&self, position: usize) -> rust::Ref {
+        match self {
+            Operand::Repeated(r) => *r,
+            Operand::Each(refs) => refs[position],
+        }
+    }
+}
+
+/// Inserts `op` in the current graph once for each position of the operands. All nodes
+/// are inserted under a single lock of the graph.
+fn insert_each<O: rust::Op + Clone>(
+    op: O,
+    operands: &[Operand],
+    n_positions: usize,
+) -> PyResult<Vec<Ref>> {
+    try_with_current(|g| {
+        let ops = (0..n_positions).map(|position| {
+            let args = operands.iter().map(|operand| operand.get(position));
+            (op.clone(), args.collect())
+        });
+        Ok(g.insert_many(ops)
+            .map_err(ToPyErr)?
+            .into_iter()
+            .map(Ref)
+            .collect())
+    })
+}
+
+/// Applies an operation, given by name, to each position of the operands at once,
+/// returning the list of results. Each operand is either a sequence of values, all of the
+/// same length, or a single value, which is used in every position. This is the same as
+/// applying the operation to each position in turn, but without going back and forth
+/// between Python and the graph for each new node.
+#[pyfunction]
+#[pyo3(signature = (op, *operands))]
+pub fn elementwise(op: &str, operands: &Bound<PyTuple>) -> PyResult<Vec<Ref>> {
+    let operands = operands
+        .iter()
+        .map(|operand| Operand::new(&operand))
+        .collect::<PyResult<Vec<_>>>()?;
+
+    let mut n_positions = None;
+    for operand in &operands {
+        let Operand::Each(refs) = operand else {
+            continue;
+        };
+        match n_positions {
+            Some(n) if n != refs.len() => {
+                return Err(pyo3::exceptions::PyValueError::new_err(format!(
+                    "operands of elementwise {op:?} have different lengths: {n} and {}",
+                    refs.len()
+                )))
+            }
+            _ => n_positions = Some(refs.len()),
+        }
+    }
+    let n_positions = n_positions.unwrap_or(1);
+
+    match op {
+        "add" => insert_each(rust::op::Add, &operands, n_positions),
+        "sub" => insert_each(rust::op::Sub, &operands, n_positions),
+        "mul" => insert_each(rust::op::Mul, &operands, n_positions),
+        "div" => insert_each(rust::op::Div, &operands, n_positions),
+        "rem" => insert_each(rust::op::Rem, &operands, n_positions),
+        "neg" => insert_each(rust::op::Neg, &operands, n_positions),
+        "abs" => insert_each(rust::op::Abs, &operands, n_positions),
+        "min" => insert_each(rust::op::Min, &operands, n_positions),
+        "max" => insert_each(rust::op::Max, &operands, n_positions),
+        "eq" => insert_each(rust::op::Eq(None), &operands, n_positions),
+        "lt" => insert_each(rust::op::Lt, &operands, n_positions),
+        "gt" => insert_each(rust::op::Gt, &operands, n_positions),
+        "le" => insert_each(rust::op::Le, &operands, n_positions),
+        "ge" => insert_each(rust::op::Ge, &operands, n_positions),
+        "and" => insert_each(rust::op::And, &operands, n_positions),
+        "or" => insert_each(rust::op::Or, &operands, n_positions),
+        "not" => insert_each(rust::op::Not, &operands, n_positions),
+        "to_float" => insert_each(rust::op::ToFloat, &operands, n_positions),
+        "to_bool" => insert_each(rust::op::ToBool, &operands, n_positions),
+        // Everything else is a call to a pure function (e.g., "sqrt" or "powf").
+        name => insert_each(rust::op::Call(name.to_string()), &operands, n_positions),
+    }
+}
@@ -1,6 +1,8 @@
+mod elementwise;
 mod indexed;
 mod r#ref;
 
+pub use elementwise::elementwise;
 pub use indexed::IndexedList;
 pub use r#ref::{make, Ref};
 
@@ -10,6 +12,7 @@ use pyo3::types::{PyBytes, PyDict, PyTuple};
 use std::cell::RefCell;
 use std::sync::{Arc, Mutex};
 
+use super::io::{PyReader, PyWriter};
 use super::layout::Layout;
 use super::{depythonize_ref_value, pythonize_ref_value, Function, ToPyErr};
 
@@ -146,16 +149,37 @@ impl Graph {
         Ok(())
     }
 
+    /// Writes the graph to a binary file-like object, as it is serialized.
+    pub fn dump_to(&self, file: &Bound<'_, PyAny>) -> PyResult<()> {
+        self.0
+            .lock()
+            .expect("poisoned")
+            .dump_stream(PyWriter::buffered(file))
+            .map_err(ToPyErr)?;
+        Ok(())
+    }
+
     #[staticmethod]
-    pub fn load(bytes: &Bound<'_, PyBytes>) -> PyResult<Self> {
+    pub fn load_from(file: &Bound<'_, PyAny>) -> PyResult<Self> {
         Ok(Graph(Arc::new(Mutex::new(
-            rust::Graph::load(std::io::Cursor::new(bytes.as_bytes())).map_err(ToPyErr)?,
+            rust::Graph::load_stream(PyReader::buffered(file)).map_err(ToPyErr)?,
         ))))
     }
 
+    #[staticmethod]
+    pub fn load(bytes: &Bound<'_, PyBytes>) -> PyResult<Self> {
+        let bytes = bytes.as_bytes();
+        let inner = bytes
+            .py()
+            .allow_threads(|| rust::Graph::load(std::io::Cursor::new(bytes)));
+        Ok(Graph(Arc::new(Mutex::new(inner.map_err(ToPyErr)?))))
+    }
+
     pub fn __setstate__(&self, bytes: &Bound<'_, PyBytes>) -> PyResult<()> {
-        *self.0.lock().expect("poisoned") =
-            rust::Graph::load(std::io::Cursor::new(bytes.as_bytes())).map_err(ToPyErr)?;
+        let py = bytes.py();
+        let bytes = bytes.as_bytes();
+        let inner = py.allow_threads(|| rust::Graph::load(std::io::Cursor::new(bytes)));
+        *self.0.lock().expect("poisoned") = inner.map_err(ToPyErr)?;
         Ok(())
     }
 
@@ -218,15 +242,19 @@ impl Graph {
             .map_err(ToPyErr)?)
     }
 
-    fn compile(&self) -> PyResult<Function> {
+    #[pyo3(signature = (profile=false))]
+    fn compile(&self, py: Python, profile: bool) -> PyResult<Function> {
+        // Running QBE, the assembler and the linker does not need the GIL.
+        let inner = py.allow_threads(|| {
+            let graph = self.0.lock().expect("poisoned");
+            if profile {
+                graph.compile_profiled()
+            } else {
+                graph.compile()
+            }
+        });
         Ok(Function {
-            inner: Some(
-                self.0
-                    .lock()
-                    .expect("poisoned")
-                    .compile()
-                    .map_err(ToPyErr)?,
-            ),
+            inner: Some(inner.map_err(ToPyErr)?),
             original: None,
         })
     }
@@ -0,0 +1,68 @@
+//! Adapters to use Python file-like objects as Rust readers and writers.
+
+use pyo3::prelude::*;
+use pyo3::types::PyBytes;
+use std::io::{Read, Write};
+
+/// How much to buffer when reading from or writing to Python objects.
+const BUFFER_SIZE: usize = 1 << 16;
+
+/// Reads from a Python object with a `read` method returning `bytes`, such as a file
+/// opened in binary mode.
+pub struct PyReader<'py>(Bound<'py, PyAny>);
+
+impl<'py> PyReader<'py> {
+    pub fn buffered(file: &Bound<'py, PyAny>) -> std::io::BufReader<PyReader<'py>> {
+        std::io::BufReader::with_capacity(BUFFER_SIZE, PyReader(file.clone()))
+    }
+}
+
+impl Read for PyReader<'_> {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let read = self
+            .0
+            .call_method1("read", (buf.len(),))
+            .map_err(std::io::Error::other)?;
+        let bytes = read
+            .downcast::<PyBytes>()
+            .map_err(|err| std::io::Error::other(PyErr::from(err)))?
+            .as_bytes();
+        let len = bytes.len().min(buf.len());
+        buf[..len].copy_from_slice(&bytes[..len]);
+        Ok(len)
+    }
+}
+
+/// Writes to a Python object with a `write` method accepting `bytes`, such as a file
+/// opened in binary mode.
+pub struct PyWriter<'py>(Bound<'py, PyAny>);
+
+impl<'py> PyWriter<'py> {
+    pub fn buffered(file: &Bound<'py, PyAny>) -> std::io::BufWriter<PyWriter<'py>> {
+        std::io::BufWriter::with_capacity(BUFFER_SIZE, PyWriter(file.clone()))
+    }
+}
+
+impl Write for PyWriter<'_> {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        let written = self
+            .0
+            .call_method1("write", (PyBytes::new_bound(self.0.py(), buf),))
+            .map_err(std::io::Error::other)?;
+        // Raw files might write less than asked for. Others return nothing.
+        Ok(written
+            .extract::<Option<usize>>()
+            .ok()
+            .flatten()
+            .unwrap_or(buf.len()))
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        if self.0.hasattr("flush").map_err(std::io::Error::other)? {
+            self.0
+                .call_method0("flush")
+                .map_err(std::io::Error::other)?;
+        }
+        Ok(())
+    }
+}
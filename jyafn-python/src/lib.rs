@@ -1,8 +1,10 @@
 extern crate jyafn as rust;
 
+mod columns;
 mod extension;
 mod function;
 mod graph;
+mod io;
 mod layout;
 mod mapping;
 mod pfunc;
@@ -29,8 +31,10 @@ fn jyafn(m: &Bound<'_, PyModule>) -> PyResult<()> {
     m.add_function(wrap_pyfunction!(read_metadata, m)?)?;
     m.add_function(wrap_pyfunction!(read_graph, m)?)?;
     m.add_function(wrap_pyfunction!(read_fn, m)?)?;
+    m.add_function(wrap_pyfunction!(set_trust_native, m)?)?;
     m.add_function(wrap_pyfunction!(graph::current_graph, m)?)?;
     m.add_function(wrap_pyfunction!(graph::make, m)?)?;
+    m.add_function(wrap_pyfunction!(graph::elementwise, m)?)?;
     m.add_function(wrap_pyfunction!(r#const, m)?)?;
     m.add_function(wrap_pyfunction!(input, m)?)?;
     m.add_function(wrap_pyfunction!(ret, m)?)?;
@@ -217,21 +221,38 @@ fn read_metadata(file: &str) -> PyResult<HashMap<String, String>> {
 
 #[pyfunction]
 #[pyo3(signature = (file, initialize=None))]
-fn read_graph(file: &str, initialize: Option<bool>) -> PyResult<Graph> {
+fn read_graph(py: Python, file: &str, initialize: Option<bool>) -> PyResult<Graph> {
     let initialize = initialize.unwrap_or(true);
-    let file = std::fs::File::open(file)?;
     let inner = if initialize {
-        rust::Graph::load(file)
+        py.allow_threads(|| rust::Graph::load_mapped(file))
     } else {
-        rust::Graph::load_uninitialized(file)
+        let file = std::fs::File::open(file)?;
+        py.allow_threads(|| rust::Graph::load_uninitialized(file))
     };
     Ok(Graph(Arc::new(Mutex::new(inner.map_err(ToPyErr)?))))
 }
 
 #[pyfunction]
-fn read_fn(file: &str) -> PyResult<Function> {
-    let file = std::fs::File::open(file)?;
-    let inner = rust::Function::load(file).map_err(ToPyErr)?;
+fn set_trust_native(trusted: bool) {
+    rust::native::set_trusted(trusted)
+}
+
+#[pyfunction]
+#[pyo3(signature = (file, lazy=false, strip=false))]
+fn read_fn(py: Python, file: &str, lazy: bool, strip: bool) -> PyResult<Function> {
+    let inner = py
+        .allow_threads(|| {
+            let mut func = if lazy {
+                rust::Function::load_lazy(file)
+            } else {
+                rust::Function::load_mapped(file)
+            }?;
+            if strip {
+                func.strip()?;
+            }
+            Ok::<_, rust::Error>(func)
+        })
+        .map_err(ToPyErr)?;
     Ok(Function {
         inner: Some(inner),
         original: None,
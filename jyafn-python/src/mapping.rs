@@ -5,49 +5,96 @@ use pyo3::types::PyDict;
 use super::layout::Obj;
 use super::{depythonize_ref_value, graph, pythonize_ref_value, Layout, ToPyErr};
 
+/// The storage backing a mapping, as chosen from Python.
+#[derive(Debug, Clone, Copy)]
+enum StorageKind {
+    HashMap,
+    Flat,
+    Mapped,
+    Perfect,
+}
+
+impl StorageKind {
+    fn from_name(name: &str) -> PyResult<StorageKind> {
+        match name {
+            "hashmap" => Ok(StorageKind::HashMap),
+            "flat" => Ok(StorageKind::Flat),
+            "mapped" => Ok(StorageKind::Mapped),
+            "perfect" => Ok(StorageKind::Perfect),
+            _ => Err(exceptions::PyValueError::new_err(format!(
+                "unknown mapping storage {name:?}; expected \"hashmap\", \"flat\", \
+                \"mapped\" or \"perfect\""
+            ))),
+        }
+    }
+}
+
 #[pyclass(module = "jyafn")]
 pub struct LazyMapping {
     is_consumed: bool,
     name: String,
     key_layout: rust::layout::Layout,
     value_layout: rust::layout::Layout,
+    storage: StorageKind,
     obj: PyObject,
 }
 
 impl LazyMapping {
     fn init(&mut self, py: Python, g: &mut rust::Graph) -> PyResult<()> {
         if !g.mappings().contains_key(&self.name) {
-            if let Ok(dict) = self.obj.downcast_bound::<PyDict>(py) {
-                g.insert_mapping(
-                    self.name.clone(),
-                    self.key_layout.clone(),
-                    self.value_layout.clone(),
-                    rust::mapping::HashMapStorage,
-                    dict.iter().map(|(k, v)| (Obj(k), Obj(v))).map(Ok),
-                )?;
-            } else {
-                if self.is_consumed {
-                    return Err(exceptions::PyException::new_err(
-                        "LazyMapping is already consumed. You initialized this LazyMapping with an \
-                        iterator and this iterator has been consumed.",
-                    ));
-                }
+            let obj = self.obj.bind(py);
+            let items: Box<dyn Iterator<Item = PyResult<(Obj, Obj)>> + '_> =
+                if let Ok(dict) = obj.downcast::<PyDict>() {
+                    Box::new(dict.iter().map(|(k, v)| (Obj(k), Obj(v))).map(Ok))
+                } else {
+                    if self.is_consumed {
+                        return Err(exceptions::PyException::new_err(
+                            "LazyMapping is already consumed. You initialized this LazyMapping \
+                            with an iterator and this iterator has been consumed.",
+                        ));
+                    }
 
-                // Fallible tuple iterator:
-                let iter = self.obj.bind(py).iter()?.map(|item| {
-                    item.and_then(|i| {
-                        i.extract::<(Bound<PyAny>, Bound<PyAny>)>()
-                            .map(|(k, v)| (Obj(k), Obj(v)))
-                    })
-                });
+                    // Fallible tuple iterator:
+                    Box::new(obj.iter()?.map(|item| {
+                        item.and_then(|i| {
+                            i.extract::<(Bound<PyAny>, Bound<PyAny>)>()
+                                .map(|(k, v)| (Obj(k), Obj(v)))
+                        })
+                    }))
+                };
 
-                g.insert_mapping(
-                    self.name.clone(),
-                    self.key_layout.clone(),
-                    self.value_layout.clone(),
+            let name = self.name.clone();
+            let key_layout = self.key_layout.clone();
+            let value_layout = self.value_layout.clone();
+            match self.storage {
+                StorageKind::HashMap => g.insert_mapping(
+                    name,
+                    key_layout,
+                    value_layout,
                     rust::mapping::HashMapStorage,
-                    iter,
-                )?;
+                    items,
+                )?,
+                StorageKind::Flat => g.insert_mapping(
+                    name,
+                    key_layout,
+                    value_layout,
+                    rust::mapping::FlatStorage,
+                    items,
+                )?,
+                StorageKind::Mapped => g.insert_mapping(
+                    name,
+                    key_layout,
+                    value_layout,
+                    rust::mapping::MappedStorage,
+                    items,
+                )?,
+                StorageKind::Perfect => g.insert_mapping(
+                    name,
+                    key_layout,
+                    value_layout,
+                    rust::mapping::PerfectHashStorage,
+                    items,
+                )?,
             }
         }
 
@@ -60,14 +107,22 @@ impl LazyMapping {
 #[pymethods]
 impl LazyMapping {
     #[new]
-    fn new(name: String, key_layout: Layout, value_layout: Layout, obj: PyObject) -> Self {
-        Self {
+    #[pyo3(signature = (name, key_layout, value_layout, obj, storage="hashmap"))]
+    fn new(
+        name: String,
+        key_layout: Layout,
+        value_layout: Layout,
+        obj: PyObject,
+        storage: &str,
+    ) -> PyResult<Self> {
+        Ok(Self {
             is_consumed: false,
             name,
             key_layout: key_layout.0,
             value_layout: value_layout.0,
+            storage: StorageKind::from_name(storage)?,
             obj,
-        }
+        })
     }
 
     fn __getitem__(&mut self, key: &Bound<PyAny>) -> PyResult<PyObject> {
@@ -0,0 +1,46 @@
+import jyafn as fn
+import numpy as np
+
+
+@fn.func
+def a_fun(a: fn.scalar, b: fn.scalar) -> fn.scalar:
+    fn.assert_(a >= 0.0, "a must be non-negative")
+    return 2.0 * a + b + 1.0
+
+
+inputs = np.array([[1.0, 2.0], [3.0, 4.0], [-1.0, 0.0], [0.0, 0.0]])
+outputs, errors = a_fun.eval_batch_raw(inputs)
+
+assert outputs.shape == (4, 1)
+assert list(outputs[[0, 1, 3], 0]) == [5.0, 11.0, 1.0]
+assert [row for row, _ in errors] == [2]
+print(errors)
+
+many_inputs = np.random.uniform(-1.0, 1.0, size=(10_000, 2))
+par_outputs, par_errors = a_fun.eval_batch_raw(many_inputs, parallel=True)
+seq_outputs, seq_errors = a_fun.eval_batch_raw(many_inputs)
+
+ok = many_inputs[:, 0] >= 0.0
+assert (par_outputs[ok] == seq_outputs[ok]).all()
+assert [row for row, _ in par_errors] == [row for row, _ in seq_errors]
+
+
+@fn.func
+def a_struct_fun(
+    a: fn.scalar, b: fn.bool, c: fn.list[fn.scalar, 2]
+) -> fn.struct[{"x": fn.scalar, "y": fn.bool}]:
+    fn.assert_(a >= 0.0, "a must be non-negative")
+    return {"x": a + c[0] * c[1], "y": ~b}
+
+
+columns = {
+    "a": np.array([1.0, -1.0, 2.0]),
+    "b": np.array([True, False, False]),
+    "c": np.array([[1.0, 2.0], [3.0, 4.0], [5.0, 6.0]]),
+}
+col_outputs, col_errors = a_struct_fun.eval_batch(columns)
+
+assert list(col_outputs["x"][[0, 2]]) == [3.0, 32.0]
+assert col_outputs["y"].dtype == np.bool_
+assert list(col_outputs["y"]) == [False, True, True]
+assert [row for row, _ in col_errors] == [1]
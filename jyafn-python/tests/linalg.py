@@ -40,3 +40,26 @@ def solve(a: fn.tensor[2, 2]):
 
 
 assert solve(a)
+
+
+# Small shapes have kernels of their own and bigger ones do not.
+rng = np.random.default_rng(0)
+for n in [5, 8]:
+    m = rng.normal(size=(n, n))
+    m = m @ m.T + n * np.eye(n)
+    v = rng.normal(size=n)
+    minv = np.linalg.inv(m)
+    mdet = np.linalg.det(m)
+    mchol = np.linalg.cholesky(m)
+    msolved = np.linalg.solve(m, v)
+
+    @fn.func
+    def all_ops(a: fn.tensor[n, n]):
+        return (
+            np.isclose(np.linalg.inv(a), minv).all()
+            & np.isclose(np.linalg.det(a), mdet)
+            & np.isclose(np.linalg.cholesky(a), mchol).all()
+            & np.isclose(np.linalg.solve(a, v), msolved).all()
+        )
+
+    assert all_ops(m.tolist())
@@ -37,3 +37,55 @@ print(foo("b"))
 print(foo("c"))
 
 foo.write("silly-map.jyafn")
+
+flat_map = fn.mapping({"a": 2, "b": 4}, storage="flat")
+
+
+@fn.func
+def bar(x: fn.symbol) -> fn.scalar:
+    return flat_map.get(x, 6)
+
+
+assert bar("a") == 2
+assert bar("b") == 4
+assert bar("c") == 6
+
+mapped_map = fn.mapping({"a": 2, "b": 4}, storage="mapped")
+
+
+@fn.func
+def qux(x: fn.symbol) -> fn.scalar:
+    return mapped_map.get(x, 6)
+
+
+qux.write("mapped-map.jyafn")
+qux = fn.read_fn("mapped-map.jyafn")
+assert qux("a") == 2
+assert qux("b") == 4
+assert qux("c") == 6
+
+perfect_map = fn.mapping({"a": 2, "b": 4}, storage="perfect")
+
+
+@fn.func
+def quz(x: fn.symbol) -> fn.scalar:
+    return perfect_map.get(x, 6)
+
+
+quz.write("perfect-map.jyafn")
+quz = fn.read_fn("perfect-map.jyafn")
+assert quz("a") == 2
+assert quz("b") == 4
+assert quz("c") == 6
+
+profiled = quz.get_graph().compile(profile=True)
+assert quz.profile_report() is None
+for key in ["a", "b", "c"]:
+    profiled(key)
+report = profiled.profile_report()
+assert report["entries"][0]["kind"] == "function"
+assert report["entries"][0]["hits"] == 3
+calls = [entry for entry in report["entries"] if entry["op"] == "CallMapping"]
+assert calls and calls[0]["hits"] == 3 and calls[0]["misses"] == 1
+profiled.reset_profile()
+assert profiled.profile_report()["entries"][0]["hits"] == 0
@@ -15,3 +15,38 @@ a_fun.write("data/a_fun.jyafn")
 
 other_fun = fn.read_fn("data/a_fun.jyafn")
 print(a_fun(5, 6, "a"), other_fun(5, 6, "a"))
+
+a_fun.write("data/a_fun_native.jyafn", native=True)
+
+native_fun = fn.read_fn("data/a_fun_native.jyafn")
+assert a_fun(5, 6, "a") == native_fun(5, 6, "a")
+assert native_fun.compile_stats()["source"] != "precompiled"
+
+fn.set_trust_native(True)
+trusted_fun = fn.read_fn("data/a_fun_native.jyafn")
+fn.set_trust_native(False)
+assert a_fun(5, 6, "a") == trusted_fun(5, 6, "a")
+assert trusted_fun.compile_stats()["source"] == "precompiled"
+
+with open("data/a_fun_stream.jyafn", "wb") as f:
+    a_fun.dump_to(f)
+
+with open("data/a_fun_stream.jyafn", "rb") as f:
+    streamed_fun = fn.Function.load_from(f)
+assert a_fun(5, 6, "a") == streamed_fun(5, 6, "a")
+
+stream_fun = fn.read_fn("data/a_fun_stream.jyafn")
+assert a_fun(5, 6, "a") == stream_fun(5, 6, "a")
+
+stripped_fun = fn.read_fn("data/a_fun.jyafn", strip=True)
+assert stripped_fun.is_stripped
+assert a_fun(5, 6, "a") == stripped_fun(5, 6, "a")
+assert int(stripped_fun.metadata["jyafn.mem_size_estimate"]) < int(
+    other_fun.metadata["jyafn.mem_size_estimate"]
+)
+try:
+    stripped_fun.dump()
+    dumped = True
+except Exception:
+    dumped = False
+assert not dumped, "stripped functions cannot be dumped"
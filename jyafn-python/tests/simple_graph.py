@@ -29,3 +29,8 @@ print("jyafn-time", jyafn_time)
 print("jyafn-eval-time", jyafn_eval_time)
 print("Slower", jyafn_time / py_time)
 print("Slower-eval", jyafn_eval_time / py_time)
+
+stats = a_fun.compile_stats()
+print("compile-stats", stats)
+assert stats["ir_size"] > 0 and stats["passes"]
+assert a_fun.metadata["jyafn.compile.source"] == stats["source"]
@@ -60,3 +60,47 @@ def inner(vec: fn.tensor[2, 1]) -> fn.tensor[2, 1]:
 print(inner.input_layout)
 print(inner.output_layout)
 print(inner(np.array([[1], [2]])))
+
+
+
+@fn.func
+def affine(mat: fn.tensor[2, 2], bias: fn.tensor[2]) -> fn.tensor[2, 2]:
+    return np.sqrt(mat * 2.0 + bias - 1.0)
+
+
+result = affine(np.array([[1.0, 2.0], [3.0, 4.0]]), np.array([1.0, 0.0]))
+print(result)
+assert np.allclose(result, np.sqrt([[2.0, 3.0], [6.0, 7.0]]))
+
+
+@fn.func
+def bulk_affine(a: fn.tensor[3], b: fn.tensor[3]) -> fn.tensor[3]:
+    return fn.array(fn.elementwise("add", fn.elementwise("mul", a, 2.0), b))
+
+
+bulk_result = bulk_affine(np.array([1.0, 2.0, 3.0]), np.array([1.0, 0.5, 2.0]))
+assert list(bulk_result) == [3.0, 4.5, 8.0]
+
+
+with fn.np_dropin.pairwise_reductions():
+
+    @fn.func
+    def pairwise_sum(mat: fn.tensor[5, 3]) -> fn.tensor[3]:
+        return np.sum(mat, axis=0)
+
+    @fn.func
+    def pairwise_max(mat: fn.tensor[5, 3]) -> fn.scalar:
+        return np.max(mat)
+
+
+mat = np.arange(15.0).reshape(5, 3)
+assert list(pairwise_sum(mat)) == list(np.sum(mat, axis=0))
+assert pairwise_max(mat) == 14.0
+
+
+@fn.func
+def clip(x: fn.tensor[4]) -> fn.tensor[4]:
+    return np.minimum(np.maximum(x, -1.0), 1.0)
+
+
+assert list(clip(np.array([-3.0, -0.5, 0.5, 3.0]))) == [-1.0, -0.5, 0.5, 1.0]
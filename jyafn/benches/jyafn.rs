@@ -0,0 +1,273 @@
+//! Benchmarks of the paths that matter in production: loading, compiling and calling
+//! functions, over synthetic graphs of increasing size.
+//!
+//! Run with `cargo bench -p jyafn` (or `make bench`, which also runs the Go and Python
+//! harnesses). Criterion keeps the estimates of each benchmark, as JSON, in
+//! `target/criterion/<group>/<benchmark>/new/estimates.json` and compares every run
+//! against the previous one. The compile cache is disabled, so that compiling always
+//! runs QBE and the assembler.
+
+use byte_slice_cast::*;
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion};
+use std::collections::HashMap;
+use std::hint::black_box;
+use std::io::Cursor;
+
+use jyafn::layout::{Layout, RefValue};
+use jyafn::resource::ResourceType;
+use jyafn::{mapping, op, Error, Graph, Ref};
+
+/// The sizes of the synthetic graphs, in "units" of each kind of graph.
+const SIZES: [usize; 3] = [10, 100, 1_000];
+
+/// The sizes of the mappings looked up.
+const MAPPING_SIZES: [usize; 3] = [1_000, 100_000, 1_000_000];
+
+fn scalar(value: RefValue) -> Ref {
+    let RefValue::Scalar(value) = value else {
+        panic!("expected a scalar, got {value:?}")
+    };
+    value
+}
+
+/// Inputs `a` and `b` and a scalar output.
+fn with_inputs<F>(build: F) -> Graph
+where
+    F: FnOnce(&mut Graph, Ref, Ref) -> Ref,
+{
+    let mut graph = Graph::new();
+    let a = scalar(graph.input("a".to_string(), Layout::Scalar));
+    let b = scalar(graph.input("b".to_string(), Layout::Scalar));
+    let output = build(&mut graph, a, b);
+    graph
+        .output(RefValue::Scalar(output), Layout::Scalar)
+        .unwrap();
+    graph
+}
+
+/// A long chain of additions and multiplications.
+fn arithmetic_graph(size: usize) -> Graph {
+    with_inputs(|graph, a, b| {
+        (0..size).fold(a, |acc, i| {
+            let scaled = graph.insert(op::Mul, vec![acc, b]).unwrap();
+            graph
+                .insert(op::Add, vec![scaled, Ref::from(i as f64)])
+                .unwrap()
+        })
+    })
+}
+
+/// A chain of choices, each with sides too costly to be computed beforehand.
+fn branchy_graph(size: usize) -> Graph {
+    with_inputs(|graph, a, b| {
+        (0..size).fold(a, |acc, i| {
+            let test = graph
+                .insert(op::Gt, vec![acc, Ref::from(i as f64)])
+                .unwrap();
+            let if_true = (0..4).fold(acc, |side, _| graph.insert(op::Mul, vec![side, b]).unwrap());
+            let if_false =
+                (0..4).fold(acc, |side, _| graph.insert(op::Add, vec![side, b]).unwrap());
+            graph
+                .insert(op::Choose, vec![test, if_true, if_false])
+                .unwrap()
+        })
+    })
+}
+
+/// Inserts a mapping from `i` to `2 * i` for `i` in `0..size`.
+fn insert_mapping(graph: &mut Graph, name: &str, size: usize) {
+    graph
+        .insert_mapping(
+            name.to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..size).map(|i| Ok::<_, Error>((i as f64, 2.0 * i as f64))),
+        )
+        .unwrap();
+}
+
+/// A chain of lookups in a small mapping, each keyed on the previous one.
+fn mapping_graph(size: usize) -> Graph {
+    with_inputs(|graph, a, b| {
+        insert_mapping(graph, "m", 1_000);
+        (0..size).fold(a, |acc, _| {
+            let key = graph.insert(op::Add, vec![acc, b]).unwrap();
+            scalar(
+                graph
+                    .call_mapping_default(
+                        "m",
+                        RefValue::Scalar(key),
+                        RefValue::Scalar(Ref::from(0.0)),
+                    )
+                    .unwrap(),
+            )
+        })
+    })
+}
+
+/// A chain of resource calls.
+fn resource_graph(size: usize) -> Graph {
+    with_inputs(|graph, a, b| {
+        let r#type: Box<dyn ResourceType> = serde_json::from_str(r#"{"type":"Dummy"}"#).unwrap();
+        graph.insert_resource_boxed("dummy".to_string(), r#type.from_bytes(b"2").unwrap());
+        (0..size).fold(a, |acc, _| {
+            let x = graph.insert(op::Add, vec![acc, b]).unwrap();
+            scalar(
+                graph
+                    .call_resource(
+                        "dummy",
+                        "get",
+                        RefValue::Struct([("x".to_string(), RefValue::Scalar(x))].into()),
+                    )
+                    .unwrap(),
+            )
+        })
+    })
+}
+
+/// Subgraphs calling subgraphs, `size` levels deep, each level calling the one below
+/// twice.
+fn subgraph_graph(size: usize) -> Graph {
+    let mut level = arithmetic_graph(8);
+    for _ in 0..size {
+        let below = level;
+        level = with_inputs(|graph, a, b| {
+            let id = graph.insert_subgraph(below);
+            let call = |graph: &mut Graph, x: Ref| {
+                let args = [("a", x), ("b", b)]
+                    .into_iter()
+                    .map(|(name, arg)| (name.to_string(), RefValue::Scalar(arg)))
+                    .collect();
+                scalar(graph.call_graph(id, RefValue::Struct(args)).unwrap())
+            };
+            let first = call(graph, a);
+            call(graph, first)
+        });
+    }
+    level
+}
+
+type Builder = fn(usize) -> Graph;
+
+const GRAPHS: [(&str, Builder); 5] = [
+    ("arithmetic", arithmetic_graph),
+    ("branchy", branchy_graph),
+    ("mapping", mapping_graph),
+    ("resource", resource_graph),
+    ("subgraph", subgraph_graph),
+];
+
+/// The sizes of each kind of graph. For subgraphs, this is the depth, since the work
+/// done grows exponentially with it.
+fn sizes(kind: &str) -> Vec<usize> {
+    if kind == "subgraph" {
+        vec![1, 4, 16]
+    } else {
+        SIZES.to_vec()
+    }
+}
+
+fn bench_load(c: &mut Criterion) {
+    let mut group = c.benchmark_group("load");
+    for (kind, build) in GRAPHS {
+        for size in sizes(kind) {
+            let mut dumped = Cursor::new(vec![]);
+            build(size).dump(&mut dumped).unwrap();
+            let dumped = dumped.into_inner();
+            group.bench_with_input(BenchmarkId::new(kind, size), &dumped, |b, dumped| {
+                b.iter(|| Graph::load(Cursor::new(dumped)).unwrap())
+            });
+        }
+    }
+}
+
+fn bench_compile(c: &mut Criterion) {
+    jyafn::cache::set_dir(None);
+    let mut group = c.benchmark_group("compile");
+    group.sample_size(10);
+    for (kind, build) in GRAPHS {
+        for size in sizes(kind) {
+            let graph = build(size);
+            group.bench_with_input(BenchmarkId::new(kind, size), &graph, |b, graph| {
+                b.iter(|| graph.compile().unwrap())
+            });
+        }
+    }
+}
+
+fn bench_call(c: &mut Criterion) {
+    let mut call_raw = c.benchmark_group("call_raw");
+    for (kind, build) in GRAPHS {
+        for size in sizes(kind) {
+            let func = build(size).compile().unwrap();
+            let input = [1.0, 0.5];
+            let mut output = [0.0];
+            call_raw.bench_function(BenchmarkId::new(kind, size), |b| {
+                b.iter(|| {
+                    let status =
+                        func.call_raw(black_box(input.as_byte_slice()), output.as_mut_byte_slice());
+                    assert!(status.is_null());
+                })
+            });
+        }
+    }
+    call_raw.finish();
+
+    let func = arithmetic_graph(10).compile().unwrap();
+    let mut eval = c.benchmark_group("eval");
+    let json = br#"{"a": 1.0, "b": 0.5}"#;
+    eval.bench_function("json", |b| {
+        let mut output = vec![];
+        b.iter(|| {
+            output.clear();
+            func.eval_json(black_box(json), &mut output).unwrap();
+        })
+    });
+    let value = serde_json::json!({"a": 1.0, "b": 0.5});
+    eval.bench_function("json_value", |b| {
+        b.iter(|| {
+            func.eval::<_, serde_json::Value>(black_box(&value))
+                .unwrap()
+        })
+    });
+    let input = HashMap::from([("a".to_string(), 1.0), ("b".to_string(), 0.5)]);
+    eval.bench_function("struct", |b| {
+        b.iter(|| func.eval::<_, f64>(black_box(&input)).unwrap())
+    });
+}
+
+fn bench_mapping_lookup(c: &mut Criterion) {
+    let mut group = c.benchmark_group("mapping_lookup");
+    for size in MAPPING_SIZES {
+        let mut graph = Graph::new();
+        insert_mapping(&mut graph, "m", size);
+        let key = graph.input("key".to_string(), Layout::Scalar);
+        let value = graph.call_mapping("m", key).unwrap();
+        graph.output(value, Layout::Scalar).unwrap();
+        let func = graph.compile().unwrap();
+
+        // Keys spread all over the table, so that lookups are not always in cache.
+        let mut key = 0;
+        let mut output = [0.0];
+        group.bench_function(BenchmarkId::from_parameter(size), |b| {
+            b.iter_batched(
+                || {
+                    key = (key + 7_919) % size;
+                    [key as f64]
+                },
+                |input| func.call_raw(input.as_byte_slice(), output.as_mut_byte_slice()),
+                BatchSize::SmallInput,
+            )
+        });
+    }
+}
+
+criterion_group!(
+    benches,
+    bench_load,
+    bench_compile,
+    bench_call,
+    bench_mapping_lookup
+);
+criterion_main!(benches);
@@ -1,9 +1,47 @@
+use std::fs;
+use std::path::Path;
 use std::process::Command;
 
+/// The directories with the sources of QBE. The build writes its objects and `libqbe.a`
+/// next to the sources, so only the sources (and the Makefile) are watched.
+const QBE_SOURCE_DIRS: [&str; 4] = [
+    "vendored/qbe",
+    "vendored/qbe/amd64",
+    "vendored/qbe/arm64",
+    "vendored/qbe/rv64",
+];
+
+fn rerun_if_sources_changed() {
+    println!("cargo:rerun-if-changed=vendored/qbe/Makefile");
+    for dir in QBE_SOURCE_DIRS {
+        let entries = fs::read_dir(dir).unwrap_or_else(|err| panic!("cannot read {dir}: {err}"));
+        for entry in entries {
+            let path = entry.expect("can read directory entry").path();
+            let is_source = path.extension().is_some_and(|ext| ext == "c" || ext == "h");
+            if is_source {
+                println!("cargo:rerun-if-changed={}", path.display());
+            }
+        }
+    }
+}
+
 fn main() {
-    Command::new("make")
-        .arg("qbe")
+    let output = Command::new("make")
+        .arg("libqbe.a")
         .current_dir("vendored/qbe")
         .output()
         .expect("failed to execute process");
+    if !output.status.success() {
+        panic!(
+            "failed to build libqbe.a: {}",
+            String::from_utf8_lossy(&output.stderr)
+        );
+    }
+
+    let qbe_dir = Path::new("vendored/qbe")
+        .canonicalize()
+        .expect("vendored/qbe exists");
+    println!("cargo:rustc-link-search=native={}", qbe_dir.display());
+    println!("cargo:rustc-link-lib=static=qbe");
+    rerun_if_sources_changed();
 }
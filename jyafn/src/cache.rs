@@ -0,0 +1,120 @@
+//! An on-disk cache of compiled machine code.
+//!
+//! Compiling a graph means running QBE and the assembler, which dominates the time it
+//! takes to load a function. Since the rendered code never embeds addresses from the
+//! current process (these are read from _externs_ filled in at load time), the
+//! relocatable object produced for a given rendered module can be reused by any
+//! process running the same version of jyafn on the same target. This cache stores
+//! these objects, keyed by a hash of the rendered module.
+//!
+//! The cache is opt-in: it is only used when a directory is configured, either through
+//! the `JYAFN_COMPILE_CACHE` environment variable or with [`set_dir`]. Failing to read
+//! from or write to the cache is never an error; the code is just compiled as usual.
+
+#[cfg(test)]
+use std::cell::RefCell;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::RwLock;
+
+use crate::utils::murmur::murmur_hash64a;
+
+lazy_static::lazy_static! {
+    static ref CACHE_DIR: RwLock<Option<PathBuf>> =
+        RwLock::new(std::env::var_os("JYAFN_COMPILE_CACHE").map(PathBuf::from));
+}
+
+/// Seeds for the two halves of the 128-bit cache key.
+const KEY_SEEDS: [u64; 2] = [0x6a79_6166_6e2e_6f62, 0x6361_6368_652e_6b65];
+/// Seed for the checksum stored in front of each cached object.
+const CHECKSUM_SEED: u64 = 0x6a79_6166_6e2e_6373;
+
+/// Sets the directory where compiled code is cached, or disables the cache if `None`.
+/// This overrides the `JYAFN_COMPILE_CACHE` environment variable.
+pub fn set_dir(dir: Option<PathBuf>) {
+    *CACHE_DIR.write().expect("poisoned") = dir;
+}
+
+#[cfg(test)]
+thread_local! {
+    /// Overrides the cache directory in the current thread (see [`with_dir`]).
+    static THREAD_DIR: RefCell<Option<Option<PathBuf>>> = const { RefCell::new(None) };
+}
+
+/// The directory where compiled code is cached, if caching is enabled.
+pub fn dir() -> Option<PathBuf> {
+    #[cfg(test)]
+    if let Some(dir) = THREAD_DIR.with(|dir| dir.borrow().clone()) {
+        return dir;
+    }
+
+    CACHE_DIR.read().expect("poisoned").clone()
+}
+
+/// Runs `f` with the cache directory set to `dir` in the current thread only, so that
+/// tests running in parallel each get their own cache.
+#[cfg(test)]
+pub(crate) fn with_dir<T>(dir: Option<PathBuf>, f: impl FnOnce() -> T) -> T {
+    let previous = THREAD_DIR.with(|thread_dir| thread_dir.replace(Some(dir)));
+    let _restore = scopeguard::guard(previous, |previous| {
+        THREAD_DIR.with(|thread_dir| *thread_dir.borrow_mut() = previous);
+    });
+    f()
+}
+
+/// The cache key for a rendered QBE module. Besides the module itself, this accounts
+/// for everything else that determines the resulting object: the target and the
+/// version of jyafn (and therefore of the vendored QBE).
+pub(crate) fn key(rendered: &str) -> String {
+    let mut keyed = format!(
+        "jyafn-{}-{}-{}\n",
+        env!("CARGO_PKG_VERSION"),
+        std::env::consts::ARCH,
+        std::env::consts::OS,
+    );
+    keyed.push_str(rendered);
+
+    let [hi, lo] = KEY_SEEDS.map(|seed| murmur_hash64a(keyed.as_bytes(), seed));
+    format!("{hi:016x}{lo:016x}")
+}
+
+fn path_for(dir: &Path, key: &str) -> PathBuf {
+    dir.join(format!("{key}.o"))
+}
+
+/// Gets the cached object for the given key, if caching is enabled and there is a
+/// valid entry for it.
+pub(crate) fn get(key: &str) -> Option<Vec<u8>> {
+    let stored = std::fs::read(path_for(&dir()?, key)).ok()?;
+    if stored.len() < 8 {
+        return None;
+    }
+
+    let (checksum, object) = stored.split_at(8);
+    if checksum != murmur_hash64a(object, CHECKSUM_SEED).to_le_bytes() {
+        return None;
+    }
+
+    Some(object.to_vec())
+}
+
+/// Stores an object in the cache, if caching is enabled. The entry is written to a
+/// temporary file first and then atomically moved into place, so that concurrent
+/// readers never see a partially written object.
+pub(crate) fn put(key: &str, object: &[u8]) {
+    let Some(dir) = dir() else {
+        return;
+    };
+
+    let write = || -> std::io::Result<()> {
+        std::fs::create_dir_all(&dir)?;
+        let mut file = tempfile::NamedTempFile::new_in(&dir)?;
+        file.write_all(&murmur_hash64a(object, CHECKSUM_SEED).to_le_bytes())?;
+        file.write_all(object)?;
+        file.persist(path_for(&dir, key))?;
+        Ok(())
+    };
+
+    // Best-effort: a failure here just means the next load compiles again.
+    let _ = write();
+}
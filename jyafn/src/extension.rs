@@ -108,6 +108,9 @@ pub struct StringManifest {
 #[derive(Debug, Serialize, Deserialize)]
 pub struct ResourceManifest {
     pub fn_from_bytes: String,
+    /// Optional, for extensions built before it existed.
+    #[serde(default)]
+    pub fn_from_mapped: Option<String>,
     pub fn_dump: String,
     pub fn_size: String,
     pub fn_get_method_def: String,
@@ -120,6 +123,11 @@ pub struct ResourceManifest {
 pub struct ExternalMethod {
     /// The function pointer to be called in jyafn code.
     pub fn_ptr: usize,
+    /// The batched version of the function, if any (see
+    /// [`crate::resource::RawResourceBatchMethod`]). Optional, for extensions built
+    /// before it existed.
+    #[serde(default)]
+    pub batch_fn_ptr: Option<usize>,
     /// The input layout of the given function.
     pub input_layout: Struct,
     /// Output layout of the given function.
@@ -237,6 +245,11 @@ pub struct ResourceSymbols {
     /// Creates a new resource from the supplied binary data and length. This is the same
     /// data that is returned by the `fn_dump` function.
     pub fn_from_bytes: unsafe extern "C" fn(*const u8, usize) -> Outcome,
+    /// Same as `fn_from_bytes`, except that the supplied binary data is guaranteed to
+    /// stay alive and unchanged until `fn_drop` is called on the resulting resource. So,
+    /// the resource may use it in place, instead of copying what it needs out of it.
+    /// This is optional: `fn_from_bytes` is used if it is missing.
+    pub fn_from_mapped: Option<unsafe extern "C" fn(*const u8, usize) -> Outcome>,
     /// Creates a dump, which points to the binary representation of the supplied resource.
     pub fn_dump: unsafe extern "C" fn(RawResource) -> Outcome,
     /// Gets the amount of heap memory (ie RAM) allocated by this resource.
@@ -259,11 +272,20 @@ impl ResourceSymbols {
     ) -> Result<ResourceSymbols, Error> {
         /// For building structs that are symbol tables.
         macro_rules! symbol {
-            ($($sym:ident),*) => { Self {$(
+            ($($sym:ident),*; $($optional:ident),*) => { Self {$(
                 $sym: get_symbol(library, &manifest.$sym).context(
                         concat!("getting symbol for ", stringify!($sym)
                     )
                 )?,
+            )* $(
+                $optional: manifest
+                    .$optional
+                    .as_ref()
+                    .map(|name| {
+                        get_symbol(library, name)
+                            .context(concat!("getting symbol for ", stringify!($optional)))
+                    })
+                    .transpose()?,
             )*}}
         }
 
@@ -272,7 +294,8 @@ impl ResourceSymbols {
             fn_dump,
             fn_size,
             fn_get_method_def,
-            fn_drop
+            fn_drop;
+            fn_from_mapped
         ))
     }
 }
@@ -1,19 +1,21 @@
 use get_size::GetSize;
-use libloading::Library;
 use std::borrow::Cow;
 use std::ffi::{c_char, CStr, CString};
 use std::{
     cell::RefCell,
     fmt::Debug,
     io::{Read, Seek},
-    sync::Arc,
+    path::Path,
+    sync::{Arc, Mutex, OnceLock},
+    thread::JoinHandle,
 };
-use tempfile::NamedTempFile;
 use thread_local::ThreadLocal;
 
+use crate::image::Image;
+use crate::profile::{self, ProfileEntry, ProfileReport};
 use crate::size::Size;
 
-use super::{layout, Error, Graph};
+use super::{layout, CompileStats, Error, Graph};
 
 /// The error type returned from the compiled function. If you need to create a new error
 /// from your code, use `String::into`.
@@ -50,27 +52,158 @@ impl From<String> for FnError {
 /// The function signature exposed from jyafn.
 pub type RawFn = unsafe extern "C" fn(*const u8, *mut u8) -> *mut FnError;
 
+/// The batched function signature exposed from jyafn. This evaluates `n` contiguous rows
+/// of input into `n` contiguous rows of output, writing the status of each row into the
+/// `n`-long status array and returning how many rows failed.
+pub type RawBatchFn = unsafe extern "C" fn(*const u8, *mut u8, u64, *mut *mut FnError) -> u64;
+
+/// The machine code of a function, loaded in memory.
+#[derive(Debug)]
+struct Native {
+    image: Image,
+    fn_ptr: RawFn,
+    batch_fn_ptr: RawBatchFn,
+    /// How the code was compiled.
+    stats: CompileStats,
+    /// The sites instrumented in the code, if it was compiled for profiling (see
+    /// [`Graph::compile_profiled`]).
+    profile: Option<Vec<ProfileEntry>>,
+}
+
+impl Native {
+    fn new(image: Image, stats: CompileStats) -> Result<Native, Error> {
+        // The function pointers stay valid because `image` is held here, alongside them.
+        Ok(Native {
+            fn_ptr: image.run()?,
+            batch_fn_ptr: image.run_batch()?,
+            image,
+            stats,
+            profile: None,
+        })
+    }
+
+    /// The counters of the instrumented sites, if the code was compiled for profiling.
+    fn profile_counters(&self) -> Option<(*mut u64, &[ProfileEntry])> {
+        let sites = self.profile.as_ref()?;
+        let counters = self.image.symbol(&profile::counters_name("run")).ok()?;
+        Some((counters as *mut u64, sites))
+    }
+}
+
 /// All the data that a [`Function`] holds on to.
 #[derive(Debug)]
 pub struct FunctionData {
     graph: Graph,
-    _library: Library,
-    library_len: u64,
-    input_layout: layout::Layout,
-    output_layout: layout::Layout,
+    /// The machine code, once compiled, or why it could not be compiled. See
+    /// [`Graph::compile_tiered`].
+    native: OnceLock<Result<Native, String>>,
+    /// The precompiled object to try first when compiling in the background.
+    precompiled: Mutex<Option<(String, Vec<u8>)>>,
+    /// The thread compiling the function in the background, if any (see
+    /// [`Graph::compile_tiered`]). It holds a reference to this data until it is done.
+    compiling: Mutex<Option<JoinHandle<()>>>,
+    /// Whether the mappings that the machine code can call were all read, or why some
+    /// could not be. See [`FunctionData::read_mappings`].
+    mappings_read: OnceLock<Result<(), String>>,
+    /// The input layout, compiled once for all calls.
+    input_plan: layout::Plan,
+    /// The output layout, compiled once for all calls.
+    output_plan: layout::Plan,
     input_size: Size,
     output_size: Size,
-    fn_ptr: RawFn,
+    /// The symbols of the graph, looked up on every call.
+    symbols: layout::SymbolTable,
     input: ThreadLocal<RefCell<layout::Visitor>>,
     output: ThreadLocal<RefCell<layout::Visitor>>,
+    /// The symbols of a call that are not in the graph.
+    extra_symbols: ThreadLocal<RefCell<layout::SymbolTable>>,
+}
+
+impl FunctionData {
+    /// The machine code of the function, compiling it first or waiting for it to be
+    /// compiled in the background, if needed.
+    fn native(&self) -> Result<&Native, Error> {
+        self.native
+            .get_or_init(|| {
+                let precompiled = self.precompiled.lock().expect("poisoned").take();
+                let image = self.graph.compile_image(precompiled);
+                image
+                    .and_then(|(image, stats)| Native::new(image, stats))
+                    .map_err(|err| err.to_string())
+            })
+            .as_ref()
+            .map_err(|err| Error::Other(format!("function failed to compile: {err}")))
+    }
+
+    /// Reads the mappings that the machine code can call and that were loaded lazily
+    /// (see [`Graph::load_lazy`]) and not read yet. The machine code cannot tell a
+    /// mapping that failed to read from a missing key, so this must be called before
+    /// running it. Mappings of the graph that the code never calls stay unread. After
+    /// the first call, this only checks a flag.
+    fn read_mappings(&self) -> Result<(), Error> {
+        self.mappings_read
+            .get_or_init(|| {
+                let mut called = vec![];
+                self.graph.collect_called_mappings(&mut called);
+                called
+                    .into_iter()
+                    .try_for_each(|mapping| mapping.materialize())
+                    .map_err(|err| err.to_string())
+            })
+            .as_ref()
+            .map(|_| ())
+            .map_err(|err| Error::Other(err.clone()))
+    }
+}
+
+impl FunctionData {
+    /// Writes the estimated memory usage of the function into the metadata of the
+    /// graph. This counts the machine code only if it is already there: functions
+    /// compiled in the background (see [`Graph::compile_tiered`]) get their estimate
+    /// written before that, so it leaves the machine code out until the function is
+    /// stripped (see [`Function::strip`]). The size of a [`Function`] given by
+    /// [`GetSize`] always counts the machine code, once it exists.
+    fn estimate_size(&mut self) {
+        let data_size = self.get_size();
+        // Included in the total, but not paid again for this function (see `Graph::load`).
+        let shared_size = self.graph.shared_size.min(data_size);
+        let metadata = self.graph.metadata_mut();
+        metadata.insert("jyafn.mem_size_estimate".to_string(), data_size.to_string());
+        metadata.insert(
+            "jyafn.mem_size_estimate.shared".to_string(),
+            shared_size.to_string(),
+        );
+        metadata.insert(
+            "jyafn.mem_size_estimate.exclusive".to_string(),
+            (data_size - shared_size).to_string(),
+        );
+    }
+
+    /// Writes the compile stats of the function into the metadata of the graph, if the
+    /// machine code is already there. The stats of any previous compilation of the
+    /// graph (e.g., before it was dumped and loaded again) are removed first, since
+    /// not every compilation has the same stats.
+    fn record_compile_stats(&mut self) {
+        let Some(Ok(native)) = self.native.get() else {
+            return;
+        };
+        let entries = native.stats.to_metadata();
+        let metadata = self.graph.metadata_mut();
+        metadata.retain(|key, _| !key.starts_with("jyafn.compile."));
+        metadata.extend(entries);
+    }
 }
 
 impl GetSize for FunctionData {
     fn get_heap_size(&self) -> usize {
         self.graph.get_heap_size()
-            + self.library_len as usize
-            + self.input_layout.get_heap_size()
-            + self.output_layout.get_heap_size()
+            + match self.native.get() {
+                Some(Ok(native)) => native.image.len(),
+                _ => 0,
+            }
+            + self.input_plan.get_heap_size()
+            + self.output_plan.get_heap_size()
+            + self.symbols.heap_size()
             + self
                 .input
                 .get()
@@ -91,6 +224,21 @@ pub struct Function {
     data: Arc<FunctionData>,
 }
 
+/// A call to a function whose input is already encoded, waiting to be run. See
+/// [`Function::eval_with_decoder_around`].
+pub struct PendingCall<'a> {
+    function: &'a Function,
+    input: &'a [u8],
+    output: &'a mut [u8],
+}
+
+impl PendingCall<'_> {
+    /// Runs the call, writing the raw output.
+    pub fn run(self) -> Result<(), Error> {
+        self.function.call_checked(self.input, self.output)
+    }
+}
+
 impl From<Arc<FunctionData>> for Function {
     fn from(data: Arc<FunctionData>) -> Function {
         Function { data }
@@ -116,22 +264,120 @@ impl Function {
 
     /// The input layout of this function.
     pub fn input_layout(&self) -> &layout::Layout {
-        &self.data.input_layout
+        self.data.input_plan.layout()
     }
 
     /// The output layout of this function.
     pub fn output_layout(&self) -> &layout::Layout {
-        &self.data.output_layout
+        self.data.output_plan.layout()
     }
 
-    /// The computational graph that generated this function.
+    /// The computational graph that generated this function. If the function was
+    /// stripped (see [`Function::strip`]), this is only what remains of the graph: it
+    /// still has the name, metadata, symbols, mappings and resources, but it can no
+    /// longer be compiled or dumped.
     pub fn graph(&self) -> &Graph {
         &self.data.graph
     }
 
-    /// The raw function pointer of the compiled function in memory.
+    /// Drops everything in the graph of this function that is only needed to build and
+    /// compile it (see [`Function::graph`]). For big graphs, this is most of the memory
+    /// that the function takes. The memory estimates in the metadata are updated to the
+    /// new size. This waits for the machine code, if it is still being compiled, and
+    /// fails if it failed to compile or if this function was cloned, since the graph is
+    /// then still in use elsewhere.
+    pub fn strip(&mut self) -> Result<(), Error> {
+        self.wait_native()?;
+        // The compiling thread only lets go of its clone after the code is there.
+        let compiling = self.data.compiling.lock().expect("poisoned").take();
+        if let Some(compiling) = compiling {
+            let _ = compiling.join();
+        }
+
+        let data = Arc::get_mut(&mut self.data)
+            .ok_or_else(|| Error::Other("cannot strip a function that has clones".to_string()))?;
+        data.graph.strip();
+        // The machine code might have been compiled in the background, after these were
+        // first written.
+        data.record_compile_stats();
+        data.estimate_size();
+
+        Ok(())
+    }
+
+    /// The raw function pointer of the compiled function in memory. If the function is
+    /// still being compiled (see [`Graph::compile_tiered`]), this waits for it.
+    ///
+    /// # Panics
+    ///
+    /// If the function failed to compile or if some mapping that it calls, loaded lazily
+    /// (see [`Graph::load_lazy`]), cannot be read.
     pub fn fn_ptr(&self) -> RawFn {
-        self.data.fn_ptr
+        self.data.read_mappings().expect("mappings can be read");
+        self.data.native().expect("function compiles").fn_ptr
+    }
+
+    /// The raw function pointer of the batched version of the compiled function in
+    /// memory. If the function is still being compiled (see [`Graph::compile_tiered`]),
+    /// this waits for it.
+    ///
+    /// # Panics
+    ///
+    /// If the function failed to compile or if some mapping that it calls, loaded lazily
+    /// (see [`Graph::load_lazy`]), cannot be read.
+    pub fn batch_fn_ptr(&self) -> RawBatchFn {
+        self.data.read_mappings().expect("mappings can be read");
+        self.data.native().expect("function compiles").batch_fn_ptr
+    }
+
+    /// Whether this function already runs as machine code. This is only `false` for
+    /// functions still being compiled (see [`Graph::compile_tiered`]) or that failed to
+    /// compile.
+    pub fn is_native(&self) -> bool {
+        matches!(self.data.native.get(), Some(Ok(_)))
+    }
+
+    /// Waits for the machine code of this function to be ready (see
+    /// [`Graph::compile_tiered`]), returning the compilation error, if any.
+    pub fn wait_native(&self) -> Result<(), Error> {
+        self.data.native().map(|_| ())
+    }
+
+    /// How long each phase of the compilation of this function took and how big what
+    /// came out of each phase was. This is `None` while the function is still being
+    /// compiled in the background (see [`Graph::compile_tiered`]) or if it failed to
+    /// compile. The same stats are in the metadata, under `jyafn.compile`, except for
+    /// functions compiled in the background.
+    pub fn compile_stats(&self) -> Option<&CompileStats> {
+        match self.data.native.get() {
+            Some(Ok(native)) => Some(&native.stats),
+            _ => None,
+        }
+    }
+
+    /// How many times each call and each side of each conditional of this function ran
+    /// and how long it took, since this function was compiled (or since the last
+    /// [`Function::reset_profile`]). This is `None` if the function was not compiled
+    /// with [`Graph::compile_profiled`].
+    pub fn profile_report(&self) -> Option<ProfileReport> {
+        let Some(Ok(native)) = self.data.native.get() else {
+            return None;
+        };
+        let (counters, sites) = native.profile_counters()?;
+        // Safety: the counters were rendered for these sites and live as long as the image.
+        Some(unsafe { profile::read(counters, sites) })
+    }
+
+    /// Sets all counts of [`Function::profile_report`] back to zero. This does nothing
+    /// if the function was not compiled with [`Graph::compile_profiled`].
+    pub fn reset_profile(&self) {
+        let Some(Ok(native)) = self.data.native.get() else {
+            return;
+        };
+        if let Some((counters, sites)) = native.profile_counters() {
+            // Safety: the counters were rendered for these sites, as writable data.
+            unsafe { profile::reset(counters, sites) }
+        }
     }
 
     /// Returns the function data associated with this function.
@@ -140,54 +386,123 @@ impl Function {
     }
 
     /// Loads a computational graph from the provided reader and compiles it, returning
-    /// the reulting function.
+    /// the reulting function. If the graph was dumped with native code for the current
+    /// target (see [`Graph::dump_native`]), that code is used instead of compiling, but
+    /// only if native code in graph files is trusted (see [`crate::native`]).
     pub fn load<R: Read + Seek>(reader: R) -> Result<Function, Error> {
-        let graph = Graph::load(reader)?;
-        graph.compile()
-    }
-
-    /// Initializes a function from a given graph and a temporary file, containing the
-    /// shared object obtained from the compilation process.
-    pub(crate) fn init(graph: Graph, shared_object: NamedTempFile) -> Result<Function, Error> {
-        let library = unsafe {
-            // Safety: shared object was complied straignt from the linker into the
-            // temporary file, unless some spooky process was able to change the file
-            // contents in the mean time (highy unlikely).
-            Library::new(shared_object.path())?
-        };
-        let symbol: libloading::Symbol<RawFn> = unsafe {
-            // Safety: all jyafn shared objects have this function with this given signature.
-            // Also, `library` will be held by the current function until it is dropped.
-            library.get(b"run\0")?
+        let (graph, native) = Graph::load_with_native(reader)?;
+        graph.compile_with(native)
+    }
+
+    /// Loads a function from the file at the supplied path, which is memory-mapped. See
+    /// [`Graph::load_mapped`] for details. As in [`Function::load`], native code in the
+    /// file is only run if trusted.
+    pub fn load_mapped<P: AsRef<Path>>(path: P) -> Result<Function, Error> {
+        let (graph, native) = Graph::load_mapped_with_native(path)?;
+        graph.compile_with(native)
+    }
+
+    /// Loads a function from the file at the supplied path, reading the data of each
+    /// mapping only when it is first used. See [`Graph::load_lazy`] for details. As in
+    /// [`Function::load`], native code in the file is only run if trusted.
+    pub fn load_lazy<P: AsRef<Path>>(path: P) -> Result<Function, Error> {
+        let (graph, native) = Graph::load_lazy_with_native(path)?;
+        graph.compile_with(native)
+    }
+
+    /// Loads a function from the supplied reader, which is read only once, from start to
+    /// end, as it arrives. See [`Graph::load_stream`] for details. As in
+    /// [`Function::load`], native code in the stream is only run if trusted.
+    pub fn load_stream<R: Read>(reader: R) -> Result<Function, Error> {
+        let (graph, native) = Graph::load_stream_with_native(reader)?;
+        graph.compile_with(native)
+    }
+
+    /// Like [`Function::load`], but returns as soon as the graph is read, compiling it in
+    /// the background. See [`Graph::compile_tiered`] for details. Native code in the file
+    /// is only run if trusted.
+    pub fn load_tiered<R: Read + Seek>(reader: R) -> Result<Function, Error> {
+        let (graph, native) = Graph::load_with_native(reader)?;
+        Ok(Function::init_tiered(graph, native))
+    }
+
+    /// Like [`Function::load`], but strips the graph right after compiling it (see
+    /// [`Function::strip`]).
+    pub fn load_stripped<R: Read + Seek>(reader: R) -> Result<Function, Error> {
+        let mut func = Function::load(reader)?;
+        func.strip()?;
+        Ok(func)
+    }
+
+    /// Initializes a function from a given graph and the machine code obtained from the
+    /// compilation process, already loaded in memory.
+    pub(crate) fn init(graph: Graph, image: Image, stats: CompileStats) -> Result<Function, Error> {
+        let native = Native::new(image, stats)?;
+        Ok(Function::init_with(graph, OnceLock::from(Ok(native)), None))
+    }
+
+    /// Same as [`Function::init`], for machine code compiled for profiling, with the given
+    /// sites instrumented.
+    pub(crate) fn init_profiled(
+        graph: Graph,
+        image: Image,
+        stats: CompileStats,
+        sites: Vec<ProfileEntry>,
+    ) -> Result<Function, Error> {
+        let native = Native {
+            profile: Some(sites),
+            ..Native::new(image, stats)?
         };
-        let fn_ptr: RawFn = *symbol;
+        Ok(Function::init_with(graph, OnceLock::from(Ok(native)), None))
+    }
 
+    /// Initializes a function from a given graph, compiling it in a background thread
+    /// (or loading the precompiled object, if it is any good). See
+    /// [`Graph::compile_tiered`].
+    pub(crate) fn init_tiered(graph: Graph, precompiled: Option<(String, Vec<u8>)>) -> Function {
+        let func = Function::init_with(graph, OnceLock::new(), precompiled);
+        let data = func.data.clone();
+        // If no thread can be spawned, the first call needing the code compiles it.
+        let compiling = std::thread::Builder::new()
+            .name("jyafn-compile".to_string())
+            .spawn(move || {
+                let _ = data.native();
+            });
+        *func.data.compiling.lock().expect("poisoned") = compiling.ok();
+        func
+    }
+
+    fn init_with(
+        graph: Graph,
+        native: OnceLock<Result<Native, String>>,
+        precompiled: Option<(String, Vec<u8>)>,
+    ) -> Function {
         let input_layout = graph.input_layout.clone();
         let output_layout = graph.output_layout.clone();
         let input_size_in_floats = input_layout.size();
         let output_size_in_floats = output_layout.size();
 
         let mut data = FunctionData {
-            _library: library,
-            library_len: std::fs::metadata(shared_object.path())?.len(),
+            native,
+            precompiled: Mutex::new(precompiled),
+            compiling: Mutex::new(None),
+            mappings_read: OnceLock::new(),
             input_size: input_size_in_floats,
-            input_layout: input_layout.into(),
+            input_plan: input_layout.into(),
             output_size: output_size_in_floats,
-            output_layout,
-            fn_ptr,
+            output_plan: output_layout.into(),
+            symbols: (&graph.symbols).into(),
             graph,
             input: ThreadLocal::new(),
             output: ThreadLocal::new(),
+            extra_symbols: ThreadLocal::new(),
         };
+        data.record_compile_stats();
+        data.estimate_size();
 
-        let data_size = data.get_size();
-        data.graph
-            .metadata_mut()
-            .insert("jyafn.mem_size_estimate".to_string(), data_size.to_string());
-
-        Ok(Function {
+        Function {
             data: Arc::new(data),
-        })
+        }
     }
 
     /// Calls the function on an raw input and returns the result in the output. This
@@ -208,9 +523,168 @@ impl Function {
         assert_eq!(self.data.input_size.in_bytes(), input.len());
         assert_eq!(self.data.output_size.in_bytes(), output.len());
 
+        if let Err(err) = self.data.read_mappings() {
+            return Box::into_raw(Box::new(FnError::from(err.to_string())));
+        }
+
+        let native = match self.data.native.get() {
+            Some(Ok(native)) => native,
+            // Not compiled yet (or not compilable): interpret, if possible.
+            _ if self.data.graph.interpret(input, output).is_some() => {
+                return std::ptr::null_mut();
+            }
+            _ => match self.data.native() {
+                Ok(native) => native,
+                Err(err) => return Box::into_raw(Box::new(FnError::from(err.to_string()))),
+            },
+        };
+
         // Safety: input and output sizes are checked and function pinky-promisses not to
         // accesses anything out of bounds.
-        unsafe { (self.data.fn_ptr)(input.as_ptr(), output.as_mut_ptr()) }
+        unsafe { (native.fn_ptr)(input.as_ptr(), output.as_mut_ptr()) }
+    }
+
+    /// Calls the function on a batch of raw inputs, laid out contiguously in `input`,
+    /// writing the results contiguously in `output`, in the same order. The number of
+    /// rows is given by the size of `input` (or of `output`, for functions without
+    /// input). This function panics if the input and the output do not hold the same
+    /// whole number of rows.
+    ///
+    /// Errors are reported per row: this returns the index of each row that raised,
+    /// together with its error, in row order. The other rows are not affected by them.
+    /// The output of a row that raised is left unspecified.
+    ///
+    /// This method is not unsafe in that it does not generate Undefined Behavior if some
+    /// contract is not obeyed. However, you should really know what you are doing here.
+    /// Consider using [`Function::eval`] instead.
+    pub fn call_batch<I, O>(&self, input: I, mut output: O) -> Vec<(usize, Error)>
+    where
+        I: AsRef<[u8]>,
+        O: AsMut<[u8]>,
+    {
+        let input = input.as_ref();
+        let output = output.as_mut();
+        let input_size = self.data.input_size.in_bytes();
+        let output_size = self.data.output_size.in_bytes();
+
+        let n_rows = if input_size != 0 {
+            input.len() / input_size
+        } else if output_size != 0 {
+            output.len() / output_size
+        } else {
+            0
+        };
+        assert_eq!(n_rows * input_size, input.len());
+        assert_eq!(n_rows * output_size, output.len());
+
+        // Until the machine code is ready, rows go one by one.
+        let Some(Ok(native)) = self.data.native.get() else {
+            return (0..n_rows)
+                .filter_map(|row| {
+                    let input = &input[row * input_size..][..input_size];
+                    let output = &mut output[row * output_size..][..output_size];
+                    self.call_checked(input, output).err().map(|err| (row, err))
+                })
+                .collect();
+        };
+
+        if let Err(err) = self.data.read_mappings() {
+            let err = err.to_string();
+            return (0..n_rows)
+                .map(|row| (row, Error::Other(err.clone())))
+                .collect();
+        }
+
+        // The compiled code loops over the rows by itself. Rows are fed to it in blocks,
+        // so that the statuses fit in a small buffer on the stack.
+        const BLOCK: usize = 256;
+        let mut statuses = [std::ptr::null_mut(); BLOCK];
+        let mut errors = vec![];
+        for start in (0..n_rows).step_by(BLOCK) {
+            let n_block = BLOCK.min(n_rows - start);
+            // Safety: input and output sizes are checked and function pinky-promisses not
+            // to accesses anything out of bounds.
+            let n_failed = unsafe {
+                (native.batch_fn_ptr)(
+                    input.as_ptr().add(start * input_size),
+                    output.as_mut_ptr().add(start * output_size),
+                    n_block as u64,
+                    statuses.as_mut_ptr(),
+                )
+            };
+            if n_failed == 0 {
+                continue;
+            }
+
+            for (row, &status) in statuses[..n_block].iter().enumerate() {
+                if !status.is_null() {
+                    // Safety: null was checked and the function pinky-promisses to return
+                    // a valid C string in case of error.
+                    let mut error = unsafe { Box::from_raw(status) };
+                    errors.push((start + row, Error::StatusRaised(error.take())));
+                }
+            }
+        }
+
+        errors
+    }
+
+    /// Same as [`Function::call_batch`], but spreads the rows across the threads of a
+    /// persistent thread pool (see [`crate::pool::num_threads`]). Rows are handed out in
+    /// chunks that shrink as the work runs out, so that uneven per-row costs still
+    /// balance out between threads.
+    ///
+    /// This method is not unsafe in that it does not generate Undefined Behavior if some
+    /// contract is not obeyed. However, you should really know what you are doing here.
+    /// Consider using [`Function::par_eval_batch`] instead.
+    pub fn par_call_batch<I, O>(&self, input: I, mut output: O) -> Vec<(usize, Error)>
+    where
+        I: AsRef<[u8]>,
+        O: AsMut<[u8]>,
+    {
+        let input = input.as_ref();
+        let output = output.as_mut();
+        let input_size = self.data.input_size.in_bytes();
+        let output_size = self.data.output_size.in_bytes();
+
+        let n_rows = if input_size != 0 {
+            input.len() / input_size
+        } else if output_size != 0 {
+            output.len() / output_size
+        } else {
+            0
+        };
+        assert_eq!(n_rows * input_size, input.len());
+        assert_eq!(n_rows * output_size, output.len());
+
+        /// Chunks write to disjoint parts of the output, so it can be shared.
+        struct SharedOutput(*mut u8);
+        unsafe impl Sync for SharedOutput {}
+        let shared_output = SharedOutput(output.as_mut_ptr());
+
+        let errors = std::sync::Mutex::new(vec![]);
+        crate::pool::for_each_chunk(n_rows, |rows| {
+            let input = &input[rows.start * input_size..rows.end * input_size];
+            // Safety: the chunks of rows are disjoint and within the bounds checked above.
+            let output = unsafe {
+                std::slice::from_raw_parts_mut(
+                    shared_output.0.add(rows.start * output_size),
+                    rows.len() * output_size,
+                )
+            };
+            let chunk_errors = self.call_batch(input, output);
+            if !chunk_errors.is_empty() {
+                errors.lock().expect("poisoned").extend(
+                    chunk_errors
+                        .into_iter()
+                        .map(|(row, error)| (rows.start + row, error)),
+                );
+            }
+        });
+
+        let mut errors = errors.into_inner().expect("poisoned");
+        errors.sort_unstable_by_key(|&(row, _)| row);
+        errors
     }
 
     /// Calls the function on an raw input and returns the result as boxed slice of bytes.
@@ -224,9 +698,15 @@ impl Function {
         I: AsRef<[u8]>,
     {
         let mut output = vec![0; self.data.output_size.in_bytes()].into_boxed_slice();
-        let status = self.call_raw(input, &mut output);
+        self.call_checked(input.as_ref(), &mut output)?;
+        Ok(output)
+    }
+
+    /// Calls the function on a raw input, turning the returned status into an error.
+    fn call_checked(&self, input: &[u8], output: &mut [u8]) -> Result<(), Error> {
+        let status = self.call_raw(input, output);
         if status.is_null() {
-            Ok(output)
+            Ok(())
         } else {
             // Safety: null was checked and the function pinky-promisses to return a valid
             // C string in case of error.
@@ -235,13 +715,15 @@ impl Function {
         }
     }
 
-    /// Calls this function on an input that can be encoded to jyafn-compatible binary
-    /// data and builds the return value from the resulting binary data using the supplied
-    /// decoder.
-    pub fn eval_with_decoder<E, D>(&self, input: &E, mut decoder: D) -> Result<D::Target, Error>
+    /// Calls this function, encoding the input into its thread-local input buffer with
+    /// `encode` and building the return value out of its thread-local output buffer with
+    /// `decode`, both given the plan of the corresponding layout. The compiled code itself
+    /// is called through `run`.
+    fn eval_planned<T, F, G, R>(&self, encode: F, run: R, decode: G) -> Result<T, Error>
     where
-        E: ?Sized + layout::Encode,
-        D: layout::Decoder,
+        F: FnOnce(&layout::Plan, &mut dyn layout::Sym, &mut layout::Visitor) -> Result<(), Error>,
+        R: FnOnce(PendingCall) -> Result<(), Error>,
+        G: FnOnce(&layout::Plan, &dyn layout::Sym, &mut layout::Visitor) -> Result<T, Error>,
     {
         // Access buffers:
         let local_input = self
@@ -259,28 +741,110 @@ impl Function {
 
         // Define a symbols view (to store symbols present in the input not present in the
         // graph)
-        let mut symbols_view = layout::SymbolsView::new(&self.data.graph.symbols);
+        let local_extra_symbols = self.data.extra_symbols.get_or_default();
+        let mut extra_symbols = local_extra_symbols.borrow_mut();
+        let mut symbols_view = layout::SymbolTableView::new(&self.data.symbols, &mut extra_symbols);
 
         // Serialization dance:
-        input
-            .visit(
-                &self.data.input_layout,
-                &mut symbols_view,
-                &mut encode_visitor,
-            )
-            .map_err(|err| Error::EncodeError(Box::new(err)))?;
+        encode(
+            &self.data.input_plan,
+            &mut symbols_view,
+            &mut encode_visitor,
+        )?;
 
         // Call:
-        let status = self.call_raw(&encode_visitor.0, &mut decode_visitor.0);
-        if !status.is_null() {
-            // Safety: null was checked and the function pinky-promisses to return a valid
-            // C string in case of error.
-            let mut error = unsafe { Box::from_raw(status) };
-            return Err(Error::StatusRaised(error.take()));
-        }
+        run(PendingCall {
+            function: self,
+            input: &encode_visitor.0,
+            output: &mut decode_visitor.0,
+        })?;
 
         // Deserialization dance:
-        Ok(decoder.build(&self.data.output_layout, &symbols_view, &mut decode_visitor))
+        decode(&self.data.output_plan, &symbols_view, &mut decode_visitor)
+    }
+
+    /// Calls this function on an input that can be encoded to jyafn-compatible binary
+    /// data and builds the return value from the resulting binary data using the supplied
+    /// decoder.
+    pub fn eval_with_decoder<E, D>(&self, input: &E, decoder: D) -> Result<D::Target, Error>
+    where
+        E: ?Sized + layout::Encode,
+        D: layout::Decoder,
+    {
+        self.eval_with_decoder_around(input, decoder, PendingCall::run)
+    }
+
+    /// Like [`Function::eval_with_decoder`], but the compiled code is called through
+    /// `run`, which must eventually [`PendingCall::run`] the call it is given. Since the
+    /// call only touches the raw input and output, this is the place to release whatever
+    /// encoding and decoding need, but the computation does not (e.g., the GIL, in
+    /// Python).
+    pub fn eval_with_decoder_around<E, D, R>(
+        &self,
+        input: &E,
+        mut decoder: D,
+        run: R,
+    ) -> Result<D::Target, Error>
+    where
+        E: ?Sized + layout::Encode,
+        D: layout::Decoder,
+        R: FnOnce(PendingCall) -> Result<(), Error>,
+    {
+        self.eval_planned(
+            |plan, symbols, visitor| {
+                input
+                    .visit_planned(plan, symbols, visitor)
+                    .map_err(|err| Error::EncodeError(Box::new(err)))
+            },
+            run,
+            |plan, symbols, visitor| Ok(decoder.build_planned(plan, symbols, visitor)),
+        )
+    }
+
+    /// Calls this function on an input in JSON and appends the output, also in JSON, to
+    /// `output`. The JSON goes straight from the text into the input buffer of the
+    /// function and straight from the output buffer back to text, without any
+    /// intermediary [`serde_json::Value`]. Reusing the same `output` between calls
+    /// avoids allocating at all.
+    pub fn eval_json(&self, input: &[u8], output: &mut Vec<u8>) -> Result<(), Error> {
+        if self.data.input_plan.has_repeated_names() {
+            let value: serde_json::Value = serde_json::from_slice(input)?;
+            let evaluated: serde_json::Value = self.eval(&value)?;
+            serde_json::to_writer(output, &evaluated)?;
+            return Ok(());
+        }
+
+        self.eval_planned(
+            |plan, symbols, visitor| {
+                layout::read_json(plan, input, symbols, visitor)
+                    .map_err(|err| Error::EncodeError(Box::new(err)))
+            },
+            PendingCall::run,
+            |plan, symbols, visitor| layout::write_json(plan, symbols, visitor, output),
+        )
+    }
+
+    /// Runs this function on each one of the input values, in parallel, and returns the
+    /// results in the same order. Rows are spread across the threads of a persistent
+    /// thread pool, each of which reuses its own encoding and decoding buffers.
+    pub fn par_eval_batch<E, D>(&self, inputs: &[E]) -> Vec<Result<D, Error>>
+    where
+        E: layout::Encode + Sync,
+        D: layout::Decode + Send,
+    {
+        let chunks = std::sync::Mutex::new(vec![]);
+        crate::pool::for_each_chunk(inputs.len(), |rows| {
+            let start = rows.start;
+            let results = rows.map(|row| self.eval(&inputs[row])).collect::<Vec<_>>();
+            chunks.lock().expect("poisoned").push((start, results));
+        });
+
+        let mut chunks = chunks.into_inner().expect("poisoned");
+        chunks.sort_unstable_by_key(|&(start, _)| start);
+        chunks
+            .into_iter()
+            .flat_map(|(_, results)| results)
+            .collect()
     }
 
     /// Runs this function on an input value and returns the the computation result or an
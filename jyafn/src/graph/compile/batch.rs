@@ -0,0 +1,726 @@
+//! Rendering of the batched entrypoint of a graph.
+//!
+//! The body of the main function of the graph is rendered only once, inside of a loop
+//! over rows: `{namespace}.batch(in, out, n, status)`. This evaluates `n` contiguous
+//! rows of input into `n` contiguous rows of output, storing the status of each row
+//! (null or an error) into `status` and returning the number of rows that failed. The
+//! single-row entrypoint is still the plain body, so that single calls, which are the
+//! most common, pay neither an extra call nor the setup of the loop.
+//!
+//! Everything in the body that does not change from row to row (the loading of
+//! externs and fixed-size stack allocations) is hoisted out of the loop, so that it is
+//! paid once per batch instead of once per row.
+//!
+//! Graphs calling resource methods that have a batched version (see
+//! [`crate::resource::RawResourceBatchMethod`]) for every row are rendered in stages
+//! instead, over chunks of rows: first, the inputs of these calls are computed for all
+//! rows of the chunk; then, each method is called once for the whole chunk; finally, the
+//! rest of the body is computed for each row, picking the outputs of the calls from
+//! where the batched calls left them. Rows failing before the calls are skipped by the
+//! rest of the stages. If a batched call fails, its rows are called again one by one,
+//! which gives each row its own error. The single-row entrypoint is never staged.
+
+use serde_derive::{Deserialize, Serialize};
+use std::collections::{HashMap, HashSet};
+
+use crate::{impl_op, op, Graph, Op, Ref, Type};
+
+fn temp(name: &str) -> qbe::Value {
+    qbe::Value::Temporary(name.to_string())
+}
+
+/// Whether instructions of this kind produce the same value every time they run and
+/// can therefore be hoisted out of the loop, provided the temporary they assign to is
+/// not assigned anything else.
+fn is_invariant(instr: &qbe::Instr) -> bool {
+    match instr {
+        qbe::Instr::Load(qbe::Type::Long, qbe::Value::Global(name)) => name.contains(".extern."),
+        qbe::Instr::Alloc4(_) | qbe::Instr::Alloc8(_) | qbe::Instr::Alloc16(_) => true,
+        _ => false,
+    }
+}
+
+/// Removes the loop-invariant statements of the body from the blocks, returning them
+/// (without duplicates) in the order in which they first appear.
+fn hoist_invariants(blocks: &mut [qbe::Block<'static>]) -> Vec<qbe::Statement<'static>> {
+    // For each temporary, the only instruction assigned to it, if there is one.
+    let mut assigned: HashMap<qbe::Value, Option<&qbe::Instr>> = HashMap::new();
+    for block in blocks.iter() {
+        for statement in &block.statements {
+            if let qbe::Statement::Assign(value, _, instr) = statement {
+                assigned
+                    .entry(value.clone())
+                    .and_modify(|only| {
+                        if *only != Some(instr) {
+                            *only = None;
+                        }
+                    })
+                    .or_insert(Some(instr));
+            }
+        }
+    }
+    let hoistable = assigned
+        .into_iter()
+        .filter(|(_, only)| only.map_or(false, is_invariant))
+        .map(|(value, _)| value)
+        .collect::<HashSet<_>>();
+
+    let mut hoisted = vec![];
+    for block in blocks.iter_mut() {
+        block.statements.retain(|statement| match statement {
+            qbe::Statement::Assign(value, _, _) if hoistable.contains(value) => {
+                if !hoisted.contains(statement) {
+                    hoisted.push(statement.clone());
+                }
+                false
+            }
+            _ => true,
+        });
+    }
+
+    hoisted
+}
+
+/// Makes the returns of a block of the body store the returned status into
+/// `%batch.row_status` and go to `label` instead.
+fn returns_to(block: &mut qbe::Block<'static>, label: &str) {
+    block.statements = std::mem::take(&mut block.statements)
+        .into_iter()
+        .flat_map(|statement| match statement {
+            qbe::Statement::Volatile(qbe::Instr::Ret(value)) => vec![
+                qbe::Statement::Assign(
+                    temp("batch.row_status"),
+                    qbe::Type::Long,
+                    qbe::Instr::Copy(value.unwrap_or(qbe::Value::Const(0))),
+                ),
+                qbe::Statement::Volatile(qbe::Instr::Jmp(label.to_string())),
+            ],
+            statement => vec![statement],
+        })
+        .collect();
+}
+
+/// Renders the batched version of the main function of the graph, `main`, whose
+/// arguments are `%in` and `%out`. Rows of input and output are `input_size` and
+/// `output_size` bytes long, respectively.
+pub(super) fn render_batch(
+    main: qbe::Function<'static>,
+    name: String,
+    input_size: u64,
+    output_size: u64,
+) -> qbe::Function<'static> {
+    let mut body = main.blocks;
+    let hoisted = hoist_invariants(&mut body);
+
+    let mut func = qbe::Function::new(
+        qbe::Linkage::public(),
+        name,
+        vec![
+            (qbe::Type::Long, temp("batch.in")),
+            (qbe::Type::Long, temp("batch.out")),
+            (qbe::Type::Long, temp("batch.n")),
+            (qbe::Type::Long, temp("batch.status")),
+        ],
+        Some(qbe::Type::Long),
+    );
+
+    func.add_block("batch.start");
+    for value in ["batch.row", "batch.failed"] {
+        func.assign_instr(
+            temp(value),
+            qbe::Type::Long,
+            qbe::Instr::Copy(qbe::Value::Const(0)),
+        );
+    }
+    for statement in hoisted {
+        func.blocks
+            .last_mut()
+            .expect("block just added")
+            .statements
+            .push(statement);
+    }
+    func.add_instr(qbe::Instr::Jmp("batch.loop".to_string()));
+
+    func.add_block("batch.loop");
+    func.assign_instr(
+        temp("batch.more"),
+        qbe::Type::Word,
+        qbe::Instr::Cmp(
+            qbe::Type::Long,
+            qbe::Cmp::Slt,
+            temp("batch.row"),
+            temp("batch.n"),
+        ),
+    );
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.more"),
+        body.first().expect("main has a start block").label.clone(),
+        "batch.end".to_string(),
+    ));
+
+    // The body, evaluating one row. Returning becomes going to the next row.
+    for (i, mut block) in body.into_iter().enumerate() {
+        if i == 0 {
+            block.statements.splice(
+                0..0,
+                [
+                    qbe::Statement::Assign(
+                        temp("in"),
+                        qbe::Type::Long,
+                        qbe::Instr::Copy(temp("batch.in")),
+                    ),
+                    qbe::Statement::Assign(
+                        temp("out"),
+                        qbe::Type::Long,
+                        qbe::Instr::Copy(temp("batch.out")),
+                    ),
+                ],
+            );
+        }
+
+        returns_to(&mut block, "batch.next");
+        func.blocks.push(block);
+    }
+
+    func.add_block("batch.next");
+    func.add_instr(qbe::Instr::Store(
+        qbe::Type::Long,
+        temp("batch.status"),
+        temp("batch.row_status"),
+    ));
+    func.assign_instr(
+        temp("batch.row_failed"),
+        qbe::Type::Long,
+        qbe::Instr::Cmp(
+            qbe::Type::Long,
+            qbe::Cmp::Ne,
+            temp("batch.row_status"),
+            qbe::Value::Const(0),
+        ),
+    );
+    for (value, step) in [
+        ("batch.failed", temp("batch.row_failed")),
+        ("batch.status", qbe::Value::Const(8)),
+        ("batch.in", qbe::Value::Const(input_size)),
+        ("batch.out", qbe::Value::Const(output_size)),
+        ("batch.row", qbe::Value::Const(1)),
+    ] {
+        func.assign_instr(
+            temp(value),
+            qbe::Type::Long,
+            qbe::Instr::Add(temp(value), step),
+        );
+    }
+    func.add_instr(qbe::Instr::Jmp("batch.loop".to_string()));
+
+    func.add_block("batch.end");
+    func.add_instr(qbe::Instr::Ret(Some(temp("batch.failed"))));
+
+    func
+}
+
+/// A call to a resource method that the staged entrypoint makes once per chunk of rows,
+/// with the batched version of the method.
+pub(super) struct StagedCall {
+    /// The extern holding the address of the resource.
+    pub resource_extern: String,
+    /// The extern holding the address of the single-row version of the method.
+    pub method_extern: String,
+    /// The extern holding the address of the batched version of the method.
+    pub batch_method_extern: String,
+    /// The number of input slots of the method, per row.
+    pub input_slots: u64,
+    /// The number of output slots of the method, per row.
+    pub output_slots: u64,
+}
+
+/// The most rows in a chunk of the staged entrypoint.
+const MAX_CHUNK_ROWS: u64 = 64;
+
+/// The fewest rows in a chunk of the staged entrypoint worth staging for.
+const MIN_CHUNK_ROWS: u64 = 8;
+
+/// The most stack the staged entrypoint may use to hold the inputs and the outputs of
+/// the calls of a chunk.
+const MAX_SCRATCH_SIZE: u64 = 64 * 1024;
+
+/// The number of rows in each chunk of the staged entrypoint making the given calls, or
+/// `None` if the inputs and outputs of the calls are too big to stage enough rows.
+pub(super) fn chunk_rows(calls: &[StagedCall]) -> Option<u64> {
+    let row_size = calls
+        .iter()
+        .map(|call| 8 * (call.input_slots + call.output_slots))
+        .sum::<u64>();
+    let rows = MAX_SCRATCH_SIZE
+        .checked_div(row_size)
+        .unwrap_or(MAX_CHUNK_ROWS)
+        .min(MAX_CHUNK_ROWS);
+    (rows >= MIN_CHUNK_ROWS).then_some(rows)
+}
+
+/// Where the inputs of the `call`-th staged call have to be stored for the current row.
+pub(super) fn call_input_row(call: usize) -> qbe::Value {
+    temp(&format!("batch.call{call}.in.row"))
+}
+
+/// Where the outputs of the `call`-th staged call are for the current row.
+fn call_output_row(call: usize) -> qbe::Value {
+    temp(&format!("batch.call{call}.out.row"))
+}
+
+/// Stands for the `call`-th staged call when rendering the stage after the calls: the
+/// outputs of the call were already computed for the whole chunk.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub(super) struct StagedCallOutput {
+    pub call: usize,
+}
+
+#[typetag::serde]
+impl Op for StagedCallOutput {
+    impl_op! {}
+
+    fn annotate(&mut self, self_id: usize, _: &Graph, _: &[Type]) -> Option<Type> {
+        Some(Type::Ptr { origin: self_id })
+    }
+
+    fn render_into(
+        &self,
+        _: &Graph,
+        output: qbe::Value,
+        _: &[Ref],
+        func: &mut qbe::Function,
+        _: &str,
+    ) {
+        func.assign_instr(
+            output,
+            qbe::Type::Long,
+            qbe::Instr::Copy(call_output_row(self.call)),
+        );
+    }
+}
+
+/// Prefixes all labels of the body, so that many bodies can live in the same function.
+fn prefix_labels(blocks: &mut [qbe::Block<'static>], prefix: &str) {
+    for block in blocks {
+        block.label = format!("{prefix}{}", block.label);
+        for statement in &mut block.statements {
+            match statement {
+                qbe::Statement::Volatile(qbe::Instr::Jnz(_, if_true, if_false)) => {
+                    *if_true = format!("{prefix}{if_true}");
+                    *if_false = format!("{prefix}{if_false}");
+                }
+                qbe::Statement::Volatile(qbe::Instr::Jmp(label)) => {
+                    *label = format!("{prefix}{label}");
+                }
+                _ => {}
+            }
+        }
+    }
+}
+
+/// Renders `%name = base + %batch.crow * stride`, the address of the current row of the
+/// chunk in a buffer of rows `stride` bytes long.
+fn render_row_address(
+    func: &mut qbe::Function<'static>,
+    name: qbe::Value,
+    base: qbe::Value,
+    stride: u64,
+) {
+    func.assign_instr(
+        name.clone(),
+        qbe::Type::Long,
+        qbe::Instr::Mul(temp("batch.crow"), qbe::Value::Const(stride)),
+    );
+    func.assign_instr(name.clone(), qbe::Type::Long, qbe::Instr::Add(base, name));
+}
+
+/// Renders the loop over the rows of the current chunk, from `label`. Each row starts
+/// at `{label}.row`. If `skip_failed` is set, rows that already have a status go to
+/// `{label}.skip`, instead. Rows end by going to `{label}.next` and the loop ends by
+/// going to `end`.
+fn render_row_loop(func: &mut qbe::Function<'static>, label: &str, end: &str, skip_failed: bool) {
+    func.add_block(label);
+    func.assign_instr(
+        temp("batch.crow"),
+        qbe::Type::Long,
+        qbe::Instr::Copy(qbe::Value::Const(0)),
+    );
+    func.assign_instr(
+        temp("batch.cstatus"),
+        qbe::Type::Long,
+        qbe::Instr::Copy(temp("batch.status")),
+    );
+    func.add_instr(qbe::Instr::Jmp(format!("{label}.loop")));
+
+    func.add_block(format!("{label}.loop"));
+    func.assign_instr(
+        temp("batch.more"),
+        qbe::Type::Word,
+        qbe::Instr::Cmp(
+            qbe::Type::Long,
+            qbe::Cmp::Slt,
+            temp("batch.crow"),
+            temp("batch.size"),
+        ),
+    );
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.more"),
+        format!("{label}.{}", if skip_failed { "test" } else { "row" }),
+        end.to_string(),
+    ));
+    if !skip_failed {
+        return;
+    }
+
+    func.add_block(format!("{label}.test"));
+    func.assign_instr(
+        temp("batch.row_status"),
+        qbe::Type::Long,
+        qbe::Instr::Load(qbe::Type::Long, temp("batch.cstatus")),
+    );
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.row_status"),
+        format!("{label}.skip"),
+        format!("{label}.row"),
+    ));
+}
+
+/// Renders the end of a row of the loop rendered by [`render_row_loop`].
+fn render_row_next(func: &mut qbe::Function<'static>, label: &str) {
+    func.assign_instr(
+        temp("batch.cstatus"),
+        qbe::Type::Long,
+        qbe::Instr::Add(temp("batch.cstatus"), qbe::Value::Const(8)),
+    );
+    func.assign_instr(
+        temp("batch.crow"),
+        qbe::Type::Long,
+        qbe::Instr::Add(temp("batch.crow"), qbe::Value::Const(1)),
+    );
+    func.add_instr(qbe::Instr::Jmp(format!("{label}.loop")));
+}
+
+/// Renders the staged version of the batched entrypoint (see the module
+/// documentation), making the given calls. The body `pre`, whose arguments are `%in`
+/// and `%out`, computes the inputs of the calls and stores them at
+/// [`call_input_row`]. The body `post` computes the outputs of the graph, where the calls
+/// are [`StagedCallOutput`]s. Rows of input and output are `input_size` and
+/// `output_size` bytes long, respectively. Chunks are `chunk` rows long (see
+/// [`chunk_rows`]).
+pub(super) fn render_staged_batch(
+    pre: qbe::Function<'static>,
+    post: qbe::Function<'static>,
+    calls: &[StagedCall],
+    chunk: u64,
+    name: String,
+    input_size: u64,
+    output_size: u64,
+) -> qbe::Function<'static> {
+    let mut pre = pre.blocks;
+    let mut post = post.blocks;
+    prefix_labels(&mut pre, "pre.body.");
+    prefix_labels(&mut post, "post.body.");
+    let pre_start = pre.first().expect("pre has a start block").label.clone();
+    let post_start = post.first().expect("post has a start block").label.clone();
+
+    // Both bodies are hoisted together, since they may render the same nodes.
+    let n_pre = pre.len();
+    let mut bodies = pre;
+    bodies.extend(post);
+    let hoisted = hoist_invariants(&mut bodies);
+    let post = bodies.split_off(n_pre);
+    let pre = bodies;
+
+    let mut func = qbe::Function::new(
+        qbe::Linkage::public(),
+        name,
+        vec![
+            (qbe::Type::Long, temp("batch.in")),
+            (qbe::Type::Long, temp("batch.out")),
+            (qbe::Type::Long, temp("batch.n")),
+            (qbe::Type::Long, temp("batch.status")),
+        ],
+        Some(qbe::Type::Long),
+    );
+
+    func.add_block("batch.start");
+    for value in ["batch.row", "batch.failed"] {
+        func.assign_instr(
+            temp(value),
+            qbe::Type::Long,
+            qbe::Instr::Copy(qbe::Value::Const(0)),
+        );
+    }
+    for (k, call) in calls.iter().enumerate() {
+        for (buffer, slots) in [("in", call.input_slots), ("out", call.output_slots)] {
+            func.assign_instr(
+                temp(&format!("batch.call{k}.{buffer}")),
+                qbe::Type::Long,
+                qbe::Instr::Alloc8(chunk * slots.max(1) * 8),
+            );
+        }
+    }
+    for statement in hoisted {
+        func.blocks
+            .last_mut()
+            .expect("block just added")
+            .statements
+            .push(statement);
+    }
+    func.add_instr(qbe::Instr::Jmp("batch.chunk".to_string()));
+
+    // The chunk starting at `%batch.row` is `%batch.size` rows long.
+    func.add_block("batch.chunk");
+    func.assign_instr(
+        temp("batch.more"),
+        qbe::Type::Word,
+        qbe::Instr::Cmp(
+            qbe::Type::Long,
+            qbe::Cmp::Slt,
+            temp("batch.row"),
+            temp("batch.n"),
+        ),
+    );
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.more"),
+        "batch.chunk.size".to_string(),
+        "batch.end".to_string(),
+    ));
+
+    func.add_block("batch.chunk.size");
+    func.assign_instr(
+        temp("batch.size"),
+        qbe::Type::Long,
+        qbe::Instr::Sub(temp("batch.n"), temp("batch.row")),
+    );
+    func.assign_instr(
+        temp("batch.last"),
+        qbe::Type::Word,
+        qbe::Instr::Cmp(
+            qbe::Type::Long,
+            qbe::Cmp::Sle,
+            temp("batch.size"),
+            qbe::Value::Const(chunk),
+        ),
+    );
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.last"),
+        "pre".to_string(),
+        "batch.chunk.full".to_string(),
+    ));
+    func.add_block("batch.chunk.full");
+    func.assign_instr(
+        temp("batch.size"),
+        qbe::Type::Long,
+        qbe::Instr::Copy(qbe::Value::Const(chunk)),
+    );
+    func.add_instr(qbe::Instr::Jmp("pre".to_string()));
+
+    // First stage: the inputs of the calls. This gives each row of the chunk its
+    // status.
+    render_row_loop(&mut func, "pre", "call0", false);
+    func.add_block("pre.row");
+    render_row_address(&mut func, temp("in"), temp("batch.in"), input_size);
+    for (k, call) in calls.iter().enumerate() {
+        render_row_address(
+            &mut func,
+            call_input_row(k),
+            temp(&format!("batch.call{k}.in")),
+            call.input_slots * 8,
+        );
+    }
+    func.add_instr(qbe::Instr::Jmp(pre_start));
+    for mut block in pre {
+        returns_to(&mut block, "pre.store");
+        func.blocks.push(block);
+    }
+    func.add_block("pre.store");
+    func.add_instr(qbe::Instr::Store(
+        qbe::Type::Long,
+        temp("batch.cstatus"),
+        temp("batch.row_status"),
+    ));
+    func.add_instr(qbe::Instr::Jmp("pre.next".to_string()));
+    func.add_block("pre.next");
+    render_row_next(&mut func, "pre");
+
+    // Second stage: the calls, once for the whole chunk if nothing fails.
+    for (k, call) in calls.iter().enumerate() {
+        let label = format!("call{k}");
+        let next = if k + 1 < calls.len() {
+            format!("call{}", k + 1)
+        } else {
+            "post".to_string()
+        };
+        let input = temp(&format!("batch.call{k}.in"));
+        let output = temp(&format!("batch.call{k}.out"));
+        let resource = temp(&format!("batch.call{k}.resource"));
+        let method = temp(&format!("batch.call{k}.method"));
+        let batch_method = temp(&format!("batch.call{k}.batch_method"));
+        let call_status = temp(&format!("batch.call{k}.status"));
+
+        func.add_block(label.clone());
+        op::render_load_extern(&mut func, resource.clone(), &call.resource_extern);
+        func.assign_instr(
+            temp("batch.single"),
+            qbe::Type::Word,
+            qbe::Instr::Cmp(
+                qbe::Type::Long,
+                qbe::Cmp::Eq,
+                temp("batch.size"),
+                qbe::Value::Const(1),
+            ),
+        );
+        func.add_instr(qbe::Instr::Jnz(
+            temp("batch.single"),
+            format!("{label}.rows"),
+            format!("{label}.batch"),
+        ));
+
+        func.add_block(format!("{label}.batch"));
+        op::render_load_extern(&mut func, batch_method.clone(), &call.batch_method_extern);
+        func.assign_instr(
+            call_status.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Call(
+                batch_method,
+                vec![
+                    (qbe::Type::Long, resource.clone()),
+                    (qbe::Type::Long, input.clone()),
+                    (qbe::Type::Long, qbe::Value::Const(call.input_slots)),
+                    (qbe::Type::Long, output.clone()),
+                    (qbe::Type::Long, qbe::Value::Const(call.output_slots)),
+                    (qbe::Type::Long, temp("batch.size")),
+                ],
+            ),
+        );
+        func.add_instr(qbe::Instr::Jnz(
+            call_status.clone(),
+            format!("{label}.rows"),
+            next.clone(),
+        ));
+
+        // One by one, for the errors.
+        render_row_loop(&mut func, &format!("{label}.rows"), &next, true);
+        func.add_block(format!("{label}.rows.skip"));
+        func.add_instr(qbe::Instr::Jmp(format!("{label}.rows.next")));
+        func.add_block(format!("{label}.rows.row"));
+        let input_row = temp(&format!("batch.call{k}.in.row"));
+        let output_row = temp(&format!("batch.call{k}.out.row"));
+        render_row_address(&mut func, input_row.clone(), input, call.input_slots * 8);
+        render_row_address(&mut func, output_row.clone(), output, call.output_slots * 8);
+        op::render_load_extern(&mut func, method.clone(), &call.method_extern);
+        func.assign_instr(
+            call_status.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Call(
+                method,
+                vec![
+                    (qbe::Type::Long, resource),
+                    (qbe::Type::Long, input_row),
+                    (qbe::Type::Long, qbe::Value::Const(call.input_slots)),
+                    (qbe::Type::Long, output_row),
+                    (qbe::Type::Long, qbe::Value::Const(call.output_slots)),
+                ],
+            ),
+        );
+        func.add_instr(qbe::Instr::Jnz(
+            call_status.clone(),
+            format!("{label}.rows.raise"),
+            format!("{label}.rows.next"),
+        ));
+
+        func.add_block(format!("{label}.rows.raise"));
+        let make_allocated = temp("batch.make_allocated");
+        op::render_load_extern(
+            &mut func,
+            make_allocated.clone(),
+            op::MAKE_ALLOCATED_ERROR_EXTERN,
+        );
+        func.assign_instr(
+            temp("batch.row_status"),
+            qbe::Type::Long,
+            qbe::Instr::Call(make_allocated, vec![(qbe::Type::Long, call_status)]),
+        );
+        func.add_instr(qbe::Instr::Store(
+            qbe::Type::Long,
+            temp("batch.cstatus"),
+            temp("batch.row_status"),
+        ));
+        func.add_instr(qbe::Instr::Jmp(format!("{label}.rows.next")));
+
+        func.add_block(format!("{label}.rows.next"));
+        render_row_next(&mut func, &format!("{label}.rows"));
+    }
+
+    // Third stage: the outputs, out of the outputs of the calls.
+    render_row_loop(&mut func, "post", "batch.chunk.next", true);
+    func.add_block("post.skip");
+    func.add_instr(qbe::Instr::Jmp("post.failed".to_string()));
+    func.add_block("post.row");
+    render_row_address(&mut func, temp("in"), temp("batch.in"), input_size);
+    render_row_address(&mut func, temp("out"), temp("batch.out"), output_size);
+    for (k, call) in calls.iter().enumerate() {
+        render_row_address(
+            &mut func,
+            call_output_row(k),
+            temp(&format!("batch.call{k}.out")),
+            call.output_slots * 8,
+        );
+    }
+    func.add_instr(qbe::Instr::Jmp(post_start));
+    for mut block in post {
+        returns_to(&mut block, "post.store");
+        func.blocks.push(block);
+    }
+    func.add_block("post.store");
+    func.add_instr(qbe::Instr::Store(
+        qbe::Type::Long,
+        temp("batch.cstatus"),
+        temp("batch.row_status"),
+    ));
+    func.add_instr(qbe::Instr::Jnz(
+        temp("batch.row_status"),
+        "post.failed".to_string(),
+        "post.next".to_string(),
+    ));
+    func.add_block("post.failed");
+    func.assign_instr(
+        temp("batch.failed"),
+        qbe::Type::Long,
+        qbe::Instr::Add(temp("batch.failed"), qbe::Value::Const(1)),
+    );
+    func.add_instr(qbe::Instr::Jmp("post.next".to_string()));
+    func.add_block("post.next");
+    render_row_next(&mut func, "post");
+
+    // On to the next chunk.
+    func.add_block("batch.chunk.next");
+    for (value, step) in [
+        ("batch.in", input_size),
+        ("batch.out", output_size),
+        ("batch.status", 8),
+    ] {
+        func.assign_instr(
+            temp("batch.step"),
+            qbe::Type::Long,
+            qbe::Instr::Mul(temp("batch.size"), qbe::Value::Const(step)),
+        );
+        func.assign_instr(
+            temp(value),
+            qbe::Type::Long,
+            qbe::Instr::Add(temp(value), temp("batch.step")),
+        );
+    }
+    func.assign_instr(
+        temp("batch.row"),
+        qbe::Type::Long,
+        qbe::Instr::Add(temp("batch.row"), temp("batch.size")),
+    );
+    func.add_instr(qbe::Instr::Jmp("batch.chunk".to_string()));
+
+    func.add_block("batch.end");
+    func.add_instr(qbe::Instr::Ret(Some(temp("batch.failed"))));
+
+    func
+}
@@ -0,0 +1,112 @@
+//! Bindings to the vendored QBE, which the build script compiles as a static library
+//! (`libqbe.a`). All of QBE's compilation state lives in thread-local storage in this
+//! build, so different threads can compile at the same time.
+
+use std::ffi::{c_char, c_int};
+use std::ptr;
+
+use crate::Error;
+
+extern "C" {
+    fn qbe_compile(
+        target: *const c_char,
+        unit: c_int,
+        ir: *const c_char,
+        ir_len: usize,
+        out: *mut *mut c_char,
+        out_len: *mut usize,
+    ) -> c_int;
+    fn qbe_free(ptr: *mut c_char);
+}
+
+/// Compiles QBE IR into assembly for the current machine, entirely in memory.
+pub fn compile(ir: &str) -> Result<String, Error> {
+    compile_as(ir, -1)
+}
+
+/// Same as [`compile`], but for one of many units of a module. The local labels of the
+/// assembly are prefixed by the unit, so that the assembly of all units can be put
+/// together into a single file.
+pub fn compile_unit(ir: &str, unit: usize) -> Result<String, Error> {
+    compile_as(ir, unit as c_int)
+}
+
+fn compile_as(ir: &str, unit: c_int) -> Result<String, Error> {
+    let mut out = ptr::null_mut();
+    let mut out_len = 0;
+    let status = unsafe {
+        qbe_compile(
+            ptr::null(),
+            unit,
+            ir.as_ptr() as *const c_char,
+            ir.len(),
+            &mut out,
+            &mut out_len,
+        )
+    };
+
+    let output = if out.is_null() {
+        "qbe could not allocate its output".to_string()
+    } else {
+        let output = unsafe { std::slice::from_raw_parts(out as *const u8, out_len) };
+        let output = String::from_utf8_lossy(output).into_owned();
+        unsafe { qbe_free(out) };
+        output
+    };
+
+    if status == 0 && !out.is_null() {
+        Ok(output)
+    } else {
+        Err(Error::Qbe {
+            status,
+            err: output,
+        })
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    const IR: &str = "export function l $run(l %in, l %out) {\n\
+        @start\n\
+            %x =d loadd %in\n\
+            %y =d add %x, d_1\n\
+            stored %y, %out\n\
+            ret 0\n\
+        }\n";
+
+    #[test]
+    fn test_compile() {
+        let assembly = compile(IR).unwrap();
+        assert!(assembly.contains("run"));
+        assert_eq!(assembly, compile(IR).unwrap());
+    }
+
+    #[test]
+    fn test_compile_unit() {
+        // The constant `d_1` lives under a local label:
+        assert!(compile_unit(IR, 3).unwrap().contains("u3_fp"));
+        assert!(!compile(IR).unwrap().contains("u3_"));
+    }
+
+    #[test]
+    fn test_compile_error() {
+        let err = compile("function $run( {").unwrap_err();
+        assert!(matches!(err, Error::Qbe { status: 1, .. }));
+    }
+
+    #[test]
+    fn test_compile_threads() {
+        let expected = compile(IR).unwrap();
+        let handles = (0..8)
+            .map(|_| std::thread::spawn(|| (0..20).map(|_| compile(IR).unwrap()).collect()))
+            .collect::<Vec<std::thread::JoinHandle<Vec<String>>>>();
+
+        for handle in handles {
+            for assembly in handle.join().unwrap() {
+                assert_eq!(assembly, expected);
+            }
+        }
+    }
+}
@@ -1,26 +1,159 @@
+mod batch;
+mod libqbe;
 mod optimize;
-mod qbe_app;
+mod profile;
+mod stats;
 
 use std::{
+    collections::BTreeMap,
     io::Write,
     process::{Command, Stdio},
+    time::Instant,
 };
+#[cfg(target_os = "macos")]
 use tempfile::NamedTempFile;
 
-use crate::Function;
+use crate::image::Image;
+use crate::profile::SiteKind;
+use crate::{cache, pfunc, FnError, Function};
+
+use self::profile::Profiler;
+use self::stats::elapsed_ms;
 
-use super::{Error, Graph, Node, SLOT_SIZE};
+pub use self::stats::{CodeSource, CompileStats, PassStats};
+
+use super::{mapping, op, Arc, Error, Graph, Node, Ref, SLOT_SIZE};
 
 impl Graph {
     /// Renders this graph as a QBE module. This fails if the graph contains illegal
     /// operations that cannot be optimized away (e.g., unconditional errors).
     pub fn render(&self) -> Result<qbe::Module<'static>, Error> {
+        let (module, _) = self.render_with_externs(&mut CompileStats::default())?;
+        Ok(module)
+    }
+
+    /// Renders this graph as a QBE module, together with the externs the module
+    /// declares and the addresses they must be filled in with once the code is loaded.
+    /// The optimization passes and the rendering are recorded in `stats`.
+    fn render_with_externs(
+        &self,
+        stats: &mut CompileStats,
+    ) -> Result<(qbe::Module<'static>, Externs), Error> {
+        self.render_with_externs_profiled(None, stats)
+    }
+
+    /// Same as [`Graph::render_with_externs`], but instruments the main function with
+    /// the given profiler, if any (see [`crate::profile`]).
+    fn render_with_externs_profiled(
+        &self,
+        mut profiler: Option<&mut Profiler>,
+        stats: &mut CompileStats,
+    ) -> Result<(qbe::Module<'static>, Externs), Error> {
+        self.check_not_stripped()?;
         let mut module = qbe::Module::new();
         let mut graph = self.clone();
-        graph.do_check_optimize()?;
-        graph.do_render(&mut module, "run");
+        graph.do_check_optimize(stats)?;
+        let start = Instant::now();
+        graph.do_render(&mut module, "run", true, profiler.as_deref_mut());
+
+        let mut externs = Externs::new();
+        graph.collect_externs(&mut externs, "run");
+        if let Some(profiler) = profiler {
+            externs.insert(
+                crate::profile::NOW_EXTERN.to_string(),
+                crate::profile::now as usize,
+            );
+            module.add_data(profiler.render_counters());
+        }
+        for name in externs.keys() {
+            module.add_data(qbe::DataDef::new(
+                qbe::Linkage::public(),
+                name.clone(),
+                Some(8),
+                vec![(qbe::Type::Long, qbe::DataItem::Const(0))],
+            ));
+        }
+        stats.render_ms = elapsed_ms(start);
 
-        Ok(module)
+        Ok((module, externs))
+    }
+
+    /// Collects the externs referenced by the code rendered for this graph (and its
+    /// subgraphs) under `namespace`. This has to mirror what the `render_into` of
+    /// each operation and [`mapping::Mapping::render`] reference.
+    fn collect_externs(&self, externs: &mut Externs, namespace: &str) {
+        externs.insert(
+            op::MAKE_STATIC_ERROR_EXTERN.to_string(),
+            FnError::make_static as usize,
+        );
+        externs.insert(
+            op::MAKE_ALLOCATED_ERROR_EXTERN.to_string(),
+            FnError::make_allocated as usize,
+        );
+
+        if !self.mappings.is_empty() {
+            for (name, address) in mapping::Mapping::static_externs() {
+                externs.insert(name.to_string(), address);
+            }
+        }
+
+        for (name, mapping) in &self.mappings {
+            externs.insert(
+                mapping_extern(namespace, name),
+                Arc::as_ptr(mapping) as usize,
+            );
+        }
+
+        for node in &self.nodes {
+            if let Some(op::Call(name)) = node.op.downcast_ref::<op::Call>() {
+                if let Some(pfunc) = pfunc::get(name) {
+                    externs.insert(op::pfunc_extern(name), pfunc.location());
+                }
+            } else if let Some(call) = node.op.downcast_ref::<op::CallResource>() {
+                let Some(resource) = self.resources.get(&call.name) else {
+                    continue;
+                };
+                externs.insert(
+                    op::resource_extern(namespace, &call.name),
+                    resource.get_raw_ptr() as usize,
+                );
+                if let Some(method) = resource.get_method(&call.method) {
+                    externs.insert(
+                        op::resource_method_extern(namespace, &call.name, &call.method),
+                        method.fn_ptr.0 as usize,
+                    );
+                    if let Some(batch_fn_ptr) = method.batch_fn_ptr {
+                        externs.insert(
+                            op::resource_batch_method_extern(namespace, &call.name, &call.method),
+                            batch_fn_ptr.0 as usize,
+                        );
+                    }
+                }
+            }
+        }
+
+        for (i, subgraph) in self.subgraphs.iter().enumerate() {
+            subgraph.collect_externs(externs, &format!("{namespace}.graph.{i}"));
+        }
+    }
+
+    /// Collects the mappings that the code rendered for this graph can call: those of
+    /// the nodes reachable from the outputs, here and in the subgraphs that these nodes
+    /// call. Mappings that are only used by unreachable nodes are left out.
+    pub(crate) fn collect_called_mappings<'a>(&'a self, called: &mut Vec<&'a mapping::Mapping>) {
+        let reachable = optimize::find_reachable(&self.outputs, &self.nodes);
+        let mut subgraphs = vec![false; self.subgraphs.len()];
+        for (node, _) in self.nodes.iter().zip(reachable).filter(|&(_, is)| is) {
+            if let Some(call) = node.op.downcast_ref::<op::CallMapping>() {
+                called.extend(self.mappings.get(&call.name).map(|mapping| &**mapping));
+            } else if let Some(&op::CallGraph(id)) = node.op.downcast_ref::<op::CallGraph>() {
+                subgraphs[id] = true;
+            }
+        }
+
+        for (subgraph, _) in self.subgraphs.iter().zip(subgraphs).filter(|&(_, is)| is) {
+            subgraph.collect_called_mappings(called);
+        }
     }
 
     /// Finds illegal instructions in graphs.
@@ -34,16 +167,48 @@ impl Graph {
     /// in this order:
     /// 1. Constant evaluation: things like `1 * x` or `2 + 2`, which we already know the
     ///    result beforehand.
-    /// 2. Reachability eliminations: remove nodes that will never be computed.
-    /// 3. Finds illegal instructions that remain: thigs that are not allowed, such as
+    /// 2. Algebraic simplification: things like `x * 2` or `(x + 1) + 2`, which can be
+    ///    computed more cheaply.
+    /// 3. Common subexpression elimination: the same operation on the same arguments is
+    ///    only computed once.
+    /// 4. Vectorization: lists computed element-wise out of other lists become packed
+    ///    vector operations.
+    /// 5. Reachability eliminations: remove nodes that will never be computed.
+    /// 6. Finds illegal instructions that remain: thigs that are not allowed, such as
     ///    unconditionally failing assertions.
-    fn do_check_optimize(&mut self) -> Result<(), Error> {
+    ///
+    /// Each pass is recorded in `stats`.
+    fn do_check_optimize(&mut self, stats: &mut CompileStats) -> Result<(), Error> {
+        stats.nodes = self.nodes.len();
+
+        // Inlining (needs to be before everything else, so that the other optimizations
+        // see through the calls to small subgraphs):
+        stats.time_pass("inline", self, optimize::inline_subgraphs);
+
         // Constant evaluation:
-        optimize::const_eval(self);
+        stats.time_pass("const_eval", self, optimize::const_eval);
+
+        // Simplification (needs to be after const eval, so that all constants are
+        // already folded):
+        stats.time_pass("simplify", self, optimize::simplify);
+
+        // Common subexpressions (needs to be after const eval, which may make different
+        // expressions the same, and before reachability, which removes the duplicates):
+        stats.time_pass("eliminate_common", self, optimize::eliminate_common);
+
+        // Vectorization (needs to be after const eval and before reachability, which
+        // gets rid of the scalar operations that were vectorized):
+        stats.time_pass("vectorize", self, optimize::vectorize);
+
+        // Sorted index-ofs (needs to be after const eval, so that lists of constants are
+        // known, and before reachability, which gets rid of the lists not used anymore):
+        stats.time_pass("sort_index_ofs", self, optimize::sort_index_ofs);
 
         // Reachability (needs to be after const eval):
-        let reachable = optimize::find_reachable(&self.outputs, &self.nodes);
-        optimize::remap_reachable(self, &reachable);
+        stats.time_pass("reachability", self, |graph| {
+            let reachable = optimize::find_reachable(&graph.outputs, &graph.nodes);
+            optimize::remap_reachable(graph, &reachable);
+        });
 
         // Find illegal (needs to be after reachability):
         if let Some(node) = self.find_illegal() {
@@ -53,17 +218,26 @@ impl Graph {
         Ok(())
     }
 
-    fn do_render(&self, module: &mut qbe::Module<'static>, namespace: &str) {
-        // Rendering main:
-        let main = module.add_function(qbe::Function::new(
+    /// Renders the function `name(in, out)`, which loads the inputs out of `%in` and
+    /// then computes the given statements. What is left to do (storing the outputs and
+    /// returning) is up to the caller. If a profiler is given, the statements are
+    /// instrumented.
+    fn render_body(
+        &self,
+        name: String,
+        statements: optimize::Statements,
+        namespace: &str,
+        mut profiler: Option<&mut Profiler>,
+    ) -> qbe::Function<'static> {
+        let mut main = qbe::Function::new(
             qbe::Linkage::public(),
-            namespace.to_string(),
+            name,
             vec![
                 (qbe::Type::Long, qbe::Value::Temporary("in".to_string())),
                 (qbe::Type::Long, qbe::Value::Temporary("out".to_string())),
             ],
             Some(qbe::Type::Long),
-        ));
+        );
         main.add_block("start".to_string());
 
         for (id, input) in self.inputs.iter().enumerate() {
@@ -92,15 +266,26 @@ impl Graph {
         // }
 
         // optimize::Statements::build(&self.nodes).render_into(self, &reachable, main, namespace);
-        optimize::Statements::build(&self.nodes).render_into(self, main, namespace);
+        let site = profiler
+            .as_deref_mut()
+            .map(|profiler| profiler.render_start(&mut main, SiteKind::Function, None, self));
+        statements.render_into(self, &mut main, namespace, profiler.as_deref_mut());
+        if let (Some(profiler), Some(site)) = (profiler, site) {
+            profiler.render_stop(&mut main, site, None);
+        }
+
+        main
+    }
 
-        for output in &self.outputs {
-            main.add_instr(qbe::Instr::Store(
-                self.type_of(*output).render(),
+    /// Renders the stores of `values`, one after the other, from `%out` on.
+    fn render_stores(&self, func: &mut qbe::Function<'static>, values: &[Ref]) {
+        for value in values {
+            func.add_instr(qbe::Instr::Store(
+                self.type_of(*value).render(),
                 qbe::Value::Temporary("out".to_string()),
-                output.render(),
+                value.render(),
             ));
-            main.assign_instr(
+            func.assign_instr(
                 qbe::Value::Temporary("out".to_string()),
                 qbe::Type::Long,
                 qbe::Instr::Add(
@@ -109,9 +294,170 @@ impl Graph {
                 ),
             );
         }
+    }
+
+    /// Renders the staged version of the batched entrypoint (see [`batch`]), if this
+    /// graph calls resource methods having a batched version for every row. These
+    /// calls are staged only if their arguments do not depend on other staged calls.
+    fn render_staged_batch(
+        &self,
+        namespace: &str,
+        name: String,
+        input_size: u64,
+        output_size: u64,
+    ) -> Option<qbe::Function<'static>> {
+        let unconditional = optimize::find_unconditional(&self.nodes, &self.outputs);
+        // Whether the node is (or depends on) a staged call.
+        let mut is_staged = vec![false; self.nodes.len()];
+        let mut staged = vec![];
+        let mut calls = vec![];
+
+        for (node_id, node) in self.nodes.iter().enumerate() {
+            is_staged[node_id] = node
+                .args
+                .iter()
+                .any(|arg| matches!(*arg, Ref::Node(arg_id) if is_staged[arg_id]));
+            if is_staged[node_id] || !unconditional[node_id] {
+                continue;
+            }
+            let Some(call) = node.op.downcast_ref::<op::CallResource>() else {
+                continue;
+            };
+            let Some(method) = self
+                .resources
+                .get(&call.name)
+                .and_then(|resource| resource.get_method(&call.method))
+            else {
+                continue;
+            };
+            if method.batch_fn_ptr.is_none() {
+                continue;
+            }
+
+            is_staged[node_id] = true;
+            staged.push(node_id);
+            calls.push(batch::StagedCall {
+                resource_extern: op::resource_extern(namespace, &call.name),
+                method_extern: op::resource_method_extern(namespace, &call.name, &call.method),
+                batch_method_extern: op::resource_batch_method_extern(
+                    namespace,
+                    &call.name,
+                    &call.method,
+                ),
+                input_slots: method.input_layout.slots().len() as u64,
+                output_slots: method.output_layout.slots().len() as u64,
+            });
+        }
+
+        if calls.is_empty() {
+            return None;
+        }
+        let chunk = batch::chunk_rows(&calls)?;
+
+        // Before the calls: their arguments and whatever must be used that does not
+        // depend on them (e.g., asserts on the input), so that failing rows fail early.
+        let args = staged
+            .iter()
+            .flat_map(|&node_id| self.nodes[node_id].args.iter().copied())
+            .collect::<Vec<_>>();
+        let pre_reachable = optimize::find_closure(
+            args.iter()
+                .filter_map(|arg| match *arg {
+                    Ref::Node(arg_id) => Some(arg_id),
+                    _ => None,
+                })
+                .chain(
+                    self.nodes
+                        .iter()
+                        .enumerate()
+                        .filter(|&(node_id, node)| node.op.must_use() && !is_staged[node_id])
+                        .map(|(node_id, _)| node_id),
+                ),
+            &self.nodes,
+        );
+        let mut pre = self.render_body(
+            namespace.to_string(),
+            optimize::Statements::build_reachable(&self.nodes, &args, &pre_reachable),
+            namespace,
+            None,
+        );
+        for (call, &node_id) in staged.iter().enumerate() {
+            pre.assign_instr(
+                qbe::Value::Temporary("out".to_string()),
+                qbe::Type::Long,
+                qbe::Instr::Copy(batch::call_input_row(call)),
+            );
+            self.render_stores(&mut pre, &self.nodes[node_id].args);
+        }
+        pre.add_instr(qbe::Instr::Ret(Some(qbe::Value::Const(0))));
+
+        // After the calls: everything else, with the calls already made.
+        let mut after = self.clone();
+        for (call, &node_id) in staged.iter().enumerate() {
+            let node = &mut after.nodes[node_id];
+            node.op = Box::new(batch::StagedCallOutput { call });
+            node.args.clear();
+        }
+        let post_reachable = optimize::find_reachable(&after.outputs, &after.nodes);
+        let mut post = after.render_body(
+            namespace.to_string(),
+            optimize::Statements::build_reachable(&after.nodes, &after.outputs, &post_reachable),
+            namespace,
+            None,
+        );
+        after.render_stores(&mut post, &after.outputs);
+        post.add_instr(qbe::Instr::Ret(Some(qbe::Value::Const(0))));
+
+        Some(batch::render_staged_batch(
+            pre,
+            post,
+            &calls,
+            chunk,
+            name,
+            input_size,
+            output_size,
+        ))
+    }
 
+    /// Renders this graph into the module, under the given namespace. If `batched` is
+    /// set, the main function is rendered as a loop over rows (see [`batch`]). If a
+    /// profiler is given, the main function is instrumented and never staged, so that
+    /// each call is measured where it would happen for a single row.
+    fn do_render(
+        &self,
+        module: &mut qbe::Module<'static>,
+        namespace: &str,
+        batched: bool,
+        profiler: Option<&mut Profiler>,
+    ) {
+        let is_profiled = profiler.is_some();
+
+        // Rendering main:
+        let mut main = self.render_body(
+            namespace.to_string(),
+            optimize::Statements::build(&self.nodes, &self.outputs),
+            namespace,
+            profiler,
+        );
+        self.render_stores(&mut main, &self.outputs);
         main.add_instr(qbe::Instr::Ret(Some(qbe::Value::Const(0))));
 
+        if batched {
+            let batch_name = format!("{namespace}.batch");
+            let input_size = (self.inputs.len() * SLOT_SIZE.in_bytes()) as u64;
+            let output_size = (self.outputs.len() * SLOT_SIZE.in_bytes()) as u64;
+            let staged = (!is_profiled)
+                .then(|| {
+                    self.render_staged_batch(namespace, batch_name.clone(), input_size, output_size)
+                })
+                .flatten();
+            let batch = staged.unwrap_or_else(|| {
+                batch::render_batch(main.clone(), batch_name, input_size, output_size)
+            });
+            module.add_function(batch);
+        }
+        module.add_function(main);
+
         // Render error messages:
         for (error_id, error) in self.errors.iter().enumerate() {
             module.add_data(qbe::DataDef::new(
@@ -125,14 +471,36 @@ impl Graph {
             ));
         }
 
-        // Rendering mapping access functions:
-        for (name, mapping) in &self.mappings {
-            module.add_function(mapping.render(format!("{namespace}.mapping.{name}")));
+        // Render the tables searched by sorted index-ofs:
+        for (node_id, node) in self.nodes.iter().enumerate() {
+            if let Some(index_of) = node.op.downcast_ref::<op::SortedIndexOf>() {
+                let name = op::SortedIndexOf::table_name(namespace, Ref::Node(node_id).render());
+                module.add_data(index_of.render_table(name));
+            }
+        }
+
+        // Rendering mapping access functions (in a fixed order, so that the same graph
+        // always renders to the same module, which is what the cache keys on):
+        let mut mappings = self.mappings.iter().collect::<Vec<_>>();
+        mappings.sort_unstable_by_key(|&(name, _)| name);
+        for (name, mapping) in mappings {
+            let mapping_extern = mapping_extern(namespace, name);
+            module.add_function(
+                mapping.render(format!("{namespace}.mapping.{name}"), &mapping_extern),
+            );
+            module.add_function(mapping.render_prefetch(
+                format!("{namespace}.mapping.{name}.prefetch"),
+                &mapping_extern,
+            ));
+            module.add_function(mapping.render_resolve(
+                format!("{namespace}.mapping.{name}.resolve"),
+                &mapping_extern,
+            ));
         }
 
         // Render sub-graphs:
         for (i, subgraph) in self.subgraphs.iter().enumerate() {
-            subgraph.do_render(module, &format!("{namespace}.graph.{i}"))
+            subgraph.do_render(module, &format!("{namespace}.graph.{i}"), false, None)
         }
     }
 
@@ -162,41 +530,195 @@ impl Graph {
         create_assembly(rendered)
     }
 
-    /// Compiles this graph to machine code and loads the resulting shared object into
-    /// the current process.
+    /// Compiles this graph to machine code and loads the resulting code into the
+    /// current process. If the [`cache`] is enabled and already holds the code for this
+    /// graph, the code is loaded from there instead of being compiled again.
     pub fn compile(&self) -> Result<Function, Error> {
-        let assembly = self.render_assembly()?;
-        let unlinked = assemble(&assembly)?;
-        let shared_object = link(&unlinked)?;
+        self.compile_with(None)
+    }
+
+    /// Same as [`Graph::compile`], but first tries the supplied precompiled object,
+    /// given together with its cache key. The object is only used if the key matches
+    /// the code this graph renders to in the current jyafn version and target.
+    pub(crate) fn compile_with(
+        &self,
+        native: Option<(String, Vec<u8>)>,
+    ) -> Result<Function, Error> {
+        let (image, stats) = self.compile_image(native)?;
+        Function::init(self.clone(), image, stats)
+    }
+
+    /// Like [`Graph::compile`], but returns right away, while the machine code is
+    /// compiled in a background thread. Until then, calls are run by interpreting the
+    /// graph, which is much slower, but needs no compilation. Inputs that cannot be
+    /// interpreted (e.g., using mappings or raising errors) wait for the machine code.
+    ///
+    /// Compilation errors (e.g., illegal instructions) are only reported once the
+    /// machine code is needed. See [`Function::wait_native`]. Since the metadata of the
+    /// function is written right away, the memory estimate in it does not count the
+    /// machine code and there are no compile stats in it, until the function is
+    /// stripped (see [`Function::strip`]). [`Function::compile_stats`] has the stats as
+    /// soon as the code is there.
+    pub fn compile_tiered(&self) -> Function {
+        Function::init_tiered(self.clone(), None)
+    }
 
-        Function::init(self.clone(), shared_object)
+    /// Like [`Graph::compile`], but the function also counts how many times each call
+    /// (to mappings, resources and subgraphs) and each side of each conditional runs and
+    /// how long it takes. This makes the function slower, so this is meant for finding
+    /// out where the time goes, not for serving. See [`Function::profile_report`].
+    pub fn compile_profiled(&self) -> Result<Function, Error> {
+        let start = Instant::now();
+        let mut stats = CompileStats::default();
+        let mut profiler = Profiler::new("run");
+        let (module, externs) =
+            self.render_with_externs_profiled(Some(&mut profiler), &mut stats)?;
+        let image = load_image(module, &externs, None, &mut stats)?;
+        stats.total_ms = elapsed_ms(start);
+        Function::init_profiled(self.clone(), image, stats, profiler.into_sites())
+    }
+
+    /// Compiles this graph to machine code (or takes it from the supplied precompiled
+    /// object or from the cache) and loads it into the current process, with all the
+    /// externs filled in. This also returns how long each phase took.
+    pub(crate) fn compile_image(
+        &self,
+        native: Option<(String, Vec<u8>)>,
+    ) -> Result<(Image, CompileStats), Error> {
+        let start = Instant::now();
+        let mut stats = CompileStats::default();
+        let (module, externs) = self.render_with_externs(&mut stats)?;
+        let image = load_image(module, &externs, native, &mut stats)?;
+        stats.total_ms = elapsed_ms(start);
+        Ok((image, stats))
+    }
+
+    /// Compiles this graph to a relocatable object, returning it together with its cache
+    /// key. This is what gets stored as native code in dumped graphs.
+    pub(crate) fn compile_object(&self) -> Result<(String, Vec<u8>), Error> {
+        let module = self.render()?;
+        let key = cache::key(&module.to_string());
+        let object = if let Some(object) = cache::get(&key) {
+            object
+        } else {
+            assemble_object(&key, module, &mut CompileStats::default())?
+        };
+
+        Ok((key, object))
     }
 }
 
-/// Invokes QBE over some rendered QBE IR code. The result is assembly code.
-fn create_assembly<R>(rendered: R) -> Result<String, Error>
-where
-    R: std::fmt::Display,
-{
-    let mut qbe = Command::new(qbe_app::get_qbe()?)
-        .stdin(Stdio::piped())
-        .stdout(Stdio::piped())
-        .stderr(Stdio::piped())
-        .spawn()?;
+/// Runs QBE and the assembler over a rendered module, storing the resulting object in
+/// the cache. Both are recorded in `stats`.
+fn assemble_object(
+    key: &str,
+    module: qbe::Module<'_>,
+    stats: &mut CompileStats,
+) -> Result<Vec<u8>, Error> {
+    let start = Instant::now();
+    let assembly = create_assembly(module)?;
+    stats.qbe_ms = Some(elapsed_ms(start));
+    stats.assembly_size = Some(assembly.len());
+
+    let start = Instant::now();
+    let object = assemble(&assembly)?;
+    stats.assemble_ms = Some(elapsed_ms(start));
+    cache::put(key, &object);
+
+    Ok(object)
+}
 
-    let mut stdin = qbe.stdin.take().expect("qbe stdin stream not captured");
-    stdin.write_all(rendered.to_string().as_bytes())?;
-    drop(stdin);
+/// Loads the machine code for a rendered module into the current process (taking it
+/// from the supplied precompiled object or from the cache, if they are for this module),
+/// with all the externs filled in. Where the code came from, the phases run and the
+/// sizes of what they produced are recorded in `stats`.
+fn load_image(
+    module: qbe::Module<'_>,
+    externs: &Externs,
+    native: Option<(String, Vec<u8>)>,
+    stats: &mut CompileStats,
+) -> Result<Image, Error> {
+    let ir = module.to_string();
+    stats.ir_size = ir.len();
+    let key = cache::key(&ir);
+
+    // A bad precompiled object or cache entry is not fatal: just compile again.
+    let mut load_start = Instant::now();
+    let load_sized = |object: Vec<u8>| load(&object).map(|image| (image, object.len()));
+    let precompiled = native
+        .filter(|(native_key, _)| *native_key == key)
+        .and_then(|(_, object)| load_sized(object).ok());
+    let (image, object_size) = if let Some(loaded) = precompiled {
+        stats.source = CodeSource::Precompiled;
+        loaded
+    } else if let Some(loaded) = cache::get(&key).and_then(|object| load_sized(object).ok()) {
+        stats.source = CodeSource::Cache;
+        loaded
+    } else {
+        stats.source = CodeSource::Compiled;
+        let object = assemble_object(&key, module, stats)?;
+        load_start = Instant::now();
+        load_sized(object)?
+    };
+
+    for (name, &address) in externs {
+        image.fill_extern(name, address)?;
+    }
+    stats.load_ms = elapsed_ms(load_start);
+    stats.object_size = object_size;
+    stats.image_size = image.len();
 
-    let qbe_output = qbe.wait_with_output()?;
-    if !qbe_output.status.success() {
-        return Err(Error::Qbe {
-            status: qbe_output.status,
-            err: String::from_utf8_lossy(&qbe_output.stderr).to_string(),
-        });
+    Ok(image)
+}
+
+/// The externs of a rendered module: the names of the cells holding addresses from the
+/// current process, mapped to these addresses.
+type Externs = BTreeMap<String, usize>;
+
+/// The name of the extern holding the address of the mapping `name` in the graph
+/// rendered under `namespace`.
+fn mapping_extern(namespace: &str, name: &str) -> String {
+    format!("{namespace}.extern.mapping.{name}")
+}
+
+/// The smallest size of a module (see [`qbe::Module::size`]) worth compiling as many
+/// units in parallel.
+const MIN_UNIT_SIZE: usize = 5_000;
+
+/// Invokes QBE over a rendered module. The result is assembly code. QBE is linked into
+/// this library, so this happens in-process. Big modules (e.g., with many subgraphs or
+/// mappings) are split into units, compiled in parallel, whose assembly is then put
+/// together again.
+fn create_assembly(module: qbe::Module<'_>) -> Result<String, Error> {
+    let units = split_units(module, crate::pool::num_threads());
+    if let [module] = units.as_slice() {
+        return libqbe::compile(&module.to_string());
     }
 
-    Ok(String::from_utf8_lossy(&qbe_output.stdout).to_string())
+    let units = units
+        .into_iter()
+        .map(|unit| unit.to_string())
+        .collect::<Vec<_>>();
+    let assemblies = std::thread::scope(|scope| {
+        let handles = units
+            .iter()
+            .enumerate()
+            .map(|(unit, ir)| scope.spawn(move || libqbe::compile_unit(ir, unit)))
+            .collect::<Vec<_>>();
+        handles
+            .into_iter()
+            .map(|handle| handle.join().expect("qbe does not panic"))
+            .collect::<Result<Vec<_>, _>>()
+    })?;
+
+    Ok(assemblies.concat())
+}
+
+/// Splits a module into the units compiled in parallel by [`create_assembly`], one for
+/// every [`MIN_UNIT_SIZE`] of the module, but no more than `max_units`.
+fn split_units(module: qbe::Module<'_>, max_units: usize) -> Vec<qbe::Module<'_>> {
+    let n_units = (module.size() / MIN_UNIT_SIZE).clamp(1, max_units);
+    module.split(n_units)
 }
 
 /// Invokes an assembler on the provided assembly code to produce an output object.
@@ -284,28 +806,62 @@ fn link(unlinked: &[u8]) -> Result<NamedTempFile, Error> {
     Ok(output)
 }
 
-/// Links the output object into a shared object using a linker.
+/// Loads the output object straight from memory, without a linker.
 #[cfg(target_os = "linux")]
-fn link(unlinked: &[u8]) -> Result<NamedTempFile, Error> {
-    let tempdir = tempfile::tempdir()?;
-    let input = tempdir.path().join("main.o");
-    let output = NamedTempFile::new()?;
-    std::fs::write(&input, unlinked)?;
+fn load(unlinked: &[u8]) -> Result<Image, Error> {
+    Image::from_object(unlinked)
+}
 
-    let linker = Command::new("ld")
-        .arg("-shared")
-        .arg(input)
-        .arg("-o")
-        .arg(output.path())
-        .stdin(Stdio::null())
-        .stderr(Stdio::piped())
-        .output()?;
-    if !linker.status.success() {
-        return Err(Error::Linker {
-            status: linker.status,
-            err: String::from_utf8_lossy(&linker.stderr).to_string(),
-        });
+/// Links the output object into a shared object and loads it.
+#[cfg(target_os = "macos")]
+fn load(unlinked: &[u8]) -> Result<Image, Error> {
+    let shared_object = link(unlinked)?;
+    Image::from_shared_object(shared_object.path())
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::layout::{Layout, RefValue};
+
+    /// A graph calling a subgraph with `size` multiplications and as many additions.
+    fn graph_of_size(size: usize) -> Graph {
+        let mut h = Graph::new_with_name("h".to_string());
+        let RefValue::Scalar(x) = h.input("x".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let mut y = x;
+        for _ in 0..size {
+            y = h.insert(op::Mul, vec![y, Ref::from(1.0001)]).unwrap();
+            y = h.insert(op::Add, vec![y, x]).unwrap();
+        }
+        h.output(RefValue::Scalar(y), Layout::Scalar).unwrap();
+
+        let mut g = Graph::new();
+        let graph_id = g.insert_subgraph(h);
+        let a = g.input("a".to_string(), Layout::Scalar);
+        let args = RefValue::Struct([("x".to_string(), a)].into_iter().collect());
+        let out = g.call_graph(graph_id, args).unwrap();
+        g.output(out, Layout::Scalar).unwrap();
+        g
     }
 
-    Ok(output)
+    #[test]
+    fn test_split_units() {
+        let small = graph_of_size(10).render().unwrap();
+        assert_eq!(split_units(small, 4).len(), 1);
+
+        let big = graph_of_size(6000).render().unwrap();
+        assert!(big.size() >= 2 * MIN_UNIT_SIZE);
+        let units = split_units(big, 4);
+        assert!(units.len() > 1, "got {} units", units.len());
+        assert_eq!(
+            split_units(graph_of_size(6000).render().unwrap(), 1).len(),
+            1
+        );
+
+        for (unit, module) in units.iter().enumerate() {
+            libqbe::compile_unit(&module.to_string(), unit).unwrap();
+        }
+    }
 }
@@ -1,33 +1,45 @@
 //! Graph optimizations (those not covered by qbe).
 
-use std::collections::{BTreeMap, BTreeSet};
+use std::any::TypeId;
+use std::collections::{BTreeMap, BTreeSet, HashMap};
 
-use crate::{Graph, Node, Ref};
+use crate::profile::SiteKind;
+use crate::{op, Graph, Node, Op, Ref, Type};
+
+use super::profile::Profiler;
 
 /// Even though QBE can make a good job of finding unused data, sometimes it cannot
 /// optimize everything out. One example are pfuncs. Since, fot QBE, the call might as
 /// well result in something somewhere being mutated, it never optimizes a call away. We,
 /// however know that pfuncs are immutable and can get rid of them.
 pub fn find_reachable(outputs: &[Ref], nodes: &[Node]) -> Vec<bool> {
-    let mut stack = outputs
-        .iter()
-        .filter_map(|r| {
-            // All output nodes.
-            if let &Ref::Node(node_id) = r {
-                Some(node_id)
-            } else {
-                None
-            }
-        })
-        .chain(
-            // Operations that must always be used, such as assert.
-            nodes
-                .iter()
-                .enumerate()
-                .filter(|(_, node)| node.op.must_use())
-                .map(|(id, _)| id),
-        )
-        .collect::<Vec<_>>();
+    find_closure(
+        outputs
+            .iter()
+            .filter_map(|r| {
+                // All output nodes.
+                if let &Ref::Node(node_id) = r {
+                    Some(node_id)
+                } else {
+                    None
+                }
+            })
+            .chain(
+                // Operations that must always be used, such as assert.
+                nodes
+                    .iter()
+                    .enumerate()
+                    .filter(|(_, node)| node.op.must_use())
+                    .map(|(id, _)| id),
+            ),
+        nodes,
+    )
+}
+
+/// Finds the nodes needed to compute the given nodes: themselves and, recursively, their
+/// arguments.
+pub fn find_closure(roots: impl IntoIterator<Item = usize>, nodes: &[Node]) -> Vec<bool> {
+    let mut stack = roots.into_iter().collect::<Vec<_>>();
     let mut reachable = vec![false; nodes.len()];
 
     while let Some(node_id) = stack.pop() {
@@ -81,6 +93,102 @@ pub fn remap_reachable(graph: &mut Graph, reachable: &[bool]) {
     }
 }
 
+/// The largest subgraph (in nodes) that is inlined into its callers.
+const MAX_INLINED_SUBGRAPH: usize = 32;
+
+/// Whether calls to this subgraph can be replaced by its nodes. The subgraph has to be
+/// small and only do arithmetic that does not depend on anything outside the graph
+/// (mappings, resources, errors or other subgraphs).
+fn is_inlineable(subgraph: &Graph) -> bool {
+    subgraph.nodes.len() <= MAX_INLINED_SUBGRAPH
+        && subgraph.subgraphs.is_empty()
+        && subgraph.mappings.is_empty()
+        && subgraph.resources.is_empty()
+        && subgraph.errors.is_empty()
+        && subgraph.nodes.iter().all(|node| {
+            let op = node.op.as_ref();
+            op.is_cheap()
+                || op.downcast_ref::<op::Choose>().is_some()
+                || op.downcast_ref::<op::Call>().is_some()
+                || op.downcast_ref::<op::Div>().is_some()
+                || op.downcast_ref::<op::Rem>().is_some()
+        })
+}
+
+/// Replaces the calls to small subgraphs (see [`is_inlineable`]) by the nodes of the
+/// subgraph, so that the other optimizations work across the call: constant arguments
+/// are folded into the subgraph and outputs that are not used are never computed. The
+/// subgraphs are kept, even if not called anymore.
+pub fn inline_subgraphs(graph: &mut Graph) {
+    let inlineable = graph
+        .subgraphs
+        .iter()
+        .map(is_inlineable)
+        .collect::<Vec<_>>();
+    if !inlineable.contains(&true) {
+        return;
+    }
+
+    // What each node has been replaced by. Inlined calls have no value of their own:
+    // they are only used by the loads of their outputs, which are replaced as well.
+    let mut replaced: Vec<Option<Ref>> = Vec::with_capacity(graph.nodes.len());
+    // The outputs of each inlined call, by the id of the call node.
+    let mut call_outputs: HashMap<usize, Vec<Ref>> = HashMap::new();
+    let mut nodes = Vec::with_capacity(graph.nodes.len());
+
+    for (node_id, mut node) in std::mem::take(&mut graph.nodes).into_iter().enumerate() {
+        if let (Some(load), &[Ref::Node(call_id)]) = (
+            node.op.downcast_ref::<op::LoadSubgraphOutput>(),
+            node.args.as_slice(),
+        ) {
+            if let Some(outputs) = call_outputs.get(&call_id) {
+                replaced.push(Some(outputs[load.slot]));
+                continue;
+            }
+        }
+
+        for arg in &mut node.args {
+            if let Ref::Node(arg_id) = *arg {
+                *arg = replaced[arg_id].expect("inlined calls are only used by loads");
+            }
+        }
+
+        if let Some(&op::CallGraph(subgraph_id)) = node.op.downcast_ref::<op::CallGraph>() {
+            if inlineable[subgraph_id] {
+                let subgraph = &graph.subgraphs[subgraph_id];
+                let offset = nodes.len();
+                let remap = |r: Ref| match r {
+                    Ref::Input(input_id) => node.args[input_id],
+                    Ref::Node(sub_node_id) => Ref::Node(offset + sub_node_id),
+                    r => r,
+                };
+
+                nodes.extend(subgraph.nodes.iter().map(|sub_node| Node {
+                    op: sub_node.op.clone(),
+                    args: sub_node.args.iter().copied().map(remap).collect(),
+                    ty: sub_node.ty,
+                }));
+                call_outputs.insert(
+                    node_id,
+                    subgraph.outputs.iter().copied().map(remap).collect(),
+                );
+                replaced.push(None);
+                continue;
+            }
+        }
+
+        replaced.push(Some(Ref::Node(nodes.len())));
+        nodes.push(node);
+    }
+
+    graph.nodes = nodes;
+    for output in &mut graph.outputs {
+        if let Ref::Node(node_id) = *output {
+            *output = replaced[node_id].expect("inlined calls are never outputs");
+        }
+    }
+}
+
 /// Runs constant evaluation optimization on the graph.
 pub fn const_eval(graph: &mut Graph) {
     let mut visited = vec![false; graph.nodes.len()];
@@ -119,128 +227,477 @@ pub fn const_eval(graph: &mut Graph) {
     graph.outputs = new_outputs;
 }
 
-/// The adjacency list of the reverse graph, with everything indexed only by node ids.
-fn reverse(nodes: &[Node]) -> Vec<Vec<usize>> {
-    let mut reversed = nodes.iter().map(|_| vec![]).collect::<Vec<_>>();
-    let mut visited = nodes.iter().map(|_| false).collect::<Vec<_>>();
-    let mut stack = vec![];
-
-    while let Some(start) = visited.iter().position(|&visited| !visited) {
-        stack.push(start);
-
-        while let Some(node) = stack.pop() {
-            if !visited[node] {
-                visited[node] = true;
-                for &arg in &nodes[node].args {
-                    if let Ref::Node(arg_id) = arg {
-                        reversed[arg_id].push(node);
-                        stack.push(arg_id);
-                    }
+/// The result of simplifying a single node.
+enum Simplified {
+    /// The node computes a value that already exists.
+    Replace(Ref),
+    /// The node can be computed by a cheaper (or more canonical) operation.
+    Rewrite(Box<dyn Op>, Vec<Ref>),
+}
+
+/// The operation and the arguments of the node a reference points to, if it is a node
+/// of the given operation.
+fn node_of<T: Op>(graph: &Graph, r: Ref) -> Option<(&T, &[Ref])> {
+    let Ref::Node(node_id) = r else {
+        return None;
+    };
+    let node = &graph.nodes[node_id];
+    Some((node.op.downcast_ref::<T>()?, &node.args))
+}
+
+/// Whether `1 / c` is exactly representable, that is, `x / c == x * (1 / c)` for all `x`.
+fn has_exact_reciprocal(c: f64) -> bool {
+    const MANTISSA: u64 = (1 << 52) - 1;
+    c.is_normal() && (1.0 / c).is_normal() && c.to_bits() & MANTISSA == 0
+}
+
+/// Whether `(x + c1) + c2` can be folded into `x + (c1 + c2)`. The constants must have
+/// the same sign, so that they never cancel each other out, and a finite sum, so that
+/// folding never overflows where the original does not.
+fn can_fold_sum(c1: f64, c2: f64) -> bool {
+    c1.is_sign_negative() == c2.is_sign_negative() && (c1 + c2).is_finite()
+}
+
+/// Whether `(x * c1) * c2` can be folded into `x * (c1 * c2)`. The constants must both
+/// grow or both shrink what they multiply, so that `x * c1` overflows (or underflows)
+/// only where `x * (c1 * c2)` does too, and their product must be finite and normal.
+fn can_fold_product(c1: f64, c2: f64) -> bool {
+    let grows = |c: f64| c.abs() >= 1.0;
+    grows(c1) == grows(c2) && (c1 * c2).is_normal()
+}
+
+/// Applies algebraic identities with (at least) one constant operand. Constants are
+/// always moved to the right of commutative operations, so that only one side needs
+/// to be checked.
+fn simplify_node(graph: &Graph, node: &Node) -> Option<Simplified> {
+    use Simplified::*;
+    let args = &node.args;
+    let node_op = node.op.as_ref();
+
+    if node_op.is::<op::Add>() || node_op.is::<op::Mul>() {
+        if args[0].as_f64().is_some() && args[1].as_f64().is_none() {
+            return Some(Rewrite(
+                dyn_clone::clone_box(node_op),
+                vec![args[1], args[0]],
+            ));
+        }
+    }
+
+    if node_op.is::<op::Add>() {
+        let c = args[1].as_f64()?;
+        // `x + -0.0` is `x` even when `x` is `-0.0` (unlike `x + 0.0`).
+        if c == 0.0 && c.is_sign_negative() {
+            return Some(Replace(args[0]));
+        }
+        // (x + c1) + c2 => x + (c1 + c2)
+        if let Some((_, &[x, c1])) = node_of::<op::Add>(graph, args[0]) {
+            if let Some(c1) = c1.as_f64().filter(|&c1| can_fold_sum(c1, c)) {
+                return Some(Rewrite(Box::new(op::Add), vec![x, (c1 + c).into()]));
+            }
+        }
+    } else if node_op.is::<op::Sub>() {
+        // x - c => x + -c
+        let c = args[1].as_f64()?;
+        return Some(Rewrite(Box::new(op::Add), vec![args[0], (-c).into()]));
+    } else if node_op.is::<op::Mul>() {
+        let c = args[1].as_f64()?;
+        // (x * c1) * c2 => x * (c1 * c2)
+        if let Some((_, &[x, c1])) = node_of::<op::Mul>(graph, args[0]) {
+            if let Some(c1) = c1.as_f64().filter(|&c1| can_fold_product(c1, c)) {
+                return Some(Rewrite(Box::new(op::Mul), vec![x, (c1 * c).into()]));
+            }
+        }
+        if c == 2.0 {
+            return Some(Rewrite(Box::new(op::Add), vec![args[0], args[0]]));
+        }
+        if c == -1.0 {
+            return Some(Rewrite(Box::new(op::Neg), vec![args[0]]));
+        }
+    } else if node_op.is::<op::Div>() {
+        let c = args[1].as_f64()?;
+        if has_exact_reciprocal(c) {
+            return Some(Rewrite(Box::new(op::Mul), vec![args[0], (1.0 / c).into()]));
+        }
+    } else if node_op.is::<op::Neg>() {
+        // --x => x
+        if let Some((_, &[x])) = node_of::<op::Neg>(graph, args[0]) {
+            return Some(Replace(x));
+        }
+    } else if node_op.is::<op::Not>() {
+        // !!b => b
+        if let Some((_, &[b])) = node_of::<op::Not>(graph, args[0]) {
+            return Some(Replace(b));
+        }
+    } else if let Some(op::Call(name)) = node_op.downcast_ref::<op::Call>() {
+        if name == "powf" {
+            let c = args[1].as_f64()?;
+            if c == 1.0 {
+                return Some(Replace(args[0]));
+            }
+            if c == 2.0 {
+                return Some(Rewrite(Box::new(op::Mul), vec![args[0], args[0]]));
+            }
+        }
+    }
+
+    None
+}
+
+/// Runs algebraic simplification and strength reduction on the graph: operations with
+/// constant operands are rewritten into cheaper ones (e.g., `x * 2` into `x + x` and
+/// `x / 4` into `x * 0.25`), double negations are removed and chains of constants are
+/// folded together (e.g., `(x + 1) + 2` into `x + 3`). Nodes that are not needed
+/// anymore become unreachable.
+///
+/// Note that floating point arithmetic is not associative, so reassociating constants
+/// changes the rounding of the result. Constants are only folded when that cannot make
+/// the result overflow, underflow or become infinite or zero where it would not
+/// otherwise (see `can_fold_sum` and `can_fold_product`); what remains is rounding,
+/// which is larger if `x` cancels out with the constants. The other rewrites are exact.
+pub fn simplify(graph: &mut Graph) {
+    // What each node has been replaced by (possibly itself).
+    let mut replaced = (0..graph.nodes.len()).map(Ref::Node).collect::<Vec<_>>();
+
+    for node_id in 0..graph.nodes.len() {
+        for arg in &mut graph.nodes[node_id].args {
+            if let Ref::Node(arg_id) = *arg {
+                *arg = replaced[arg_id];
+            }
+        }
+
+        if graph.nodes[node_id].op.must_use() {
+            continue;
+        }
+
+        loop {
+            let node = &graph.nodes[node_id];
+            if let Some(evald) = node.op.const_eval(graph, &node.args) {
+                replaced[node_id] = evald;
+                break;
+            }
+
+            match simplify_node(graph, node) {
+                None => break,
+                Some(Simplified::Replace(r)) => {
+                    replaced[node_id] = r;
+                    break;
+                }
+                Some(Simplified::Rewrite(op, args)) => {
+                    let node = &mut graph.nodes[node_id];
+                    node.op = op;
+                    node.args = args;
                 }
             }
         }
     }
 
-    reversed
+    for output in &mut graph.outputs {
+        if let Ref::Node(node_id) = *output {
+            *output = replaced[node_id];
+        }
+    }
 }
 
-/// This optimization is also a no-no for QBE, but here at `jyafn` we play fast and loose
-/// with operation order, because side-effects are undefined behavior.
-fn find_branches(
-    nodes: &[Node],
-    reversed: &[Vec<usize>],
-    choose_node_id: usize,
-) -> (BTreeSet<usize>, BTreeSet<usize>) {
-    let is_accessible_later = |node_id: usize| {
-        reversed[node_id]
+/// Eliminates common subexpressions: nodes that apply the same operation to the same
+/// arguments as an earlier node are replaced by that node (and therefore become
+/// unreachable). Operations that must be used are never merged, since they are kept for
+/// their effects.
+pub fn eliminate_common(graph: &mut Graph) {
+    // What each node has been replaced by (possibly itself).
+    let mut replaced = (0..graph.nodes.len()).map(Ref::Node).collect::<Vec<_>>();
+    // The nodes seen so far, by their kind of operation and arguments.
+    let mut seen: HashMap<(TypeId, Vec<Ref>), Vec<usize>> = HashMap::new();
+
+    for node_id in 0..graph.nodes.len() {
+        for arg in &mut graph.nodes[node_id].args {
+            if let Ref::Node(arg_id) = *arg {
+                *arg = replaced[arg_id];
+            }
+        }
+
+        let node = &graph.nodes[node_id];
+        if node.op.must_use() {
+            continue;
+        }
+
+        let candidates = seen
+            .entry((node.op.as_any().type_id(), node.args.clone()))
+            .or_default();
+        if let Some(&same) = candidates
             .iter()
-            .any(|&other| other >= choose_node_id)
+            .find(|&&other| graph.nodes[other].op.is_eq(node.op.as_ref()))
+        {
+            replaced[node_id] = Ref::Node(same);
+        } else {
+            candidates.push(node_id);
+        }
+    }
+
+    for output in &mut graph.outputs {
+        if let Ref::Node(node_id) = *output {
+            *output = replaced[node_id];
+        }
+    }
+}
+
+/// Rewrites lists of floats whose elements are all the same arithmetic operation on the
+/// elements of two other lists, in order (e.g., `[a[0] + b[0], a[1] + b[1], ...]`), as
+/// that operation applied element-wise to those lists. This is rendered as packed
+/// vector instructions and the scalar nodes become unreachable, unless used elsewhere.
+pub fn vectorize(graph: &mut Graph) {
+    let is_float_list = |node: &Node| {
+        node.op
+            .downcast_ref::<op::List>()
+            .filter(|list| list.element == Type::Float && list.n_elements >= 2)
+            .is_some()
     };
 
-    // The search queue
-    let mut queue = BTreeSet::new();
-    // Nodes that reachable from the `if` side. These may also be accessble from the `else`
-    // side.
-    let mut true_nodes = BTreeSet::new();
-    // Nodes that reachable from the `else` side. These may also be accessble from the `if`
-    // side.
-    let mut false_nodes = BTreeSet::new();
-    // The number of nodes reachable from the `if` side in the queue.
-    let mut true_in_queue = 0;
-    // The number of nodes reachable from the `else` side in the queue.
-    let mut false_in_queue = 0;
-
-    // Extract arguments:
-    if let Ref::Node(condition) = nodes[choose_node_id].args[0] {
-        queue.insert(condition);
-        // The test condition is accessible from _both_ the `if` and `else` sides.
-        true_nodes.insert(condition);
-        false_nodes.insert(condition);
-        true_in_queue += 1;
-        false_in_queue += 1;
+    // The lists of floats, by their (original) elements:
+    let mut lists = HashMap::new();
+    for (node_id, node) in graph.nodes.iter().enumerate() {
+        if is_float_list(node) {
+            lists.entry(node.args.clone()).or_insert(node_id);
+        }
     }
-    if let Ref::Node(t_node) = nodes[choose_node_id].args[1] {
-        queue.insert(t_node);
-        true_nodes.insert(t_node);
-        true_in_queue += 1;
+
+    for node_id in 0..graph.nodes.len() {
+        let node = &graph.nodes[node_id];
+        if !is_float_list(node) {
+            continue;
+        }
+
+        // Are all elements the same operation?
+        let mut op = None;
+        let mut lhs = Vec::with_capacity(node.args.len());
+        let mut rhs = Vec::with_capacity(node.args.len());
+        for &arg in &node.args {
+            let Ref::Node(element_id) = arg else {
+                break;
+            };
+            let element = &graph.nodes[element_id];
+            let Some(element_op) = op::Elementwise::of(element.op.as_ref()) else {
+                break;
+            };
+            if *op.get_or_insert(element_op) != element_op {
+                break;
+            }
+            lhs.push(element.args[0]);
+            rhs.push(element.args[1]);
+        }
+        if lhs.len() != node.args.len() {
+            continue;
+        }
+
+        // ... on the elements of two lists declared before?
+        let (Some(op), Some(&lhs), Some(&rhs)) = (op, lists.get(&lhs), lists.get(&rhs)) else {
+            continue;
+        };
+        if lhs >= node_id || rhs >= node_id {
+            continue;
+        }
+
+        let n_elements = node.args.len();
+        let node = &mut graph.nodes[node_id];
+        node.op = Box::new(op::ListElementwise { op, n_elements });
+        node.args = vec![Ref::Node(lhs), Ref::Node(rhs)];
     }
-    if let Ref::Node(f_node) = nodes[choose_node_id].args[2] {
-        queue.insert(f_node);
-        false_nodes.insert(f_node);
-        false_in_queue += 1;
+}
+
+/// Rewrites index-ofs on (not tiny) lists of constants as searches on a sorted table of
+/// the elements, made at compile time. The lists become unreachable, unless used
+/// elsewhere, and so are never built.
+pub fn sort_index_ofs(graph: &mut Graph) {
+    for node_id in 0..graph.nodes.len() {
+        let node = &graph.nodes[node_id];
+        let Some(index_of) = node.op.downcast_ref::<op::IndexOf>() else {
+            continue;
+        };
+        let Some(sorted) = index_of.sorted(graph, &node.args) else {
+            continue;
+        };
+
+        let node = &mut graph.nodes[node_id];
+        node.args = vec![node.args[1]];
+        node.op = Box::new(sorted);
     }
+}
 
-    while let Some(node_id) = queue.pop_last() {
-        let args = &nodes[node_id].args;
-
-        // If is accessible from the `if` side...
-        if true_nodes.contains(&node_id) {
-            true_in_queue -= 1;
-            for &arg in args {
-                if let Ref::Node(arg_id) = arg {
-                    if true_nodes.insert(arg_id) {
-                        queue.insert(arg_id);
-                        true_in_queue += 1;
-
-                        // Sneaky: using logic op short-circuiting.
-                        if is_accessible_later(arg_id) && false_nodes.insert(arg_id) {
-                            false_in_queue += 1;
-                        }
-                    }
-                }
-            }
+/// Where nodes are computed: either the top level of the function or one of the sides of
+/// a conditional, which is itself computed in some region.
+struct Region {
+    parent: usize,
+    depth: usize,
+}
+
+/// The top level region, which is its own parent.
+const ROOT_REGION: usize = 0;
+
+/// The innermost region that contains both regions. Nodes used in both have to be
+/// computed there.
+fn common_region(regions: &[Region], mut a: usize, mut b: usize) -> usize {
+    while a != b {
+        if regions[a].depth >= regions[b].depth {
+            a = regions[a].parent;
+        } else {
+            b = regions[b].parent;
         }
+    }
+    a
+}
 
-        // If is accessible from the `else` side...
-        if false_nodes.contains(&node_id) {
-            false_in_queue -= 1;
-            for &arg in args {
-                if let Ref::Node(arg_id) = arg {
-                    if false_nodes.insert(arg_id) {
-                        queue.insert(arg_id);
-                        false_in_queue += 1;
+/// Finds the region each node is computed in. Each side of each [`op::Choose`] gets its
+/// own region and each node goes to the innermost region that contains all of its uses:
+/// nodes only used (directly or not) by one side of a conditional are only computed if
+/// that side is taken. Since nodes are sorted topologically, this is a single sweep from
+/// the last node to the first, in which the uses of each node are all known by the time
+/// it is reached.
+///
+/// This optimization is also a no-no for QBE, but here at `jyafn` we play fast and loose
+/// with operation order, because side-effects are undefined behavior.
+///
+/// Only the nodes flagged in `reachable` are placed and only their uses count. The
+/// others are left in the top level region, but are not computed anywhere.
+///
+/// Returns the regions, the region of each node and the regions of the sides of each
+/// conditional, by node id.
+fn place(
+    nodes: &[Node],
+    outputs: &[Ref],
+    reachable: &[bool],
+) -> (Vec<Region>, Vec<usize>, Vec<Option<[usize; 2]>>) {
+    let mut regions = vec![Region {
+        parent: ROOT_REGION,
+        depth: 0,
+    }];
+    // The innermost region containing the uses seen so far, if any.
+    let mut placement = vec![None; nodes.len()];
+    let mut sides = vec![None; nodes.len()];
+
+    for output in outputs {
+        if let Ref::Node(node_id) = *output {
+            placement[node_id] = Some(ROOT_REGION);
+        }
+    }
 
-                        // Sneaky: using logic op short-circuiting.
-                        if is_accessible_later(arg_id) && true_nodes.insert(arg_id) {
-                            true_in_queue += 1;
-                        }
-                    }
-                }
-            }
+    for node_id in (0..nodes.len()).rev() {
+        if !reachable[node_id] {
+            placement[node_id] = Some(ROOT_REGION);
+            continue;
         }
 
-        // If everything is reachable from true and from false, there is no point in
-        // pursuing the search further. This helps to cut the search waaay earlier in
-        // case of big graphs.
-        if true_in_queue == queue.len() && false_in_queue == queue.len() {
-            break;
+        // Nodes without uses (e.g., asserts) are always computed.
+        let region = *placement[node_id].get_or_insert(ROOT_REGION);
+        let node = &nodes[node_id];
+
+        let node_sides = if node.op.is::<op::Choose>() {
+            let node_sides = [regions.len(), regions.len() + 1];
+            let depth = regions[region].depth + 1;
+            for _ in node_sides {
+                regions.push(Region {
+                    parent: region,
+                    depth,
+                });
+            }
+            sides[node_id] = Some(node_sides);
+            Some(node_sides)
+        } else {
+            None
+        };
+
+        for (position, &arg) in node.args.iter().enumerate() {
+            let Ref::Node(arg_id) = arg else {
+                continue;
+            };
+            // The test condition is needed before branching.
+            let needed = match (node_sides, position) {
+                (Some([true_side, _]), 1) => true_side,
+                (Some([_, false_side]), 2) => false_side,
+                _ => region,
+            };
+            placement[arg_id] = Some(match placement[arg_id] {
+                None => needed,
+                Some(current) => common_region(&regions, current, needed),
+            });
         }
     }
 
-    (
-        true_nodes.difference(&false_nodes).copied().collect(),
-        false_nodes.difference(&true_nodes).copied().collect(),
-    )
+    let placement = placement
+        .into_iter()
+        .map(|region| region.expect("all nodes placed"))
+        .collect();
+    (regions, placement, sides)
+}
+
+/// Which of the (reachable) nodes are computed unconditionally, at the top level of the
+/// function, i.e., not only on one side of a conditional.
+pub fn find_unconditional(nodes: &[Node], outputs: &[Ref]) -> Vec<bool> {
+    let (_, placement, _) = place(nodes, outputs, &vec![true; nodes.len()]);
+    placement
+        .into_iter()
+        .map(|region| region == ROOT_REGION)
+        .collect()
+}
+
+/// The most nodes a side of a conditional may have for it to be computed unconditionally
+/// and the choice to be rendered without a branch.
+const MAX_SELECT_SIDE: usize = 4;
+
+/// Whether the nodes of a side of a conditional are few and cheap enough to be computed
+/// even when the side is not taken. For small conditionals (think `clip` or
+/// `nan_to_num`), this is cheaper than mispredicting the branch.
+fn is_cheap_side(nodes: &[Node], side: &[usize]) -> bool {
+    side.len() <= MAX_SELECT_SIDE && side.iter().all(|&node_id| nodes[node_id].op.is_cheap())
+}
+
+/// Renders `output = condition ? if_true : if_false` without branches, by blending the
+/// bits of both values with a mask made out of the condition (which is always `0` or
+/// `1`): `if_false ^ ((if_true ^ if_false) & -condition)`.
+fn render_select(output: qbe::Value, ty: Type, args: &[Ref], func: &mut qbe::Function) {
+    let temp = |name: &str| qbe::Value::Temporary(op::unique_for(output.clone(), name));
+    let is_float = ty == Type::Float;
+    // Constants are already rendered as their bits.
+    let as_bits = |func: &mut qbe::Function, value: Ref, name: &str| {
+        if is_float && !matches!(value, Ref::Const(..)) {
+            let bits = temp(name);
+            func.assign_instr(
+                bits.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Cast(value.render()),
+            );
+            bits
+        } else {
+            value.render()
+        }
+    };
+
+    let mask = temp("select.mask");
+    func.assign_instr(
+        mask.clone(),
+        qbe::Type::Long,
+        qbe::Instr::Neg(args[0].render()),
+    );
+    let if_true = as_bits(func, args[1], "select.true");
+    let if_false = as_bits(func, args[2], "select.false");
+    let diff = temp("select.diff");
+    func.assign_instr(
+        diff.clone(),
+        qbe::Type::Long,
+        qbe::Instr::Xor(if_true, if_false.clone()),
+    );
+    let masked = temp("select.masked");
+    func.assign_instr(masked.clone(), qbe::Type::Long, qbe::Instr::And(diff, mask));
+
+    if is_float {
+        let bits = temp("select.bits");
+        func.assign_instr(
+            bits.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Xor(if_false, masked),
+        );
+        func.assign_instr(output, qbe::Type::Double, qbe::Instr::Cast(bits));
+    } else {
+        func.assign_instr(output, ty.render(), qbe::Instr::Xor(if_false, masked));
+    }
 }
 
 /// A restructuring of your good old plain list of instructions into a cool tree structure
@@ -259,70 +716,188 @@ pub enum StatementOrConditional {
         /// Statements on the `else` side.
         false_side: Statements,
     },
+    /// A condition whose sides are cheap enough to be computed beforehand, at the same
+    /// level as the condition. This is the id of the node that contains the
+    /// [`op::Choose`] operation.
+    Select(usize),
 }
 
 /// Statements are a list of statements or conditionals.
 pub struct Statements(Vec<StatementOrConditional>);
 
 impl Statements {
-    /// Build the nested conditional structure out of a list of topologically sorted nodes.
-    pub fn build(nodes: &[Node]) -> Statements {
-        let reversed = reverse(nodes);
-        let all_node_ids = (0..nodes.len()).collect::<BTreeSet<_>>();
+    /// Build the nested conditional structure out of a list of topologically sorted nodes
+    /// (see [`place`]).
+    pub fn build(nodes: &[Node], outputs: &[Ref]) -> Statements {
+        Statements::build_reachable(nodes, outputs, &vec![true; nodes.len()])
+    }
 
-        return do_build(all_node_ids, &reversed, nodes);
+    /// Same as [`Statements::build`], but only for the nodes flagged in `reachable`,
+    /// which have to include everything the outputs and themselves use. The others are
+    /// not rendered. This renders part of a graph while keeping node ids as they are.
+    pub fn build_reachable(nodes: &[Node], outputs: &[Ref], reachable: &[bool]) -> Statements {
+        let (regions, placement, sides) = place(nodes, outputs, reachable);
+        let mut members = vec![vec![]; regions.len()];
+        for (node_id, &region) in placement.iter().enumerate() {
+            if reachable[node_id] {
+                members[region].push(node_id);
+            }
+        }
+
+        // Cheap sides are computed unconditionally, in the region of their conditional.
+        // These have no conditionals of their own, since choices are not cheap.
+        let mut is_select = vec![false; nodes.len()];
+        for (node_id, node_sides) in sides.iter().enumerate() {
+            let Some([true_side, false_side]) = *node_sides else {
+                continue;
+            };
+            if is_cheap_side(nodes, &members[true_side])
+                && is_cheap_side(nodes, &members[false_side])
+            {
+                is_select[node_id] = true;
+                for side in [true_side, false_side] {
+                    let moved = std::mem::take(&mut members[side]);
+                    members[placement[node_id]].extend(moved);
+                }
+            }
+        }
+        for region_members in &mut members {
+            region_members.sort_unstable();
+        }
+
+        return do_build(ROOT_REGION, nodes, &members, &sides, &is_select);
 
         fn do_build(
-            mut node_ids: BTreeSet<usize>,
-            reversed: &[Vec<usize>],
+            region: usize,
             nodes: &[Node],
+            members: &[Vec<usize>],
+            sides: &[Option<[usize; 2]>],
+            is_select: &[bool],
         ) -> Statements {
-            let mut buffer = vec![];
-
-            while let Some(node_id) = node_ids.pop_last() {
-                if nodes[node_id].op.as_any().is::<crate::op::Choose>() {
-                    // Found conditional! Let's split.
-                    let condition = nodes[node_id].args[0];
-                    let (true_side, false_side) = find_branches(nodes, reversed, node_id);
-
-                    // All these nodes are already accounted for in the branch. They do
-                    // not belong to the main level. Therefore, remove!
-                    true_side.iter().chain(false_side.iter()).for_each(|n| {
-                        node_ids.remove(n);
-                    });
-
-                    // Build conditional block:
-                    buffer.push(StatementOrConditional::Conditional {
-                        node_id,
-                        condition,
-                        true_side: do_build(true_side, reversed, nodes),
-                        false_side: do_build(false_side, reversed, nodes),
-                    });
-                } else {
-                    // Meh! just a plain old normal statement. Add it to the list.
-                    buffer.push(StatementOrConditional::Statement(node_id));
-                }
+            Statements(
+                members[region]
+                    .iter()
+                    .map(|&node_id| match sides[node_id] {
+                        Some(_) if is_select[node_id] => StatementOrConditional::Select(node_id),
+                        Some([true_side, false_side]) => StatementOrConditional::Conditional {
+                            node_id,
+                            condition: nodes[node_id].args[0],
+                            true_side: do_build(true_side, nodes, members, sides, is_select),
+                            false_side: do_build(false_side, nodes, members, sides, is_select),
+                        },
+                        // Meh! just a plain old normal statement.
+                        None => StatementOrConditional::Statement(node_id),
+                    })
+                    .collect(),
+            )
+        }
+    }
+
+    /// The id of the node defined by each statement.
+    fn node_ids(&self) -> impl '_ + Iterator<Item = usize> {
+        self.0.iter().map(|statement| match statement {
+            &StatementOrConditional::Statement(node_id) => node_id,
+            &StatementOrConditional::Select(node_id) => node_id,
+            StatementOrConditional::Conditional { node_id, .. } => *node_id,
+        })
+    }
+
+    /// Schedules the mapping calls in this list of statements to be rendered in two
+    /// halves (see [`op::CallMapping::render_prefetch_into`]): the first, as early as
+    /// possible, right after the last of its arguments is computed and the second, in
+    /// its original place. This way, independent lookups are all hashed and prefetched
+    /// first and then resolved, overlapping their cache misses, instead of waiting on
+    /// each other. Returns, for each statement, the mapping calls to prefetch before it.
+    fn schedule_prefetches(&self, graph: &Graph) -> Vec<Vec<usize>> {
+        let position = self
+            .node_ids()
+            .enumerate()
+            .map(|(position, node_id)| (node_id, position))
+            .collect::<HashMap<_, _>>();
+        let mut prefetches = vec![vec![]; self.0.len()];
+
+        for (i, node_id) in self.node_ids().enumerate() {
+            let node = &graph.nodes[node_id];
+            if !node.op.is::<op::CallMapping>() {
+                continue;
             }
 
-            // Remember: we traversed the node in descending order. So, need to
-            // disinvert...
-            Statements(buffer.into_iter().rev().collect())
+            // Arguments not computed in this list were computed before it.
+            let earliest = node
+                .args
+                .iter()
+                .filter_map(|arg| match arg {
+                    Ref::Node(arg_id) => position.get(arg_id).map(|&position| position + 1),
+                    _ => None,
+                })
+                .max()
+                .unwrap_or(0);
+
+            // Nothing to overlap with if the call cannot be moved.
+            if earliest < i {
+                prefetches[earliest].push(node_id);
+            }
         }
+
+        prefetches
     }
 
-    /// Render the resulting nested structure into the provided QBE function builder.
-    pub fn render_into(&self, graph: &Graph, func: &mut qbe::Function, namespace: &str) {
-        for statement in &self.0 {
+    /// Render the resulting nested structure into the provided QBE function builder. If
+    /// a profiler is given, calls and the sides of conditionals are instrumented.
+    pub fn render_into(
+        &self,
+        graph: &Graph,
+        func: &mut qbe::Function,
+        namespace: &str,
+        mut profiler: Option<&mut Profiler>,
+    ) {
+        let prefetches = self.schedule_prefetches(graph);
+        let prefetched = prefetches.iter().flatten().collect::<BTreeSet<_>>();
+
+        for (statement, prefetches) in self.0.iter().zip(&prefetches) {
+            for &node_id in prefetches {
+                let node = &graph.nodes[node_id];
+                let call = node
+                    .op
+                    .downcast_ref::<op::CallMapping>()
+                    .expect("only mapping calls are prefetched");
+                call.render_prefetch_into(
+                    graph,
+                    Ref::Node(node_id).render(),
+                    &node.args,
+                    func,
+                    namespace,
+                );
+            }
+
             match statement {
                 &StatementOrConditional::Statement(node_id) => {
+                    let site = profiler
+                        .as_deref_mut()
+                        .and_then(|profiler| profiler.render_start_node(func, node_id, graph));
                     let node = &graph.nodes[node_id];
-                    node.op.render_into(
-                        graph,
-                        Ref::Node(node_id).render(),
-                        &node.args,
-                        func,
-                        namespace,
-                    )
+                    if prefetched.contains(&node_id) {
+                        let call = node
+                            .op
+                            .downcast_ref::<op::CallMapping>()
+                            .expect("only mapping calls are prefetched");
+                        call.render_resolve_into(Ref::Node(node_id).render(), func, namespace);
+                    } else {
+                        node.op.render_into(
+                            graph,
+                            Ref::Node(node_id).render(),
+                            &node.args,
+                            func,
+                            namespace,
+                        );
+                    }
+                    if let (Some(profiler), Some(site)) = (profiler.as_deref_mut(), site) {
+                        profiler.render_stop(func, site, Some(Ref::Node(node_id).render()));
+                    }
+                }
+                &StatementOrConditional::Select(node_id) => {
+                    let node = &graph.nodes[node_id];
+                    render_select(Ref::Node(node_id).render(), node.ty, &node.args, func);
                 }
                 StatementOrConditional::Conditional {
                     node_id,
@@ -342,22 +917,28 @@ impl Statements {
                         false_label.clone(),
                     ));
 
-                    func.add_block(true_label);
-                    true_side.render_into(graph, func, namespace);
-                    func.assign_instr(
-                        output.clone(),
-                        node.ty.render(),
-                        qbe::Instr::Copy(node.args[1].render()),
-                    );
-                    func.add_instr(qbe::Instr::Jmp(end_label.clone()));
-
-                    func.add_block(false_label);
-                    false_side.render_into(graph, func, namespace);
-                    func.assign_instr(
-                        output,
-                        node.ty.render(),
-                        qbe::Instr::Copy(node.args[2].render()),
-                    );
+                    for (label, kind, side, arg) in [
+                        (true_label, SiteKind::IfTrue, true_side, node.args[1]),
+                        (false_label, SiteKind::IfFalse, false_side, node.args[2]),
+                    ] {
+                        func.add_block(label);
+                        let site = profiler.as_deref_mut().map(|profiler| {
+                            profiler.render_start(func, kind, Some(*node_id), graph)
+                        });
+                        side.render_into(graph, func, namespace, profiler.as_deref_mut());
+                        if let (Some(profiler), Some(site)) = (profiler.as_deref_mut(), site) {
+                            profiler.render_stop(func, site, None);
+                        }
+                        func.assign_instr(
+                            output.clone(),
+                            node.ty.render(),
+                            qbe::Instr::Copy(arg.render()),
+                        );
+                        // The false side falls through to the end.
+                        if kind == SiteKind::IfTrue {
+                            func.add_instr(qbe::Instr::Jmp(end_label.clone()));
+                        }
+                    }
 
                     func.add_block(end_label);
                 }
@@ -0,0 +1,179 @@
+//! Rendering of the instrumentation of profiled functions (see [`crate::profile`]).
+//!
+//! Each site reads the clock when it starts and, when it is done, adds the ticks since
+//! then and one hit to its counters, in `{namespace}.profile`. Sites are numbered in the
+//! order they are rendered, which is also the order of their counters.
+
+use crate::profile::{self, ProfileEntry, SiteKind};
+use crate::{op, Graph, Op};
+
+fn temp(name: &str) -> qbe::Value {
+    qbe::Value::Temporary(name.to_string())
+}
+
+/// Keeps track of the sites rendered so far into a profiled function.
+pub struct Profiler {
+    counters: String,
+    sites: Vec<ProfileEntry>,
+    /// Where the counters of the next site go, in bytes.
+    offset: u64,
+}
+
+impl Profiler {
+    pub fn new(namespace: &str) -> Profiler {
+        Profiler {
+            counters: profile::counters_name(namespace),
+            sites: vec![],
+            offset: 0,
+        }
+    }
+
+    /// The sites rendered so far.
+    pub fn into_sites(self) -> Vec<ProfileEntry> {
+        self.sites
+    }
+
+    /// Renders the counters of all sites rendered so far, all starting from zero.
+    pub fn render_counters(&self) -> qbe::DataDef<'static> {
+        let n_counters = self
+            .sites
+            .iter()
+            .map(ProfileEntry::n_counters)
+            .sum::<usize>();
+        qbe::DataDef::new(
+            qbe::Linkage::public(),
+            self.counters.clone(),
+            Some(8),
+            vec![(qbe::Type::Long, qbe::DataItem::Const(0)); n_counters.max(1)],
+        )
+    }
+
+    /// Starts a new site, reading the clock, and returns it to be passed to
+    /// [`Profiler::render_stop`].
+    pub fn render_start(
+        &mut self,
+        func: &mut qbe::Function,
+        kind: SiteKind,
+        node_id: Option<usize>,
+        graph: &Graph,
+    ) -> Site {
+        let node = node_id.map(|node_id| &graph.nodes[node_id]);
+        let name = node.and_then(|node| {
+            if let Some(call) = node.op.downcast_ref::<op::CallMapping>() {
+                Some(call.name.clone())
+            } else if let Some(call) = node.op.downcast_ref::<op::CallResource>() {
+                Some(format!("{}.{}", call.name, call.method))
+            } else {
+                node.op
+                    .downcast_ref::<op::CallGraph>()
+                    .map(|&op::CallGraph(id)| graph.subgraphs[id].name.clone())
+            }
+        });
+        let entry = ProfileEntry {
+            kind,
+            node_id,
+            op: node.map(|node| node.op.typetag_name().to_string()),
+            name,
+            hits: 0,
+            ticks: 0,
+            misses: None,
+        };
+
+        let site = Site {
+            id: self.sites.len(),
+            offset: self.offset,
+            counts_misses: entry.counts_misses(),
+        };
+        self.offset += (entry.n_counters() * 8) as u64;
+        self.sites.push(entry);
+
+        let now = temp("profile.now");
+        op::render_load_extern(func, now.clone(), profile::NOW_EXTERN);
+        func.assign_instr(site.start(), qbe::Type::Long, qbe::Instr::Call(now, vec![]));
+
+        site
+    }
+
+    /// Starts the site of a node, if it is a call.
+    pub fn render_start_node(
+        &mut self,
+        func: &mut qbe::Function,
+        node_id: usize,
+        graph: &Graph,
+    ) -> Option<Site> {
+        let op = &graph.nodes[node_id].op;
+        let is_call =
+            op.is::<op::CallMapping>() || op.is::<op::CallResource>() || op.is::<op::CallGraph>();
+        is_call.then(|| self.render_start(func, SiteKind::Call, Some(node_id), graph))
+    }
+
+    /// Adds the ticks since the start of the site and one hit to its counters. For
+    /// sites counting misses, `output` is the null pointer on a miss.
+    pub fn render_stop(&self, func: &mut qbe::Function, site: Site, output: Option<qbe::Value>) {
+        let now = temp("profile.now");
+        let end = temp("profile.end");
+        op::render_load_extern(func, now.clone(), profile::NOW_EXTERN);
+        func.assign_instr(end.clone(), qbe::Type::Long, qbe::Instr::Call(now, vec![]));
+        let ticks = temp("profile.ticks");
+        func.assign_instr(
+            ticks.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Sub(end, site.start()),
+        );
+
+        let one = qbe::Value::Const(1);
+        let miss = output.filter(|_| site.counts_misses).map(|output| {
+            let miss = temp("profile.miss");
+            func.assign_instr(
+                miss.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Cmp(qbe::Type::Long, qbe::Cmp::Eq, output, qbe::Value::Const(0)),
+            );
+            miss
+        });
+        let increments = [Some(ticks), Some(one), miss];
+
+        for (i, increment) in increments.into_iter().enumerate() {
+            let Some(increment) = increment else {
+                continue;
+            };
+            let cell = temp("profile.cell");
+            let value = temp("profile.value");
+            func.assign_instr(
+                cell.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Add(
+                    qbe::Value::Global(self.counters.clone()),
+                    qbe::Value::Const(site.offset + 8 * i as u64),
+                ),
+            );
+            func.assign_instr(
+                value.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Load(qbe::Type::Long, cell.clone()),
+            );
+            func.assign_instr(
+                value.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Add(value.clone(), increment),
+            );
+            func.add_instr(qbe::Instr::Store(qbe::Type::Long, cell, value));
+        }
+    }
+}
+
+/// A site being rendered.
+#[derive(Debug, Clone, Copy)]
+pub struct Site {
+    id: usize,
+    /// Where the counters of the site are, in bytes.
+    offset: u64,
+    counts_misses: bool,
+}
+
+impl Site {
+    /// The temporary holding the clock when the site started.
+    fn start(&self) -> qbe::Value {
+        temp(&format!("profile.start.{}", self.id))
+    }
+}
@@ -0,0 +1,133 @@
+//! Timings and sizes of the phases of the compilation of a graph.
+
+use serde_derive::{Deserialize, Serialize};
+use std::time::Instant;
+
+use crate::Graph;
+
+/// The milliseconds since `start`.
+pub(crate) fn elapsed_ms(start: Instant) -> f64 {
+    start.elapsed().as_secs_f64() * 1e3
+}
+
+/// Where the machine code of a function came from.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum CodeSource {
+    /// Compiled from the graph, running QBE and the assembler.
+    #[default]
+    Compiled,
+    /// Taken from the [`crate::cache`].
+    Cache,
+    /// Taken from the native code dumped with the graph (see [`Graph::dump_native`]).
+    Precompiled,
+}
+
+impl CodeSource {
+    fn as_str(&self) -> &'static str {
+        match self {
+            CodeSource::Compiled => "compiled",
+            CodeSource::Cache => "cache",
+            CodeSource::Precompiled => "precompiled",
+        }
+    }
+}
+
+/// An optimization pass, run before rendering the graph.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct PassStats {
+    /// The name of the pass.
+    pub name: String,
+    /// How long the pass took, in milliseconds.
+    pub time_ms: f64,
+    /// How many nodes the graph had after the pass.
+    pub nodes: usize,
+}
+
+/// How long each phase of the compilation of a graph took and how big what came out of
+/// each phase was. Times are wall time, in milliseconds.
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+pub struct CompileStats {
+    /// Where the machine code came from. If not compiled, there are no stats for QBE and
+    /// the assembler.
+    pub source: CodeSource,
+    /// How many nodes the graph had before the optimizations.
+    pub nodes: usize,
+    /// The optimization passes, in the order they ran.
+    pub passes: Vec<PassStats>,
+    /// Rendering the optimized graph (and its subgraphs) as QBE IR.
+    pub render_ms: f64,
+    /// The size of the QBE IR, in bytes.
+    pub ir_size: usize,
+    /// Running QBE over the IR.
+    pub qbe_ms: Option<f64>,
+    /// The size of the assembly code that QBE output, in bytes.
+    pub assembly_size: Option<usize>,
+    /// Running the assembler over the assembly code.
+    pub assemble_ms: Option<f64>,
+    /// The size of the relocatable object, in bytes.
+    pub object_size: usize,
+    /// Loading the object into memory (linking it and opening the shared object, in
+    /// macOS) and filling in the externs.
+    pub load_ms: f64,
+    /// The size of the machine code loaded in memory, in bytes.
+    pub image_size: usize,
+    /// The whole compilation.
+    pub total_ms: f64,
+}
+
+impl CompileStats {
+    /// Runs an optimization pass over the graph, recording it.
+    pub(crate) fn time_pass<F>(&mut self, name: &str, graph: &mut Graph, pass: F)
+    where
+        F: FnOnce(&mut Graph),
+    {
+        let start = Instant::now();
+        pass(graph);
+        self.passes.push(PassStats {
+            name: name.to_string(),
+            time_ms: elapsed_ms(start),
+            nodes: graph.nodes.len(),
+        });
+    }
+
+    /// These stats as metadata entries, all under `jyafn.compile`.
+    pub(crate) fn to_metadata(&self) -> Vec<(String, String)> {
+        let mut metadata = vec![
+            ("source".to_string(), self.source.as_str().to_string()),
+            ("nodes".to_string(), self.nodes.to_string()),
+        ];
+        for pass in &self.passes {
+            metadata.push((format!("nodes.{}", pass.name), pass.nodes.to_string()));
+            metadata.push((format!("time_ms.{}", pass.name), pass.time_ms.to_string()));
+        }
+        let phases = [
+            ("render", Some(self.render_ms)),
+            ("qbe", self.qbe_ms),
+            ("assemble", self.assemble_ms),
+            ("load", Some(self.load_ms)),
+        ];
+        for (phase, time_ms) in phases {
+            if let Some(time_ms) = time_ms {
+                metadata.push((format!("time_ms.{phase}"), time_ms.to_string()));
+            }
+        }
+        metadata.push(("time_ms".to_string(), self.total_ms.to_string()));
+        let sizes = [
+            ("ir", Some(self.ir_size)),
+            ("assembly", self.assembly_size),
+            ("object", Some(self.object_size)),
+            ("image", Some(self.image_size)),
+        ];
+        for (what, size) in sizes {
+            if let Some(size) = size {
+                metadata.push((format!("size.{what}"), size.to_string()));
+            }
+        }
+
+        metadata
+            .into_iter()
+            .map(|(key, value)| (format!("jyafn.compile.{key}"), value))
+            .collect()
+    }
+}
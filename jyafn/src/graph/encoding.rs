@@ -0,0 +1,393 @@
+//! The compact binary encoding of graphs.
+//!
+//! Graphs are serialized with bincode, except for their nodes. Going through `typetag`
+//! for each node writes the name of the type of its operation (and the names of all of
+//! its fields) over and over again and has to look the type up by name when reading it
+//! back. Here, the names of the operation types are written once, in a table, and each
+//! node refers to its entry. References to other nodes are written as the distance to
+//! the referencing node, as variable-length integers, so they mostly take a single byte.
+//!
+//! Graphs in this encoding start with [`HEADER`] and the version of the encoding. Graphs
+//! written by older versions of jyafn start with the length of their name instead, which
+//! is never this big, and are still read.
+
+use serde::de::{self, Visitor};
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::fmt;
+use std::io::Read;
+
+use crate::op::{self, Op};
+use crate::Error;
+
+use super::{Graph, Node, Ref, Type};
+
+/// Starts every encoded graph.
+const HEADER: [u8; 7] = *b"\xffjyafng";
+/// The current version of the encoding, written right after [`HEADER`].
+const VERSION: u8 = 1;
+
+thread_local! {
+    /// Set while decoding a graph written before this encoding existed (or, in tests,
+    /// writing one).
+    static LEGACY: Cell<bool> = const { Cell::new(false) };
+}
+
+/// Encodes a graph.
+pub(super) fn encode(graph: &Graph) -> Result<Vec<u8>, Error> {
+    let mut encoded = HEADER.to_vec();
+    encoded.push(VERSION);
+    bincode::serialize_into(&mut encoded, graph).map_err(Error::Bincode)?;
+    Ok(encoded)
+}
+
+/// Decodes a graph, be it in this encoding or in the previous one.
+pub(super) fn decode<R: Read>(mut reader: R) -> Result<Graph, Error> {
+    let mut start = Vec::with_capacity(HEADER.len() + 1);
+    reader
+        .by_ref()
+        .take(HEADER.len() as u64 + 1)
+        .read_to_end(&mut start)?;
+
+    if start.len() == HEADER.len() + 1 && start[..HEADER.len()] == HEADER {
+        let version = start[HEADER.len()];
+        if version > VERSION {
+            return Err(format!(
+                "graph encoding version {version} is not supported by this version of jyafn"
+            )
+            .into());
+        }
+        return bincode::deserialize_from(reader).map_err(Error::Bincode);
+    }
+
+    LEGACY.with(|legacy| legacy.set(true));
+    scopeguard::defer! {
+        LEGACY.with(|legacy| legacy.set(false));
+    }
+    bincode::deserialize_from(start.as_slice().chain(reader)).map_err(Error::Bincode)
+}
+
+/// How the operations of a given type are written, without `typetag`.
+struct Codec {
+    name: &'static str,
+    encode: fn(&dyn Op, &mut Vec<u8>) -> bincode::Result<()>,
+    decode: fn(&mut &[u8]) -> bincode::Result<Box<dyn Op>>,
+}
+
+macro_rules! codecs {
+    ($($op:ident),* $(,)?) => {
+        /// The operation types with a compact encoding. Operations of other types are
+        /// still written with `typetag`.
+        const CODECS: &[Codec] = &[$(
+            Codec {
+                name: stringify!($op),
+                encode: |operation, buffer| {
+                    let operation = operation
+                        .downcast_ref::<op::$op>()
+                        .expect("codec matches type");
+                    bincode::serialize_into(buffer, operation)
+                },
+                decode: |bytes| {
+                    Ok(Box::new(bincode::deserialize_from::<_, op::$op>(bytes)?))
+                },
+            },
+        )*];
+    };
+}
+
+codecs! {
+    Add, Sub, Mul, Div, Rem, Neg, Abs, Min, Max,
+    Eq, Gt, Lt, Ge, Le,
+    ToBool, ToFloat,
+    Assert, Choose, Not, And, Or,
+    Call, CallGraph, LoadSubgraphOutput,
+    List, ListElementwise, Index, IndexOf, SortedIndexOf,
+    CallMapping, LoadMappingValue, LoadOrDefaultMappingValue,
+    CallResource, LoadMethodOutput,
+}
+
+/// The entry of the table of operation types for operations written with `typetag`.
+const TYPETAG: u8 = 0;
+/// The entry of the table of operation types for operations written with a [`Codec`].
+const COMPACT: u8 = 1;
+
+fn write_varint(buffer: &mut Vec<u8>, mut value: u64) {
+    while value >= 0x80 {
+        buffer.push(value as u8 | 0x80);
+        value >>= 7;
+    }
+    buffer.push(value as u8);
+}
+
+fn read_u8(bytes: &mut &[u8]) -> Result<u8, Error> {
+    let (&byte, rest) = bytes
+        .split_first()
+        .ok_or_else(|| Error::from("unexpected end of encoded nodes".to_string()))?;
+    *bytes = rest;
+    Ok(byte)
+}
+
+fn read_varint(bytes: &mut &[u8]) -> Result<u64, Error> {
+    let mut value = 0;
+    for shift in (0..64).step_by(7) {
+        let byte = read_u8(bytes)?;
+        value |= ((byte & 0x7f) as u64) << shift;
+        if byte < 0x80 {
+            return Ok(value);
+        }
+    }
+    Err("varint in encoded nodes is too long".to_string().into())
+}
+
+fn read_usize(bytes: &mut &[u8]) -> Result<usize, Error> {
+    usize::try_from(read_varint(bytes)?)
+        .map_err(|_| "integer in encoded nodes is too big".to_string().into())
+}
+
+fn write_type(buffer: &mut Vec<u8>, ty: Type) {
+    match ty {
+        Type::Float => buffer.push(0),
+        Type::Bool => buffer.push(1),
+        Type::Symbol => buffer.push(2),
+        Type::Ptr { origin } => {
+            buffer.push(3);
+            write_varint(buffer, origin as u64);
+        }
+        Type::DateTime => buffer.push(4),
+    }
+}
+
+fn read_type(bytes: &mut &[u8]) -> Result<Type, Error> {
+    Ok(match read_u8(bytes)? {
+        0 => Type::Float,
+        1 => Type::Bool,
+        2 => Type::Symbol,
+        3 => Type::Ptr {
+            origin: read_usize(bytes)?,
+        },
+        4 => Type::DateTime,
+        tag => return Err(format!("unknown type tag {tag} in encoded nodes").into()),
+    })
+}
+
+/// Node references are written relative to the node referencing them.
+fn write_ref(buffer: &mut Vec<u8>, node_id: usize, r: Ref) {
+    match r {
+        Ref::Input(input_id) => {
+            buffer.push(0);
+            write_varint(buffer, input_id as u64);
+        }
+        Ref::Const(ty, value) => {
+            buffer.push(1);
+            write_type(buffer, ty);
+            buffer.extend(value.to_le_bytes());
+        }
+        Ref::Node(id) => {
+            // Zigzag, just in case the node is not a previous one.
+            let distance = node_id as i64 - id as i64;
+            buffer.push(2);
+            write_varint(buffer, ((distance << 1) ^ (distance >> 63)) as u64);
+        }
+    }
+}
+
+fn read_ref(bytes: &mut &[u8], node_id: usize) -> Result<Ref, Error> {
+    Ok(match read_u8(bytes)? {
+        0 => Ref::Input(read_usize(bytes)?),
+        1 => {
+            let ty = read_type(bytes)?;
+            if bytes.len() < 8 {
+                return Err("unexpected end of encoded nodes".to_string().into());
+            }
+            let (value, rest) = bytes.split_at(8);
+            *bytes = rest;
+            Ref::Const(
+                ty,
+                u64::from_le_bytes(value.try_into().expect("has 8 bytes")),
+            )
+        }
+        2 => {
+            let zigzag = read_varint(bytes)?;
+            let distance = (zigzag >> 1) as i64 ^ -((zigzag & 1) as i64);
+            Ref::Node((node_id as i64 - distance) as usize)
+        }
+        tag => return Err(format!("unknown reference tag {tag} in encoded nodes").into()),
+    })
+}
+
+fn encode_nodes(nodes: &[Node]) -> Result<Vec<u8>, Error> {
+    // The table of operation types, in order of appearance, is only complete at the
+    // end, but it is written first.
+    let mut table = HashMap::<&'static str, (usize, Option<&Codec>)>::new();
+    let mut body = vec![];
+    write_varint(&mut body, nodes.len() as u64);
+    for (node_id, node) in nodes.iter().enumerate() {
+        let name = node.op.typetag_name();
+        let next = table.len();
+        let &mut (index, codec) = table
+            .entry(name)
+            .or_insert_with(|| (next, CODECS.iter().find(|codec| codec.name == name)));
+        write_varint(&mut body, index as u64);
+        if let Some(codec) = codec {
+            (codec.encode)(node.op.as_ref(), &mut body)?;
+        } else {
+            bincode::serialize_into(&mut body, &node.op)?;
+        }
+
+        write_type(&mut body, node.ty);
+        write_varint(&mut body, node.args.len() as u64);
+        for &arg in &node.args {
+            write_ref(&mut body, node_id, arg);
+        }
+    }
+
+    let mut entries = table.into_iter().collect::<Vec<_>>();
+    entries.sort_unstable_by_key(|(_, (index, _))| *index);
+    let mut encoded = vec![];
+    write_varint(&mut encoded, entries.len() as u64);
+    for (name, (_, codec)) in entries {
+        write_varint(&mut encoded, name.len() as u64);
+        encoded.extend(name.as_bytes());
+        encoded.push(if codec.is_some() { COMPACT } else { TYPETAG });
+    }
+    encoded.extend(body);
+
+    Ok(encoded)
+}
+
+fn decode_nodes(mut bytes: &[u8]) -> Result<Vec<Node>, Error> {
+    let bytes = &mut bytes;
+
+    let n_types = read_usize(bytes)?;
+    let mut table = Vec::with_capacity(n_types.min(CODECS.len() * 2));
+    for _ in 0..n_types {
+        let len = read_usize(bytes)?;
+        if bytes.len() < len {
+            return Err("unexpected end of encoded nodes".to_string().into());
+        }
+        let (name, rest) = bytes.split_at(len);
+        *bytes = rest;
+
+        table.push(match read_u8(bytes)? {
+            TYPETAG => None,
+            COMPACT => Some(
+                CODECS
+                    .iter()
+                    .find(|codec| codec.name.as_bytes() == name)
+                    .ok_or_else(|| {
+                        Error::from(format!(
+                            "unknown operation type {}",
+                            String::from_utf8_lossy(name)
+                        ))
+                    })?,
+            ),
+            kind => return Err(format!("unknown operation encoding {kind}").into()),
+        });
+    }
+
+    let n_nodes = read_usize(bytes)?;
+    // Every node takes at least 3 bytes.
+    let mut nodes = Vec::with_capacity(n_nodes.min(bytes.len() / 3));
+    for node_id in 0..n_nodes {
+        let codec = table
+            .get(read_usize(bytes)?)
+            .ok_or_else(|| Error::from("operation type out of bounds".to_string()))?;
+        let op = if let Some(codec) = codec {
+            (codec.decode)(bytes)?
+        } else {
+            bincode::deserialize_from::<_, Box<dyn Op>>(&mut *bytes)?
+        };
+
+        let ty = read_type(bytes)?;
+        let n_args = read_usize(bytes)?;
+        let mut args = Vec::with_capacity(n_args.min(bytes.len()));
+        for _ in 0..n_args {
+            args.push(read_ref(bytes, node_id)?);
+        }
+
+        nodes.push(Node { op, args, ty });
+    }
+
+    if !bytes.is_empty() {
+        return Err("trailing data after encoded nodes".to_string().into());
+    }
+
+    Ok(nodes)
+}
+
+/// Serializes the nodes of a graph compactly in binary formats (see the module
+/// documentation) and as a plain list elsewhere. Use with `#[serde(with = ...)]`.
+pub(super) mod nodes {
+    use super::*;
+
+    pub fn serialize<S: Serializer>(nodes: &[Node], serializer: S) -> Result<S::Ok, S::Error> {
+        if serializer.is_human_readable() || LEGACY.with(Cell::get) {
+            return nodes.serialize(serializer);
+        }
+
+        let encoded = encode_nodes(nodes).map_err(serde::ser::Error::custom)?;
+        serializer.serialize_bytes(&encoded)
+    }
+
+    pub fn deserialize<'de, D: Deserializer<'de>>(deserializer: D) -> Result<Vec<Node>, D::Error> {
+        if deserializer.is_human_readable() || LEGACY.with(Cell::get) {
+            return Vec::<Node>::deserialize(deserializer);
+        }
+
+        deserializer.deserialize_bytes(NodesVisitor)
+    }
+
+    struct NodesVisitor;
+
+    impl<'de> Visitor<'de> for NodesVisitor {
+        type Value = Vec<Node>;
+
+        fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+            write!(f, "encoded nodes")
+        }
+
+        fn visit_bytes<E: de::Error>(self, bytes: &[u8]) -> Result<Vec<Node>, E> {
+            decode_nodes(bytes).map_err(E::custom)
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::layout::{Layout, RefValue};
+
+    fn create_graph() -> Graph {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let mut out = a;
+        for i in 0..100 {
+            let abs = g.insert(op::Abs, vec![out]).unwrap();
+            out = g.insert(op::Add, vec![abs, Ref::from(i as f64)]).unwrap();
+        }
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+
+        g
+    }
+
+    #[test]
+    fn test_encode_decode() {
+        let g = create_graph();
+        let encoded = encode(&g).unwrap();
+        assert_eq!(decode(encoded.as_slice()).unwrap(), g);
+    }
+
+    #[test]
+    fn test_decode_legacy() {
+        let g = create_graph();
+        LEGACY.with(|legacy| legacy.set(true));
+        let legacy = bincode::serialize(&g).unwrap();
+        LEGACY.with(|legacy| legacy.set(false));
+
+        assert!(encode(&g).unwrap().len() * 2 < legacy.len());
+        assert_eq!(decode(legacy.as_slice()).unwrap(), g);
+    }
+}
@@ -0,0 +1,53 @@
+//! Running a graph without compiling it, by evaluating one node at a time with the same
+//! constant evaluation the optimizer uses (see [`Op::const_eval`]). This is much slower
+//! than compiled code, but is available right away (see [`Graph::compile_tiered`]).
+//!
+//! [`Op::const_eval`]: crate::Op::const_eval
+
+use super::{Graph, Ref, SLOT_SIZE};
+
+impl Graph {
+    /// Runs this graph on a raw input, writing the raw output. Returns `None` if some
+    /// node cannot be evaluated as a constant (e.g., mapping calls, lists or failing
+    /// assertions), in which case only the compiled code can run the input and the
+    /// output is left unspecified.
+    ///
+    /// Both sides of every choice are evaluated, so a side that fails when not taken is
+    /// enough to give up.
+    pub(crate) fn interpret(&self, input: &[u8], output: &mut [u8]) -> Option<()> {
+        if self.stripped {
+            return None;
+        }
+
+        let slot_size = SLOT_SIZE.in_bytes();
+        let slot = |id: usize| {
+            let bytes = &input[id * slot_size..][..slot_size];
+            u64::from_ne_bytes(bytes.try_into().expect("slots have 8 bytes"))
+        };
+        let value = |values: &[Ref], r: Ref| match r {
+            Ref::Input(input_id) => Ref::Const(self.inputs[input_id], slot(input_id)),
+            Ref::Node(node_id) => values[node_id],
+            r => r,
+        };
+
+        let mut values = Vec::with_capacity(self.nodes.len());
+        let mut args = vec![];
+        for node in &self.nodes {
+            args.clear();
+            args.extend(node.args.iter().map(|&arg| value(&values, arg)));
+            match node.op.const_eval(self, &args)? {
+                evald @ Ref::Const(..) => values.push(evald),
+                _ => return None,
+            }
+        }
+
+        for (output_id, &r) in self.outputs.iter().enumerate() {
+            let Ref::Const(_, bits) = value(&values, r) else {
+                return None;
+            };
+            output[output_id * slot_size..][..slot_size].copy_from_slice(&bits.to_ne_bytes());
+        }
+
+        Some(())
+    }
+}
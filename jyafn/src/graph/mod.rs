@@ -1,11 +1,16 @@
 mod check;
 mod compile;
+mod encoding;
+mod interpret;
 mod node;
 mod serde;
+mod shared;
+mod stream;
 mod r#type;
 
 pub mod size;
 
+pub use compile::{CodeSource, CompileStats, PassStats};
 pub use node::{Node, Ref};
 pub use r#type::{Type, SLOT_SIZE};
 
@@ -16,6 +21,7 @@ use std::{
     collections::HashMap,
     error::Error as StdError,
     fmt::Debug,
+    hash::{DefaultHasher, Hash, Hasher},
     pin::Pin,
     sync::atomic::{AtomicUsize, Ordering},
     sync::Arc,
@@ -45,6 +51,7 @@ pub struct Graph {
     pub(crate) input_layout: Struct,
     pub(crate) output_layout: Layout,
     pub(crate) inputs: Vec<Type>,
+    #[serde(with = "encoding::nodes")]
     pub(crate) nodes: Vec<Node>,
     pub(crate) outputs: Vec<Ref>,
     pub(crate) symbols: Symbols,
@@ -52,6 +59,18 @@ pub struct Graph {
     pub(crate) mappings: HashMap<String, Arc<mapping::Mapping>>,
     pub(crate) resources: HashMap<String, Arc<ResourceContainer>>,
     pub(crate) subgraphs: Vec<Graph>,
+    /// The heap size of the mappings and resources this graph reused from other graphs
+    /// already loaded in this process when it was loaded (see [`Graph::load`]).
+    #[serde(skip)]
+    pub(crate) shared_size: usize,
+    /// The ids of the subgraphs, by their [`Graph::structural_hash`]. This is built as
+    /// subgraphs are inserted (or, after loading, on the first insertion).
+    #[serde(skip)]
+    pub(crate) subgraph_index: HashMap<u64, Vec<usize>>,
+    /// Whether the nodes of this graph were dropped, keeping only what compiled code
+    /// needs to run (see [`Graph::strip`]).
+    #[serde(skip)]
+    pub(crate) stripped: bool,
 }
 
 impl PartialEq for Graph {
@@ -100,6 +119,41 @@ impl Graph {
         Graph::new_with_name(format!("g{graph_id}"))
     }
 
+    /// Drops everything in this graph (and in its subgraphs) that is only needed to
+    /// build, optimize and compile it, i.e., the nodes and outputs, keeping what the
+    /// compiled code needs at runtime: layouts, symbols, error messages, metadata,
+    /// mappings and resources. Afterwards, the graph can no longer be rendered, compiled
+    /// or dumped.
+    pub(crate) fn strip(&mut self) {
+        self.nodes = vec![];
+        self.outputs = vec![];
+        self.subgraph_index = HashMap::new();
+        // Compiled code still points to the mappings and resources of subgraphs.
+        for subgraph in &mut self.subgraphs {
+            subgraph.strip();
+        }
+        self.stripped = true;
+    }
+
+    /// Whether this graph is only what remained of a graph after compilation, which is
+    /// enough to run the compiled code, but not to compile it again. See
+    /// [`crate::Function::strip`].
+    pub fn is_stripped(&self) -> bool {
+        self.stripped
+    }
+
+    /// Fails if this graph was stripped of its nodes (see [`Graph::is_stripped`]).
+    pub(crate) fn check_not_stripped(&self) -> Result<(), Error> {
+        if self.stripped {
+            return Err(Error::Other(format!(
+                "graph {:?} was stripped after compilation and only runs as compiled code",
+                self.name
+            )));
+        }
+
+        Ok(())
+    }
+
     /// Gets the name of the graph.
     pub fn name(&self) -> &str {
         &self.name
@@ -153,15 +207,25 @@ impl Graph {
     /// Inserts a new operation in the graph and returns the reference associated with it.
     pub fn insert<O: Op>(&mut self, op: O, args: Vec<Ref>) -> Result<Ref, Error> {
         let current_id = self.nodes.len();
-        // Need to do this (quite inefficient way) because of borrowing.
-        let error_msg = format!("initializing node for {op:?} on {args:?}");
-
-        self.nodes
-            .push(Node::init(current_id, self, op, args).with_context(|| error_msg)?);
+        self.nodes.push(Node::init(current_id, self, op, args)?);
 
         Ok(Ref::Node(current_id))
     }
 
+    /// Inserts a sequence of new operations in the graph, in order, and returns the
+    /// references associated with them. This is the same as calling [`Graph::insert`]
+    /// for each operation, except that room for all the new nodes is made at once. If
+    /// some operation fails, the operations before it stay in the graph.
+    pub fn insert_many<O, I>(&mut self, ops: I) -> Result<Vec<Ref>, Error>
+    where
+        O: Op,
+        I: IntoIterator<Item = (O, Vec<Ref>)>,
+    {
+        let ops = ops.into_iter();
+        self.nodes.reserve(ops.size_hint().0);
+        ops.map(|(op, args)| self.insert(op, args)).collect()
+    }
+
     fn push_input(&mut self, ty: Type) -> Ref {
         let current_id = self.inputs.len();
         self.inputs.push(ty);
@@ -520,13 +584,51 @@ impl Graph {
             .ok_or_else(|| "building ref-value for call {method_name} on {name}".to_string())?)
     }
 
-    /// Inserts a new subgraph in the graph, returning the id associated with it.
+    /// A hash of the structure of this graph: its name, inputs, nodes, outputs, errors
+    /// and subgraphs. Equal graphs have equal hashes. Operations are only hashed by their
+    /// kind, so different graphs may still collide.
+    pub(crate) fn structural_hash(&self) -> u64 {
+        let mut hasher = DefaultHasher::new();
+        self.name.hash(&mut hasher);
+        self.inputs.hash(&mut hasher);
+        for node in &self.nodes {
+            node.op.as_any().type_id().hash(&mut hasher);
+            node.args.hash(&mut hasher);
+            node.ty.hash(&mut hasher);
+        }
+        self.outputs.hash(&mut hasher);
+        self.errors.hash(&mut hasher);
+        for subgraph in &self.subgraphs {
+            subgraph.structural_hash().hash(&mut hasher);
+        }
+        hasher.finish()
+    }
+
+    /// Inserts a new subgraph in the graph, returning the id associated with it. If an
+    /// equal subgraph was already inserted, its id is returned instead.
     pub fn insert_subgraph(&mut self, subgraph: Graph) -> usize {
-        if let Some(exitsting) = self.subgraphs.iter().position(|g| g == &subgraph) {
-            return exitsting;
+        // Index the subgraphs that are not indexed yet (e.g., after loading):
+        let n_indexed = self.subgraph_index.values().map(Vec::len).sum::<usize>();
+        for (graph_id, existing) in self.subgraphs.iter().enumerate().skip(n_indexed) {
+            self.subgraph_index
+                .entry(existing.structural_hash())
+                .or_default()
+                .push(graph_id);
+        }
+
+        let candidates = self
+            .subgraph_index
+            .entry(subgraph.structural_hash())
+            .or_default();
+        if let Some(&existing) = candidates
+            .iter()
+            .find(|&&graph_id| self.subgraphs[graph_id] == subgraph)
+        {
+            return existing;
         }
 
         let graph_id = self.subgraphs.len();
+        candidates.push(graph_id);
         self.subgraphs.push(subgraph);
         graph_id
     }
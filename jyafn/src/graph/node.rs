@@ -3,13 +3,13 @@ use serde_derive::{Deserialize, Serialize};
 use std::cmp::PartialEq;
 use std::fmt::{self, Display};
 
-use crate::{Error, Op};
+use crate::{Context, Error, Op};
 
 use super::Graph;
 use super::Type;
 
 /// A reference to a value in a graph.
-#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, GetSize)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Serialize, Deserialize, GetSize)]
 pub enum Ref {
     /// A reference to the input of a given id.
     Input(usize),
@@ -102,7 +102,9 @@ impl Node {
     ) -> Result<Node, Error> {
         let arg_types = args.iter().map(|r| graph.type_of(*r)).collect::<Vec<_>>();
         let Some(ty) = op.annotate(node_id, graph, &arg_types) else {
-            return Err(Error::Type(Box::new(op), arg_types));
+            // Only formatted when needed, since nodes are inserted by the thousands.
+            let context = format!("initializing node for {op:?} on {args:?}");
+            return Err(Error::Type(Box::new(op), arg_types)).context(&context);
         };
 
         Ok(Node {
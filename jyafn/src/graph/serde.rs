@@ -1,34 +1,153 @@
+use get_size::GetSize;
+use serde::Serialize;
 use std::collections::HashMap;
 use std::io::{Read, Seek, Write};
+use std::path::Path;
+use std::sync::Arc;
 use zip::write::SimpleFileOptions;
+use zip::{CompressionMethod, ZipArchive};
 
+use crate::utils::mmap::MappedFile;
 use crate::Error;
 
+use super::encoding;
+use super::shared::{self, HashingReader, Key};
+use super::stream::{self, StreamReader, StreamWriter};
 use super::{check, Graph};
 
+/// The directory in the archive holding native code for the current target.
+fn native_prefix() -> String {
+    format!(
+        "native/{}-{}/",
+        std::env::consts::ARCH,
+        std::env::consts::OS
+    )
+}
+
+/// The key under which the entry `id` of the archive is shared, as read into something
+/// described by `description`. Entries that are used straight from the memory-mapped
+/// file, i.e., stored uncompressed for something `mappable`, are keyed on where they
+/// are in the file and never read here. All others are read through once to be hashed.
+fn entry_key<R: Read + Seek, T: Serialize>(
+    archive: &mut ZipArchive<R>,
+    id: usize,
+    mapped: Option<&Arc<MappedFile>>,
+    mappable: bool,
+    description: &T,
+) -> Result<Key, Error> {
+    let file = archive.by_index(id)?;
+    match mapped.and_then(|mapped| mapped.id()) {
+        Some(mapped) if mappable && file.compression() == CompressionMethod::Stored => {
+            let start = file.data_start() as usize;
+            Key::mapped(mapped, start..start + file.size() as usize, description)
+        }
+        _ => Key::new(file, description),
+    }
+}
+
 impl Graph {
     /// Writes a binary representation of the graph to the supplied writer.
     pub fn dump<W: Write + Seek>(&self, writer: W) -> Result<(), Error> {
-        let mut writer = zip::ZipWriter::new(writer);
+        self.do_dump(writer, None)
+    }
+
+    /// Writes a binary representation of the graph to the supplied writer, together
+    /// with the graph compiled to native code for the current target. Loading the
+    /// result with [`crate::Function::load`] with the same jyafn version on the same
+    /// target skips compilation altogether, but only where native code in graph files is
+    /// trusted (see [`crate::native`]). Elsewhere, the graph is compiled as usual.
+    pub fn dump_native<W: Write + Seek>(&self, writer: W) -> Result<(), Error> {
+        self.do_dump(writer, Some(self.compile_object()?))
+    }
 
-        writer.start_file("graph", SimpleFileOptions::default())?;
-        bincode::serialize_into(&mut writer, self).map_err(Error::Bincode)?;
+    /// Writes a binary representation of the graph to the supplied writer, in a format
+    /// that never needs seeking, neither to write nor to read. Each part of the graph is
+    /// written as soon as it is serialized, so only one of them needs to be in memory
+    /// at a time. Use this to upload graphs straight to where they are stored. The
+    /// result can be loaded with [`Graph::load_stream`] as it is downloaded, but also
+    /// with any other of the loading functions.
+    pub fn dump_stream<W: Write>(&self, writer: W) -> Result<(), Error> {
+        self.do_dump_stream(writer, None)
+    }
+
+    /// Same as [`Graph::dump_stream`], but with native code, as in [`Graph::dump_native`].
+    pub fn dump_stream_native<W: Write>(&self, writer: W) -> Result<(), Error> {
+        self.do_dump_stream(writer, Some(self.compile_object()?))
+    }
+
+    /// Goes through each entry of the binary representation of the graph, in order,
+    /// with its name, whether it should be stored uncompressed and its contents.
+    fn dump_entries<F>(&self, native: Option<(String, Vec<u8>)>, mut put: F) -> Result<(), Error>
+    where
+        F: FnMut(&str, bool, &[u8]) -> Result<(), Error>,
+    {
+        self.check_not_stripped()?;
+        put("graph", false, &encoding::encode(self)?)?;
 
         // This is the authoritative value of metadata. Why? Because it's easy to load without
         // bloating the memory.
-        writer.start_file("metadata.json", SimpleFileOptions::default())?;
-        serde_json::to_writer(&mut writer, &self.metadata).map_err(Error::Json)?;
+        put(
+            "metadata.json",
+            false,
+            &serde_json::to_vec(&self.metadata).map_err(Error::Json)?,
+        )?;
 
         for (name, mapping) in &self.mappings {
-            writer.start_file(format!("{name}.mapping"), SimpleFileOptions::default())?;
-            writer.write_all(&mapping.dump())?;
+            // Mappable storages need to be stored as-is to be used from mapped files.
+            put(
+                &format!("{name}.mapping"),
+                mapping.is_mappable(),
+                &mapping.dump()?,
+            )?;
         }
 
         for (name, resources) in &self.resources {
-            writer.start_file(format!("{name}.resource"), SimpleFileOptions::default())?;
-            writer.write_all(&resources.dump()?)?;
+            put(
+                &format!("{name}.resource"),
+                resources.is_mappable(),
+                &resources.dump()?,
+            )?;
+        }
+
+        if let Some((key, object)) = native {
+            put(&format!("{}{key}.o", native_prefix()), false, &object)?;
         }
 
+        Ok(())
+    }
+
+    fn do_dump<W: Write + Seek>(
+        &self,
+        writer: W,
+        native: Option<(String, Vec<u8>)>,
+    ) -> Result<(), Error> {
+        let mut writer = zip::ZipWriter::new(writer);
+
+        self.dump_entries(native, |name, stored, contents| {
+            let options = if stored {
+                SimpleFileOptions::default().compression_method(CompressionMethod::Stored)
+            } else {
+                SimpleFileOptions::default()
+            };
+            writer.start_file(name, options)?;
+            writer.write_all(contents)?;
+            Ok(())
+        })?;
+
+        writer.finish()?;
+
+        Ok(())
+    }
+
+    fn do_dump_stream<W: Write>(
+        &self,
+        writer: W,
+        native: Option<(String, Vec<u8>)>,
+    ) -> Result<(), Error> {
+        let mut writer = StreamWriter::new(writer)?;
+        self.dump_entries(native, |name, _, contents| {
+            writer.write_entry(name, contents)
+        })?;
         writer.finish()?;
 
         Ok(())
@@ -36,8 +155,14 @@ impl Graph {
 
     /// Loads only the metadata of a graph. This is quicker and takes less memory than
     /// loading the whole graph and reading its metadata.
-    pub fn load_metadata<R: Read + Seek>(reader: R) -> Result<HashMap<String, String>, Error> {
-        let mut archive = zip::ZipArchive::new(reader)?;
+    pub fn load_metadata<R: Read + Seek>(mut reader: R) -> Result<HashMap<String, String>, Error> {
+        if stream::is_stream(&mut reader)? {
+            let metadata = stream::read_entry(&mut reader, "metadata.json")?
+                .ok_or_else(|| Error::from("stream has no metadata".to_string()))?;
+            return serde_json::from_slice(&metadata).map_err(Error::Json);
+        }
+
+        let mut archive = ZipArchive::new(reader)?;
         let file = archive.by_name("metadata.json")?;
         let metadata: HashMap<String, String> =
             serde_json::from_reader(file).map_err(Error::Json)?;
@@ -47,11 +172,19 @@ impl Graph {
 
     /// Loads a graph in an unintialized state. This is quicker, since extra resources are
     /// not loader. However, you will not be able to compile the resulting graph.
-    pub fn load_uninitialized<R: Read + Seek>(reader: R) -> Result<Self, Error> {
-        let mut archive = zip::ZipArchive::new(reader)?;
+    pub fn load_uninitialized<R: Read + Seek>(mut reader: R) -> Result<Self, Error> {
+        if stream::is_stream(&mut reader)? {
+            let graph = stream::read_entry(&mut reader, "graph")?
+                .ok_or_else(|| Error::from("stream has no graph".to_string()))?;
+            let mut graph = encoding::decode(graph.as_slice())?;
+            graph.metadata = Self::load_metadata(reader)?;
+            return Ok(graph);
+        }
+
+        let mut archive = ZipArchive::new(reader)?;
 
         let file = archive.by_name("graph")?;
-        let mut graph: Graph = bincode::deserialize_from(file).map_err(Error::Bincode)?;
+        let mut graph = encoding::decode(file)?;
 
         let file = archive.by_name("metadata.json")?;
         let metadata: HashMap<String, String> =
@@ -62,11 +195,178 @@ impl Graph {
     }
 
     /// Loads a graph from the supplied reader.
+    ///
+    /// Mappings and resources that are identical to ones held by other graphs already
+    /// loaded in this process are not read again, but shared with these graphs.
     pub fn load<R: Read + Seek>(reader: R) -> Result<Self, Error> {
-        let mut archive = zip::ZipArchive::new(reader)?;
+        let (graph, _) = Self::load_with_native(reader)?;
+        Ok(graph)
+    }
+
+    /// Loads a graph from the supplied reader, together with the native code for the
+    /// current target stored alongside it, if any. The native code is given with the
+    /// cache key it was stored under. Native code is only read if trusted (see
+    /// [`crate::native`]); otherwise, it is ignored.
+    pub(crate) fn load_with_native<R: Read + Seek>(
+        reader: R,
+    ) -> Result<(Self, Option<(String, Vec<u8>)>), Error> {
+        Self::do_load(reader, None, false)
+    }
+
+    /// Loads a graph from the file at the supplied path, which is memory-mapped. The
+    /// mappings whose storage supports it (see [`crate::mapping::MappedStorage`]) are
+    /// used directly from the mapped file, instead of being read into memory. Their
+    /// memory is then shared by all processes loading the same file. Likewise, resources
+    /// whose type supports it are created straight out of the mapped file (see
+    /// [`crate::resource::ResourceType::from_mapped`]).
+    pub fn load_mapped<P: AsRef<Path>>(path: P) -> Result<Self, Error> {
+        let (graph, _) = Self::load_mapped_with_native(path)?;
+        Ok(graph)
+    }
+
+    /// Same as [`Graph::load_mapped`], also returning the native code stored in the file
+    /// (see [`Graph::load_with_native`]).
+    pub(crate) fn load_mapped_with_native<P: AsRef<Path>>(
+        path: P,
+    ) -> Result<(Self, Option<(String, Vec<u8>)>), Error> {
+        let file = Arc::new(MappedFile::open(path)?);
+        Self::do_load(std::io::Cursor::new(&file[..]), Some(&file), false)
+    }
+
+    /// Loads a graph from the file at the supplied path, which is memory-mapped (see
+    /// [`Graph::load_mapped`]), without reading the data of any mapping. Each mapping is
+    /// only read the first time it is accessed. For functions, laziness is per function
+    /// and not per mapping: the first call reads every mapping that the function can
+    /// call, whatever branch the call takes, since the machine code cannot tell a
+    /// mapping that failed to read from a missing key. Mappings that the function never
+    /// calls stay unread. This makes loading graphs with big mappings much quicker and
+    /// saves the memory of the mappings of functions that are never called, at the
+    /// expense of a slower first call. Errors reading mappings are only
+    /// found when they are accessed (or with [`crate::mapping::Mapping::materialize`]):
+    /// every call of a function with such a mapping fails with the error, while
+    /// [`crate::mapping::Mapping::get`] finds no key at all.
+    ///
+    /// Resources are still read right away, since compiling the graph needs them. Unlike
+    /// resources, mappings loaded lazily are never shared with other graphs (see
+    /// [`Graph::load`]).
+    pub fn load_lazy<P: AsRef<Path>>(path: P) -> Result<Self, Error> {
+        let (graph, _) = Self::load_lazy_with_native(path)?;
+        Ok(graph)
+    }
+
+    /// Same as [`Graph::load_lazy`], also returning the native code stored in the file
+    /// (see [`Graph::load_with_native`]).
+    pub(crate) fn load_lazy_with_native<P: AsRef<Path>>(
+        path: P,
+    ) -> Result<(Self, Option<(String, Vec<u8>)>), Error> {
+        let file = Arc::new(MappedFile::open(path)?);
+        Self::do_load(std::io::Cursor::new(&file[..]), Some(&file), true)
+    }
+
+    /// Loads a graph dumped with [`Graph::dump_stream`] from the supplied reader, which
+    /// is read only once, from start to end. Each part of the graph is deserialized as
+    /// soon as it is read, e.g., while the rest of it is still being downloaded, and
+    /// it is never all held in memory at once.
+    ///
+    /// Graphs dumped with [`Graph::dump`] can also be loaded with this function, but
+    /// they are read to the end before anything else is done.
+    pub fn load_stream<R: Read>(reader: R) -> Result<Self, Error> {
+        let (graph, _) = Self::load_stream_with_native(reader)?;
+        Ok(graph)
+    }
+
+    /// Same as [`Graph::load_stream`], also returning the native code stored in the
+    /// stream (see [`Graph::load_with_native`]).
+    pub(crate) fn load_stream_with_native<R: Read>(
+        reader: R,
+    ) -> Result<(Self, Option<(String, Vec<u8>)>), Error> {
+        let mut stream = match StreamReader::new(reader)? {
+            Ok(stream) => stream,
+            Err((mut buffer, mut reader)) => {
+                // Probably a zip archive, which cannot be read without seeking.
+                reader.read_to_end(&mut buffer)?;
+                return Self::do_load(std::io::Cursor::new(buffer), None, false);
+            }
+        };
+        let mut graph: Option<Graph> = None;
+        let mut native = None;
+        let prefix = native_prefix();
+
+        while let Some(mut entry) = stream.next_entry()? {
+            let name = entry.name().to_string();
+            if name == "graph" {
+                graph = Some(encoding::decode(&mut entry)?);
+                continue;
+            }
+            // The graph always comes first.
+            let Some(graph) = graph.as_mut() else {
+                return Err(format!("stream entry {name} comes before the graph").into());
+            };
+
+            if name == "metadata.json" {
+                graph.metadata = serde_json::from_reader(&mut entry).map_err(Error::Json)?;
+            } else if let Some(mapping) = name
+                .strip_suffix(".mapping")
+                .and_then(|name| graph.mappings.get_mut(name))
+            {
+                // Entries of a stream can only be read once, as they arrive, so these
+                // are always read and only then shared.
+                let mut hashing = HashingReader::new(&mut entry);
+                let read = mapping.read_stream(&mut hashing)?;
+                let (loaded, reused) = shared::MAPPINGS.share(hashing.key(&**mapping)?, read);
+
+                if reused {
+                    graph.shared_size += loaded.get_size();
+                }
+                *mapping = loaded;
+            } else if let Some(resource) = name
+                .strip_suffix(".resource")
+                .and_then(|name| graph.resources.get_mut(name))
+            {
+                let mut hashing = HashingReader::new(&mut entry);
+                let read = resource.read_stream(&mut hashing)?;
+                let (loaded, reused) = shared::RESOURCES.share(hashing.key(&**resource)?, read);
+
+                if reused {
+                    graph.shared_size += loaded.get_size();
+                }
+                *resource = loaded;
+            } else if let Some(key) = name
+                .strip_prefix(&prefix)
+                .and_then(|name| name.strip_suffix(".o"))
+                .filter(|_| crate::native::is_trusted())
+            {
+                let mut object = Vec::with_capacity(entry.size() as usize);
+                entry.read_to_end(&mut object)?;
+                native = Some((key.to_string(), object));
+            }
+        }
+
+        let mut graph = graph.ok_or_else(|| Error::from("stream has no graph".to_string()))?;
+        check::run_checks(&mut graph)?;
+
+        Ok((graph, native))
+    }
+
+    /// Loads a graph out of the supplied reader. If the reader reads from a mapped file,
+    /// the file is also supplied, so that mappings can be used directly from it or, if
+    /// `lazy` is set, read from it only when accessed.
+    ///
+    /// Graphs dumped with [`Graph::dump_stream`] are also accepted, but then always read
+    /// into memory right away.
+    fn do_load<R: Read + Seek>(
+        mut reader: R,
+        mapped: Option<&Arc<MappedFile>>,
+        lazy: bool,
+    ) -> Result<(Self, Option<(String, Vec<u8>)>), Error> {
+        if stream::is_stream(&mut reader)? {
+            return Self::load_stream_with_native(reader);
+        }
+
+        let mut archive = ZipArchive::new(reader)?;
 
         let file = archive.by_name("graph")?;
-        let mut graph: Graph = bincode::deserialize_from(file).map_err(Error::Bincode)?;
+        let mut graph = encoding::decode(file)?;
 
         let file = archive.by_name("metadata.json")?;
         let metadata: HashMap<String, String> =
@@ -82,7 +382,22 @@ impl Graph {
                 continue;
             };
 
-            *mapping = mapping.read(file)?.into();
+            if let (Some(mapped), true) = (mapped, lazy) {
+                // Not shared: telling whether some loaded mapping holds the same data
+                // would mean reading all of it right away.
+                *mapping = Arc::new(mapping.read_lazy(mapped.clone(), file.name().to_string()));
+                continue;
+            }
+
+            drop(file);
+            let key = entry_key(&mut archive, id, mapped, mapping.is_mappable(), &**mapping)?;
+            let (loaded, reused) = shared::MAPPINGS
+                .get_or_read(key, || mapping.read(archive.by_index(id)?, mapped))?;
+
+            if reused {
+                graph.shared_size += loaded.get_size();
+            }
+            *mapping = loaded;
         }
 
         for id in 0..archive.len() {
@@ -94,12 +409,44 @@ impl Graph {
                 continue;
             };
 
-            *resource = resource.read(file)?.into();
+            drop(file);
+            let key = entry_key(
+                &mut archive,
+                id,
+                mapped,
+                resource.is_mappable(),
+                &**resource,
+            )?;
+            let (loaded, reused) = shared::RESOURCES
+                .get_or_read(key, || resource.read(archive.by_index(id)?, mapped))?;
+
+            if reused {
+                graph.shared_size += loaded.get_size();
+            }
+            *resource = loaded;
+        }
+
+        let mut native = None;
+        let prefix = native_prefix();
+        for id in (0..archive.len()).filter(|_| crate::native::is_trusted()) {
+            let mut file = archive.by_index(id)?;
+            let Some(key) = file
+                .name()
+                .strip_prefix(&prefix)
+                .and_then(|name| name.strip_suffix(".o"))
+                .map(str::to_owned)
+            else {
+                continue;
+            };
+
+            let mut object = Vec::with_capacity(file.size() as usize);
+            file.read_to_end(&mut object)?;
+            native = Some((key, object));
         }
 
         check::run_checks(&mut graph)?;
 
-        Ok(graph)
+        Ok((graph, native))
     }
 
     /// Creates a JSON representation of this graph.
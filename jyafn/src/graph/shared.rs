@@ -0,0 +1,170 @@
+//! A process-wide registry of the mappings and resources loaded with graphs.
+//!
+//! Graphs loaded by the same process often hold the very same mapping or resource (think
+//! of many variants of a model, all sharing the same embeddings). When a graph is loaded,
+//! its mappings and resources are looked up here by the file they are read from and, if
+//! some other graph has already loaded the same file, reused instead of being read again.
+//! The registry only holds weak references, so that mappings and resources are still
+//! freed as soon as no graph uses them anymore.
+//!
+//! Files are identified by the SHA-256 of their contents, together with the serialized
+//! description of what is read out of them (layouts and storage type or resource type).
+//! Checksums recorded in the archive, such as CRC-32, are not enough to tell two files
+//! apart: a collision would silently swap the data of one mapping or resource for that of
+//! another. Finding a match therefore reads the data once, but only to hash it, which is
+//! much cheaper than building the mapping or resource out of it again.
+//!
+//! Files used straight from a memory-mapped archive are the exception: hashing them
+//! would read all of what mapping them avoids reading. These are identified instead by
+//! the archive they live in and where in it they are, which only matches when the very
+//! same bytes on disk are mapped again.
+
+use serde::Serialize;
+use sha2::{Digest, Sha256};
+use std::collections::HashMap;
+use std::io::{self, Read};
+use std::ops::Range;
+use std::sync::{Arc, Mutex, Weak};
+
+use crate::mapping::Mapping;
+use crate::resource::ResourceContainer;
+use crate::utils::mmap::FileId;
+use crate::Error;
+
+lazy_static::lazy_static! {
+    /// The mappings loaded in this process.
+    pub(super) static ref MAPPINGS: Registry<Mapping> = Registry::default();
+    /// The resources loaded in this process.
+    pub(super) static ref RESOURCES: Registry<ResourceContainer> = Registry::default();
+}
+
+/// What identifies the contents of a file, together with what is read out of it.
+#[derive(Debug, PartialEq, Eq, Hash)]
+pub(super) struct Key {
+    contents: Contents,
+    description: Vec<u8>,
+}
+
+/// What identifies the contents of a file.
+#[derive(Debug, PartialEq, Eq, Hash)]
+enum Contents {
+    /// Contents read into memory, by their hash.
+    Sha256([u8; 32]),
+    /// Contents used straight from a memory-mapped file, by where they are in it.
+    Mapped { file: FileId, range: Range<usize> },
+}
+
+impl Key {
+    /// The key for reading the data in `reader` into something described by
+    /// `description`. This reads `reader` to the end.
+    pub(super) fn new<T: Serialize>(reader: impl Read, description: &T) -> Result<Key, Error> {
+        let mut hashing = HashingReader::new(reader);
+        io::copy(&mut hashing, &mut io::sink())?;
+        hashing.key(description)
+    }
+
+    /// The key for using the data in `range` of a memory-mapped file as something
+    /// described by `description`. Nothing is read.
+    pub(super) fn mapped<T: Serialize>(
+        file: FileId,
+        range: Range<usize>,
+        description: &T,
+    ) -> Result<Key, Error> {
+        Ok(Key {
+            contents: Contents::Mapped { file, range },
+            description: describe(description)?,
+        })
+    }
+}
+
+fn describe<T: Serialize>(description: &T) -> Result<Vec<u8>, Error> {
+    bincode::serialize(description).map_err(Error::Bincode)
+}
+
+/// A reader that hashes everything read through it, so that the key of some data can be
+/// known after reading it only once.
+pub(super) struct HashingReader<R> {
+    reader: R,
+    hasher: Sha256,
+}
+
+impl<R: Read> HashingReader<R> {
+    pub(super) fn new(reader: R) -> Self {
+        HashingReader {
+            reader,
+            hasher: Sha256::new(),
+        }
+    }
+
+    /// The key for the data in the underlying reader, read into something described by
+    /// `description`. Whatever was not read yet is read here.
+    pub(super) fn key<T: Serialize>(mut self, description: &T) -> Result<Key, Error> {
+        io::copy(&mut self, &mut io::sink())?;
+        Ok(Key {
+            contents: Contents::Sha256(self.hasher.finalize().into()),
+            description: describe(description)?,
+        })
+    }
+}
+
+impl<R: Read> Read for HashingReader<R> {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let read = self.reader.read(buf)?;
+        self.hasher.update(&buf[..read]);
+        Ok(read)
+    }
+}
+
+/// The values of a given type that are currently loaded, by the key of the file they
+/// were read from.
+#[derive(Debug)]
+pub(super) struct Registry<T>(Mutex<HashMap<Key, Weak<T>>>);
+
+impl<T> Default for Registry<T> {
+    fn default() -> Self {
+        Registry(Mutex::new(HashMap::new()))
+    }
+}
+
+impl<T> Registry<T> {
+    /// Gets the value read from the file with the given key, if it is still loaded, or
+    /// reads it with `read` and registers it otherwise. Also returns whether the value
+    /// was already loaded.
+    pub(super) fn get_or_read<F>(&self, key: Key, read: F) -> Result<(Arc<T>, bool), Error>
+    where
+        F: FnOnce() -> Result<T, Error>,
+    {
+        if let Some(loaded) = self.get(&key) {
+            return Ok((loaded, true));
+        }
+
+        // Not holding the lock while reading, which may take a while. Two graphs
+        // loading the same file at the same time might end up reading it twice, but
+        // only the first one to finish gets registered.
+        Ok(self.share(key, read()?))
+    }
+
+    /// Registers a value that was already read, unless some other value read from a
+    /// file with the same key is still loaded, in which case that one is returned
+    /// instead. Also returns whether the value was already loaded.
+    pub(super) fn share(&self, key: Key, read: T) -> (Arc<T>, bool) {
+        let mut registry = self.0.lock().expect("poisoned");
+        if let Some(loaded) = registry.get(&key).and_then(Weak::upgrade) {
+            return (loaded, true);
+        }
+
+        let read = Arc::new(read);
+        registry.retain(|_, value| value.strong_count() > 0);
+        registry.insert(key, Arc::downgrade(&read));
+
+        (read, false)
+    }
+
+    fn get(&self, key: &Key) -> Option<Arc<T>> {
+        self.0
+            .lock()
+            .expect("poisoned")
+            .get(key)
+            .and_then(Weak::upgrade)
+    }
+}
@@ -0,0 +1,337 @@
+//! A container format for graphs that is written and read sequentially, without ever
+//! seeking.
+//!
+//! Zip archives need seeking both ways: writers go back to fill in the sizes of each
+//! entry and readers start from the central directory, at the end of the file. Uploads
+//! to and downloads from object storage cannot do either. In this format, each entry is
+//! written at once, preceded by its name, size and CRC-32, so that it can be used as
+//! soon as it is read. An index of all entries is written at the end, so that readers
+//! that _can_ seek find single entries without going through the whole stream.
+//!
+//! The layout is as follows (all integers are little-endian):
+//! ```text
+//! magic
+//! for each entry: 0x01, name length (u16), name, size (u64), CRC-32 (u32), data
+//! 0x00, number of entries (u64)
+//! for each entry: name length (u16), name, data offset (u64), size (u64), CRC-32 (u32)
+//! index offset (u64), magic
+//! ```
+
+use std::io::{Read, Seek, SeekFrom, Write};
+
+use crate::Error;
+
+/// Starts and ends every stream. The last byte is the version of the format.
+const MAGIC: [u8; 8] = *b"jyafnst\x01";
+
+/// Precedes each entry.
+const ENTRY_TAG: u8 = 1;
+/// Precedes the index, after the last entry.
+const INDEX_TAG: u8 = 0;
+
+/// Whether the reader, from its current position on, holds a stream. The reader is put
+/// back where it was.
+pub(super) fn is_stream<R: Read + Seek>(reader: &mut R) -> Result<bool, Error> {
+    let start = reader.stream_position()?;
+    let mut magic = [0; MAGIC.len()];
+    let is_stream = match reader.read_exact(&mut magic) {
+        Ok(()) => magic == MAGIC,
+        Err(err) if err.kind() == std::io::ErrorKind::UnexpectedEof => false,
+        Err(err) => return Err(err.into()),
+    };
+    reader.seek(SeekFrom::Start(start))?;
+    Ok(is_stream)
+}
+
+/// Reads the entry with the given name out of a stream starting at the reader's current
+/// position, using the index at the end of the stream, or `None` if there is no such
+/// entry.
+pub(super) fn read_entry<R: Read + Seek>(
+    reader: &mut R,
+    name: &str,
+) -> Result<Option<Vec<u8>>, Error> {
+    let start = reader.stream_position()?;
+    reader.seek(SeekFrom::End(-(8 + MAGIC.len() as i64)))?;
+    let index_offset = read_u64(reader)?;
+    read_magic(reader)?;
+
+    reader.seek(SeekFrom::Start(start + index_offset))?;
+    if read_u8(reader)? != INDEX_TAG {
+        return Err("stream index is corrupted".to_string().into());
+    }
+    for _ in 0..read_u64(reader)? {
+        let entry = IndexEntry::read(reader)?;
+        if entry.name != name {
+            continue;
+        }
+
+        reader.seek(SeekFrom::Start(start + entry.offset))?;
+        let mut data = vec![0; entry.size as usize];
+        reader.read_exact(&mut data)?;
+        if crc32fast::hash(&data) != entry.crc32 {
+            return Err(format!("stream entry {name} is corrupted").into());
+        }
+
+        return Ok(Some(data));
+    }
+
+    Ok(None)
+}
+
+fn read_u8(reader: &mut impl Read) -> Result<u8, Error> {
+    let mut buf = [0; 1];
+    reader.read_exact(&mut buf)?;
+    Ok(buf[0])
+}
+
+fn read_u16(reader: &mut impl Read) -> Result<u16, Error> {
+    let mut buf = [0; 2];
+    reader.read_exact(&mut buf)?;
+    Ok(u16::from_le_bytes(buf))
+}
+
+fn read_u32(reader: &mut impl Read) -> Result<u32, Error> {
+    let mut buf = [0; 4];
+    reader.read_exact(&mut buf)?;
+    Ok(u32::from_le_bytes(buf))
+}
+
+fn read_u64(reader: &mut impl Read) -> Result<u64, Error> {
+    let mut buf = [0; 8];
+    reader.read_exact(&mut buf)?;
+    Ok(u64::from_le_bytes(buf))
+}
+
+fn read_name(reader: &mut impl Read) -> Result<String, Error> {
+    let mut name = vec![0; read_u16(reader)? as usize];
+    reader.read_exact(&mut name)?;
+    String::from_utf8(name).map_err(|_| "stream entry name is not utf-8".to_string().into())
+}
+
+fn read_magic(reader: &mut impl Read) -> Result<(), Error> {
+    let mut magic = [0; MAGIC.len()];
+    reader.read_exact(&mut magic)?;
+    if magic != MAGIC {
+        return Err("not a jyafn stream (or an unsupported version)"
+            .to_string()
+            .into());
+    }
+    Ok(())
+}
+
+fn write_name(writer: &mut impl Write, name: &str) -> Result<(), Error> {
+    let len = u16::try_from(name.len())
+        .map_err(|_| Error::from(format!("stream entry name {name:?} is too long")))?;
+    writer.write_all(&len.to_le_bytes())?;
+    writer.write_all(name.as_bytes())?;
+    Ok(())
+}
+
+/// Where an entry is in the stream.
+#[derive(Debug)]
+struct IndexEntry {
+    name: String,
+    offset: u64,
+    size: u64,
+    crc32: u32,
+}
+
+impl IndexEntry {
+    fn read(reader: &mut impl Read) -> Result<IndexEntry, Error> {
+        Ok(IndexEntry {
+            name: read_name(reader)?,
+            offset: read_u64(reader)?,
+            size: read_u64(reader)?,
+            crc32: read_u32(reader)?,
+        })
+    }
+
+    fn write(&self, writer: &mut impl Write) -> Result<(), Error> {
+        write_name(writer, &self.name)?;
+        writer.write_all(&self.offset.to_le_bytes())?;
+        writer.write_all(&self.size.to_le_bytes())?;
+        writer.write_all(&self.crc32.to_le_bytes())?;
+        Ok(())
+    }
+}
+
+/// Writes entries to a stream, one after the other.
+pub(super) struct StreamWriter<W> {
+    writer: W,
+    /// How many bytes were written so far.
+    position: u64,
+    index: Vec<IndexEntry>,
+}
+
+impl<W: Write> StreamWriter<W> {
+    pub(super) fn new(mut writer: W) -> Result<Self, Error> {
+        writer.write_all(&MAGIC)?;
+        Ok(StreamWriter {
+            writer,
+            position: MAGIC.len() as u64,
+            index: vec![],
+        })
+    }
+
+    /// Writes a whole entry.
+    pub(super) fn write_entry(&mut self, name: &str, data: &[u8]) -> Result<(), Error> {
+        let crc32 = crc32fast::hash(data);
+        self.writer.write_all(&[ENTRY_TAG])?;
+        write_name(&mut self.writer, name)?;
+        self.writer.write_all(&(data.len() as u64).to_le_bytes())?;
+        self.writer.write_all(&crc32.to_le_bytes())?;
+        self.position += (1 + 2 + name.len() + 8 + 4) as u64;
+
+        self.index.push(IndexEntry {
+            name: name.to_string(),
+            offset: self.position,
+            size: data.len() as u64,
+            crc32,
+        });
+        self.writer.write_all(data)?;
+        self.position += data.len() as u64;
+
+        Ok(())
+    }
+
+    /// Writes the index, ending the stream.
+    pub(super) fn finish(mut self) -> Result<W, Error> {
+        let index_offset = self.position;
+        self.writer.write_all(&[INDEX_TAG])?;
+        self.writer
+            .write_all(&(self.index.len() as u64).to_le_bytes())?;
+        for entry in &self.index {
+            entry.write(&mut self.writer)?;
+        }
+        self.writer.write_all(&index_offset.to_le_bytes())?;
+        self.writer.write_all(&MAGIC)?;
+        self.writer.flush()?;
+
+        Ok(self.writer)
+    }
+}
+
+/// The entry currently being read.
+struct Current {
+    name: String,
+    size: u64,
+    crc32: u32,
+    hasher: crc32fast::Hasher,
+    remaining: u64,
+}
+
+/// Reads the entries of a stream, one after the other, as they arrive.
+pub(super) struct StreamReader<R> {
+    reader: R,
+    current: Option<Current>,
+    done: bool,
+}
+
+impl<R: Read> StreamReader<R> {
+    /// Starts reading a stream. If the reader turns out to hold something else, the
+    /// reader is given back, together with what was read out of it.
+    pub(super) fn new(mut reader: R) -> Result<Result<Self, (Vec<u8>, R)>, Error> {
+        let mut start = Vec::with_capacity(MAGIC.len());
+        reader
+            .by_ref()
+            .take(MAGIC.len() as u64)
+            .read_to_end(&mut start)?;
+        if start != MAGIC {
+            return Ok(Err((start, reader)));
+        }
+
+        Ok(Ok(StreamReader {
+            reader,
+            current: None,
+            done: false,
+        }))
+    }
+
+    /// The next entry in the stream, or `None` if all entries were read. Whatever was
+    /// not read of the previous entry is skipped and the checksum of the previous entry
+    /// is verified.
+    pub(super) fn next_entry(&mut self) -> Result<Option<Entry<'_, R>>, Error> {
+        if let Some(mut current) = self.current.take() {
+            std::io::copy(
+                &mut Entry {
+                    current: &mut current,
+                    reader: &mut self.reader,
+                },
+                &mut std::io::sink(),
+            )?;
+            if current.hasher.finalize() != current.crc32 {
+                return Err(format!("stream entry {} is corrupted", current.name).into());
+            }
+        }
+
+        if self.done {
+            return Ok(None);
+        }
+
+        match read_u8(&mut self.reader)? {
+            ENTRY_TAG => {}
+            INDEX_TAG => {
+                // Nothing after this is needed, but make sure the stream was not cut short.
+                for _ in 0..read_u64(&mut self.reader)? {
+                    IndexEntry::read(&mut self.reader)?;
+                }
+                read_u64(&mut self.reader)?;
+                read_magic(&mut self.reader)?;
+                self.done = true;
+                return Ok(None);
+            }
+            tag => return Err(format!("unknown tag {tag} in stream").into()),
+        }
+
+        let name = read_name(&mut self.reader)?;
+        let size = read_u64(&mut self.reader)?;
+        let crc32 = read_u32(&mut self.reader)?;
+        let current = self.current.insert(Current {
+            name,
+            size,
+            crc32,
+            hasher: crc32fast::Hasher::new(),
+            remaining: size,
+        });
+
+        Ok(Some(Entry {
+            current,
+            reader: &mut self.reader,
+        }))
+    }
+}
+
+/// An entry of a stream, which can be read as it arrives.
+pub(super) struct Entry<'a, R> {
+    current: &'a mut Current,
+    reader: &'a mut R,
+}
+
+impl<'a, R> Entry<'a, R> {
+    pub(super) fn name(&self) -> &str {
+        &self.current.name
+    }
+
+    /// The size of the data of this entry.
+    pub(super) fn size(&self) -> u64 {
+        self.current.size
+    }
+}
+
+impl<'a, R: Read> Read for Entry<'a, R> {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let max = self.current.remaining.min(buf.len() as u64) as usize;
+        if max == 0 {
+            return Ok(0);
+        }
+
+        let read = self.reader.read(&mut buf[..max])?;
+        if read == 0 {
+            return Err(std::io::ErrorKind::UnexpectedEof.into());
+        }
+        self.current.hasher.update(&buf[..read]);
+        self.current.remaining -= read as u64;
+
+        Ok(read)
+    }
+}
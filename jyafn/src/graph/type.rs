@@ -7,7 +7,7 @@ use crate::Error;
 use super::size::{InSlots, Size, Unit};
 
 /// The primitive types of data that can be represented in the computational graph.
-#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, GetSize)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Serialize, Deserialize, GetSize)]
 #[repr(u8)]
 pub enum Type {
     /// A floating point number.
@@ -0,0 +1,190 @@
+//! A handle to a function that can be replaced by a new version while it is being called.
+//!
+//! Callers never take a lock: each thread announces the version it is about to call in a
+//! slot of its own (a hazard pointer) and clears it when the call returns. A swap
+//! publishes the new version with a single atomic store and then waits until no slot
+//! still points to the old one, so the old version (and, with it, its library and
+//! mappings) is only dropped after all calls in flight are done.
+
+use std::ops::Deref;
+use std::ptr;
+use std::sync::atomic::{AtomicPtr, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, JoinHandle};
+use thread_local::ThreadLocal;
+
+use super::{layout, Error, FnError, Function};
+
+/// A function that can be replaced by a new version without pausing the threads that
+/// call it. Calls go through [`FunctionHandle::with`] (or any of its shortcuts), which
+/// never block, not even during a swap.
+pub struct FunctionHandle {
+    current: AtomicPtr<Function>,
+    /// The version each thread is calling right now, or null.
+    readers: ThreadLocal<AtomicPtr<Function>>,
+    /// Makes swaps one at a time, so that a swap never waits for another.
+    swapping: Mutex<()>,
+}
+
+impl Drop for FunctionHandle {
+    fn drop(&mut self) {
+        // Safety: `&mut self` means no calls are in flight and `current` always comes
+        // from `Box::into_raw`.
+        drop(unsafe { Box::from_raw(*self.current.get_mut()) });
+    }
+}
+
+impl From<Function> for FunctionHandle {
+    fn from(func: Function) -> FunctionHandle {
+        FunctionHandle::new(func)
+    }
+}
+
+impl std::fmt::Debug for FunctionHandle {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        self.with(|func| f.debug_tuple("FunctionHandle").field(func).finish())
+    }
+}
+
+/// Clears the slot of the current thread when a call is done, even if it panics.
+struct Guard<'a> {
+    slot: Option<&'a AtomicPtr<Function>>,
+    func: &'a Function,
+}
+
+impl Drop for Guard<'_> {
+    fn drop(&mut self) {
+        if let Some(slot) = self.slot {
+            slot.store(ptr::null_mut(), Ordering::Release);
+        }
+    }
+}
+
+impl Deref for Guard<'_> {
+    type Target = Function;
+    fn deref(&self) -> &Function {
+        self.func
+    }
+}
+
+impl FunctionHandle {
+    /// Creates a new handle, starting with the given version of the function.
+    pub fn new(func: Function) -> FunctionHandle {
+        FunctionHandle {
+            current: AtomicPtr::new(Box::into_raw(Box::new(func))),
+            readers: ThreadLocal::new(),
+            swapping: Mutex::new(()),
+        }
+    }
+
+    fn enter(&self) -> Guard<'_> {
+        let slot = self.readers.get_or(|| AtomicPtr::new(ptr::null_mut()));
+        let protected = slot.load(Ordering::Relaxed);
+        if !protected.is_null() {
+            // A nested call in the same thread: the version of the outer call is still
+            // protected and it is the one that is used.
+            //
+            // Safety: a protected version is not dropped.
+            return Guard {
+                slot: None,
+                func: unsafe { &*protected },
+            };
+        }
+
+        loop {
+            let current = self.current.load(Ordering::SeqCst);
+            slot.store(current, Ordering::SeqCst);
+            // If no swap happened in between, the swap that comes next will see the slot.
+            if self.current.load(Ordering::SeqCst) == current {
+                // Safety: the version is protected by the slot until the guard drops.
+                return Guard {
+                    slot: Some(slot),
+                    func: unsafe { &*current },
+                };
+            }
+        }
+    }
+
+    /// Runs `f` with the current version of the function. The version is kept alive,
+    /// even if it is swapped out, until `f` returns. Nested uses of the same handle in
+    /// the same thread all see the version of the outermost one.
+    pub fn with<F, T>(&self, f: F) -> T
+    where
+        F: FnOnce(&Function) -> T,
+    {
+        let guard = self.enter();
+        f(&guard)
+    }
+
+    /// A clone of the current version of the function, which is kept alive for as long
+    /// as the clone is.
+    pub fn current(&self) -> Function {
+        self.with(Function::clone)
+    }
+
+    /// Calls the current version of the function. See [`Function::call_raw`].
+    pub fn call_raw<I, O>(&self, input: I, output: O) -> *mut FnError
+    where
+        I: AsRef<[u8]>,
+        O: AsMut<[u8]>,
+    {
+        self.with(|func| func.call_raw(input, output))
+    }
+
+    /// Evaluates the current version of the function. See [`Function::eval`].
+    pub fn eval<E, D>(&self, input: &E) -> Result<D, Error>
+    where
+        E: ?Sized + layout::Encode,
+        D: layout::Decode,
+    {
+        self.with(|func| func.eval(input))
+    }
+
+    /// Evaluates the current version of the function from JSON to JSON. See
+    /// [`Function::eval_json`].
+    pub fn eval_json(&self, input: &[u8], output: &mut Vec<u8>) -> Result<(), Error> {
+        self.with(|func| func.eval_json(input, output))
+    }
+
+    /// Makes `next` the current version of the function, returning the previous one after
+    /// all calls to it that were in flight are done. All new calls go to `next` as soon
+    /// as this function is called. Swaps are done one at a time.
+    ///
+    /// This waits for calls in other threads. Therefore, calling it from within
+    /// [`FunctionHandle::with`] on the same handle never returns.
+    pub fn swap(&self, next: Function) -> Function {
+        let _swapping = self.swapping.lock().expect("poisoned");
+        let next = Box::into_raw(Box::new(next));
+        let previous = self.current.swap(next, Ordering::SeqCst);
+
+        // Each thread either saw the new version or has already announced the previous
+        // one in its slot (see `enter`).
+        for slot in self.readers.iter() {
+            while slot.load(Ordering::SeqCst) == previous {
+                thread::yield_now();
+            }
+        }
+
+        // Safety: `previous` came from `Box::into_raw` and no one can see it anymore.
+        *unsafe { Box::from_raw(previous) }
+    }
+
+    /// Loads a new version of the function in a new thread and swaps it in. The previous
+    /// version is also dropped in that thread, so that callers never pay for loading or
+    /// unloading. The thread returns the error of `load`, if any, in which case the
+    /// current version stays.
+    pub fn reload<F>(self: &Arc<Self>, load: F) -> JoinHandle<Result<(), Error>>
+    where
+        F: 'static + Send + FnOnce() -> Result<Function, Error>,
+    {
+        let handle = self.clone();
+        thread::Builder::new()
+            .name("jyafn-reload".to_string())
+            .spawn(move || {
+                let next = load()?;
+                drop(handle.swap(next));
+                Ok(())
+            })
+            .expect("can spawn thread")
+    }
+}
@@ -0,0 +1,563 @@
+//! Machine code of compiled graphs, loaded into the current process.
+//!
+//! On Linux, the relocatable object produced by the assembler is loaded straight from
+//! memory: its sections are copied into freshly mapped pages, relocations are applied
+//! in place and only then the text is made executable. No linker, temporary file or
+//! `dlopen` is involved. Elsewhere, the object is linked into a shared object, which is
+//! then loaded with `dlopen`.
+
+use std::fmt::{self, Debug};
+use std::path::Path;
+
+use super::{Error, RawBatchFn, RawFn};
+
+/// Machine code of a compiled graph, loaded into the current process. The code is
+/// unloaded when this value is dropped.
+pub struct Image(Inner);
+
+enum Inner {
+    #[cfg(target_os = "linux")]
+    Mapped(elf::Mapped),
+    Library { library: libloading::Library, len: usize },
+}
+
+impl Debug for Image {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match &self.0 {
+            #[cfg(target_os = "linux")]
+            Inner::Mapped(mapped) => f
+                .debug_struct("Image")
+                .field("base", &mapped.base())
+                .field("len", &mapped.len())
+                .finish(),
+            Inner::Library { library, len } => f
+                .debug_struct("Image")
+                .field("library", library)
+                .field("len", len)
+                .finish(),
+        }
+    }
+}
+
+impl Image {
+    /// Loads a relocatable object (the output of the assembler) from memory.
+    #[cfg(target_os = "linux")]
+    pub fn from_object(object: &[u8]) -> Result<Image, Error> {
+        Ok(Image(Inner::Mapped(elf::Mapped::load(object)?)))
+    }
+
+    /// Loads a shared object from a file using the system's dynamic loader.
+    #[cfg_attr(target_os = "linux", allow(dead_code))]
+    pub fn from_shared_object(path: &Path) -> Result<Image, Error> {
+        let library = unsafe {
+            // Safety: shared object was complied straignt from the linker into the
+            // temporary file, unless some spooky process was able to change the file
+            // contents in the mean time (highy unlikely).
+            libloading::Library::new(path)?
+        };
+        let len = std::fs::metadata(path)?.len() as usize;
+
+        Ok(Image(Inner::Library { library, len }))
+    }
+
+    /// The amount of memory taken by the loaded code and data, in bytes.
+    pub fn len(&self) -> usize {
+        match &self.0 {
+            #[cfg(target_os = "linux")]
+            Inner::Mapped(mapped) => mapped.len(),
+            Inner::Library { len, .. } => *len,
+        }
+    }
+
+    /// The address of a global symbol defined in this image.
+    pub fn symbol(&self, name: &str) -> Result<*const u8, Error> {
+        match &self.0 {
+            #[cfg(target_os = "linux")]
+            Inner::Mapped(mapped) => mapped.symbol(name).ok_or_else(|| {
+                Error::BadObject(format!("symbol {name:?} not defined in object"))
+            }),
+            Inner::Library { library, .. } => {
+                let mut c_name = name.as_bytes().to_vec();
+                c_name.push(0);
+                let symbol: libloading::Symbol<*const u8> = unsafe {
+                    // Safety: we only read the address of the symbol.
+                    library.get(&c_name)?
+                };
+                Ok(*symbol)
+            }
+        }
+    }
+
+    /// Writes an address into an extern of this image: an exported 8-byte cell in the
+    /// data section that the compiled code reads the address from. This must happen
+    /// before any code that uses the extern runs.
+    pub fn fill_extern(&self, name: &str, address: usize) -> Result<(), Error> {
+        let cell = self.symbol(name)? as *mut usize;
+        unsafe {
+            // Safety: externs are rendered as writable, 8-byte aligned data definitions
+            // and nothing reads them concurrently while the image is being set up.
+            cell.write(address);
+        }
+        Ok(())
+    }
+
+    /// The entrypoint of the compiled graph, the `run` function.
+    pub fn run(&self) -> Result<RawFn, Error> {
+        let ptr = self.symbol("run")?;
+        Ok(unsafe {
+            // Safety: all jyafn images have this function with this given signature. The
+            // caller must hold on to this image for as long as it uses the pointer.
+            std::mem::transmute::<*const u8, RawFn>(ptr)
+        })
+    }
+
+    /// The batched entrypoint of the compiled graph, the `run.batch` function.
+    pub fn run_batch(&self) -> Result<RawBatchFn, Error> {
+        let ptr = self.symbol("run.batch")?;
+        Ok(unsafe {
+            // Safety: all jyafn images have this function with this given signature. The
+            // caller must hold on to this image for as long as it uses the pointer.
+            std::mem::transmute::<*const u8, RawBatchFn>(ptr)
+        })
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod elf {
+    //! A minimal in-memory loader for ELF relocatable objects, supporting the (small)
+    //! subset of ELF that the assembler produces for QBE output.
+
+    use std::collections::HashMap;
+
+    use crate::Error;
+
+    const ET_REL: u16 = 1;
+    #[cfg(target_arch = "x86_64")]
+    const EM_HOST: u16 = 62;
+    #[cfg(target_arch = "aarch64")]
+    const EM_HOST: u16 = 183;
+
+    const SHT_SYMTAB: u32 = 2;
+    const SHT_RELA: u32 = 4;
+    const SHT_NOBITS: u32 = 8;
+    const SHF_ALLOC: u64 = 0x2;
+    const SHF_EXECINSTR: u64 = 0x4;
+    const SHN_UNDEF: u16 = 0;
+    const SHN_ABS: u16 = 0xfff1;
+    const STB_GLOBAL: u8 = 1;
+    const STB_WEAK: u8 = 2;
+
+    const SYM_SIZE: usize = 24;
+    const RELA_SIZE: usize = 24;
+
+    fn bad(msg: impl Into<String>) -> Error {
+        Error::BadObject(msg.into())
+    }
+
+    /// Bounds-checked little-endian reads over the object file.
+    struct Reader<'a>(&'a [u8]);
+
+    impl<'a> Reader<'a> {
+        fn bytes<const N: usize>(&self, at: usize) -> Result<[u8; N], Error> {
+            self.0
+                .get(at..at.saturating_add(N))
+                .map(|b| b.try_into().expect("slice has N bytes"))
+                .ok_or_else(|| bad("truncated object"))
+        }
+
+        fn u8(&self, at: usize) -> Result<u8, Error> {
+            Ok(self.bytes::<1>(at)?[0])
+        }
+
+        fn u16(&self, at: usize) -> Result<u16, Error> {
+            Ok(u16::from_le_bytes(self.bytes(at)?))
+        }
+
+        fn u32(&self, at: usize) -> Result<u32, Error> {
+            Ok(u32::from_le_bytes(self.bytes(at)?))
+        }
+
+        fn u64(&self, at: usize) -> Result<u64, Error> {
+            Ok(u64::from_le_bytes(self.bytes(at)?))
+        }
+
+        fn slice(&self, at: usize, len: usize) -> Result<&'a [u8], Error> {
+            self.0
+                .get(at..at.saturating_add(len))
+                .ok_or_else(|| bad("truncated object"))
+        }
+
+        fn c_str(&self, at: usize) -> Result<&'a str, Error> {
+            let tail = self.0.get(at..).ok_or_else(|| bad("truncated object"))?;
+            let end = tail
+                .iter()
+                .position(|&b| b == 0)
+                .ok_or_else(|| bad("unterminated string in object"))?;
+            std::str::from_utf8(&tail[..end]).map_err(|_| bad("symbol name is not utf-8"))
+        }
+    }
+
+    struct Section {
+        kind: u32,
+        flags: u64,
+        offset: usize,
+        size: usize,
+        link: usize,
+        info: usize,
+        align: usize,
+    }
+
+    impl Section {
+        fn read(reader: &Reader, at: usize) -> Result<Section, Error> {
+            Ok(Section {
+                kind: reader.u32(at + 4)?,
+                flags: reader.u64(at + 8)?,
+                offset: reader.u64(at + 24)? as usize,
+                size: reader.u64(at + 32)? as usize,
+                link: reader.u32(at + 40)? as usize,
+                info: reader.u32(at + 44)? as usize,
+                align: reader.u64(at + 48)?.max(1) as usize,
+            })
+        }
+
+        fn is_alloc(&self) -> bool {
+            self.flags & SHF_ALLOC != 0
+        }
+
+        fn is_exec(&self) -> bool {
+            self.flags & SHF_EXECINSTR != 0
+        }
+    }
+
+    fn align_up(x: usize, align: usize) -> usize {
+        x.div_ceil(align) * align
+    }
+
+    fn page_size() -> usize {
+        unsafe { libc::sysconf(libc::_SC_PAGESIZE) as usize }
+    }
+
+    /// An object loaded in anonymous memory. Executable sections come first, in their own
+    /// read-execute pages; everything else follows in read-write pages.
+    pub struct Mapped {
+        base: *mut u8,
+        len: usize,
+        symbols: HashMap<String, usize>,
+    }
+
+    // Safety: the mapping is never written to after loading, except by the loaded code
+    // itself.
+    unsafe impl Send for Mapped {}
+    unsafe impl Sync for Mapped {}
+
+    impl Drop for Mapped {
+        fn drop(&mut self) {
+            unsafe {
+                libc::munmap(self.base as *mut libc::c_void, self.len);
+            }
+        }
+    }
+
+    impl Mapped {
+        pub fn base(&self) -> *const u8 {
+            self.base
+        }
+
+        pub fn len(&self) -> usize {
+            self.len
+        }
+
+        pub fn symbol(&self, name: &str) -> Option<*const u8> {
+            self.symbols.get(name).map(|&addr| addr as *const u8)
+        }
+
+        pub fn load(object: &[u8]) -> Result<Mapped, Error> {
+            let reader = Reader(object);
+
+            if object.get(..4) != Some(b"\x7fELF") || reader.u8(4)? != 2 || reader.u8(5)? != 1
+            {
+                return Err(bad("not a 64-bit little-endian ELF object"));
+            }
+            if reader.u16(16)? != ET_REL {
+                return Err(bad("not a relocatable object"));
+            }
+            if reader.u16(18)? != EM_HOST {
+                return Err(bad("object is not for the current architecture"));
+            }
+
+            let sh_offset = reader.u64(0x28)? as usize;
+            let sh_entry_size = reader.u16(0x3a)? as usize;
+            let sh_count = reader.u16(0x3c)? as usize;
+            let sections = (0..sh_count)
+                .map(|i| Section::read(&reader, sh_offset + i * sh_entry_size))
+                .collect::<Result<Vec<_>, _>>()?;
+
+            // Lay out the allocated sections: text first, then data.
+            let page_size = page_size();
+            let mut offsets = vec![None; sections.len()];
+            let mut len = 0;
+            let mut text_len = 0;
+            for exec in [true, false] {
+                for (i, section) in sections.iter().enumerate() {
+                    if section.is_alloc() && section.is_exec() == exec {
+                        len = align_up(len, section.align);
+                        offsets[i] = Some(len);
+                        len += section.size;
+                    }
+                }
+
+                if exec {
+                    text_len = align_up(len, page_size);
+                    len = text_len;
+                }
+            }
+            let len = align_up(len.max(1), page_size);
+
+            let base = unsafe {
+                libc::mmap(
+                    std::ptr::null_mut(),
+                    len,
+                    libc::PROT_READ | libc::PROT_WRITE,
+                    libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                    -1,
+                    0,
+                )
+            };
+            if base == libc::MAP_FAILED {
+                return Err(std::io::Error::last_os_error().into());
+            }
+            let mut mapped = Mapped {
+                base: base as *mut u8,
+                len,
+                symbols: HashMap::new(),
+            };
+            let memory = unsafe {
+                // Safety: we have just mapped this region and nobody else knows about it.
+                std::slice::from_raw_parts_mut(mapped.base, len)
+            };
+            let base = mapped.base as usize;
+
+            for (section, offset) in sections.iter().zip(&offsets) {
+                if let (Some(offset), true) = (offset, section.kind != SHT_NOBITS) {
+                    memory[*offset..*offset + section.size]
+                        .copy_from_slice(reader.slice(section.offset, section.size)?);
+                }
+            }
+
+            // Resolve the address of every symbol.
+            let symtab = sections
+                .iter()
+                .find(|section| section.kind == SHT_SYMTAB)
+                .ok_or_else(|| bad("object has no symbol table"))?;
+            let strtab = sections
+                .get(symtab.link)
+                .ok_or_else(|| bad("bad string table index"))?;
+            let mut names = Vec::with_capacity(symtab.size / SYM_SIZE);
+            let mut addresses = Vec::with_capacity(symtab.size / SYM_SIZE);
+            for i in 0..symtab.size / SYM_SIZE {
+                let at = symtab.offset + i * SYM_SIZE;
+                let name = reader.c_str(strtab.offset + reader.u32(at)? as usize)?;
+                let bind = reader.u8(at + 4)? >> 4;
+                let section_index = reader.u16(at + 6)?;
+                let value = reader.u64(at + 8)? as usize;
+
+                let address = match section_index {
+                    SHN_UNDEF => None,
+                    SHN_ABS => Some(value),
+                    index => offsets
+                        .get(index as usize)
+                        .copied()
+                        .flatten()
+                        .map(|offset| base + offset + value),
+                };
+
+                if let (Some(address), true, false) = (
+                    address,
+                    bind == STB_GLOBAL || bind == STB_WEAK,
+                    name.is_empty(),
+                ) {
+                    mapped.symbols.insert(name.to_string(), address);
+                }
+
+                names.push(name);
+                addresses.push(address);
+            }
+
+            // Apply relocations to the allocated sections.
+            for section in sections.iter().filter(|section| section.kind == SHT_RELA) {
+                let Some(target) = offsets.get(section.info).copied().flatten() else {
+                    continue;
+                };
+
+                for i in 0..section.size / RELA_SIZE {
+                    let at = section.offset + i * RELA_SIZE;
+                    let place = target + reader.u64(at)? as usize;
+                    let info = reader.u64(at + 8)?;
+                    let addend = reader.u64(at + 16)? as i64;
+                    let symbol = (info >> 32) as usize;
+                    let kind = info as u32;
+
+                    let address = addresses.get(symbol).copied().flatten().ok_or_else(|| {
+                        bad(format!(
+                            "undefined symbol {:?} in object",
+                            names.get(symbol).unwrap_or(&"")
+                        ))
+                    })?;
+
+                    relocate(
+                        memory,
+                        place,
+                        (base + place) as i64,
+                        kind,
+                        (address as i64).wrapping_add(addend),
+                    )?;
+                }
+            }
+
+            if text_len > 0 {
+                #[cfg(target_arch = "aarch64")]
+                unsafe {
+                    extern "C" {
+                        fn __clear_cache(start: *mut libc::c_char, end: *mut libc::c_char);
+                    }
+                    __clear_cache(
+                        mapped.base as *mut libc::c_char,
+                        mapped.base.add(text_len) as *mut libc::c_char,
+                    );
+                }
+
+                let status = unsafe {
+                    libc::mprotect(
+                        mapped.base as *mut libc::c_void,
+                        text_len,
+                        libc::PROT_READ | libc::PROT_EXEC,
+                    )
+                };
+                if status != 0 {
+                    return Err(std::io::Error::last_os_error().into());
+                }
+            }
+
+            Ok(mapped)
+        }
+    }
+
+    fn field<const N: usize>(memory: &mut [u8], at: usize) -> Result<&mut [u8; N], Error> {
+        memory
+            .get_mut(at..at.saturating_add(N))
+            .map(|b| b.try_into().expect("slice has N bytes"))
+            .ok_or_else(|| bad("relocation out of bounds"))
+    }
+
+    fn write_i32(memory: &mut [u8], at: usize, value: i64) -> Result<(), Error> {
+        let value = i32::try_from(value).map_err(|_| bad("relocation overflow"))?;
+        *field(memory, at)? = value.to_le_bytes();
+        Ok(())
+    }
+
+    fn write_u64(memory: &mut [u8], at: usize, value: i64) -> Result<(), Error> {
+        *field(memory, at)? = value.to_le_bytes();
+        Ok(())
+    }
+
+    /// Applies relocation of type `kind` at offset `at` of the mapping, whose address is
+    /// `place`. The (symbol + addend) value is `value`.
+    #[cfg(target_arch = "x86_64")]
+    fn relocate(
+        memory: &mut [u8],
+        at: usize,
+        place: i64,
+        kind: u32,
+        value: i64,
+    ) -> Result<(), Error> {
+        const R_X86_64_64: u32 = 1;
+        const R_X86_64_PC32: u32 = 2;
+        const R_X86_64_PLT32: u32 = 4;
+        const R_X86_64_32: u32 = 10;
+        const R_X86_64_32S: u32 = 11;
+        const R_X86_64_PC64: u32 = 24;
+
+        match kind {
+            R_X86_64_64 => write_u64(memory, at, value),
+            R_X86_64_PC32 | R_X86_64_PLT32 => write_i32(memory, at, value - place),
+            R_X86_64_PC64 => write_u64(memory, at, value - place),
+            R_X86_64_32 => {
+                let value = u32::try_from(value).map_err(|_| bad("relocation overflow"))?;
+                *field(memory, at)? = value.to_le_bytes();
+                Ok(())
+            }
+            R_X86_64_32S => write_i32(memory, at, value),
+            _ => Err(bad(format!("unsupported relocation type {kind}"))),
+        }
+    }
+
+    /// Applies relocation of type `kind` at offset `at` of the mapping, whose address is
+    /// `place`. The (symbol + addend) value is `value`.
+    #[cfg(target_arch = "aarch64")]
+    fn relocate(
+        memory: &mut [u8],
+        at: usize,
+        place: i64,
+        kind: u32,
+        value: i64,
+    ) -> Result<(), Error> {
+        const R_AARCH64_ABS64: u32 = 257;
+        const R_AARCH64_PREL64: u32 = 260;
+        const R_AARCH64_PREL32: u32 = 261;
+        const R_AARCH64_ADR_PREL_PG_HI21: u32 = 275;
+        const R_AARCH64_ADD_ABS_LO12_NC: u32 = 277;
+        const R_AARCH64_LDST8_ABS_LO12_NC: u32 = 278;
+        const R_AARCH64_CONDBR19: u32 = 280;
+        const R_AARCH64_JUMP26: u32 = 282;
+        const R_AARCH64_CALL26: u32 = 283;
+        const R_AARCH64_LDST16_ABS_LO12_NC: u32 = 284;
+        const R_AARCH64_LDST32_ABS_LO12_NC: u32 = 285;
+        const R_AARCH64_LDST64_ABS_LO12_NC: u32 = 286;
+        const R_AARCH64_LDST128_ABS_LO12_NC: u32 = 299;
+
+        let patch = |memory: &mut [u8], mask: u32, bits: u32| -> Result<(), Error> {
+            let insn = field::<4>(memory, at)?;
+            let patched = (u32::from_le_bytes(*insn) & !mask) | (bits & mask);
+            *insn = patched.to_le_bytes();
+            Ok(())
+        };
+        let branch = |memory: &mut [u8], bits: u32| -> Result<(), Error> {
+            let delta = value - place;
+            if delta % 4 != 0 || delta.unsigned_abs() >= 1 << (bits + 1) {
+                return Err(bad("branch relocation out of range"));
+            }
+            let mask = (1 << bits) - 1;
+            let shift = if bits == 26 { 0 } else { 5 };
+            patch(memory, mask << shift, (((delta >> 2) as u32) & mask) << shift)
+        };
+        let lo12 = |memory: &mut [u8], shift: u32| {
+            patch(memory, 0xfff << 10, (((value & 0xfff) as u32) >> shift) << 10)
+        };
+
+        match kind {
+            R_AARCH64_ABS64 => write_u64(memory, at, value),
+            R_AARCH64_PREL64 => write_u64(memory, at, value - place),
+            R_AARCH64_PREL32 => write_i32(memory, at, value - place),
+            R_AARCH64_ADR_PREL_PG_HI21 => {
+                let pages = ((value & !0xfff) - (place & !0xfff)) >> 12;
+                if !(-(1 << 20)..1 << 20).contains(&pages) {
+                    return Err(bad("page relocation out of range"));
+                }
+                let pages = pages as u32;
+                patch(
+                    memory,
+                    (0x3 << 29) | (0x7ffff << 5),
+                    ((pages & 0x3) << 29) | (((pages >> 2) & 0x7ffff) << 5),
+                )
+            }
+            R_AARCH64_ADD_ABS_LO12_NC | R_AARCH64_LDST8_ABS_LO12_NC => lo12(memory, 0),
+            R_AARCH64_LDST16_ABS_LO12_NC => lo12(memory, 1),
+            R_AARCH64_LDST32_ABS_LO12_NC => lo12(memory, 2),
+            R_AARCH64_LDST64_ABS_LO12_NC => lo12(memory, 3),
+            R_AARCH64_LDST128_ABS_LO12_NC => lo12(memory, 4),
+            R_AARCH64_JUMP26 | R_AARCH64_CALL26 => branch(memory, 26),
+            R_AARCH64_CONDBR19 => branch(memory, 19),
+            _ => Err(bad(format!("unsupported relocation type {kind}"))),
+        }
+    }
+}
@@ -7,7 +7,7 @@ use hashbrown::HashMap;
 use crate::utils;
 
 use super::symbols::Sym;
-use super::{Layout, Visitor};
+use super::{plan, Layout, Plan, Visitor};
 
 /// Decodes unstructured binary data into a target data structure.
 pub trait Decoder {
@@ -20,6 +20,17 @@ pub trait Decoder {
     /// no decode errors are expected from this function. If necessary, this code should
     /// panic, indicating a bug in the caller code.
     fn build(&mut self, layout: &Layout, symbols: &dyn Sym, visitor: &mut Visitor) -> Self::Target;
+    /// Decodes unstructured data stored inside `visitor` following a [`Plan`] compiled
+    /// from the layout. By default, this walks the layout the plan was compiled from
+    /// with [`Decoder::build`].
+    fn build_planned(
+        &mut self,
+        plan: &Plan,
+        symbols: &dyn Sym,
+        visitor: &mut Visitor,
+    ) -> Self::Target {
+        self.build(plan.layout(), symbols, visitor)
+    }
 }
 
 /// A type that can be decoded from a `layout`, `symbols` and a visitor.
@@ -30,6 +41,14 @@ pub trait Decode {
     /// no decode errors are expected from this function. If necessary, this code should
     /// panic, indicating a bug in the caller code.
     fn build(layout: &Layout, symbols: &dyn Sym, visitor: &mut Visitor) -> Self;
+    /// Creates a value of `Self` following a [`Plan`] compiled from the layout. By
+    /// default, this walks the layout the plan was compiled from with [`Decode::build`].
+    fn build_planned(plan: &Plan, symbols: &dyn Sym, visitor: &mut Visitor) -> Self
+    where
+        Self: Sized,
+    {
+        Self::build(plan.layout(), symbols, visitor)
+    }
 }
 
 /// A decoder for types that implement [`Decode`].
@@ -53,6 +72,14 @@ impl<D: Decode> Decoder for ZeroDecoder<D> {
     fn build(&mut self, layout: &Layout, symbols: &dyn Sym, visitor: &mut Visitor) -> Self::Target {
         D::build(layout, symbols, visitor)
     }
+    fn build_planned(
+        &mut self,
+        plan: &Plan,
+        symbols: &dyn Sym,
+        visitor: &mut Visitor,
+    ) -> Self::Target {
+        D::build_planned(plan, symbols, visitor)
+    }
 }
 
 impl Decode for () {
@@ -70,6 +97,9 @@ macro_rules! impl_decode_container {
             fn build(layout: &Layout, symbols: &dyn Sym, visitor: &mut Visitor) -> Self {
                 Self::from(T::build(layout, symbols, visitor))
             }
+            fn build_planned(plan: &Plan, symbols: &dyn Sym, visitor: &mut Visitor) -> Self {
+                Self::from(T::build_planned(plan, symbols, visitor))
+            }
         }
     };
 }
@@ -241,4 +271,7 @@ impl Decode for serde_json::Value {
                 .into(),
         }
     }
+    fn build_planned(plan: &Plan, symbols: &dyn Sym, visitor: &mut Visitor) -> Self {
+        plan::decode_json(plan, 0, 0, symbols, plan::slots(visitor))
+    }
 }
@@ -6,7 +6,7 @@ use std::sync::Arc;
 use crate::{utils, Error};
 
 use super::symbols::Sym;
-use super::{Layout, Visitor};
+use super::{plan, Layout, Plan, Visitor};
 
 /// A type that can be encoded into a jyafn context.
 pub trait Encode {
@@ -19,6 +19,17 @@ pub trait Encode {
         symbols: &mut dyn Sym,
         visitor: &mut Visitor,
     ) -> Result<(), Self::Err>;
+    /// Encodes this value into the provided context, following a [`Plan`] compiled from
+    /// the layout. Types that can make use of the plan should implement this; by
+    /// default, this walks the layout the plan was compiled from with [`Encode::visit`].
+    fn visit_planned(
+        &self,
+        plan: &Plan,
+        symbols: &mut dyn Sym,
+        visitor: &mut Visitor,
+    ) -> Result<(), Self::Err> {
+        self.visit(plan.layout(), symbols, visitor)
+    }
 }
 
 impl Encode for () {
@@ -43,6 +54,14 @@ impl<T: Encode> Encode for &T {
     ) -> Result<(), T::Err> {
         (*self).visit(layout, symbols, visitor)
     }
+    fn visit_planned(
+        &self,
+        plan: &Plan,
+        symbols: &mut dyn Sym,
+        visitor: &mut Visitor,
+    ) -> Result<(), T::Err> {
+        (*self).visit_planned(plan, symbols, visitor)
+    }
 }
 
 macro_rules! impl_encode_container {
@@ -57,6 +76,14 @@ macro_rules! impl_encode_container {
             ) -> Result<(), T::Err> {
                 (&*self as &T).visit(layout, symbols, visitor)
             }
+            fn visit_planned(
+                &self,
+                plan: &Plan,
+                symbols: &mut dyn Sym,
+                visitor: &mut Visitor,
+            ) -> Result<(), T::Err> {
+                (&*self as &T).visit_planned(plan, symbols, visitor)
+            }
         }
     };
 }
@@ -366,4 +393,12 @@ impl Encode for serde_json::Value {
 
         Ok(())
     }
+    fn visit_planned(
+        &self,
+        plan: &Plan,
+        symbols: &mut dyn Sym,
+        visitor: &mut Visitor,
+    ) -> Result<(), Error> {
+        plan::encode_json(plan, 0, self, 0, symbols, plan::slots_mut(visitor))
+    }
 }
@@ -0,0 +1,376 @@
+//! Reading and writing JSON straight from and to slots, following a [`Plan`].
+//!
+//! Going through [`serde_json::Value`] means building a whole tree for each input and for
+//! each output, just to throw them away right after. Here, JSON input is deserialized
+//! straight into the slots of the function and the output is serialized straight out of
+//! the slots. Nothing is allocated along the way, except for the symbols in the input
+//! that the function does not know about.
+
+use serde::de::{self, DeserializeSeed, IgnoredAny, MapAccess, SeqAccess, Unexpected};
+use serde::ser::{self, Serialize, SerializeMap, SerializeSeq};
+use std::fmt;
+
+use crate::{utils, Error};
+
+use super::plan::{self, Plan, Step};
+use super::symbols::Sym;
+use super::Visitor;
+
+/// Reads a JSON value from `json` into the slots of `visitor`, following `plan`. Plans
+/// of layouts with repeated field names (see [`Plan::has_repeated_names`]) are not
+/// supported.
+pub fn read_json(
+    plan: &Plan,
+    json: &[u8],
+    symbols: &mut dyn Sym,
+    visitor: &mut Visitor,
+) -> Result<(), Error> {
+    let mut deserializer = serde_json::Deserializer::from_slice(json);
+    Fill {
+        plan,
+        index: 0,
+        base: 0,
+        symbols,
+        slots: plan::slots_mut(visitor),
+    }
+    .deserialize(&mut deserializer)?;
+    deserializer.end()?;
+
+    Ok(())
+}
+
+/// Writes the slots of `visitor` as a JSON value into `output`, following `plan`.
+pub fn write_json(
+    plan: &Plan,
+    symbols: &dyn Sym,
+    visitor: &Visitor,
+    output: &mut Vec<u8>,
+) -> Result<(), Error> {
+    serde_json::to_writer(
+        output,
+        &View {
+            plan,
+            index: 0,
+            base: 0,
+            symbols,
+            slots: plan::slots(visitor),
+        },
+    )?;
+
+    Ok(())
+}
+
+/// Which fields of a struct were already found. Only structs with more than 64 fields
+/// need allocating.
+enum Found {
+    Few(u64),
+    Many(Vec<bool>),
+}
+
+impl Found {
+    fn new(n_fields: usize) -> Found {
+        if n_fields <= 64 {
+            Found::Few(0)
+        } else {
+            Found::Many(vec![false; n_fields])
+        }
+    }
+
+    /// Marks a field as found, returning whether it was found for the first time.
+    fn insert(&mut self, position: usize) -> bool {
+        match self {
+            Found::Few(mask) => {
+                let is_new = *mask & (1 << position) == 0;
+                *mask |= 1 << position;
+                is_new
+            }
+            Found::Many(found) => !std::mem::replace(&mut found[position], true),
+        }
+    }
+
+    fn contains(&self, position: usize) -> bool {
+        match self {
+            Found::Few(mask) => *mask & (1 << position) != 0,
+            Found::Many(found) => found[position],
+        }
+    }
+}
+
+/// Deserializes a value into the slots, starting at step `index`.
+struct Fill<'a> {
+    plan: &'a Plan,
+    index: usize,
+    base: usize,
+    symbols: &'a mut dyn Sym,
+    slots: &'a mut [u64],
+}
+
+impl<'a> Fill<'a> {
+    fn step(&self) -> &'a Step {
+        self.plan.step(self.index)
+    }
+
+    fn child(&mut self, index: usize, base: usize) -> Fill<'_> {
+        Fill {
+            plan: self.plan,
+            index,
+            base,
+            symbols: &mut *self.symbols,
+            slots: &mut *self.slots,
+        }
+    }
+
+    fn scalar<E: de::Error>(self, float: f64, unexpected: Unexpected) -> Result<(), E> {
+        match self.step() {
+            Step::Scalar(slot) => {
+                self.slots[self.base + slot] = float.to_bits();
+                Ok(())
+            }
+            _ => Err(E::invalid_type(unexpected, &self)),
+        }
+    }
+}
+
+impl<'de, 'a> DeserializeSeed<'de> for Fill<'a> {
+    type Value = ();
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: de::Deserializer<'de>,
+    {
+        deserializer.deserialize_any(self)
+    }
+}
+
+impl<'de, 'a> de::Visitor<'de> for Fill<'a> {
+    type Value = ();
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self.step() {
+            Step::Unit => write!(f, "null"),
+            Step::Scalar(_) => write!(f, "a number"),
+            Step::Bool(_) => write!(f, "a boolean"),
+            Step::DateTime(_, format) => write!(f, "a datetime formatted as {format:?}"),
+            Step::Symbol(_) => write!(f, "a string"),
+            Step::Struct { .. } => write!(f, "an object"),
+            Step::Tuple(_) => write!(f, "a tuple, which is not supported in JSON"),
+            Step::List { size, .. } => write!(f, "an array of size {size}"),
+        }
+    }
+
+    fn visit_unit<E: de::Error>(self) -> Result<(), E> {
+        match self.step() {
+            Step::Unit => Ok(()),
+            _ => Err(E::invalid_type(Unexpected::Unit, &self)),
+        }
+    }
+
+    fn visit_bool<E: de::Error>(self, b: bool) -> Result<(), E> {
+        match self.step() {
+            Step::Bool(slot) => {
+                self.slots[self.base + slot] = b as u64;
+                Ok(())
+            }
+            _ => Err(E::invalid_type(Unexpected::Bool(b), &self)),
+        }
+    }
+
+    fn visit_i64<E: de::Error>(self, int: i64) -> Result<(), E> {
+        self.scalar(int as f64, Unexpected::Signed(int))
+    }
+
+    fn visit_u64<E: de::Error>(self, uint: u64) -> Result<(), E> {
+        self.scalar(uint as f64, Unexpected::Unsigned(uint))
+    }
+
+    fn visit_f64<E: de::Error>(self, float: f64) -> Result<(), E> {
+        self.scalar(float, Unexpected::Float(float))
+    }
+
+    fn visit_str<E: de::Error>(self, s: &str) -> Result<(), E> {
+        let (slot, value) = match self.step() {
+            Step::Scalar(slot) => {
+                let Ok(float) = s.parse::<f64>() else {
+                    return Err(E::invalid_value(Unexpected::Str(s), &self));
+                };
+                (slot, float.to_bits())
+            }
+            Step::DateTime(slot, format) => {
+                let datetime = utils::parse_datetime(s, format).map_err(E::custom)?;
+                (
+                    slot,
+                    i64::from(utils::Timestamp::from(datetime.to_utc())) as u64,
+                )
+            }
+            Step::Symbol(slot) => (slot, self.symbols.find(s)),
+            _ => return Err(E::invalid_type(Unexpected::Str(s), &self)),
+        };
+        self.slots[self.base + slot] = value;
+
+        Ok(())
+    }
+
+    fn visit_seq<A: SeqAccess<'de>>(mut self, mut seq: A) -> Result<(), A::Error> {
+        let &Step::List {
+            start,
+            element,
+            size,
+            stride,
+        } = self.step()
+        else {
+            return Err(de::Error::invalid_type(Unexpected::Seq, &self));
+        };
+
+        let base = self.base + start;
+        let mut n_items = 0;
+        while n_items < size {
+            if seq
+                .next_element_seed(self.child(element, base + n_items * stride))?
+                .is_none()
+            {
+                return Err(de::Error::invalid_length(n_items, &self));
+            }
+            n_items += 1;
+        }
+        if seq.next_element::<IgnoredAny>()?.is_some() {
+            return Err(de::Error::custom(format!(
+                "expected array of size {size}, got a longer array"
+            )));
+        }
+
+        Ok(())
+    }
+
+    fn visit_map<A: MapAccess<'de>>(mut self, mut map: A) -> Result<(), A::Error> {
+        let Step::Struct {
+            fields, by_name, ..
+        } = self.step()
+        else {
+            return Err(de::Error::invalid_type(Unexpected::Map, &self));
+        };
+
+        let mut found = Found::new(fields.len());
+        let mut n_found = 0;
+        while let Some(position) = map.next_key_seed(Field(by_name))? {
+            let Some(position) = position else {
+                map.next_value::<IgnoredAny>()?;
+                continue;
+            };
+
+            let base = self.base;
+            map.next_value_seed(self.child(fields[position].1, base))?;
+            if found.insert(position) {
+                n_found += 1;
+            }
+        }
+
+        if n_found < fields.len() {
+            let (name, _) = fields
+                .iter()
+                .enumerate()
+                .find(|&(position, _)| !found.contains(position))
+                .map(|(_, field)| field)
+                .expect("some field was not found");
+            return Err(de::Error::custom(format!("missing field {name:?}")));
+        }
+
+        Ok(())
+    }
+}
+
+/// Deserializes the name of a field into its position in the struct, if it is a field
+/// of the struct at all.
+struct Field<'a>(&'a hashbrown::HashMap<Box<str>, usize>);
+
+impl<'de, 'a> DeserializeSeed<'de> for Field<'a> {
+    type Value = Option<usize>;
+    fn deserialize<D>(self, deserializer: D) -> Result<Option<usize>, D::Error>
+    where
+        D: de::Deserializer<'de>,
+    {
+        deserializer.deserialize_str(self)
+    }
+}
+
+impl<'de, 'a> de::Visitor<'de> for Field<'a> {
+    type Value = Option<usize>;
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "a field name")
+    }
+
+    fn visit_str<E: de::Error>(self, name: &str) -> Result<Option<usize>, E> {
+        Ok(self.0.get(name).copied())
+    }
+}
+
+/// Serializes the slots, starting at step `index`.
+struct View<'a> {
+    plan: &'a Plan,
+    index: usize,
+    base: usize,
+    symbols: &'a dyn Sym,
+    slots: &'a [u64],
+}
+
+impl<'a> View<'a> {
+    fn child(&self, index: usize, base: usize) -> View<'a> {
+        View {
+            plan: self.plan,
+            index,
+            base,
+            symbols: self.symbols,
+            slots: self.slots,
+        }
+    }
+}
+
+impl<'a> Serialize for View<'a> {
+    fn serialize<S: ser::Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let slot = |slot: &usize| self.slots[self.base + slot];
+        match self.plan.step(self.index) {
+            Step::Unit => serializer.serialize_unit(),
+            Step::Scalar(s) => serializer.serialize_f64(f64::from_bits(slot(s))),
+            Step::Bool(s) => serializer.serialize_bool(slot(s) != 0),
+            Step::DateTime(s, format) => serializer.collect_str(
+                &chrono::DateTime::<chrono::Utc>::from(utils::Timestamp::from(slot(s) as i64))
+                    .format(format),
+            ),
+            Step::Symbol(s) => {
+                let id = slot(s);
+                let Some(symbol) = self.symbols.get(id) else {
+                    return Err(ser::Error::custom(format!(
+                        "symbol of index {id} not found"
+                    )));
+                };
+                serializer.serialize_str(symbol)
+            }
+            Step::Struct { fields, sorted, .. } => {
+                let mut map = serializer.serialize_map(Some(sorted.len()))?;
+                for &position in sorted.iter() {
+                    let (name, field) = &fields[position];
+                    map.serialize_entry(&**name, &self.child(*field, self.base))?;
+                }
+                map.end()
+            }
+            Step::Tuple(fields) => {
+                let mut seq = serializer.serialize_seq(Some(fields.len()))?;
+                for field in fields.iter() {
+                    seq.serialize_element(&self.child(*field, self.base))?;
+                }
+                seq.end()
+            }
+            &Step::List {
+                start,
+                element,
+                size,
+                stride,
+            } => {
+                let mut seq = serializer.serialize_seq(Some(size))?;
+                for i in 0..size {
+                    seq.serialize_element(&self.child(element, self.base + start + i * stride))?;
+                }
+                seq.end()
+            }
+        }
+    }
+}
@@ -3,17 +3,21 @@
 
 mod decode;
 mod encode;
+mod json;
+mod plan;
 mod ref_value;
 mod symbols;
 mod visitor;
 
 pub use decode::{Decode, Decoder, ZeroDecoder};
 pub use encode::Encode;
+pub use json::{read_json, write_json};
+pub use plan::Plan;
 pub use ref_value::RefValue;
 pub use symbols::{symbol_hash, Sym, Symbols};
 pub use visitor::Visitor;
 
-pub(crate) use symbols::SymbolsView;
+pub(crate) use symbols::{SymbolTable, SymbolTableView};
 
 use get_size::GetSize;
 use serde_derive::{Deserialize, Serialize};
@@ -0,0 +1,448 @@
+//! Layouts compiled into flat plans for encoding and decoding values.
+//!
+//! Encoding a value by walking its [`Layout`] means matching on the variants of the
+//! layout, keeping track of where each slot goes and looking struct fields up by name,
+//! over and over again for every call, even though the layouts of a function never
+//! change. A [`Plan`] does all of that once: each node of the layout becomes a step that
+//! knows the slot it reads or writes and each struct gets a table from field name to
+//! field. Types can then be encoded (see [`super::Encode::visit_planned`]) and decoded
+//! (see [`super::Decode::build_planned`]) straight from the plan.
+
+use byte_slice_cast::*;
+use get_size::GetSize;
+use hashbrown::HashMap;
+
+use crate::utils;
+use crate::Error;
+
+use super::symbols::Sym;
+use super::{Layout, Visitor};
+
+/// A single node of a compiled layout. Slots are counted from the start of the list
+/// element the step is in, or from the start of the whole value, if it is not in a list.
+#[derive(Debug, Clone)]
+pub(super) enum Step {
+    Unit,
+    Scalar(usize),
+    Bool(usize),
+    DateTime(usize, String),
+    Symbol(usize),
+    Struct {
+        /// The name and step of each field, in order.
+        fields: Box<[(Box<str>, usize)]>,
+        /// The position in `fields` of each field name. If the struct repeats some
+        /// name, only the first field with that name is found here.
+        by_name: HashMap<Box<str>, usize>,
+        /// The positions in `fields` sorted by field name, which is the order fields are
+        /// written in, as in a [`serde_json::Map`] (without `preserve_order`). If the
+        /// struct repeats some name, only the last field with that name is found here.
+        sorted: Box<[usize]>,
+    },
+    Tuple(Box<[usize]>),
+    List {
+        /// The first slot of the list.
+        start: usize,
+        /// The step of the elements.
+        element: usize,
+        size: usize,
+        /// How many slots each element takes.
+        stride: usize,
+    },
+}
+
+/// A [`Layout`] compiled to a flat list of steps. See the module documentation for
+/// details.
+#[derive(Debug, Clone)]
+pub struct Plan {
+    layout: Layout,
+    /// All the steps, the first being the root of the layout.
+    steps: Vec<Step>,
+    repeated_names: bool,
+}
+
+impl From<Layout> for Plan {
+    fn from(layout: Layout) -> Plan {
+        Plan::new(layout)
+    }
+}
+
+impl GetSize for Plan {
+    fn get_heap_size(&self) -> usize {
+        self.layout.get_heap_size()
+            + self.steps.capacity() * std::mem::size_of::<Step>()
+            + self
+                .steps
+                .iter()
+                .map(|step| match step {
+                    Step::DateTime(_, format) => format.capacity(),
+                    Step::Struct {
+                        fields,
+                        by_name,
+                        sorted,
+                    } => {
+                        fields
+                            .iter()
+                            .map(|(name, _)| 2 * name.len() + std::mem::size_of::<usize>())
+                            .sum::<usize>()
+                            + by_name.capacity() * (std::mem::size_of::<(Box<str>, usize)>() + 1)
+                            + sorted.len() * std::mem::size_of::<usize>()
+                    }
+                    Step::Tuple(fields) => fields.len() * std::mem::size_of::<usize>(),
+                    _ => 0,
+                })
+                .sum::<usize>()
+    }
+}
+
+impl Plan {
+    /// Compiles a layout into a plan.
+    pub fn new(layout: Layout) -> Plan {
+        let mut steps = vec![];
+        compile(&layout, &mut 0, &mut steps);
+        let repeated_names = steps.iter().any(|step| match step {
+            Step::Struct {
+                fields, by_name, ..
+            } => fields.len() != by_name.len(),
+            _ => false,
+        });
+
+        Plan {
+            layout,
+            steps,
+            repeated_names,
+        }
+    }
+
+    /// The layout this plan was compiled from.
+    pub fn layout(&self) -> &Layout {
+        &self.layout
+    }
+
+    /// The step of the given index.
+    pub(super) fn step(&self, index: usize) -> &Step {
+        &self.steps[index]
+    }
+
+    /// Whether some struct in the layout has more than one field with the same name.
+    pub fn has_repeated_names(&self) -> bool {
+        self.repeated_names
+    }
+}
+
+/// Compiles `layout`, starting at `slot`, into new steps and returns the index of the
+/// step of its root. At the end, `slot` is the slot right after `layout`.
+fn compile(layout: &Layout, slot: &mut usize, steps: &mut Vec<Step>) -> usize {
+    let index = steps.len();
+    // Children are compiled before the parent step is known.
+    steps.push(Step::Unit);
+
+    let step = match layout {
+        Layout::Unit => Step::Unit,
+        Layout::Scalar => Step::Scalar(next(slot)),
+        Layout::Bool => Step::Bool(next(slot)),
+        Layout::DateTime(format) => Step::DateTime(next(slot), format.clone()),
+        Layout::Symbol => Step::Symbol(next(slot)),
+        Layout::Struct(fields) => {
+            let fields = fields
+                .0
+                .iter()
+                .map(|(name, field)| (name.as_str().into(), compile(field, slot, steps)))
+                .collect::<Box<[(Box<str>, usize)]>>();
+            let mut by_name = HashMap::with_capacity(fields.len());
+            for (position, (name, _)) in fields.iter().enumerate() {
+                by_name.entry(name.clone()).or_insert(position);
+            }
+            let mut sorted = (0..fields.len()).rev().collect::<Vec<_>>();
+            // Stable, so that the last of the fields with the same name comes first.
+            sorted.sort_by_key(|&position| &fields[position].0);
+            sorted.dedup_by_key(|&mut position| &fields[position].0);
+            Step::Struct {
+                fields,
+                by_name,
+                sorted: sorted.into(),
+            }
+        }
+        Layout::Tuple(fields) => Step::Tuple(
+            fields
+                .iter()
+                .map(|field| compile(field, slot, steps))
+                .collect(),
+        ),
+        Layout::List(element, size) => {
+            let start = *slot;
+            let element_step = compile(element, &mut 0, steps);
+            let stride = element.size().in_slots();
+            *slot += size * stride;
+            Step::List {
+                start,
+                element: element_step,
+                size: *size,
+                stride,
+            }
+        }
+    };
+
+    steps[index] = step;
+    index
+}
+
+/// Takes the next slot.
+fn next(slot: &mut usize) -> usize {
+    *slot += 1;
+    *slot - 1
+}
+
+fn incompatible(step: &Step, value: &serde_json::Value) -> Error {
+    let expected = match step {
+        Step::Unit => "unit",
+        Step::Scalar(_) => "scalar",
+        Step::Bool(_) => "bool",
+        Step::DateTime(..) => "datetime",
+        Step::Symbol(_) => "symbol",
+        Step::Struct { .. } => "struct",
+        Step::Tuple(_) => "tuple",
+        Step::List { .. } => "list",
+    };
+    format!("incompatible layout {expected} for {value:?}").into()
+}
+
+/// Encodes a JSON value into `slots` following the plan, starting at step `index`.
+pub(super) fn encode_json(
+    plan: &Plan,
+    index: usize,
+    value: &serde_json::Value,
+    base: usize,
+    symbols: &mut dyn Sym,
+    slots: &mut [u64],
+) -> Result<(), Error> {
+    use serde_json::Value;
+
+    let step = &plan.steps[index];
+    match (value, step) {
+        (Value::Null, Step::Unit) => {}
+        (Value::Bool(b), Step::Bool(slot)) => slots[base + slot] = *b as u64,
+        (Value::Number(num), Step::Scalar(slot)) => {
+            let float = if let Some(int) = num.as_i64() {
+                int as f64
+            } else if let Some(uint) = num.as_u64() {
+                uint as f64
+            } else {
+                num.as_f64()
+                    .ok_or_else(|| format!("{num} cannot be represented as 64 bit float"))?
+            };
+            slots[base + slot] = float.to_bits();
+        }
+        (Value::String(num), Step::Scalar(slot)) => {
+            let Ok(float) = num.parse::<f64>() else {
+                return Err(incompatible(step, value));
+            };
+            slots[base + slot] = float.to_bits();
+        }
+        (Value::String(datetime), Step::DateTime(slot, format)) => {
+            let timestamp = utils::Timestamp::from(
+                utils::parse_datetime(datetime, format)
+                    .map_err(|err| err.to_string())?
+                    .to_utc(),
+            );
+            slots[base + slot] = i64::from(timestamp) as u64;
+        }
+        (Value::String(e), Step::Symbol(slot)) => slots[base + slot] = symbols.find(e),
+        (
+            Value::Array(array),
+            &Step::List {
+                start,
+                element,
+                size,
+                stride,
+            },
+        ) => {
+            if array.len() != size {
+                return Err(format!(
+                    "expected array of size {size}, got array of size {}",
+                    array.len()
+                )
+                .into());
+            }
+            for (i, item) in array.iter().enumerate() {
+                encode_json(
+                    plan,
+                    element,
+                    item,
+                    base + start + i * stride,
+                    symbols,
+                    slots,
+                )?;
+            }
+        }
+        (
+            Value::Object(map),
+            Step::Struct {
+                fields, by_name, ..
+            },
+        ) => {
+            // Going through the entries of the object, instead of looking each field up
+            // in it, takes a single hash lookup per entry.
+            let mut found = 0;
+            for (name, item) in map {
+                if let Some(&position) = by_name.get(name.as_str()) {
+                    encode_json(plan, fields[position].1, item, base, symbols, slots)?;
+                    found += 1;
+                }
+            }
+
+            if found < fields.len() {
+                for (name, field) in fields.iter() {
+                    let Some(item) = map.get(&**name) else {
+                        return Err(format!("missing field {name:?} in {value:?}").into());
+                    };
+                    // Repeated names are the only way to get here with all fields present.
+                    encode_json(plan, *field, item, base, symbols, slots)?;
+                }
+            }
+        }
+        _ => return Err(incompatible(step, value)),
+    }
+
+    Ok(())
+}
+
+/// Decodes a JSON value out of `slots` following the plan, starting at step `index`.
+pub(super) fn decode_json(
+    plan: &Plan,
+    index: usize,
+    base: usize,
+    symbols: &dyn Sym,
+    slots: &[u64],
+) -> serde_json::Value {
+    use serde_json::Value;
+
+    match &plan.steps[index] {
+        Step::Unit => Value::Null,
+        Step::Scalar(slot) => f64::from_bits(slots[base + slot]).into(),
+        Step::Bool(slot) => (slots[base + slot] != 0).into(),
+        Step::DateTime(slot, format) => {
+            chrono::DateTime::<chrono::Utc>::from(utils::Timestamp::from(slots[base + slot] as i64))
+                .format(format)
+                .to_string()
+                .into()
+        }
+        Step::Symbol(slot) => Value::String(symbols.get(slots[base + slot]).unwrap().to_string()),
+        Step::Struct { fields, .. } => fields
+            .iter()
+            .map(|(name, field)| {
+                (
+                    name.to_string(),
+                    decode_json(plan, *field, base, symbols, slots),
+                )
+            })
+            .collect::<serde_json::Map<_, _>>()
+            .into(),
+        Step::Tuple(fields) => fields
+            .iter()
+            .map(|&field| decode_json(plan, field, base, symbols, slots))
+            .collect::<Vec<_>>()
+            .into(),
+        &Step::List {
+            start,
+            element,
+            size,
+            stride,
+        } => (0..size)
+            .map(|i| decode_json(plan, element, base + start + i * stride, symbols, slots))
+            .collect::<Vec<_>>()
+            .into(),
+    }
+}
+
+/// The slots of a visitor, for writing at any position.
+pub(super) fn slots_mut(visitor: &mut Visitor) -> &mut [u64] {
+    visitor
+        .buffer_mut()
+        .as_mut_slice_of::<u64>()
+        .expect("visitor buffers are made of slots")
+}
+
+/// The slots of a visitor, for reading at any position.
+pub(super) fn slots(visitor: &Visitor) -> &[u64] {
+    visitor
+        .buffer()
+        .as_slice_of::<u64>()
+        .expect("visitor buffers are made of slots")
+}
+
+#[cfg(test)]
+mod test {
+    use super::super::{symbols::Symbols, Decode, Encode, Struct};
+    use super::*;
+
+    fn layout() -> Layout {
+        Layout::Struct(Struct(vec![
+            ("x".to_string(), Layout::Scalar),
+            (
+                "y".to_string(),
+                Layout::List(
+                    Box::new(Layout::Struct(Struct(vec![
+                        ("is".to_string(), Layout::Bool),
+                        ("name".to_string(), Layout::Symbol),
+                    ]))),
+                    2,
+                ),
+            ),
+            (
+                "z".to_string(),
+                Layout::DateTime(super::super::ISOFORMAT.to_string()),
+            ),
+        ]))
+    }
+
+    #[test]
+    fn test_plan_matches_layout() {
+        let layout = layout();
+        let plan = Plan::new(layout.clone());
+        let value = serde_json::json!({
+            "z": "2024-01-02T03:04:05",
+            "y": [{ "name": "a", "is": true }, { "is": false, "name": "b" }],
+            "x": 1.5,
+            "extra": null,
+        });
+
+        let mut symbols = Symbols::default();
+        let mut walked = Visitor::new(layout.size());
+        value.visit(&layout, &mut symbols, &mut walked).unwrap();
+        let mut planned = Visitor::new(layout.size());
+        value
+            .visit_planned(&plan, &mut symbols, &mut planned)
+            .unwrap();
+        assert_eq!(walked.buffer(), planned.buffer());
+
+        let decoded = serde_json::Value::build_planned(&plan, &symbols, &mut planned);
+        assert_eq!(decoded["x"], 1.5);
+        assert_eq!(decoded["y"][1]["name"], "b");
+        assert_eq!(decoded["y"][0]["is"], true);
+
+        let missing = serde_json::json!({ "x": 1.5, "z": "2024-01-02T03:04:05" });
+        assert!(missing
+            .visit_planned(&plan, &mut symbols, &mut planned)
+            .is_err());
+    }
+
+    #[test]
+    fn test_write_json_matches_value() {
+        let layout = Layout::Struct(Struct(vec![
+            ("b".to_string(), Layout::Scalar),
+            ("a".to_string(), Layout::Scalar),
+            ("b".to_string(), Layout::Scalar),
+        ]));
+        let plan = Plan::new(layout.clone());
+        let symbols = Symbols::default();
+        let mut visitor = Visitor::new(layout.size());
+        slots_mut(&mut visitor).copy_from_slice(&[1.0f64, 2.0, 3.0].map(f64::to_bits));
+
+        let mut written = vec![];
+        super::super::json::write_json(&plan, &symbols, &visitor, &mut written).unwrap();
+        assert_eq!(written, br#"{"a":2.0,"b":3.0}"#);
+
+        let decoded = serde_json::Value::build_planned(&plan, &symbols, &mut visitor);
+        assert_eq!(written, serde_json::to_vec(&decoded).unwrap());
+    }
+}
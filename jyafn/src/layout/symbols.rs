@@ -136,3 +136,222 @@ impl Sym for SymbolsView<'_> {
         }
     }
 }
+
+/// A slot of a [`SymbolTable`]. The symbol is `text[start..end]` of the table.
+#[derive(Debug, Clone, Copy, Default)]
+struct Slot {
+    id: u64,
+    start: u32,
+    end: u32,
+    /// The slot is only occupied if this is the generation of the table.
+    generation: u32,
+}
+
+/// A flat hash table of symbols, with linear probing, keyed by id and with all the text
+/// in a single buffer. Since ids are already hashes, they index the table directly.
+///
+/// Clearing the table keeps all its memory for reuse: once it has grown to the number
+/// of symbols it usually holds, inserting them again allocates nothing.
+#[derive(Debug, Clone)]
+pub(crate) struct SymbolTable {
+    slots: Vec<Slot>,
+    text: String,
+    len: usize,
+    generation: u32,
+}
+
+impl Default for SymbolTable {
+    fn default() -> SymbolTable {
+        SymbolTable {
+            slots: vec![],
+            text: String::new(),
+            len: 0,
+            // Zeroed slots are empty.
+            generation: 1,
+        }
+    }
+}
+
+impl From<&Symbols> for SymbolTable {
+    fn from(symbols: &Symbols) -> SymbolTable {
+        let mut table = SymbolTable::default();
+        table.reserve(symbols.0.len());
+        for (&id, name) in &symbols.0 {
+            table.insert(id, name);
+        }
+        table
+    }
+}
+
+impl SymbolTable {
+    /// Where the probing for `id` starts.
+    fn home(&self, id: u64) -> usize {
+        id as usize & (self.slots.len() - 1)
+    }
+
+    /// The slot holding `id` or, if there is none, the empty slot where it would go.
+    fn probe(&self, id: u64) -> usize {
+        let mask = self.slots.len() - 1;
+        let mut i = self.home(id);
+        loop {
+            let slot = &self.slots[i];
+            if slot.generation != self.generation || slot.id == id {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    /// Makes room for `additional` more symbols, keeping the table at most half full.
+    fn reserve(&mut self, additional: usize) {
+        let wanted = ((self.len + additional) * 2).next_power_of_two().max(8);
+        if wanted <= self.slots.len() {
+            return;
+        }
+
+        let old = std::mem::replace(&mut self.slots, vec![Slot::default(); wanted]);
+        let generation = std::mem::replace(&mut self.generation, 1);
+        for slot in old.into_iter().filter(|slot| slot.generation == generation) {
+            let i = self.probe(slot.id);
+            self.slots[i] = Slot {
+                generation: 1,
+                ..slot
+            };
+        }
+    }
+
+    /// The number of symbols in this table.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Gets a symbol by id.
+    pub fn get(&self, id: u64) -> Option<&str> {
+        if self.len == 0 {
+            return None;
+        }
+        let slot = &self.slots[self.probe(id)];
+        (slot.generation == self.generation)
+            .then(|| &self.text[slot.start as usize..slot.end as usize])
+    }
+
+    /// Whether there is a symbol with this id.
+    pub fn contains(&self, id: u64) -> bool {
+        self.get(id).is_some()
+    }
+
+    /// Inserts a symbol, if there is none with the same id yet.
+    pub fn insert(&mut self, id: u64, name: &str) {
+        self.reserve(1);
+        let i = self.probe(id);
+        if self.slots[i].generation == self.generation {
+            return;
+        }
+
+        let start = self.text.len();
+        self.text.push_str(name);
+        let offset = |offset: usize| u32::try_from(offset).expect("symbols fit in 4GiB");
+        self.slots[i] = Slot {
+            id,
+            start: offset(start),
+            end: offset(self.text.len()),
+            generation: self.generation,
+        };
+        self.len += 1;
+    }
+
+    /// Removes all symbols, keeping the memory of the table.
+    pub fn clear(&mut self) {
+        if self.len == 0 {
+            return;
+        }
+        self.text.clear();
+        self.len = 0;
+        self.generation = self.generation.wrapping_add(1);
+        if self.generation == 0 {
+            // Slots of all generations are still around. Start over.
+            self.slots.fill(Slot::default());
+            self.generation = 1;
+        }
+    }
+
+    /// The memory the table holds on to, in bytes.
+    pub fn heap_size(&self) -> usize {
+        self.slots.capacity() * std::mem::size_of::<Slot>() + self.text.capacity()
+    }
+}
+
+/// A view on top of the [`SymbolTable`] of a function, with the symbols that are not in
+/// the function going into a reusable table of extra symbols.
+pub(crate) struct SymbolTableView<'a> {
+    top: &'a SymbolTable,
+    extra: &'a mut SymbolTable,
+}
+
+impl<'a> SymbolTableView<'a> {
+    /// Creates a new view, clearing the extra symbols.
+    pub fn new(top: &'a SymbolTable, extra: &'a mut SymbolTable) -> SymbolTableView<'a> {
+        extra.clear();
+        SymbolTableView { top, extra }
+    }
+}
+
+impl Sym for SymbolTableView<'_> {
+    fn find(&mut self, name: &str) -> u64 {
+        let h = symbol_hash(name);
+        if !self.top.contains(h) {
+            self.extra.insert(h, name);
+        }
+        h
+    }
+
+    fn get(&self, id: u64) -> Option<&str> {
+        self.top.get(id).or_else(|| self.extra.get(id))
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_symbol_table_matches_symbols() {
+        let mut symbols = Symbols::default();
+        let ids = (0..100)
+            .map(|i| symbols.push(format!("symbol-{i}")))
+            .collect::<Vec<_>>();
+
+        let table = SymbolTable::from(&symbols);
+        assert_eq!(table.len(), 100);
+        for &id in &ids {
+            assert_eq!(table.get(id), symbols.get(id));
+        }
+        assert_eq!(table.get(symbol_hash("nope")), None);
+    }
+
+    #[test]
+    fn test_symbol_table_view_reuses_extra() {
+        let mut symbols = Symbols::default();
+        let a = symbols.push("a".to_string());
+        let top = SymbolTable::from(&symbols);
+        let mut extra = SymbolTable::default();
+
+        for round in 0..3 {
+            let mut view = SymbolTableView::new(&top, &mut extra);
+            assert_eq!(view.find("a"), a);
+            let b = view.find(&format!("b{round}"));
+            assert_eq!(view.get(a), Some("a"));
+            assert_eq!(view.get(b), Some(format!("b{round}").as_str()));
+            // The extra symbols of the last round are gone.
+            if round > 0 {
+                assert_eq!(view.get(symbol_hash(&format!("b{}", round - 1))), None);
+            }
+            assert_eq!(extra.len(), 1);
+        }
+
+        let heap_size = extra.heap_size();
+        let mut view = SymbolTableView::new(&top, &mut extra);
+        view.find("c");
+        assert_eq!(extra.heap_size(), heap_size);
+    }
+}
@@ -5,23 +5,30 @@ compile_error!("Currently `jyafn` only works in 64-bit atchitectures");
 
 extern crate jyafn_qbe as qbe; // vendored
 
+pub mod cache;
 pub mod r#const;
 pub mod extension;
 pub mod layout;
 pub mod mapping;
+pub mod native;
 pub mod op;
 pub mod pfunc;
+pub mod pool;
+pub mod profile;
 pub mod resource;
 pub mod utils;
 
 mod function;
 mod graph;
+mod handle;
+mod image;
 
 #[cfg(feature = "map-reduce")]
 pub use dataset::Dataset;
-pub use function::{FnError, Function, FunctionData, RawFn};
+pub use function::{FnError, Function, FunctionData, PendingCall, RawBatchFn, RawFn};
 pub use graph::size;
-pub use graph::{Graph, IndexedList, Node, Ref, Type};
+pub use graph::{CodeSource, CompileStats, Graph, IndexedList, Node, PassStats, Ref, Type};
+pub use handle::FunctionHandle;
 pub use op::Op;
 pub use r#const::Const;
 
@@ -45,14 +52,16 @@ pub enum Error {
     Io(#[from] std::io::Error),
     #[error("found illegal instruction: {0}")]
     IllegalInstruction(String),
-    #[error("qbe failed with {status}: {err}")]
-    Qbe { status: ExitStatus, err: String },
+    #[error("qbe failed with status {status}: {err}")]
+    Qbe { status: i32, err: String },
     #[error("assembler failed with status {status}: {err}")]
     Assembler { status: ExitStatus, err: String },
     #[error("linker failed with status {status}: {err}")]
     Linker { status: ExitStatus, err: String },
     #[error("loader error: {0}")]
     Loader(#[from] libloading::Error),
+    #[error("bad object code: {0}")]
+    BadObject(String),
     #[error("function raised status: {0:?}")]
     StatusRaised(Cow<'static, CStr>),
     #[error("encode error: {0}")]
@@ -186,6 +195,26 @@ mod test {
         graph.compile().unwrap();
     }
 
+    #[test]
+    fn test_compile_stats_simple_graph() {
+        let graph = create_simple_graph();
+        let func = graph.compile().unwrap();
+        let stats = func.compile_stats().unwrap();
+        assert_eq!(stats.nodes, graph.nodes.len());
+        assert_eq!(stats.passes.last().unwrap().name, "reachability");
+        assert!(stats.ir_size > 0 && stats.object_size > 0 && stats.image_size > 0);
+        assert_eq!(stats.qbe_ms.is_some(), stats.source == CodeSource::Compiled);
+
+        let metadata = func.graph().metadata();
+        assert_eq!(metadata["jyafn.compile.size.ir"], stats.ir_size.to_string());
+        assert!(metadata.contains_key("jyafn.compile.time_ms.reachability"));
+
+        // Compiled in the background: only there once the machine code is.
+        let tiered = graph.compile_tiered();
+        tiered.wait_native().unwrap();
+        assert!(tiered.compile_stats().is_some());
+    }
+
     #[test]
     fn test_run_simple_graph() {
         let graph = create_simple_graph();
@@ -198,6 +227,56 @@ mod test {
         println!("fn({:?}) = {:?}", i, out.as_slice_of::<f64>().unwrap());
     }
 
+    #[test]
+    fn test_eval_json_simple_graph() {
+        let graph = create_simple_graph();
+        let func = graph.compile().unwrap();
+
+        let mut output = vec![];
+        func.eval_json(br#"{"b": 2.0, "c": [1, 2], "a": 3}"#, &mut output)
+            .unwrap();
+        assert_eq!(output, b"6.0");
+
+        output.clear();
+        func.eval_json(br#"{"a": "1.5", "b": 2.0}"#, &mut output)
+            .unwrap();
+        assert_eq!(output, b"4.5");
+
+        assert!(func.eval_json(br#"{"a": 1.0}"#, &mut output).is_err());
+        assert!(func
+            .eval_json(br#"{"a": 1.0, "b": true}"#, &mut output)
+            .is_err());
+        assert!(func
+            .eval_json(br#"{"a": 1.0, "b": 2.0} x"#, &mut output)
+            .is_err());
+    }
+
+    #[test]
+    fn test_run_batch_simple_graph() {
+        let graph = create_simple_graph();
+        let func = graph.compile().unwrap();
+
+        let i = [5.0, 6.0, 1.0, 2.0, -1.0, 0.0];
+        let mut out = [0.0; 3];
+        let errors = func.call_batch(i.as_byte_slice(), out.as_mut_byte_slice());
+        assert!(errors.is_empty());
+        assert_eq!(out, [12.0, 4.0, 0.0]);
+    }
+
+    #[test]
+    fn test_par_run_batch_simple_graph() {
+        let graph = create_simple_graph();
+        let func = graph.compile().unwrap();
+
+        let i = (0..2_000).map(f64::from).collect::<Vec<_>>();
+        let mut out = vec![0.0; 1_000];
+        let errors = func.par_call_batch(i.as_byte_slice(), out.as_mut_byte_slice());
+        assert!(errors.is_empty());
+        for (row, out) in out.into_iter().enumerate() {
+            assert_eq!(out, (4 * row + 2) as f64);
+        }
+    }
+
     fn create_pfunc_graph() -> Graph {
         let mut g = Graph::new();
         let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
@@ -229,6 +308,62 @@ mod test {
         println!("sqrt({num}) = {sqrt}");
     }
 
+    #[test]
+    fn test_run_pfunc_cached() {
+        let cache_dir = tempfile::tempdir().unwrap();
+        let graph = create_pfunc_graph();
+        let (compiled, cached) = cache::with_dir(Some(cache_dir.path().to_owned()), || {
+            (graph.compile().unwrap(), graph.compile().unwrap())
+        });
+
+        let source = |func: &Function| func.compile_stats().unwrap().source;
+        assert_eq!(source(&compiled), CodeSource::Compiled);
+        assert_eq!(source(&cached), CodeSource::Cache);
+
+        // Nothing is left of the stats of the first compilation (e.g., of QBE).
+        assert!(compiled
+            .graph()
+            .metadata()
+            .contains_key("jyafn.compile.time_ms.qbe"));
+        let recompiled = cache::with_dir(Some(cache_dir.path().to_owned()), || {
+            compiled.graph().compile().unwrap()
+        });
+        let metadata = recompiled.graph().metadata();
+        assert_eq!(metadata["jyafn.compile.source"], "cache");
+        assert!(!metadata.contains_key("jyafn.compile.time_ms.qbe"));
+
+        for func in [compiled, cached] {
+            let sqrt: f64 = func.eval(&serde_json::json!({ "a": 4.0 })).unwrap();
+            assert_eq!(sqrt, 2.0);
+        }
+    }
+
+    #[test]
+    fn test_load_pfunc_native() {
+        let graph = create_pfunc_graph();
+        let mut dumped = vec![];
+        graph
+            .dump_native(std::io::Cursor::new(&mut dumped))
+            .unwrap();
+
+        let load = |trusted| {
+            native::with_trusted(trusted, || {
+                cache::with_dir(None, || {
+                    Function::load(std::io::Cursor::new(&dumped)).unwrap()
+                })
+            })
+        };
+        let source = |func: &Function| func.compile_stats().unwrap().source;
+        let (untrusted, trusted) = (load(false), load(true));
+        assert_eq!(source(&untrusted), CodeSource::Compiled);
+        assert_eq!(source(&trusted), CodeSource::Precompiled);
+
+        for func in [untrusted, trusted] {
+            let sqrt: f64 = func.eval(&serde_json::json!({ "a": 4.0 })).unwrap();
+            assert_eq!(sqrt, 2.0);
+        }
+    }
+
     fn create_abs_graph() -> Graph {
         let mut g = Graph::new();
         let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
@@ -268,4 +403,759 @@ mod test {
 
         println!("abs({num}) = {abs}");
     }
+
+    #[test]
+    fn test_run_min_max() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let RefValue::Scalar(b) = g.input("b".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let min = g.insert(op::Min, vec![a, b]).unwrap();
+        let max = g.insert(op::Max, vec![a, b]).unwrap();
+        let out = g.insert(op::Sub, vec![max, min]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+        let func = g.compile().unwrap();
+
+        for (i, expected) in [([1.0, 3.0], 2.0), ([3.0, 1.0], 2.0), ([-2.0, -2.0], 0.0)] {
+            let out = func.eval_raw(i.as_byte_slice()).unwrap();
+            assert_eq!(out.as_slice_of::<f64>().unwrap(), [expected]);
+        }
+    }
+
+    #[test]
+    fn test_run_select() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let RefValue::Scalar(b) = g.input("b".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let test = g.insert(op::Gt, vec![a, b]).unwrap();
+        let b_plus_one = g.insert(op::Add, vec![b, Ref::from(1.0)]).unwrap();
+        let out = g.insert(op::Choose, vec![test, b_plus_one, a]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+        let func = g.compile().unwrap();
+        // Cheap sides need no branch:
+        let rendered = g.render().unwrap().to_string();
+        assert!(rendered.contains("select.mask") && !rendered.contains("if.true"));
+
+        for (i, expected) in [([1.0, 3.0], 1.0), ([3.0, 1.0], 2.0), ([-0.0, -1.0], 0.0)] {
+            let out = func.eval_raw(i.as_byte_slice()).unwrap();
+            assert_eq!(out.as_slice_of::<f64>().unwrap(), [expected]);
+        }
+    }
+
+    #[test]
+    fn test_run_inlined_subgraph() {
+        let subgraph = || {
+            let mut h = Graph::new_with_name("h".to_string());
+            let RefValue::Scalar(x) = h.input("x".to_string(), Layout::Scalar) else {
+                unreachable!()
+            };
+            let RefValue::Scalar(y) = h.input("y".to_string(), Layout::Scalar) else {
+                unreachable!()
+            };
+            let twice = h.insert(op::Mul, vec![x, Ref::from(2.0)]).unwrap();
+            let sum = h.insert(op::Add, vec![twice, y]).unwrap();
+            let diff = h.insert(op::Sub, vec![x, y]).unwrap();
+            h.output(
+                RefValue::Tuple(vec![RefValue::Scalar(sum), RefValue::Scalar(diff)]),
+                Layout::Tuple(vec![Layout::Scalar, Layout::Scalar]),
+            )
+            .unwrap();
+            h
+        };
+
+        let mut g = Graph::new();
+        let graph_id = g.insert_subgraph(subgraph());
+        assert_eq!(g.insert_subgraph(subgraph()), graph_id);
+        assert_eq!(g.subgraphs.len(), 1);
+
+        let a = g.input("a".to_string(), Layout::Scalar);
+        let args = RefValue::Struct(
+            [
+                ("x".to_string(), a),
+                ("y".to_string(), RefValue::Scalar(Ref::from(3.0))),
+            ]
+            .into_iter()
+            .collect(),
+        );
+        let RefValue::Tuple(mut outputs) = g.call_graph(graph_id, args).unwrap() else {
+            unreachable!()
+        };
+        g.output(outputs.remove(0), Layout::Scalar).unwrap();
+        let func = g.compile().unwrap();
+        // Small subgraphs are not called:
+        let rendered = g.render().unwrap().to_string();
+        assert!(!rendered.contains("callgraph.input"));
+
+        let out = func.eval_raw([2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [7.0]);
+    }
+
+    #[test]
+    fn test_run_compiled_in_units() {
+        // Big enough to be compiled in more than one unit, given more than one thread
+        // (see `graph::compile::test::test_split_units`):
+        let mut h = Graph::new_with_name("h".to_string());
+        let RefValue::Scalar(x) = h.input("x".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let mut y = x;
+        for _ in 0..6000 {
+            y = h.insert(op::Mul, vec![y, Ref::from(1.0001)]).unwrap();
+            y = h.insert(op::Add, vec![y, x]).unwrap();
+        }
+        h.output(RefValue::Scalar(y), Layout::Scalar).unwrap();
+
+        let mut g = Graph::new();
+        let graph_id = g.insert_subgraph(h);
+        let a = g.input("a".to_string(), Layout::Scalar);
+        let args = RefValue::Struct([("x".to_string(), a)].into_iter().collect());
+        let out = g.call_graph(graph_id, args).unwrap();
+        g.output(out, Layout::Scalar).unwrap();
+        let func = g.compile().unwrap();
+
+        let mut expected = 2.0f64;
+        for _ in 0..6000 {
+            expected = expected * 1.0001 + 2.0;
+        }
+        let out = func.eval_raw([2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [expected]);
+    }
+
+    #[test]
+    fn test_run_choose_shared_node() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        // `x` is used both before the choice and on its `if` side:
+        let x = g.insert(op::Add, vec![a, Ref::from(1.0)]).unwrap();
+        let y = g.insert(op::Mul, vec![x, x]).unwrap();
+        let t = g.insert(op::Div, vec![x, a]).unwrap();
+        let test = g.insert(op::Gt, vec![a, Ref::from(0.0)]).unwrap();
+        let chosen = g.insert(op::Choose, vec![test, t, a]).unwrap();
+        let out = g.insert(op::Add, vec![y, chosen]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+        let func = g.compile().unwrap();
+
+        for (i, expected) in [(2.0, 10.5), (-1.0, -1.0)] {
+            let out = func.eval_raw([i].as_byte_slice()).unwrap();
+            assert_eq!(out.as_slice_of::<f64>().unwrap(), [expected]);
+        }
+    }
+
+    #[test]
+    fn test_run_tiered() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let positive = g.insert(op::Ge, vec![a, Ref::from(0.0)]).unwrap();
+        g.assert(positive, "negative input".to_string()).unwrap();
+        let root = g.insert(op::Call("sqrt".to_string()), vec![a]).unwrap();
+        let out = g.insert(op::Add, vec![root, Ref::from(1.0)]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+
+        // Plain arithmetic can be interpreted, unless some assertion fails:
+        let mut output = [0.0f64];
+        assert!(g
+            .interpret([4.0].as_byte_slice(), output.as_mut_byte_slice())
+            .is_some());
+        assert_eq!(output, [3.0]);
+        assert!(g
+            .interpret([-4.0].as_byte_slice(), output.as_mut_byte_slice())
+            .is_none());
+
+        let func = g.compile_tiered();
+        let out = func.eval_raw([9.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [4.0]);
+        // Errors need the compiled code, which raises them:
+        let err = func.eval_raw([-1.0].as_byte_slice()).unwrap_err();
+        assert!(err.to_string().contains("negative input"));
+        assert!(func.is_native());
+
+        let mut g = Graph::new();
+        g.assert(Ref::from(false), "always".to_string()).unwrap();
+        let func = g.compile_tiered();
+        assert!(func.wait_native().is_err());
+        assert!(!func.is_native());
+        assert!(func.eval_raw([0u8; 0]).is_err());
+    }
+
+    #[test]
+    fn test_run_stripped() {
+        let graph = create_simple_graph();
+        let mut func = graph.compile().unwrap();
+        let size_estimate = |func: &Function| -> usize {
+            func.graph().metadata()["jyafn.mem_size_estimate"]
+                .parse()
+                .unwrap()
+        };
+        let full_size = size_estimate(&func);
+
+        let clone = func.clone();
+        assert!(func.strip().is_err());
+        drop(clone);
+
+        func.strip().unwrap();
+        assert!(func.graph().is_stripped());
+        assert!(size_estimate(&func) < full_size);
+        let out = func.eval_raw([5.0, 6.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [12.0]);
+        assert!(func.graph().render().is_err());
+        assert!(func.graph().dump(std::io::Cursor::new(Vec::new())).is_err());
+    }
+
+    #[test]
+    fn test_strip_tiered() {
+        let graph = create_simple_graph();
+        // Right away, while the code is still compiling in the background.
+        for _ in 0..10 {
+            let mut func = graph.compile_tiered();
+            func.strip().unwrap();
+            assert!(func.is_native());
+            assert!(func.compile_stats().is_some());
+            let metadata = func.graph().metadata();
+            assert!(metadata.contains_key("jyafn.compile.source"));
+            let out = func.eval_raw([5.0, 6.0].as_byte_slice()).unwrap();
+            assert_eq!(out.as_slice_of::<f64>().unwrap(), [12.0]);
+        }
+    }
+
+    fn create_offset_function(offset: f64) -> Function {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let out = g.insert(op::Add, vec![a, Ref::from(offset)]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+        g.compile().unwrap()
+    }
+
+    #[test]
+    fn test_run_handle_swap() {
+        let handle = std::sync::Arc::new(FunctionHandle::new(create_offset_function(1.0)));
+        let eval = |handle: &FunctionHandle| {
+            let out = handle
+                .with(|func| func.eval_raw([1.0].as_byte_slice()))
+                .unwrap();
+            out.as_slice_of::<f64>().unwrap()[0]
+        };
+        assert_eq!(eval(&handle), 2.0);
+
+        let callers = (0..4)
+            .map(|_| {
+                let handle = handle.clone();
+                std::thread::spawn(move || {
+                    for _ in 0..1_000 {
+                        let out = eval(&handle);
+                        assert!(out == 2.0 || out == 3.0, "got {out}");
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+
+        // The previous version stays alive while a call holds it:
+        let held = handle.current();
+        let previous = handle.swap(create_offset_function(2.0));
+        assert_eq!(previous.eval_raw([1.0].as_byte_slice()).unwrap().len(), 8);
+        drop(previous);
+        assert_eq!(eval(&handle), 3.0);
+        assert_eq!(
+            held.eval_raw([1.0].as_byte_slice())
+                .unwrap()
+                .as_slice_of::<f64>()
+                .unwrap(),
+            [2.0]
+        );
+
+        for caller in callers {
+            caller.join().unwrap();
+        }
+
+        handle
+            .reload(|| Ok(create_offset_function(3.0)))
+            .join()
+            .unwrap()
+            .unwrap();
+        assert_eq!(eval(&handle), 4.0);
+    }
+
+    fn create_elementwise_graph() -> Graph {
+        let mut g = Graph::new();
+        let mut input = |name: &str| {
+            let RefValue::Scalar(x) = g.input(name.to_string(), Layout::Scalar) else {
+                unreachable!()
+            };
+            x
+        };
+        let a = ["a0", "a1", "a2"].map(&mut input);
+        let b = ["b0", "b1", "b2"].map(&mut input);
+        let idx = input("idx");
+
+        let a_list = g.indexed_list(a.to_vec()).unwrap();
+        let b_list = g.indexed_list(b.to_vec()).unwrap();
+        let sum = (0..3)
+            .map(|i| g.insert(op::Add, vec![a[i], b[i]]).unwrap())
+            .collect();
+        let sum_list = g.indexed_list(sum).unwrap();
+
+        let a0 = a_list.get(&mut g, idx).unwrap();
+        let b0 = b_list.get(&mut g, idx).unwrap();
+        let sum0 = sum_list.get(&mut g, idx).unwrap();
+        let out = g.insert(op::Mul, vec![sum0, a0]).unwrap();
+        let out = g.insert(op::Add, vec![out, b0]).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+
+        g
+    }
+
+    #[test]
+    fn test_run_elementwise() {
+        let graph = create_elementwise_graph();
+        let rendered = graph.render().unwrap().to_string();
+        assert!(rendered.contains("vaddd"), "{rendered}");
+
+        let func = graph.compile().unwrap();
+        for idx in 0..3 {
+            let i = [1.0, 2.0, 3.0, 10.0, 20.0, 30.0, idx as f64];
+            let out = func.eval_raw(i.as_byte_slice()).unwrap();
+            let (a, b) = (i[idx], i[idx + 3]);
+            assert_eq!(out.as_slice_of::<f64>().unwrap(), [(a + b) * a + b]);
+        }
+    }
+
+    #[test]
+    fn test_run_index_of_sorted() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(x) = g.input("x".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        // Unsorted, with a repetition, a NaN and both zeros:
+        let elements = [
+            5.0,
+            -3.0,
+            0.0,
+            8.0,
+            5.0,
+            f64::NAN,
+            12.5,
+            -0.0,
+            100.0,
+            7.0,
+            -1.0,
+        ];
+        let list = g
+            .indexed_list(elements.iter().map(|&e| Ref::from(e)).collect())
+            .unwrap();
+        let out = list.index_of(&mut g, x).unwrap();
+        g.output(RefValue::Scalar(out), Layout::Scalar).unwrap();
+
+        let rendered = g.render().unwrap().to_string();
+        assert!(rendered.contains("indexof.table"), "{rendered}");
+
+        let func = g.compile().unwrap();
+        for (x, expected) in [
+            (5.0, 0.0),
+            (-3.0, 1.0),
+            (0.0, 2.0),
+            (-0.0, 2.0),
+            (8.0, 3.0),
+            (12.5, 6.0),
+            (100.0, 8.0),
+            (7.0, 9.0),
+            (-1.0, 10.0),
+            (f64::NAN, -1.0),
+            (6.0, -1.0),
+            (-100.0, -1.0),
+            (1000.0, -1.0),
+        ] {
+            let out = func.eval_raw([x].as_byte_slice()).unwrap();
+            assert_eq!(
+                out.as_slice_of::<f64>().unwrap(),
+                [expected],
+                "index of {x}"
+            );
+        }
+    }
+
+    #[test]
+    fn test_eliminate_common() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let RefValue::Scalar(b) = g.input("b".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        let c = g.insert(op::Add, vec![a, b]).unwrap();
+        let d = g.insert(op::Add, vec![a, b]).unwrap();
+        let e = g.insert(op::Mul, vec![c, d]).unwrap();
+        g.output(RefValue::Scalar(e), Layout::Scalar).unwrap();
+
+        let rendered = g.render().unwrap().to_string();
+        assert_eq!(rendered.matches("=d add").count(), 1, "{rendered}");
+
+        let func = g.compile().unwrap();
+        let out = func.eval_raw([1.0, 2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [9.0]);
+    }
+
+    #[test]
+    fn test_simplify() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        // ((a * 2) / 4 + 1) + 2 => (a + a) * 0.25 + 3
+        let two = g.r#const(2.0);
+        let b = g.insert(op::Mul, vec![a, two]).unwrap();
+        let four = g.r#const(4.0);
+        let c = g.insert(op::Div, vec![b, four]).unwrap();
+        let one = g.r#const(1.0);
+        let d = g.insert(op::Add, vec![c, one]).unwrap();
+        let e = g.insert(op::Add, vec![d, two]).unwrap();
+        g.output(RefValue::Scalar(e), Layout::Scalar).unwrap();
+
+        let rendered = g.render().unwrap().to_string();
+        assert_eq!(rendered.matches("=d add").count(), 2, "{rendered}");
+        assert_eq!(rendered.matches("=d mul").count(), 1, "{rendered}");
+        assert_eq!(rendered.matches("=d div").count(), 0, "{rendered}");
+
+        let func = g.compile().unwrap();
+        let out = func.eval_raw([2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [4.0]);
+    }
+
+    #[test]
+    fn test_simplify_keeps_overflow() {
+        let mut g = Graph::new();
+        let RefValue::Scalar(a) = g.input("a".to_string(), Layout::Scalar) else {
+            unreachable!()
+        };
+        // (a * 1e300) * 1e-300 is not folded into a * 1, which would not overflow.
+        let big = g.r#const(1e300);
+        let b = g.insert(op::Mul, vec![a, big]).unwrap();
+        let small = g.r#const(1e-300);
+        let c = g.insert(op::Mul, vec![b, small]).unwrap();
+        g.output(RefValue::Scalar(c), Layout::Scalar).unwrap();
+
+        let func = g.compile().unwrap();
+        let out = func.eval_raw([1e10].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [f64::INFINITY]);
+    }
+
+    fn create_mapping_graph<S: mapping::StorageType + 'static>(storage_type: S) -> Graph {
+        let mut g = Graph::new();
+        let key_layout = Layout::List(Box::new(Layout::Scalar), 2);
+        g.insert_mapping(
+            "m".to_string(),
+            key_layout.clone(),
+            Layout::Scalar,
+            storage_type,
+            (0..100).map(|i| Ok::<_, Error>((vec![i as f64, 2.0 * i as f64], 10.0 * i as f64))),
+        )
+        .unwrap();
+        let key = g.input("key".to_string(), key_layout);
+        let value = g.call_mapping("m", key).unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        g
+    }
+
+    fn check_mapping_graph(graph: &Graph) {
+        let func = graph.compile().unwrap();
+        let out = func.eval_raw([3.0, 6.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [30.0]);
+        assert!(func.eval_raw([3.0, 7.0].as_byte_slice()).is_err());
+    }
+
+    #[test]
+    fn test_run_mapping() {
+        check_mapping_graph(&create_mapping_graph(mapping::HashMapStorage));
+    }
+
+    #[test]
+    fn test_profile_mapping_calls() {
+        let graph = create_mapping_graph(mapping::HashMapStorage);
+        assert!(graph.compile().unwrap().profile_report().is_none());
+
+        let func = graph.compile_profiled().unwrap();
+        for _ in 0..3 {
+            func.eval_raw([3.0, 6.0].as_byte_slice()).unwrap();
+        }
+        assert!(func.eval_raw([3.0, 7.0].as_byte_slice()).is_err());
+
+        let report = func.profile_report().unwrap();
+        let whole = &report.entries[0];
+        assert_eq!((whole.kind, whole.hits), (profile::SiteKind::Function, 3));
+        let call = report
+            .entries
+            .iter()
+            .find(|entry| entry.op.as_deref() == Some("CallMapping"))
+            .unwrap();
+        assert_eq!(call.name.as_deref(), Some("m"));
+        assert_eq!((call.hits, call.misses), (4, Some(1)));
+        assert!(call.ticks > 0);
+
+        func.reset_profile();
+        let report = func.profile_report().unwrap();
+        assert!(report.entries.iter().all(|entry| entry.hits == 0));
+    }
+
+    #[test]
+    fn test_run_flat_mapping() {
+        let graph = create_mapping_graph(mapping::FlatStorage);
+        check_mapping_graph(&graph);
+
+        let mut dumped = vec![];
+        graph.dump(std::io::Cursor::new(&mut dumped)).unwrap();
+        check_mapping_graph(&Graph::load(std::io::Cursor::new(&dumped)).unwrap());
+    }
+
+    #[test]
+    fn test_load_mapped_mapping() {
+        let graph = create_mapping_graph(mapping::MappedStorage);
+        check_mapping_graph(&graph);
+
+        let file = tempfile::NamedTempFile::new().unwrap();
+        graph.dump(file.reopen().unwrap()).unwrap();
+        check_mapping_graph(&Graph::load(file.reopen().unwrap()).unwrap());
+        check_mapping_graph(&Graph::load_mapped(file.path()).unwrap());
+
+        // Mapped storages are shared by where they are in the file, without reading them.
+        let first = Graph::load_mapped(file.path()).unwrap();
+        let second = Graph::load_mapped(file.path()).unwrap();
+        assert!(std::sync::Arc::ptr_eq(
+            &first.mappings["m"],
+            &second.mappings["m"]
+        ));
+        assert!(second.shared_size > 0);
+
+        let func = Function::load_mapped(file.path()).unwrap();
+        let out = func.eval_raw([99.0, 198.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [990.0]);
+    }
+
+    #[test]
+    fn test_run_perfect_hash_mapping() {
+        let graph = create_mapping_graph(mapping::PerfectHashStorage);
+        check_mapping_graph(&graph);
+
+        let mut dumped = vec![];
+        graph.dump(std::io::Cursor::new(&mut dumped)).unwrap();
+        check_mapping_graph(&Graph::load(std::io::Cursor::new(&dumped)).unwrap());
+    }
+
+    #[test]
+    fn test_prefetch_mapping_calls() {
+        let mut g = create_mapping_graph(mapping::HashMapStorage);
+        let key_layout = Layout::List(Box::new(Layout::Scalar), 2);
+        let key = g.input("other_key".to_string(), key_layout);
+        let value = g.call_mapping("m", key).unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        // The second lookup does not depend on the first, so it is prefetched before the
+        // first and resolved after it: one definition and one call of each half.
+        let rendered = g.render().unwrap().to_string();
+        assert_eq!(
+            rendered.matches("mapping.m.prefetch(").count(),
+            2,
+            "{rendered}"
+        );
+        assert_eq!(
+            rendered.matches("mapping.m.resolve(").count(),
+            2,
+            "{rendered}"
+        );
+
+        let func = g.compile().unwrap();
+        let out = func
+            .eval_raw([3.0, 6.0, 5.0, 10.0].as_byte_slice())
+            .unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [30.0, 50.0]);
+        assert!(func
+            .eval_raw([3.0, 6.0, 5.0, 11.0].as_byte_slice())
+            .is_err());
+
+        let values = g.mappings["m"].get_many([
+            [3.0, 6.0].as_byte_slice(),
+            [3.0, 7.0].as_byte_slice(),
+            [5.0, 10.0].as_byte_slice(),
+        ]);
+        assert_eq!(
+            values,
+            [
+                Some(30.0f64.to_ne_bytes().as_slice()),
+                None,
+                Some(50.0f64.to_ne_bytes().as_slice()),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_share_loaded_mappings() {
+        let mut g = Graph::new();
+        g.insert_mapping(
+            "shared".to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..1000).map(|i| Ok::<_, Error>((i as f64, 7.0 * i as f64 + 0.5))),
+        )
+        .unwrap();
+        let key = g.input("key".to_string(), Layout::Scalar);
+        let value = g.call_mapping("shared", key).unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        let mut dumped = vec![];
+        g.dump(std::io::Cursor::new(&mut dumped)).unwrap();
+
+        let first = Graph::load(std::io::Cursor::new(&dumped)).unwrap();
+        let second = Graph::load(std::io::Cursor::new(&dumped)).unwrap();
+        assert!(std::sync::Arc::ptr_eq(
+            &first.mappings["shared"],
+            &second.mappings["shared"]
+        ));
+        assert_eq!(first.shared_size, 0);
+        assert!(second.shared_size > 0);
+
+        // Sharing goes by the contents, whatever the format they are stored in.
+        let mut streamed = vec![];
+        g.dump_stream(&mut streamed).unwrap();
+        let from_stream = Graph::load_stream(&streamed[..]).unwrap();
+        assert!(std::sync::Arc::ptr_eq(
+            &first.mappings["shared"],
+            &from_stream.mappings["shared"]
+        ));
+
+        let func = second.compile().unwrap();
+        let shared_size = &func.graph().metadata()["jyafn.mem_size_estimate.shared"];
+        assert_eq!(shared_size, &second.shared_size.to_string());
+
+        // Once no one holds the mapping anymore, it is read again.
+        drop((first, second, from_stream, func));
+        let third = Graph::load(std::io::Cursor::new(&dumped)).unwrap();
+        assert_eq!(third.shared_size, 0);
+    }
+
+    #[test]
+    fn test_load_lazy_mapping() {
+        let mut g = Graph::new();
+        g.insert_mapping(
+            "lazy".to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..1000).map(|i| Ok::<_, Error>((i as f64, 3.0 * i as f64 + 0.25))),
+        )
+        .unwrap();
+        g.insert_mapping(
+            "unused".to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..1000).map(|i| Ok::<_, Error>((i as f64, 2.0 * i as f64))),
+        )
+        .unwrap();
+        let key = g.input("key".to_string(), Layout::Scalar);
+        let value = g.call_mapping("lazy", key).unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        let file = tempfile::NamedTempFile::new().unwrap();
+        g.dump(file.reopen().unwrap()).unwrap();
+
+        let func = Function::load_lazy(file.path()).unwrap();
+        let mapping = &func.graph().mappings["lazy"];
+        assert!(mapping.is_initialized());
+        assert_eq!(get_size::GetSize::get_heap_size(&**mapping), 0);
+
+        let out = func.eval_raw([2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [6.25]);
+        assert!(func.eval_raw([2.5].as_byte_slice()).is_err());
+        assert!(get_size::GetSize::get_heap_size(&**mapping) > 0);
+
+        // Mappings the function never calls are not read on its behalf.
+        let unused = &func.graph().mappings["unused"];
+        assert_eq!(get_size::GetSize::get_heap_size(&**unused), 0);
+    }
+
+    #[test]
+    fn test_load_lazy_mapping_error() {
+        let mut g = Graph::new();
+        g.insert_mapping(
+            "broken".to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..1000).map(|i| Ok::<_, Error>((i as f64, 3.0 * i as f64 + 0.25))),
+        )
+        .unwrap();
+        let key = g.input("key".to_string(), Layout::Scalar);
+        let value = g
+            .call_mapping_default("broken", key, RefValue::Scalar(Ref::from(0.0)))
+            .unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        g.dump(file.reopen().unwrap()).unwrap();
+
+        // Corrupts the data of the mapping, which is only found out when reading it. The
+        // entry is deflated and a first byte of `0xff` starts a block of invalid type.
+        let data_start = {
+            let mut archive = zip::ZipArchive::new(file.reopen().unwrap()).unwrap();
+            let entry = archive.by_name("broken.mapping").unwrap();
+            assert_eq!(entry.compression(), zip::CompressionMethod::Deflated);
+            entry.data_start() as usize
+        };
+        let mut contents = std::fs::read(file.path()).unwrap();
+        contents[data_start] = 0xff;
+        std::io::Write::write_all(&mut file, &contents).unwrap();
+
+        // The error is reported as such, not as a missing key, which has a default.
+        let func = Function::load_lazy(file.path()).unwrap();
+        let err = func.eval_raw([2.0].as_byte_slice()).unwrap_err();
+        assert!(err.to_string().contains("failed to read mapping"), "{err}");
+    }
+
+    #[test]
+    fn test_dump_load_stream() {
+        let mut g = Graph::new();
+        g.insert_mapping(
+            "streamed".to_string(),
+            Layout::Scalar,
+            Layout::Scalar,
+            mapping::HashMapStorage,
+            (0..1000).map(|i| Ok::<_, Error>((i as f64, 5.0 * i as f64 + 0.75))),
+        )
+        .unwrap();
+        let key = g.input("key".to_string(), Layout::Scalar);
+        let value = g.call_mapping("streamed", key).unwrap();
+        g.output(value, Layout::Scalar).unwrap();
+
+        // Neither `Vec<u8>` nor `&[u8]` can seek.
+        let mut dumped = vec![];
+        g.dump_stream(&mut dumped).unwrap();
+
+        let func = Function::load_stream(&dumped[..]).unwrap();
+        let out = func.eval_raw([2.0].as_byte_slice()).unwrap();
+        assert_eq!(out.as_slice_of::<f64>().unwrap(), [10.75]);
+
+        // Streams can also be loaded as any other graph.
+        let loaded = Graph::load(std::io::Cursor::new(&dumped)).unwrap();
+        assert_eq!(loaded.mappings.len(), 1);
+        let metadata = Graph::load_metadata(std::io::Cursor::new(&dumped)).unwrap();
+        assert_eq!(metadata, g.metadata);
+
+        // Corrupted data is found out.
+        let position = dumped.len() / 2;
+        dumped[position] ^= 0xff;
+        assert!(Graph::load_stream(&dumped[..]).is_err());
+    }
 }
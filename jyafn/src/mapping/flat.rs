@@ -0,0 +1,114 @@
+//! A flat hash table storage, for mappings with many entries.
+//!
+//! All values of a mapping have the same size (that of its value layout). So, instead of
+//! allocating each value separately on the heap, this storage keeps all values in a
+//! single contiguous arena, with a fixed stride. The index is a SIMD-probed open
+//! addressing table from the hash of the key to the position of the value in the arena,
+//! which keeps all hashes in a single array as well. This cuts down the overhead per
+//! entry and the number of pointers to chase in each lookup.
+
+use hashbrown::HashMap;
+use serde_derive::{Deserialize, Serialize};
+use std::io::Read;
+
+use crate::Error;
+
+use super::{prefetch_bucket, Storage, StorageType, UnHash};
+
+/// A [`StorageType`] implementation of an in-memory hash table where all values are
+/// stored inline in one contiguous buffer.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct FlatStorage;
+
+#[typetag::serde]
+impl StorageType for FlatStorage {
+    fn init(&self) -> Result<Box<dyn Storage>, Error> {
+        Ok(Box::new(FlatTable::default()))
+    }
+
+    fn read(&self, f: &mut dyn Read) -> Result<Box<dyn Storage>, Error> {
+        let dumped: Dumped = bincode::deserialize_from(f).map_err(Error::Bincode)?;
+        if dumped.values.len() != dumped.keys.len() * dumped.value_size {
+            return Err("flat mapping has wrong number of values".to_string().into());
+        }
+
+        let mut index = HashMap::with_capacity_and_hasher(dumped.keys.len(), UnHash);
+        for (position, hash) in dumped.keys.into_iter().enumerate() {
+            index.insert(hash, position);
+        }
+
+        Ok(Box::new(FlatTable {
+            index,
+            value_size: dumped.value_size,
+            values: dumped.values,
+        }))
+    }
+}
+
+/// The dumped format of a [`FlatTable`]: the value of the `i`-th key is the `i`-th chunk
+/// of `value_size` bytes of `values`.
+#[derive(Serialize, Deserialize)]
+struct Dumped {
+    value_size: usize,
+    keys: Vec<u64>,
+    values: Vec<u8>,
+}
+
+#[derive(Debug, Default)]
+pub(super) struct FlatTable {
+    /// The position of the value associated with each hash, in units of `value_size`.
+    pub(super) index: HashMap<u64, usize, UnHash>,
+    /// The size of every value in this table, set by the first insertion.
+    pub(super) value_size: usize,
+    /// All values, one after the other.
+    pub(super) values: Vec<u8>,
+}
+
+impl Storage for FlatTable {
+    fn insert(&mut self, hash: u64, value: Box<[u8]>) {
+        if self.index.is_empty() {
+            self.value_size = value.len();
+        }
+        assert_eq!(
+            value.len(),
+            self.value_size,
+            "all values in a mapping have the same size"
+        );
+
+        if let Some(&position) = self.index.get(&hash) {
+            let start = position * self.value_size;
+            self.values[start..start + self.value_size].copy_from_slice(&value);
+        } else {
+            self.index.insert(hash, self.index.len());
+            self.values.extend_from_slice(&value);
+        }
+    }
+
+    fn get(&self, hash: u64) -> Option<&[u8]> {
+        let start = *self.index.get(&hash)? * self.value_size;
+        Some(&self.values[start..start + self.value_size])
+    }
+
+    fn prefetch(&self, hash: u64) {
+        prefetch_bucket(&self.index, hash);
+    }
+
+    fn size(&self) -> usize {
+        let buckets = self.index.raw_table().buckets();
+        std::mem::size_of::<Self>()
+            // One entry and one control byte per bucket:
+            + (std::mem::size_of::<(u64, usize)>() + 1) * buckets
+            + self.values.capacity()
+    }
+
+    fn dump(&self) -> Result<Vec<u8>, Error> {
+        let mut keys = vec![0; self.index.len()];
+        for (&hash, &position) in &self.index {
+            keys[position] = hash;
+        }
+
+        // Same as serializing a `Dumped`, without copying the values.
+        Ok(bincode::serialize(&(self.value_size, keys, &self.values))
+            .expect("serialization never fails"))
+    }
+}
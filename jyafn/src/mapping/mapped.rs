@@ -0,0 +1,253 @@
+//! A mapping storage whose dumped form is the hash table itself, ready to be probed.
+//!
+//! Loading this storage does not deserialize anything: the dumped bytes are used as-is.
+//! If the graph is loaded with [`crate::Graph::load_mapped`], the table is not even
+//! read, but used straight from the memory-mapped file (these mappings are always
+//! written uncompressed for this to be possible). This makes loading near-instant and
+//! lets every process on the same host loading the same file share the same pages.
+//!
+//! # Format
+//!
+//! All integers are little-endian `u64`s:
+//!
+//! | offset                | contents                                         |
+//! |-----------------------|--------------------------------------------------|
+//! | 0                     | the magic bytes `jyafnmap`                       |
+//! | 8                     | the number of buckets, a power of two            |
+//! | 16                    | the size of each value, in bytes                 |
+//! | 24                    | the number of entries                            |
+//! | 32                    | the buckets: pairs of hash and position plus one |
+//! | 32 + 16 * buckets     | the values, one after the other                  |
+//!
+//! Buckets are probed linearly, starting from the one given by the lower bits of the
+//! hash. A bucket whose position is zero is empty and ends the search.
+
+use serde_derive::{Deserialize, Serialize};
+use std::io::Read;
+use std::ops::Deref;
+
+use crate::utils::{self, mmap::MappedSlice};
+use crate::Error;
+
+use super::flat::FlatTable;
+use super::{Storage, StorageType};
+
+const MAGIC: &[u8; 8] = b"jyafnmap";
+const HEADER_SIZE: usize = 32;
+const BUCKET_SIZE: usize = 16;
+
+/// A [`StorageType`] implementation of a hash table whose dumped form can be used
+/// directly, even from memory-mapped files. See the [module documentation](self) for
+/// details.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct MappedStorage;
+
+#[typetag::serde]
+impl StorageType for MappedStorage {
+    fn init(&self) -> Result<Box<dyn Storage>, Error> {
+        Ok(Box::new(MappedTable::Building(FlatTable::default())))
+    }
+
+    fn read(&self, f: &mut dyn Read) -> Result<Box<dyn Storage>, Error> {
+        let mut bytes = vec![];
+        f.read_to_end(&mut bytes)?;
+        Ok(Box::new(MappedTable::Frozen(Table::new(Bytes::Owned(
+            bytes,
+        ))?)))
+    }
+
+    fn is_mappable(&self) -> bool {
+        true
+    }
+
+    fn read_mapped(&self, data: MappedSlice) -> Result<Box<dyn Storage>, Error> {
+        Ok(Box::new(MappedTable::Frozen(Table::new(Bytes::Mapped(
+            data,
+        ))?)))
+    }
+}
+
+#[derive(Debug)]
+enum Bytes {
+    Owned(Vec<u8>),
+    Mapped(MappedSlice),
+}
+
+impl Deref for Bytes {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            Bytes::Owned(bytes) => bytes,
+            Bytes::Mapped(slice) => slice,
+        }
+    }
+}
+
+fn read_u64(bytes: &[u8], offset: usize) -> u64 {
+    u64::from_le_bytes(
+        bytes[offset..offset + 8]
+            .try_into()
+            .expect("slice has 8 bytes"),
+    )
+}
+
+/// A table in the dumped format, ready to be probed.
+#[derive(Debug)]
+struct Table {
+    bytes: Bytes,
+    mask: usize,
+    value_size: usize,
+    values_start: usize,
+}
+
+impl Table {
+    /// Validates the header of the table, so that probing never goes out of bounds.
+    fn new(bytes: Bytes) -> Result<Table, Error> {
+        let bad = |msg: &str| Error::from(format!("bad mapped table: {msg}"));
+
+        if bytes.len() < HEADER_SIZE || &bytes[..8] != MAGIC {
+            return Err(bad("not a mapped table"));
+        }
+        let n_buckets = read_u64(&bytes, 8) as usize;
+        let value_size = read_u64(&bytes, 16) as usize;
+        let n_entries = read_u64(&bytes, 24) as usize;
+        if !n_buckets.is_power_of_two() || n_entries >= n_buckets {
+            return Err(bad("bad number of buckets"));
+        }
+
+        let values_start = n_buckets
+            .checked_mul(BUCKET_SIZE)
+            .and_then(|size| size.checked_add(HEADER_SIZE))
+            .ok_or_else(|| bad("table too big"))?;
+        let expected_len = n_entries
+            .checked_mul(value_size)
+            .and_then(|size| size.checked_add(values_start));
+        if expected_len != Some(bytes.len()) {
+            return Err(bad("wrong size"));
+        }
+
+        Ok(Table {
+            bytes,
+            mask: n_buckets - 1,
+            value_size,
+            values_start,
+        })
+    }
+
+    fn get(&self, hash: u64) -> Option<&[u8]> {
+        let mut bucket = hash as usize & self.mask;
+        // Bounded, in case the table is corrupted and has no empty buckets.
+        for _ in 0..=self.mask {
+            let offset = HEADER_SIZE + bucket * BUCKET_SIZE;
+            let position = read_u64(&self.bytes, offset + 8) as usize;
+            if position == 0 {
+                return None;
+            }
+            if read_u64(&self.bytes, offset) == hash {
+                let start = (position - 1)
+                    .checked_mul(self.value_size)?
+                    .checked_add(self.values_start)?;
+                return self.bytes.get(start..start.checked_add(self.value_size)?);
+            }
+            bucket = (bucket + 1) & self.mask;
+        }
+
+        None
+    }
+
+    fn prefetch(&self, hash: u64) {
+        let bucket = hash as usize & self.mask;
+        utils::prefetch(
+            self.bytes
+                .as_ptr()
+                .wrapping_add(HEADER_SIZE + bucket * BUCKET_SIZE),
+        );
+    }
+
+    /// Builds the dumped form of a table out of its contents.
+    fn dump(flat: &FlatTable) -> Vec<u8> {
+        // Keep the load factor under 3/4, so that probe sequences stay short (and there
+        // is always an empty bucket to end them).
+        let n_entries = flat.index.len();
+        let n_buckets = (n_entries * 4 / 3 + 1).next_power_of_two();
+        let mask = n_buckets - 1;
+
+        let mut buckets = vec![(0u64, 0u64); n_buckets];
+        for (&hash, &position) in &flat.index {
+            let mut bucket = hash as usize & mask;
+            while buckets[bucket].1 != 0 {
+                bucket = (bucket + 1) & mask;
+            }
+            buckets[bucket] = (hash, position as u64 + 1);
+        }
+
+        let mut dumped =
+            Vec::with_capacity(HEADER_SIZE + BUCKET_SIZE * n_buckets + flat.values.len());
+        dumped.extend_from_slice(MAGIC);
+        for header in [n_buckets, flat.value_size, n_entries] {
+            dumped.extend_from_slice(&(header as u64).to_le_bytes());
+        }
+        for (hash, position) in buckets {
+            dumped.extend_from_slice(&hash.to_le_bytes());
+            dumped.extend_from_slice(&position.to_le_bytes());
+        }
+        dumped.extend_from_slice(&flat.values);
+
+        dumped
+    }
+}
+
+#[derive(Debug)]
+enum MappedTable {
+    /// Still receiving insertions, while the graph is being built.
+    Building(FlatTable),
+    /// Read from a dumped table.
+    Frozen(Table),
+}
+
+impl Storage for MappedTable {
+    fn insert(&mut self, hash: u64, value: Box<[u8]>) {
+        match self {
+            MappedTable::Building(flat) => flat.insert(hash, value),
+            MappedTable::Frozen(_) => panic!("cannot insert into a loaded mapped table"),
+        }
+    }
+
+    fn get(&self, hash: u64) -> Option<&[u8]> {
+        match self {
+            MappedTable::Building(flat) => flat.get(hash),
+            MappedTable::Frozen(table) => table.get(hash),
+        }
+    }
+
+    fn prefetch(&self, hash: u64) {
+        match self {
+            MappedTable::Building(flat) => flat.prefetch(hash),
+            MappedTable::Frozen(table) => table.prefetch(hash),
+        }
+    }
+
+    fn size(&self) -> usize {
+        std::mem::size_of::<Self>()
+            + match self {
+                MappedTable::Building(flat) => flat.size(),
+                MappedTable::Frozen(Table {
+                    bytes: Bytes::Owned(bytes),
+                    ..
+                }) => bytes.capacity(),
+                // Not on the heap and shared with everyone mapping the same file.
+                MappedTable::Frozen(Table {
+                    bytes: Bytes::Mapped(_),
+                    ..
+                }) => 0,
+            }
+    }
+
+    fn dump(&self) -> Result<Vec<u8>, Error> {
+        Ok(match self {
+            MappedTable::Building(flat) => Table::dump(flat),
+            MappedTable::Frozen(table) => table.bytes.to_vec(),
+        })
+    }
+}
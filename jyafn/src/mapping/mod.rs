@@ -11,16 +11,27 @@
 //! the implementation, this aspect can change in the future, with changes to the
 //! [`Storage`] API in a future version.
 
+mod flat;
+mod mapped;
+mod perfect;
+
+pub use flat::FlatStorage;
+pub use mapped::MappedStorage;
+pub use perfect::PerfectHashStorage;
+
 use get_size::GetSize;
 use hashbrown::HashMap;
 use serde_derive::{Deserialize, Serialize};
 use std::hash::{BuildHasher, Hasher};
+use std::io::Read;
 use std::panic::{RefUnwindSafe, UnwindSafe};
-use std::sync::Arc;
+use std::sync::{Arc, Mutex, OnceLock};
 use zip::read::ZipFile;
 
 use crate::layout::Layout;
-use crate::utils::murmur;
+use crate::op;
+use crate::utils::mmap::{MappedFile, MappedSlice};
+use crate::utils::{self, murmur};
 use crate::Error;
 #[cfg(doc)]
 use crate::Graph;
@@ -53,6 +64,25 @@ impl Hasher for UnHasher {
     }
 }
 
+/// Hints that `hash` is going to be looked up in `map` soon, by prefetching the control
+/// bytes and the entry of the bucket where the probing for it starts. Since keys are
+/// already hashes, that bucket is just given by the lower bits of the key. This is only
+/// a hint: should the layout of the table be different, the wrong memory is fetched and
+/// nothing else happens.
+fn prefetch_bucket<V>(map: &HashMap<u64, V, UnHash>, hash: u64) {
+    let table = map.raw_table();
+    let bucket = hash as usize & (table.buckets() - 1);
+    let data_end = table.data_end().as_ptr();
+    // Control bytes go up from the end of the data and entries go down.
+    utils::prefetch((data_end as *const u8).wrapping_add(bucket));
+    utils::prefetch(data_end.wrapping_sub(bucket + 1));
+}
+
+/// The extern holding the address of [`Mapping::call_mapping`].
+const CALL_MAPPING_EXTERN: &str = "jyafn.extern.mapping.call_mapping";
+/// The extern holding the address of [`Mapping::prefetch_mapping`].
+const PREFETCH_MAPPING_EXTERN: &str = "jyafn.extern.mapping.prefetch_mapping";
+
 fn update_hash(hash: i64, value: i64) -> i64 {
     let hash = u64::from_ne_bytes(hash.to_ne_bytes());
     let value = u64::from_ne_bytes(value.to_ne_bytes());
@@ -61,6 +91,49 @@ fn update_hash(hash: i64, value: i64) -> i64 {
     i64::from_ne_bytes(updated.to_ne_bytes())
 }
 
+/// Renders [`update_hash`] inline, as plain QBE arithmetic, updating `hash` with the
+/// 8-byte slot `value`. This is murmur64a of the slot, seeded with the current hash
+/// (unrolled for a key of exactly 8 bytes) and must produce exactly the same result as
+/// [`update_hash`], otherwise lookups will miss.
+fn render_update_hash(func: &mut qbe::Function, hash: &qbe::Value, value: qbe::Value, i: usize) {
+    let m = qbe::Value::Const(murmur::M);
+    let r = qbe::Value::Const(murmur::R as u64);
+    let k = qbe::Value::Temporary(format!("hash.k{i}"));
+    let k_shifted = qbe::Value::Temporary(format!("hash.k{i}.shifted"));
+    let h = qbe::Value::Temporary(format!("hash.h{i}"));
+    let h_shifted = qbe::Value::Temporary(format!("hash.h{i}.shifted"));
+
+    let mut assign = |value: &qbe::Value, instr| {
+        func.assign_instr(value.clone(), qbe::Type::Long, instr);
+    };
+
+    // h = seed ^ (len * m)
+    assign(
+        &h,
+        qbe::Instr::Xor(
+            hash.clone(),
+            qbe::Value::Const(8u64.wrapping_mul(murmur::M)),
+        ),
+    );
+
+    // k *= m; k ^= k >> r; k *= m;
+    assign(&k, qbe::Instr::Mul(value, m.clone()));
+    assign(&k_shifted, qbe::Instr::Shr(k.clone(), r.clone()));
+    assign(&k, qbe::Instr::Xor(k.clone(), k_shifted.clone()));
+    assign(&k, qbe::Instr::Mul(k.clone(), m.clone()));
+
+    // h ^= k; h *= m;
+    assign(&h, qbe::Instr::Xor(h.clone(), k));
+    assign(&h, qbe::Instr::Mul(h.clone(), m.clone()));
+
+    // h ^= h >> r; h *= m; h ^= h >> r;
+    assign(&h_shifted, qbe::Instr::Shr(h.clone(), r.clone()));
+    assign(&h, qbe::Instr::Xor(h.clone(), h_shifted.clone()));
+    assign(&h, qbe::Instr::Mul(h.clone(), m));
+    assign(&h_shifted, qbe::Instr::Shr(h.clone(), r));
+    assign(hash, qbe::Instr::Xor(h, h_shifted));
+}
+
 fn hash(line: &[u8]) -> u64 {
     let mut hash = 0u64;
 
@@ -87,12 +160,27 @@ fn hash(line: &[u8]) -> u64 {
 pub trait StorageType: std::fmt::Debug + Send + Sync + UnwindSafe + RefUnwindSafe {
     /// Initializes a new and empty storage instance for this type.
     fn init(&self) -> Result<Box<dyn Storage>, Error>;
-    /// Reads the contents of a single file inside a zip archive and returns a new
-    /// storage instance populated with all the data present in the file.
+    /// Reads the contents of a single entry of a graph file and returns a new storage
+    /// instance populated with all the data present in the entry.
     ///
     /// The input data is the same that is generated by the corresponding [`Storage::dump`]
     /// implementation.
-    fn read(&self, f: ZipFile<'_>) -> Result<Box<dyn Storage>, Error>;
+    fn read(&self, f: &mut dyn Read) -> Result<Box<dyn Storage>, Error>;
+    /// Whether the data generated by [`Storage::dump`] can be used directly out of a
+    /// memory-mapped file, with [`StorageType::read_mapped`]. If so, the data is always
+    /// stored uncompressed when dumping graphs. The default implementation returns
+    /// `false`.
+    fn is_mappable(&self) -> bool {
+        false
+    }
+    /// Returns a new storage instance backed by the supplied data, which lives in a
+    /// memory-mapped file. This is only called if [`StorageType::is_mappable`] returns
+    /// `true`. The default implementation always fails.
+    fn read_mapped(&self, _data: MappedSlice) -> Result<Box<dyn Storage>, Error> {
+        Err("storage type cannot be read from a memory-mapped file"
+            .to_string()
+            .into())
+    }
 }
 
 /// A plugable storage instance. This can be a simple hash table (the default
@@ -102,13 +190,27 @@ pub trait Storage: std::fmt::Debug + Send + Sync + UnwindSafe + RefUnwindSafe {
     fn insert(&mut self, hash: u64, value: Box<[u8]>);
     /// Gets the value associated with the given hash, if any.
     fn get(&self, hash: u64) -> Option<&[u8]>;
+    /// Hints that the value associated with the given hash is going to be looked up
+    /// soon, so that the memory where it lives can start being fetched. Cache misses of
+    /// independent lookups then overlap instead of happening one after the other. This
+    /// must be cheap and never fail. The default implementation does nothing.
+    fn prefetch(&self, _hash: u64) {}
+    /// Gets the values associated with each of the given hashes, in order. The default
+    /// implementation prefetches all of them before looking any of them up.
+    fn get_many(&self, hashes: &[u64]) -> Vec<Option<&[u8]>> {
+        for &hash in hashes {
+            self.prefetch(hash);
+        }
+
+        hashes.iter().map(|&hash| self.get(hash)).collect()
+    }
     /// The ammount of heap used by this storage.
     fn size(&self) -> usize;
     /// Dumps the contents of this storage instance as binary data.
     ///
     /// The returned data must be the same that will be consumed by the corresponding
     /// [`StorageType::read`] implementation.
-    fn dump(&self) -> Vec<u8>;
+    fn dump(&self) -> Result<Vec<u8>, Error>;
 }
 
 /// A [`StorageType`] implementation of an in-memory hash table backed by Rust's default
@@ -122,7 +224,7 @@ impl StorageType for HashMapStorage {
         Ok(Box::new(HashTable::default()))
     }
 
-    fn read(&self, f: ZipFile<'_>) -> Result<Box<dyn Storage>, Error> {
+    fn read(&self, f: &mut dyn Read) -> Result<Box<dyn Storage>, Error> {
         let map = bincode::deserialize_from(f).map_err(Error::Bincode)?;
         Ok(Box::new(HashTable(map)))
     }
@@ -140,6 +242,10 @@ impl Storage for HashTable {
         self.0.get(&hash).map(|v| v.as_ref())
     }
 
+    fn prefetch(&self, hash: u64) {
+        prefetch_bucket(&self.0, hash);
+    }
+
     fn size(&self) -> usize {
         std::mem::size_of::<Self>()
             + std::mem::size_of::<(u64, Box<[u8]>)>() * self.0.raw_table().capacity()
@@ -150,21 +256,41 @@ impl Storage for HashTable {
                 .sum::<usize>()
     }
 
-    fn dump(&self) -> Vec<u8> {
-        bincode::serialize(&self.0).expect("serialization never fails")
+    fn dump(&self) -> Result<Vec<u8>, Error> {
+        Ok(bincode::serialize(&self.0).expect("serialization never fails"))
     }
 }
 
+/// Where the storage of a lazily loaded mapping is read from, the first time it is
+/// accessed. See [`Graph::load_lazy`].
+#[derive(Debug)]
+struct LazySource {
+    /// The graph file.
+    file: Arc<MappedFile>,
+    /// The name of the entry of the archive holding the mapping.
+    entry: String,
+    /// Held while reading the storage, so that it is only read once.
+    lock: Mutex<()>,
+    /// Why reading the storage failed, if it did. It is not tried again.
+    error: OnceLock<String>,
+}
+
 /// A mapping. Mappings are key-value pairs that can be randomly accessed in functions.
 #[derive(Debug, Serialize, Deserialize)]
 pub struct Mapping {
     key_layout: Layout,
     value_layout: Layout,
     storage_type: Arc<dyn StorageType>,
+    /// Set only once: either when the mapping is created or loaded, or when it is first
+    /// accessed, if it was loaded lazily.
+    #[serde(skip_serializing)]
+    #[serde(skip_deserializing)]
+    #[serde(default)]
+    storage: OnceLock<Box<dyn Storage>>,
     #[serde(skip_serializing)]
     #[serde(skip_deserializing)]
     #[serde(default)]
-    storage: Option<Box<dyn Storage>>,
+    lazy: Option<LazySource>,
     /// We need this field because we _hardcode_ the pointer to this struct in the
     /// function code. If this moves anywhere, we get the pleasure of accessing bad
     /// memory and The Most Horrible Things™ ensue.
@@ -180,7 +306,8 @@ fn new_pinned() -> std::marker::PhantomPinned {
 
 impl GetSize for Mapping {
     fn get_heap_size(&self) -> usize {
-        if let Some(storage) = &self.storage {
+        // Lazy mappings take no memory until they are used.
+        if let Some(storage) = self.storage.get() {
             storage.size()
         } else {
             0
@@ -204,35 +331,132 @@ impl Mapping {
             key_layout,
             value_layout,
             storage_type: Arc::new(storage_type),
-            storage: Some(storage),
+            storage: storage.into(),
+            lazy: None,
             _pin: std::marker::PhantomPinned,
         })
     }
 
-    /// Builds this storage from the supplied data.
-    pub(crate) fn read(&self, f: ZipFile<'_>) -> Result<Self, Error> {
-        let storage = self.storage_type.read(f)?;
-        Ok(Mapping {
+    /// Reads the storage of this mapping out of the supplied file. If the archive is
+    /// read from a memory-mapped file, it is also supplied, so that storages supporting
+    /// it are used directly from memory.
+    fn read_storage(
+        &self,
+        mut f: ZipFile<'_>,
+        mapped: Option<&Arc<MappedFile>>,
+    ) -> Result<Box<dyn Storage>, Error> {
+        match mapped.filter(|file| file.is_mapped()) {
+            Some(mapped)
+                if self.is_mappable() && f.compression() == zip::CompressionMethod::Stored =>
+            {
+                let start = f.data_start() as usize;
+                self.storage_type
+                    .read_mapped(mapped.slice(start..start + f.size() as usize)?)
+            }
+            _ => self.storage_type.read(&mut f),
+        }
+    }
+
+    /// Builds this storage from the supplied data (see [`Mapping::read_storage`]).
+    pub(crate) fn read(
+        &self,
+        f: ZipFile<'_>,
+        mapped: Option<&Arc<MappedFile>>,
+    ) -> Result<Self, Error> {
+        Ok(self.with_storage(self.read_storage(f, mapped)?))
+    }
+
+    /// Builds this storage from an entry read out of a stream (see
+    /// [`Graph::load_stream`]).
+    pub(crate) fn read_stream(&self, f: &mut dyn Read) -> Result<Self, Error> {
+        Ok(self.with_storage(self.storage_type.read(f)?))
+    }
+
+    /// A mapping like this one, but with the supplied storage.
+    fn with_storage(&self, storage: Box<dyn Storage>) -> Self {
+        Mapping {
             key_layout: self.key_layout.clone(),
             value_layout: self.value_layout.clone(),
             storage_type: self.storage_type.clone(),
-            storage: Some(storage),
+            storage: storage.into(),
+            lazy: None,
             _pin: std::marker::PhantomPinned,
-        })
+        }
+    }
+
+    /// Builds this storage such that the data is only read out of the entry `entry` of
+    /// the graph file `file` when it is first accessed.
+    pub(crate) fn read_lazy(&self, file: Arc<MappedFile>, entry: String) -> Self {
+        Mapping {
+            key_layout: self.key_layout.clone(),
+            value_layout: self.value_layout.clone(),
+            storage_type: self.storage_type.clone(),
+            storage: OnceLock::new(),
+            lazy: Some(LazySource {
+                file,
+                entry,
+                lock: Mutex::new(()),
+                error: OnceLock::new(),
+            }),
+            _pin: std::marker::PhantomPinned,
+        }
+    }
+
+    /// Whether the storage of this mapping can be used directly out of a memory-mapped
+    /// file.
+    pub(crate) fn is_mappable(&self) -> bool {
+        self.storage_type.is_mappable()
+    }
+
+    /// The storage of this mapping, reading it first if this mapping was loaded lazily
+    /// and has not been accessed yet.
+    fn storage(&self) -> Result<&dyn Storage, Error> {
+        if let Some(storage) = self.storage.get() {
+            return Ok(&**storage);
+        }
+        let Some(lazy) = &self.lazy else {
+            return Err("storage not initialized".to_string().into());
+        };
+
+        // Only one reader at a time. The others wait and then find the storage set.
+        let _guard = lazy.lock.lock().expect("poisoned");
+        if let Some(storage) = self.storage.get() {
+            return Ok(&**storage);
+        }
+        if let Some(error) = lazy.error.get() {
+            return Err(error.clone().into());
+        }
+
+        let read = (|| {
+            let mut archive = zip::ZipArchive::new(std::io::Cursor::new(&lazy.file[..]))?;
+            self.read_storage(archive.by_name(&lazy.entry)?, Some(&lazy.file))
+        })();
+        match read {
+            Ok(storage) => Ok(&**self.storage.get_or_init(|| storage)),
+            Err(err) => {
+                let error = format!("failed to read mapping from {}: {err}", lazy.entry);
+                Err(lazy.error.get_or_init(|| error).clone().into())
+            }
+        }
+    }
+
+    /// Reads the storage of this mapping right away, if it was loaded lazily. This lets
+    /// errors reading it surface here, instead of as missing keys later on.
+    pub fn materialize(&self) -> Result<(), Error> {
+        self.storage().map(|_| ())
     }
 
     /// Serializes the current mapping.
-    pub(crate) fn dump(&self) -> Vec<u8> {
-        self.storage
-            .as_ref()
-            .expect("storage not initialized")
-            .dump()
+    pub(crate) fn dump(&self) -> Result<Vec<u8>, Error> {
+        self.storage()?.dump()
     }
 
     /// Whether this mapping has been initialized with data or not. You might get
     /// unitialized mappings when loading graphs with [`Graph::load_uninitialized`].
+    /// Mappings loaded with [`Graph::load_lazy`] count as initialized, even before
+    /// their data is read.
     pub fn is_initialized(&self) -> bool {
-        self.storage.is_some()
+        self.storage.get().is_some() || self.lazy.is_some()
     }
 
     /// The layout of the key of this mapping.
@@ -248,26 +472,63 @@ impl Mapping {
     /// Inserts a new key-value pair in this mapping.
     pub(crate) fn insert(&mut self, key: Box<[u8]>, value: Box<[u8]>) {
         self.storage
-            .as_mut()
+            .get_mut()
             .expect("storage not initialized")
             .insert(hash(&key), value);
     }
 
     /// Gets the raw data associated with the supplied raw key.
     pub fn get(&self, key: &[u8]) -> Option<&[u8]> {
-        self.storage.as_ref().and_then(|s| s.get(hash(key)))
+        self.storage().ok().and_then(|s| s.get(hash(key)))
+    }
+
+    /// Gets the raw data associated with each of the supplied raw keys, in order. This
+    /// is faster than calling [`Mapping::get`] for each key, since the lookups are
+    /// overlapped.
+    pub fn get_many<'a, I>(&self, keys: I) -> Vec<Option<&[u8]>>
+    where
+        I: IntoIterator<Item = &'a [u8]>,
+    {
+        let hashes = keys.into_iter().map(hash).collect::<Vec<_>>();
+        if let Ok(storage) = self.storage() {
+            storage.get_many(&hashes)
+        } else {
+            vec![None; hashes.len()]
+        }
     }
 
+    /// Called from the machine code. This never reads a mapping loaded lazily, which
+    /// could fail (or panic) with no way of telling the caller: functions read all the
+    /// mappings they call before running any machine code (see [`crate::Function`]).
     unsafe extern "C" fn call_mapping(mapping: *const Mapping, hash: u64) -> *const u8 {
         let mapping = &*mapping;
-        if let Some(line) = mapping.storage.as_ref().and_then(|s| s.get(hash)) {
+        if let Some(line) = mapping.storage.get().and_then(|s| s.get(hash)) {
             line.as_ptr()
         } else {
             std::ptr::null()
         }
     }
 
-    pub fn render(&self, func_name: String) -> qbe::Function<'static> {
+    unsafe extern "C" fn prefetch_mapping(mapping: *const Mapping, hash: u64) {
+        let mapping = &*mapping;
+        // Not worth reading a lazy mapping for: the lookup that follows will.
+        if let Some(storage) = mapping.storage.get() {
+            storage.prefetch(hash);
+        }
+    }
+
+    /// The externs needed by every rendered mapping access function, together with the
+    /// addresses they must be filled with.
+    pub(crate) fn static_externs() -> [(&'static str, usize); 2] {
+        [
+            (CALL_MAPPING_EXTERN, Mapping::call_mapping as usize),
+            (PREFETCH_MAPPING_EXTERN, Mapping::prefetch_mapping as usize),
+        ]
+    }
+
+    /// Starts a function whose arguments are the slots of a key of this mapping,
+    /// rendering the hashing of the key into the temporary `%hash`.
+    fn render_hash_key(&self, func_name: String) -> qbe::Function<'static> {
         let input_slots = self.key_layout.slots();
         let args = input_slots
             .iter()
@@ -301,36 +562,109 @@ impl Mapping {
                 },
             );
 
-            func.assign_instr(
-                hash.clone(),
-                qbe::Type::Long,
-                qbe::Instr::Call(
-                    qbe::Value::Const(update_hash as usize as u64),
-                    vec![
-                        (qbe::Type::Long, hash.clone()),
-                        (qbe::Type::Long, qbe::Value::Temporary(format!("cast_i{i}"))),
-                    ],
-                ),
+            render_update_hash(
+                &mut func,
+                &hash,
+                qbe::Value::Temporary(format!("cast_i{i}")),
+                i,
             );
         }
 
-        let mapping_ptr = self as *const Mapping;
-        func.assign_instr(
-            qbe::Value::Temporary("slice".to_string()),
-            qbe::Type::Long,
-            qbe::Instr::Call(
-                qbe::Value::Const(Mapping::call_mapping as usize as u64),
-                vec![
-                    (qbe::Type::Long, qbe::Value::Const(mapping_ptr as u64)),
-                    (qbe::Type::Long, hash.clone()),
-                ],
-            ),
+        func
+    }
+
+    /// Renders the call of the extern `function_extern` with the address of this mapping
+    /// (read from `mapping_extern`) and the temporary `%hash` as arguments.
+    fn render_call_with_hash(
+        func: &mut qbe::Function,
+        output: Option<qbe::Value>,
+        function_extern: &str,
+        mapping_extern: &str,
+    ) {
+        let function_ptr = qbe::Value::Temporary("function".to_string());
+        let mapping_ptr = qbe::Value::Temporary("mapping".to_string());
+        op::render_load_extern(func, function_ptr.clone(), function_extern);
+        op::render_load_extern(func, mapping_ptr.clone(), mapping_extern);
+        let call = qbe::Instr::Call(
+            function_ptr,
+            vec![
+                (qbe::Type::Long, mapping_ptr),
+                (qbe::Type::Long, qbe::Value::Temporary("hash".to_string())),
+            ],
         );
 
+        if let Some(output) = output {
+            func.assign_instr(output, qbe::Type::Long, call);
+        } else {
+            func.add_instr(call);
+        }
+    }
+
+    /// Renders the access function for this mapping. The address of this mapping is read
+    /// from the extern `mapping_extern`, which must be filled in with it at load time.
+    ///
+    /// The function takes the slots of the key and returns a pointer to the value, or
+    /// null if the key is not in the mapping.
+    pub fn render(&self, func_name: String, mapping_extern: &str) -> qbe::Function<'static> {
+        let mut func = self.render_hash_key(func_name);
+        let slice = qbe::Value::Temporary("slice".to_string());
+        Self::render_call_with_hash(
+            &mut func,
+            Some(slice.clone()),
+            CALL_MAPPING_EXTERN,
+            mapping_extern,
+        );
+        func.add_instr(qbe::Instr::Ret(Some(slice)));
+
+        func
+    }
+
+    /// Renders the first half of the access function for this mapping, to be called
+    /// ahead of time. This takes the slots of the key, starts fetching the memory where
+    /// the value lives (see [`Storage::prefetch`]) and returns the hash of the key,
+    /// which is then passed to the second half, rendered by [`Mapping::render_resolve`].
+    ///
+    /// Splitting the access in two lets the lookups of many independent keys overlap:
+    /// all keys are hashed and prefetched first and only then resolved.
+    pub fn render_prefetch(
+        &self,
+        func_name: String,
+        mapping_extern: &str,
+    ) -> qbe::Function<'static> {
+        let mut func = self.render_hash_key(func_name);
+        Self::render_call_with_hash(&mut func, None, PREFETCH_MAPPING_EXTERN, mapping_extern);
         func.add_instr(qbe::Instr::Ret(Some(qbe::Value::Temporary(
-            "slice".to_string(),
+            "hash".to_string(),
         ))));
 
         func
     }
+
+    /// Renders the second half of the access function for this mapping (see
+    /// [`Mapping::render_prefetch`]). This takes the hash of the key and returns the
+    /// same as the function rendered by [`Mapping::render`].
+    pub fn render_resolve(
+        &self,
+        func_name: String,
+        mapping_extern: &str,
+    ) -> qbe::Function<'static> {
+        let mut func = qbe::Function::new(
+            qbe::Linkage::private(),
+            func_name,
+            vec![(qbe::Type::Long, qbe::Value::Temporary("hash".to_string()))],
+            Some(qbe::Type::Long),
+        );
+        func.add_block("start");
+
+        let slice = qbe::Value::Temporary("slice".to_string());
+        Self::render_call_with_hash(
+            &mut func,
+            Some(slice.clone()),
+            CALL_MAPPING_EXTERN,
+            mapping_extern,
+        );
+        func.add_instr(qbe::Instr::Ret(Some(slice)));
+
+        func
+    }
 }
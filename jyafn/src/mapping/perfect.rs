@@ -0,0 +1,318 @@
+//! A mapping storage backed by a minimal perfect hash function, for static mappings.
+//!
+//! Mappings never change after the graph is built. So, when the mapping is dumped, a
+//! minimal perfect hash function over its keys is built, using the hash-and-displace
+//! method: keys are split into small buckets and, for each bucket (biggest first), a
+//! _pilot_ is searched such that all keys in the bucket land on free slots. There are as
+//! many slots as there are keys and every lookup is exactly one probe: find the bucket,
+//! read its pilot, go to the slot. The (hash of the) key is stored in its slot as well,
+//! so that keys not in the mapping can be told apart.
+//!
+//! Tables hold at most [`MAX_KEYS`] keys. Mappings with more than that fail to dump.
+
+use serde_derive::{Deserialize, Serialize};
+use std::io::Read;
+use std::sync::OnceLock;
+
+use crate::utils;
+use crate::Error;
+
+use super::flat::FlatTable;
+use super::{Storage, StorageType};
+
+/// The average number of keys in each bucket.
+const KEYS_PER_BUCKET: usize = 4;
+/// The fewest pilots to try for a bucket before starting over with a new seed (see
+/// [`max_pilot`]).
+const MIN_PILOTS: u64 = 1 << 24;
+/// How many seeds to try before giving up. With distinct hashes, the first seed almost
+/// always works.
+const MAX_SEEDS: u64 = 16;
+/// The most keys a table can hold. Pilots are 32-bit, so at most about `4 * MAX_KEYS`
+/// of them can be tried for a bucket. Past this many keys, that is no longer enough
+/// for the first few seeds to work.
+const MAX_KEYS: usize = 1 << 30;
+
+/// How many pilots to try for a bucket, in a table with `n_slots` slots. The last
+/// buckets to be placed have a single key and only a handful of free slots left to
+/// choose from, so each of them takes about `n_slots` tries. Trying 16 times as many
+/// leaves a chance of about `e^-16` of getting stuck.
+fn max_pilot(n_slots: usize) -> u32 {
+    (16 * n_slots as u64).clamp(MIN_PILOTS, u32::MAX as u64) as u32
+}
+
+/// A [`StorageType`] implementation of a minimal perfect hash table, built when the
+/// mapping is dumped. Lookups on loaded mappings always take a single probe. Mappings
+/// with more than 2^30 keys cannot be dumped.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct PerfectHashStorage;
+
+#[typetag::serde]
+impl StorageType for PerfectHashStorage {
+    fn init(&self) -> Result<Box<dyn Storage>, Error> {
+        Ok(Box::new(PerfectTable::Building(
+            FlatTable::default(),
+            OnceLock::new(),
+        )))
+    }
+
+    fn read(&self, f: &mut dyn Read) -> Result<Box<dyn Storage>, Error> {
+        let table: Perfect = bincode::deserialize_from(f).map_err(Error::Bincode)?;
+        if table.keys.len() * table.value_size != table.values.len()
+            || (table.pilots.is_empty() && !table.keys.is_empty())
+        {
+            return Err("perfect hash mapping has wrong number of values"
+                .to_string()
+                .into());
+        }
+
+        Ok(Box::new(PerfectTable::Frozen(table)))
+    }
+}
+
+/// The splitmix64 finalizer.
+fn mix(mut x: u64) -> u64 {
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d049bb133111eb);
+    x ^ (x >> 31)
+}
+
+/// Maps `x` uniformly onto `0..n`, without a division.
+fn reduce(x: u64, n: usize) -> usize {
+    ((x as u128 * n as u128) >> 64) as usize
+}
+
+/// A minimal perfect hash table over the hashes of the keys of a mapping.
+#[derive(Debug, Serialize, Deserialize)]
+struct Perfect {
+    seed: u64,
+    /// The pilot of each bucket.
+    pilots: Vec<u32>,
+    /// The hash in each slot.
+    keys: Vec<u64>,
+    value_size: usize,
+    /// The value of each slot, one after the other.
+    values: Vec<u8>,
+}
+
+impl Perfect {
+    fn bucket(seed: u64, hash: u64, n_buckets: usize) -> usize {
+        reduce(mix(hash ^ seed), n_buckets)
+    }
+
+    fn slot(seed: u64, hash: u64, pilot: u32, n_slots: usize) -> usize {
+        reduce(
+            mix(hash ^ seed ^ (pilot as u64 + 1).wrapping_mul(0x9e3779b97f4a7c15)),
+            n_slots,
+        )
+    }
+
+    /// Finds the pilots for all buckets with the given seed, giving the slot of each
+    /// hash, or `None` if some bucket has no good pilot.
+    fn search(seed: u64, hashes: &[u64], n_buckets: usize) -> Option<(Vec<u32>, Vec<usize>)> {
+        let n_slots = hashes.len();
+        let mut buckets = vec![vec![]; n_buckets];
+        for (i, &hash) in hashes.iter().enumerate() {
+            buckets[Self::bucket(seed, hash, n_buckets)].push(i);
+        }
+        let mut by_size = (0..n_buckets).collect::<Vec<_>>();
+        by_size.sort_unstable_by_key(|&bucket| std::cmp::Reverse(buckets[bucket].len()));
+
+        let mut pilots = vec![0; n_buckets];
+        let mut slots = vec![0; hashes.len()];
+        let mut taken = vec![false; n_slots];
+        let mut candidate = vec![];
+        let max_pilot = max_pilot(n_slots);
+        for bucket in by_size {
+            let keys = &buckets[bucket];
+            if keys.is_empty() {
+                break;
+            }
+
+            let pilot = (0..max_pilot).find(|&pilot| {
+                candidate.clear();
+                for &i in keys {
+                    let slot = Self::slot(seed, hashes[i], pilot, n_slots);
+                    if taken[slot] || candidate.contains(&slot) {
+                        return false;
+                    }
+                    candidate.push(slot);
+                }
+                true
+            })?;
+
+            pilots[bucket] = pilot;
+            for (&i, &slot) in keys.iter().zip(&candidate) {
+                taken[slot] = true;
+                slots[i] = slot;
+            }
+        }
+
+        Some((pilots, slots))
+    }
+
+    /// Builds the table out of the flat table of a mapping, failing if it has more than
+    /// [`MAX_KEYS`] keys or if no seed in the first [`MAX_SEEDS`] works.
+    fn build(flat: &FlatTable) -> Result<Perfect, Error> {
+        if flat.index.len() > MAX_KEYS {
+            return Err(format!(
+                "perfect hash mapping has {} keys, more than the {MAX_KEYS} it can hold",
+                flat.index.len()
+            )
+            .into());
+        }
+
+        let mut hashes = vec![0; flat.index.len()];
+        for (&hash, &position) in &flat.index {
+            hashes[position] = hash;
+        }
+        let n_buckets = hashes.len() / KEYS_PER_BUCKET + 1;
+
+        let (seed, pilots, slots) = (0..MAX_SEEDS)
+            .map(mix)
+            .find_map(|seed| {
+                let (pilots, slots) = Self::search(seed, &hashes, n_buckets)?;
+                Some((seed, pilots, slots))
+            })
+            .ok_or_else(|| {
+                format!("no perfect hash function found for mapping after {MAX_SEEDS} seeds")
+            })?;
+
+        let value_size = flat.value_size;
+        let mut keys = vec![0; hashes.len()];
+        let mut values = vec![0; flat.values.len()];
+        for (position, (&hash, slot)) in hashes.iter().zip(slots).enumerate() {
+            keys[slot] = hash;
+            values[slot * value_size..(slot + 1) * value_size]
+                .copy_from_slice(&flat.values[position * value_size..(position + 1) * value_size]);
+        }
+
+        Ok(Perfect {
+            seed,
+            pilots,
+            keys,
+            value_size,
+            values,
+        })
+    }
+
+    fn get(&self, hash: u64) -> Option<&[u8]> {
+        if self.keys.is_empty() {
+            return None;
+        }
+
+        let bucket = Self::bucket(self.seed, hash, self.pilots.len());
+        let slot = Self::slot(self.seed, hash, self.pilots[bucket], self.keys.len());
+        if self.keys[slot] == hash {
+            Some(&self.values[slot * self.value_size..(slot + 1) * self.value_size])
+        } else {
+            None
+        }
+    }
+
+    /// Only the pilot can be prefetched: the slot depends on its value.
+    fn prefetch(&self, hash: u64) {
+        if !self.pilots.is_empty() {
+            let bucket = Self::bucket(self.seed, hash, self.pilots.len());
+            utils::prefetch(&self.pilots[bucket]);
+        }
+    }
+}
+
+#[derive(Debug)]
+enum PerfectTable {
+    /// Still receiving insertions, while the graph is being built. The perfect table is
+    /// built on the first dump and reused by the next ones, until the next insertion.
+    Building(FlatTable, OnceLock<Perfect>),
+    /// Read from a dumped table.
+    Frozen(Perfect),
+}
+
+impl Storage for PerfectTable {
+    fn insert(&mut self, hash: u64, value: Box<[u8]>) {
+        match self {
+            PerfectTable::Building(flat, built) => {
+                built.take();
+                flat.insert(hash, value)
+            }
+            PerfectTable::Frozen(_) => panic!("cannot insert into a loaded perfect hash table"),
+        }
+    }
+
+    fn get(&self, hash: u64) -> Option<&[u8]> {
+        match self {
+            PerfectTable::Building(flat, _) => flat.get(hash),
+            PerfectTable::Frozen(table) => table.get(hash),
+        }
+    }
+
+    fn prefetch(&self, hash: u64) {
+        match self {
+            PerfectTable::Building(flat, _) => flat.prefetch(hash),
+            PerfectTable::Frozen(table) => table.prefetch(hash),
+        }
+    }
+
+    fn size(&self) -> usize {
+        std::mem::size_of::<Self>()
+            + match self {
+                PerfectTable::Building(flat, _) => flat.size(),
+                PerfectTable::Frozen(table) => {
+                    table.pilots.capacity() * std::mem::size_of::<u32>()
+                        + table.keys.capacity() * std::mem::size_of::<u64>()
+                        + table.values.capacity()
+                }
+            }
+    }
+
+    fn dump(&self) -> Result<Vec<u8>, Error> {
+        let table = match self {
+            PerfectTable::Building(flat, built) => {
+                if built.get().is_none() {
+                    let _ = built.set(Perfect::build(flat)?);
+                }
+                built.get().expect("just built")
+            }
+            PerfectTable::Frozen(table) => table,
+        };
+        Ok(bincode::serialize(table).expect("serialization never fails"))
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_build_perfect() {
+        let mut flat = FlatTable::default();
+        for i in 0..10_000u64 {
+            flat.insert(mix(i), i.to_le_bytes().into());
+        }
+
+        let perfect = Perfect::build(&flat).unwrap();
+        assert_eq!(perfect.keys.len(), 10_000);
+        for i in 0..10_000u64 {
+            assert_eq!(perfect.get(mix(i)), Some(&i.to_le_bytes()[..]));
+        }
+        for i in 10_000..20_000u64 {
+            assert_eq!(perfect.get(mix(i)), None);
+        }
+    }
+
+    #[test]
+    fn test_dump_reuses_built_table() {
+        let mut table = PerfectHashStorage.init().unwrap();
+        for i in 0..100u64 {
+            table.insert(mix(i), i.to_le_bytes().into());
+        }
+
+        let dumped = table.dump().unwrap();
+        assert_eq!(table.dump().unwrap(), dumped);
+        table.insert(mix(100), 100u64.to_le_bytes().into());
+        let read = PerfectHashStorage
+            .read(&mut table.dump().unwrap().as_slice())
+            .unwrap();
+        assert_eq!(read.get(mix(100)), Some(&100u64.to_le_bytes()[..]));
+    }
+}
@@ -0,0 +1,57 @@
+//! Whether to run the native code stored in graph files.
+//!
+//! Graphs dumped with [`crate::Graph::dump_native`] carry machine code for the current
+//! target, which loading functions can use instead of compiling the graph. The key that
+//! ties that code to the graph is written by the file itself, so nothing stops a file
+//! from carrying any machine code at all: running it is the same as running an
+//! executable from wherever the file came from.
+//!
+//! Native code in graph files is therefore only run when explicitly trusted, either
+//! through the `JYAFN_TRUST_NATIVE` environment variable (set to `1` or `true`) or with
+//! [`set_trusted`]. Otherwise, it is ignored and the graph is compiled as usual. Only
+//! turn this on if all graph files you load come from a source you trust as much as the
+//! code of your own program.
+
+#[cfg(test)]
+use std::cell::Cell;
+use std::sync::atomic::{AtomicBool, Ordering};
+
+lazy_static::lazy_static! {
+    static ref TRUSTED: AtomicBool = AtomicBool::new(
+        std::env::var("JYAFN_TRUST_NATIVE").is_ok_and(|var| var == "1" || var == "true")
+    );
+}
+
+#[cfg(test)]
+thread_local! {
+    /// Overrides whether native code is trusted in the current thread (see
+    /// [`with_trusted`]).
+    static THREAD_TRUSTED: Cell<Option<bool>> = const { Cell::new(None) };
+}
+
+/// Sets whether the native code stored in graph files is run when loading functions.
+/// This overrides the `JYAFN_TRUST_NATIVE` environment variable.
+pub fn set_trusted(trusted: bool) {
+    TRUSTED.store(trusted, Ordering::Relaxed);
+}
+
+/// Whether the native code stored in graph files is run when loading functions.
+pub fn is_trusted() -> bool {
+    #[cfg(test)]
+    if let Some(trusted) = THREAD_TRUSTED.with(Cell::get) {
+        return trusted;
+    }
+
+    TRUSTED.load(Ordering::Relaxed)
+}
+
+/// Runs `f` trusting native code (or not) in the current thread only, so that tests
+/// running in parallel do not interfere with each other.
+#[cfg(test)]
+pub(crate) fn with_trusted<T>(trusted: bool, f: impl FnOnce() -> T) -> T {
+    let previous = THREAD_TRUSTED.with(|thread_trusted| thread_trusted.replace(Some(trusted)));
+    let _restore = scopeguard::guard(previous, |previous| {
+        THREAD_TRUSTED.with(|thread_trusted| thread_trusted.set(previous));
+    });
+    f()
+}
@@ -49,6 +49,10 @@ impl Op for Add {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a - b`.
@@ -92,6 +96,10 @@ impl Op for Sub {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a * b`.
@@ -139,6 +147,10 @@ impl Op for Mul {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a / b`.
@@ -257,6 +269,10 @@ impl Op for Neg {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `|a|`.
@@ -282,51 +298,154 @@ impl Op for Abs {
         func: &mut qbe::Function,
         namespace: &str,
     ) {
-        let test_temp = qbe::Value::Temporary(unique_for(output.clone(), "abs.test"));
         func.assign_instr(
-            test_temp.clone(),
-            qbe::Type::Byte,
-            qbe::Instr::Cmp(
-                Type::Float.render(),
-                qbe::Cmp::Ge,
-                args[0].render(),
-                qbe::Value::Const(0),
-            ),
+            output,
+            Type::Float.render(),
+            qbe::Instr::Abs(args[0].render()),
         );
+    }
 
-        let true_side = unique_for(output.clone(), "abs.if.true");
-        let false_side = unique_for(output.clone(), "abs.if.false");
-        let end_side = unique_for(output.clone(), "abs.if.end");
+    fn const_eval(&self, graph: &Graph, args: &[Ref]) -> Option<Ref> {
+        if let Some(x) = args[0].as_f64() {
+            return Some(x.abs().into());
+        }
 
-        func.add_instr(qbe::Instr::Jnz(
-            test_temp,
-            true_side.clone(),
-            false_side.clone(),
-        ));
+        None
+    }
 
-        func.add_block(true_side);
-        func.assign_instr(
-            output.clone(),
-            Type::Float.render(),
-            qbe::Instr::Copy(args[0].render()),
-        );
-        func.add_instr(qbe::Instr::Jmp(end_side.clone()));
+    fn is_cheap(&self) -> bool {
+        true
+    }
+}
 
-        func.add_block(false_side);
-        func.assign_instr(
-            output,
-            Type::Float.render(),
-            qbe::Instr::Neg(args[0].render()),
-        );
+/// Implements `a > b ? b : a`. Note that this is not symmetric on NaNs: if `a` is NaN,
+/// the result is `a`.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct Min;
+
+#[typetag::serde]
+impl Op for Min {
+    impl_op! {}
+
+    fn annotate(&mut self, self_id: usize, graph: &Graph, args: &[Type]) -> Option<Type> {
+        Some(match args {
+            [Type::Float, Type::Float] => Type::Float,
+            _ => return None,
+        })
+    }
+
+    fn render_into(
+        &self,
+        graph: &Graph,
+        output: qbe::Value,
+        args: &[Ref],
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        // QBE's `min b, a` is `b < a ? b : a`.
+        render_min_max(output, args[1], args[0], false, func);
+    }
+
+    fn const_eval(&self, graph: &Graph, args: &[Ref]) -> Option<Ref> {
+        if let (Some(a), Some(b)) = (args[0].as_f64(), args[1].as_f64()) {
+            return Some(if a > b { b } else { a }.into());
+        }
+
+        None
+    }
 
-        func.add_block(end_side);
+    fn is_cheap(&self) -> bool {
+        true
+    }
+}
+
+/// Implements `a > b ? a : b`. Note that this is not symmetric on NaNs: if `a` is NaN,
+/// the result is `b`.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct Max;
+
+#[typetag::serde]
+impl Op for Max {
+    impl_op! {}
+
+    fn annotate(&mut self, self_id: usize, graph: &Graph, args: &[Type]) -> Option<Type> {
+        Some(match args {
+            [Type::Float, Type::Float] => Type::Float,
+            _ => return None,
+        })
+    }
+
+    fn render_into(
+        &self,
+        graph: &Graph,
+        output: qbe::Value,
+        args: &[Ref],
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        // QBE's `max a, b` is `a > b ? a : b`.
+        render_min_max(output, args[0], args[1], true, func);
     }
 
     fn const_eval(&self, graph: &Graph, args: &[Ref]) -> Option<Ref> {
-        if let Some(x) = args[0].as_f64() {
-            return Some(x.abs().into());
+        if let (Some(a), Some(b)) = (args[0].as_f64(), args[1].as_f64()) {
+            return Some(if a > b { a } else { b }.into());
         }
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
+}
+
+/// Renders QBE's `min a, b` (`a < b ? a : b`) or `max a, b` (`a > b ? a : b`). The
+/// RISC-V backend has no such instructions, so there the comparison is rendered as a
+/// branch instead.
+fn render_min_max(output: qbe::Value, a: Ref, b: Ref, is_max: bool, func: &mut qbe::Function) {
+    if !cfg!(target_arch = "riscv64") {
+        let instr = if is_max {
+            qbe::Instr::Max(a.render(), b.render())
+        } else {
+            qbe::Instr::Min(a.render(), b.render())
+        };
+        func.assign_instr(output, Type::Float.render(), instr);
+        return;
+    }
+
+    let test_temp = qbe::Value::Temporary(unique_for(output.clone(), "minmax.test"));
+    func.assign_instr(
+        test_temp.clone(),
+        qbe::Type::Word,
+        qbe::Instr::Cmp(
+            Type::Float.render(),
+            if is_max { qbe::Cmp::Gt } else { qbe::Cmp::Lt },
+            a.render(),
+            b.render(),
+        ),
+    );
+
+    let true_side = unique_for(output.clone(), "minmax.if.true");
+    let false_side = unique_for(output.clone(), "minmax.if.false");
+    let end_side = unique_for(output.clone(), "minmax.if.end");
+
+    func.add_instr(qbe::Instr::Jnz(
+        test_temp,
+        true_side.clone(),
+        false_side.clone(),
+    ));
+
+    func.add_block(true_side);
+    func.assign_instr(
+        output.clone(),
+        Type::Float.render(),
+        qbe::Instr::Copy(a.render()),
+    );
+    func.add_instr(qbe::Instr::Jmp(end_side.clone()));
+
+    func.add_block(false_side);
+    func.assign_instr(output, Type::Float.render(), qbe::Instr::Copy(b.render()));
+
+    func.add_block(end_side);
 }
@@ -30,12 +30,24 @@ impl Op for Call {
         func: &mut qbe::Function,
         namespace: &str,
     ) {
+        // The square root has its own instruction, which is much cheaper than a call.
+        if self.0 == "sqrt" {
+            func.assign_instr(
+                output,
+                Type::Float.render(),
+                qbe::Instr::Sqrt(args[0].render()),
+            );
+            return;
+        }
+
         let pfunc = pfunc::get(&self.0).expect("pfunc existence already checked");
+        let location = qbe::Value::Temporary(unique_for(output.clone(), "call.location"));
+        super::render_load_extern(func, location.clone(), &super::pfunc_extern(&self.0));
         func.assign_instr(
             output,
             pfunc.returns().render(),
             qbe::Instr::Call(
-                qbe::Value::Const(pfunc.location() as u64),
+                location,
                 pfunc
                     .signature()
                     .iter()
@@ -53,7 +65,7 @@ impl Op for Call {
             .copied()
             .map(Ref::as_f64)
             .collect::<Option<Vec<_>>>()?;
-        (pfunc.const_eval.0)(&const_args).map(|v| v.into())
+        pfunc.const_eval.eval(&const_args).map(|v| v.into())
     }
 
     fn get_size(&self) -> usize {
@@ -180,7 +192,7 @@ impl Op for LoadSubgraphOutput {
             return None;
         }
 
-        let subgraph = graph.subgraphs.get(self.slot)?;
+        let subgraph = graph.subgraphs.get(self.subgraph)?;
         let slots = subgraph.output_layout.slots();
 
         slots.get(self.slot).copied()
@@ -57,6 +57,10 @@ impl Op for Eq {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a > b`.
@@ -101,6 +105,10 @@ impl Op for Gt {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a < b`.
@@ -145,6 +153,10 @@ impl Op for Lt {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a >= b`.
@@ -189,6 +201,10 @@ impl Op for Ge {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a <= b`.
@@ -233,4 +249,8 @@ impl Op for Le {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
@@ -46,6 +46,10 @@ impl Op for ToBool {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Converts a boolean to a float. This is equivalent to `if a then 1.0 else 0.0`.
@@ -85,4 +89,8 @@ impl Op for ToFloat {
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
@@ -1,6 +1,6 @@
 use serde_derive::{Deserialize, Serialize};
 
-use crate::{graph::SLOT_SIZE, impl_op, Graph, Ref, Type};
+use crate::{graph::SLOT_SIZE, impl_is_eq, impl_op, Graph, Ref, Type};
 
 use super::{unique_for, Op};
 
@@ -31,10 +31,11 @@ impl Op for List {
         namespace: &str,
     ) {
         let data_ptr = qbe::Value::Temporary(unique_for(output.clone(), "list.data_ptr"));
+        // Aligned so that lists of floats can be used by vector instructions.
         func.assign_instr(
             output.clone(),
             qbe::Type::Long,
-            qbe::Instr::Alloc8((self.n_elements * SLOT_SIZE).in_bytes() as u64),
+            qbe::Instr::Alloc16((self.n_elements * SLOT_SIZE).in_bytes() as u128),
         );
         func.assign_instr(
             data_ptr.clone(),
@@ -60,6 +61,86 @@ impl Op for List {
     }
 }
 
+/// An arithmetic operation that can be applied element-wise to lists of floats.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub(crate) enum Elementwise {
+    Add,
+    Sub,
+    Mul,
+    Div,
+}
+
+impl Elementwise {
+    /// The element-wise version of the scalar operation `op`, if there is one.
+    pub fn of(op: &dyn Op) -> Option<Elementwise> {
+        if op.is::<super::Add>() {
+            Some(Elementwise::Add)
+        } else if op.is::<super::Sub>() {
+            Some(Elementwise::Sub)
+        } else if op.is::<super::Mul>() {
+            Some(Elementwise::Mul)
+        } else if op.is::<super::Div>() {
+            Some(Elementwise::Div)
+        } else {
+            None
+        }
+    }
+
+    fn render(self) -> qbe::VecOp {
+        match self {
+            Elementwise::Add => qbe::VecOp::Add,
+            Elementwise::Sub => qbe::VecOp::Sub,
+            Elementwise::Mul => qbe::VecOp::Mul,
+            Elementwise::Div => qbe::VecOp::Div,
+        }
+    }
+}
+
+/// Applies an arithmetic operation element-wise to two lists of floats of the same
+/// length, giving a new list. This is not created by the user, but by the compiler,
+/// out of lists whose elements are all the same operation on the elements of two other
+/// lists. It is rendered as packed vector instructions.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub(crate) struct ListElementwise {
+    pub op: Elementwise,
+    pub n_elements: usize,
+}
+
+#[typetag::serde]
+impl Op for ListElementwise {
+    impl_op! {}
+
+    fn annotate(&mut self, self_id: usize, graph: &Graph, args: &[Type]) -> Option<Type> {
+        if let [Type::Ptr { .. }, Type::Ptr { .. }] = args {
+            Some(Type::Ptr { origin: self_id })
+        } else {
+            None
+        }
+    }
+
+    fn render_into(
+        &self,
+        graph: &Graph,
+        output: qbe::Value,
+        args: &[Ref],
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        func.assign_instr(
+            output.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Alloc16((self.n_elements * SLOT_SIZE).in_bytes() as u128),
+        );
+        func.add_instr(qbe::Instr::Vec(
+            self.op.render(),
+            output,
+            args[0].render(),
+            args[1].render(),
+            self.n_elements as u64,
+        ));
+    }
+}
+
 #[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub(crate) struct Index {
     pub element: Type,
@@ -150,6 +231,9 @@ impl Op for Index {
     }
 }
 
+/// Lists with up to this many elements are always searched one element at a time.
+const MAX_LINEAR_INDEX_OF: usize = 8;
+
 #[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub(crate) struct IndexOf {
     pub element: Type,
@@ -199,8 +283,8 @@ impl Op for IndexOf {
                 qbe::Value::Temporary(unique_for(output.clone(), &format!("indexof.element{i}")));
             let test =
                 qbe::Value::Temporary(unique_for(output.clone(), &format!("indexof.test{i}")));
-            let found = unique_for(output.clone(), "indexof.if.found");
-            let next_if = unique_for(output.clone(), "indexof.if.next");
+            let found = unique_for(output.clone(), &format!("indexof.if.found{i}"));
+            let next_if = unique_for(output.clone(), &format!("indexof.if.next{i}"));
 
             // Compare:
             func.assign_instr(
@@ -249,3 +333,210 @@ impl Op for IndexOf {
         func.add_block(end_if);
     }
 }
+
+impl IndexOf {
+    /// The [`SortedIndexOf`] equivalent to this operation, if the list is made only of
+    /// constants and is not tiny.
+    pub(crate) fn sorted(&self, graph: &Graph, args: &[Ref]) -> Option<SortedIndexOf> {
+        let Ref::Node(list_id) = args[0] else {
+            return None;
+        };
+        let elements = &graph.nodes[list_id].args;
+        if elements.len() <= MAX_LINEAR_INDEX_OF {
+            return None;
+        }
+
+        let mut table = elements
+            .iter()
+            .enumerate()
+            .map(|(position, element)| match *element {
+                Ref::Const(_, bits) => Some((bits, position)),
+                _ => None,
+            })
+            .collect::<Option<Vec<_>>>()?;
+
+        // Stable sorts, so that the first position of each element comes first.
+        if self.element == Type::Float {
+            let as_f64 = |bits: u64| f64::from_bits(bits);
+            table.retain(|&(bits, _)| !as_f64(bits).is_nan());
+            for (bits, _) in &mut table {
+                *bits = (as_f64(*bits) + 0.0).to_bits(); // -0.0 becomes 0.0
+            }
+            table.sort_by(|&(a, _), &(b, _)| as_f64(a).total_cmp(&as_f64(b)));
+        } else {
+            table.sort_by_key(|&(bits, _)| bits);
+        }
+        table.dedup_by_key(|&mut (bits, _)| bits);
+
+        Some(SortedIndexOf {
+            element: self.element,
+            table,
+        })
+    }
+}
+
+/// Finds the position of a value in a constant list by bisection on a table of its
+/// elements, sorted at compile time and rendered as data. This is not created by the
+/// user, but by the compiler, out of an [`IndexOf`] on a list of constants.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub(crate) struct SortedIndexOf {
+    pub element: Type,
+    /// The pairs of elements and their positions in the list, sorted by element. Only the
+    /// first position of repeated elements (and of `0.0` and `-0.0`, which are equal) is
+    /// kept, since that is the one a linear search finds. NaNs are never found, so they
+    /// are left out.
+    pub table: Vec<(u64, usize)>,
+}
+
+#[typetag::serde]
+impl Op for SortedIndexOf {
+    impl_is_eq! {}
+
+    fn get_size(&self) -> usize {
+        std::mem::size_of::<Self>() + std::mem::size_of_val(self.table.as_slice())
+    }
+
+    fn annotate(&mut self, self_id: usize, graph: &Graph, args: &[Type]) -> Option<Type> {
+        if args == [self.element] {
+            Some(Type::Float)
+        } else {
+            None
+        }
+    }
+
+    /// Searches the table without branches: the number of steps is known from the size
+    /// of the table, so they are all unrolled.
+    fn render_into(
+        &self,
+        graph: &Graph,
+        output: qbe::Value,
+        args: &[Ref],
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        let temp = |name: &str| qbe::Value::Temporary(unique_for(output.clone(), name));
+        let table = qbe::Value::Global(Self::table_name(namespace, output.clone()));
+        let slot = SLOT_SIZE.in_bytes() as u64;
+        // Floats are compared as floats (so that `-0.0` finds `0.0`) and everything else,
+        // as unsigned integers.
+        let le = if self.element == Type::Float {
+            qbe::Cmp::Le
+        } else {
+            qbe::Cmp::Ule
+        };
+
+        if self.table.is_empty() {
+            func.assign_instr(
+                output,
+                Type::Float.render(),
+                qbe::Instr::Copy(Ref::from(-1.0).render()),
+            );
+            return;
+        }
+
+        // If the value is in the table, it is in `base..base + len`:
+        let base = temp("indexof.base");
+        let probe = temp("indexof.probe");
+        let element = temp("indexof.element");
+        let test = temp("indexof.test");
+        func.assign_instr(base.clone(), qbe::Type::Long, qbe::Instr::Copy(table));
+        let mut len = self.table.len();
+        while len > 1 {
+            let half = len / 2;
+            func.assign_instr(
+                probe.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Add(base.clone(), qbe::Value::Const(half as u64 * slot)),
+            );
+            func.assign_instr(
+                element.clone(),
+                self.element.render(),
+                qbe::Instr::Load(self.element.render(), probe.clone()),
+            );
+            func.assign_instr(
+                test.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Cmp(self.element.render(), le, element.clone(), args[0].render()),
+            );
+            func.assign_instr(
+                test.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Mul(test.clone(), qbe::Value::Const(half as u64 * slot)),
+            );
+            func.assign_instr(
+                base.clone(),
+                qbe::Type::Long,
+                qbe::Instr::Add(base.clone(), test.clone()),
+            );
+            len -= half;
+        }
+
+        let found = unique_for(output.clone(), "indexof.if.found");
+        let not_found = unique_for(output.clone(), "indexof.if.not_found");
+        let end_if = unique_for(output.clone(), "indexof.if.end");
+        func.assign_instr(
+            element.clone(),
+            self.element.render(),
+            qbe::Instr::Load(self.element.render(), base.clone()),
+        );
+        func.assign_instr(
+            test.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Cmp(
+                self.element.render(),
+                qbe::Cmp::Eq,
+                element,
+                args[0].render(),
+            ),
+        );
+        func.add_instr(qbe::Instr::Jnz(test, found.clone(), not_found.clone()));
+
+        func.add_block(found);
+        func.assign_instr(
+            probe.clone(),
+            qbe::Type::Long,
+            qbe::Instr::Add(base, qbe::Value::Const(self.table.len() as u64 * slot)),
+        );
+        func.assign_instr(
+            output.clone(),
+            Type::Float.render(),
+            qbe::Instr::Load(Type::Float.render(), probe),
+        );
+        func.add_instr(qbe::Instr::Jmp(end_if.clone()));
+
+        func.add_block(not_found);
+        func.assign_instr(
+            output,
+            Type::Float.render(),
+            qbe::Instr::Copy(Ref::from(-1.0).render()),
+        );
+
+        func.add_block(end_if);
+    }
+}
+
+impl SortedIndexOf {
+    /// The name of the data holding the table of the operation rendered into `output`.
+    pub(crate) fn table_name(namespace: &str, output: qbe::Value) -> String {
+        unique_for(output, &format!("{namespace}.indexof.table"))
+    }
+
+    /// The data holding the table: first the elements and then their positions in the
+    /// list, as floats.
+    pub(crate) fn render_table(&self, name: String) -> qbe::DataDef<'static> {
+        let elements = self.table.iter().map(|&(bits, _)| bits);
+        let positions = self
+            .table
+            .iter()
+            .map(|&(_, position)| (position as f64).to_bits());
+        qbe::DataDef::new(
+            qbe::Linkage::private(),
+            name,
+            Some(SLOT_SIZE.in_bytes() as u64),
+            elements
+                .chain(positions)
+                .map(|bits| (qbe::Type::Long, qbe::DataItem::Const(bits)))
+                .collect(),
+        )
+    }
+}
@@ -116,7 +116,7 @@ impl Op for Choose {
             return Some(args[1]);
         }
 
-        if Ref::from(false) == args[1] {
+        if Ref::from(false) == args[0] {
             return Some(args[2]);
         }
 
@@ -163,12 +163,16 @@ impl Op for Not {
             return Some(Ref::from(false));
         }
 
-        if Ref::from(false) == args[1] {
+        if Ref::from(false) == args[0] {
             return Some(Ref::from(true));
         }
 
         None
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a && b`.
@@ -208,6 +212,10 @@ impl Op for And {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
 
 /// Implements `a || b`.
@@ -247,4 +255,8 @@ impl Op for Or {
             None
         }
     }
+
+    fn is_cheap(&self) -> bool {
+        true
+    }
 }
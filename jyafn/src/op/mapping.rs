@@ -67,7 +67,10 @@ impl Op for CallMapping {
                 }
             })
             .collect::<Option<Vec<_>>>()?;
-        let key_ptr = if let Some(value) = graph.mappings[&self.name].get(key.as_byte_slice()) {
+        // A mapping that cannot be read is not the same as a missing key.
+        let mapping = &graph.mappings[&self.name];
+        mapping.materialize().ok()?;
+        let key_ptr = if let Some(value) = mapping.get(key.as_byte_slice()) {
             value.as_ptr() as usize as u64
         } else {
             0
@@ -77,6 +80,57 @@ impl Op for CallMapping {
     }
 }
 
+impl CallMapping {
+    /// The temporary holding the hash of the key of the call whose output is `output`,
+    /// when the call is rendered in two halves.
+    fn hash_for(output: qbe::Value) -> qbe::Value {
+        qbe::Value::Temporary(unique_for(output, "callmapping.hash"))
+    }
+
+    /// Renders the first half of this call, which hashes the key and starts fetching
+    /// the value from memory. Rendering this well before
+    /// [`CallMapping::render_resolve_into`] (with the same `output`) lets the cache
+    /// misses of independent calls overlap.
+    pub(crate) fn render_prefetch_into(
+        &self,
+        graph: &Graph,
+        output: qbe::Value,
+        args: &[Ref],
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        func.assign_instr(
+            Self::hash_for(output),
+            qbe::Type::Long,
+            qbe::Instr::Call(
+                qbe::Value::Global(format!("{namespace}.mapping.{}.prefetch", self.name)),
+                args.iter()
+                    .map(|&r| (graph.type_of(r).render(), r.render()))
+                    .collect(),
+            ),
+        );
+    }
+
+    /// Renders the second half of this call, started by
+    /// [`CallMapping::render_prefetch_into`]. The result is the same as that of
+    /// [`Op::render_into`].
+    pub(crate) fn render_resolve_into(
+        &self,
+        output: qbe::Value,
+        func: &mut qbe::Function,
+        namespace: &str,
+    ) {
+        func.assign_instr(
+            output.clone(),
+            Type::Ptr { origin: usize::MAX }.render(),
+            qbe::Instr::Call(
+                qbe::Value::Global(format!("{namespace}.mapping.{}.resolve", self.name)),
+                vec![(qbe::Type::Long, Self::hash_for(output))],
+            ),
+        );
+    }
+}
+
 /// Loads the value of a mapping call for a given slot or yields an error if none was
 /// found.
 #[derive(Debug, Clone, PartialEq, Serialize, Deserialize, GetSize)]
@@ -68,6 +68,14 @@ pub trait Op: 'static + DynClone + Debug + Send + Sync + RefUnwindSafe + Downcas
         false
     }
 
+    /// Whether this operation renders to a couple of instructions, with no calls, no
+    /// memory accesses and no side effects. Cheap operations on both sides of a
+    /// [`Choose`] can be computed unconditionally, so that the choice needs no branch.
+    /// The default implementation always returns `false`.
+    fn is_cheap(&self) -> bool {
+        false
+    }
+
     /// Checks whether this operation is correctly formed. This method can also be used
     /// to detect runtime errors in compilation time.
     #[allow(unused_variables)]
@@ -130,7 +138,7 @@ macro_rules! impl_op {
 }
 
 /// Generates an unique name for a QBE temporary, with the given prefix.
-fn unique_for(v: qbe::Value, prefix: &str) -> String {
+pub(crate) fn unique_for(v: qbe::Value, prefix: &str) -> String {
     let qbe::Value::Temporary(name) = v else {
         panic!("Can only get unique names for temporaries; got {v}")
     };
@@ -138,16 +146,57 @@ fn unique_for(v: qbe::Value, prefix: &str) -> String {
     format!("{prefix}_{name}")
 }
 
+/// The extern holding the address of [`FnError::make_static`].
+pub(crate) const MAKE_STATIC_ERROR_EXTERN: &str = "jyafn.extern.fn_error.make_static";
+/// The extern holding the address of [`FnError::make_allocated`].
+pub(crate) const MAKE_ALLOCATED_ERROR_EXTERN: &str = "jyafn.extern.fn_error.make_allocated";
+
+/// The name of the extern holding the address of the pure function `name`.
+pub(crate) fn pfunc_extern(name: &str) -> String {
+    format!("jyafn.extern.pfunc.{name}")
+}
+
+/// The name of the extern holding the address of the resource `name` in the graph
+/// rendered under `namespace`.
+pub(crate) fn resource_extern(namespace: &str, name: &str) -> String {
+    format!("{namespace}.extern.resource.{name}")
+}
+
+/// The name of the extern holding the address of the method `method` of the resource
+/// `name` in the graph rendered under `namespace`.
+pub(crate) fn resource_method_extern(namespace: &str, name: &str, method: &str) -> String {
+    format!("{namespace}.extern.method.{name}.{method}")
+}
+
+/// The name of the extern holding the address of the batched version of the method
+/// `method` of the resource `name` in the graph rendered under `namespace`.
+pub(crate) fn resource_batch_method_extern(namespace: &str, name: &str, method: &str) -> String {
+    format!("{namespace}.extern.batch_method.{name}.{method}")
+}
+
+/// Renders the load of an address living in the current process out of its extern.
+///
+/// Externs are 8-byte cells in the data section which are filled in when the compiled
+/// code is loaded. Going through them instead of embedding the address as a constant
+/// keeps the machine code independent of the process that compiled it, so that it can
+/// be cached and reused elsewhere.
+pub(crate) fn render_load_extern(func: &mut qbe::Function, output: qbe::Value, name: &str) {
+    func.assign_instr(
+        output,
+        qbe::Type::Long,
+        qbe::Instr::Load(qbe::Type::Long, qbe::Value::Global(name.to_string())),
+    );
+}
+
 /// Renders the call to create an [`FnError`] out of a static C-Style string in jyafn code.
 pub(crate) fn render_return_error(func: &mut qbe::Function, error: qbe::Value) {
     let error_ptr = qbe::Value::Temporary("__error_ptr".to_string());
+    let make_static = qbe::Value::Temporary("__error_make_static".to_string());
+    render_load_extern(func, make_static.clone(), MAKE_STATIC_ERROR_EXTERN);
     func.assign_instr(
         error_ptr.clone(),
         qbe::Type::Long,
-        qbe::Instr::Call(
-            qbe::Value::Const(FnError::make_static as usize as u64),
-            vec![(qbe::Type::Long, error)],
-        ),
+        qbe::Instr::Call(make_static, vec![(qbe::Type::Long, error)]),
     );
     func.add_instr(qbe::Instr::Ret(Some(error_ptr)));
 }
@@ -156,13 +205,12 @@ pub(crate) fn render_return_error(func: &mut qbe::Function, error: qbe::Value) {
 /// code.
 pub(crate) fn render_return_allocated_error(func: &mut qbe::Function, error: qbe::Value) {
     let error_ptr = qbe::Value::Temporary("__error_ptr".to_string());
+    let make_allocated = qbe::Value::Temporary("__error_make_allocated".to_string());
+    render_load_extern(func, make_allocated.clone(), MAKE_ALLOCATED_ERROR_EXTERN);
     func.assign_instr(
         error_ptr.clone(),
         qbe::Type::Long,
-        qbe::Instr::Call(
-            qbe::Value::Const(FnError::make_allocated as usize as u64),
-            vec![(qbe::Type::Long, error)],
-        ),
+        qbe::Instr::Call(make_allocated, vec![(qbe::Type::Long, error)]),
     );
     func.add_instr(qbe::Instr::Ret(Some(error_ptr)));
 }
@@ -47,6 +47,9 @@ impl Op for CallResource {
         let output_ptr = qbe::Value::Temporary(unique_for(output.clone(), "callresource.output"));
         let data_ptr = qbe::Value::Temporary(unique_for(output.clone(), "callresource.data"));
         let status = qbe::Value::Temporary(unique_for(output.clone(), "callresource.status"));
+        let method_ptr = qbe::Value::Temporary(unique_for(output.clone(), "callresource.method"));
+        let resource_ptr =
+            qbe::Value::Temporary(unique_for(output.clone(), "callresource.resource"));
         let raise_side = unique_for(output.clone(), "callresource.raise");
         let end_side = unique_for(output.clone(), "callresource.end");
 
@@ -86,16 +89,23 @@ impl Op for CallResource {
             );
         }
 
+        super::render_load_extern(
+            func,
+            method_ptr.clone(),
+            &super::resource_method_extern(namespace, &self.name, &self.method),
+        );
+        super::render_load_extern(
+            func,
+            resource_ptr.clone(),
+            &super::resource_extern(namespace, &self.name),
+        );
         func.assign_instr(
             status.clone(),
             qbe::Type::Long,
             qbe::Instr::Call(
-                qbe::Value::Const(method.fn_ptr.0 as *const () as u64),
+                method_ptr,
                 vec![
-                    (
-                        qbe::Type::Long,
-                        qbe::Value::Const(resource.get_raw_ptr() as u64),
-                    ),
+                    (qbe::Type::Long, resource_ptr),
                     (qbe::Type::Long, input_ptr),
                     (qbe::Type::Long, qbe::Value::Const(input_size)),
                     (qbe::Type::Long, output_ptr.clone()),
@@ -2,9 +2,8 @@
 
 use chrono::prelude::*;
 use special_fun::FloatSpecial;
-use std::collections::HashMap;
 use std::ops::Rem;
-use std::sync::RwLock;
+use std::sync::atomic::{AtomicPtr, Ordering};
 
 use super::{utils, Error, Type};
 
@@ -23,40 +22,31 @@ impl From<ThreadsafePointer> for *const () {
     }
 }
 
-/// Wraps a closure that does compile-time evaluation for a pure function.
-#[derive(Clone, Copy)]
-pub(crate) struct ConstEval(pub(crate) &'static (dyn Send + Sync + Fn(&[f64]) -> Option<f64>));
-
-impl ConstEval {
+/// How to do compile-time evaluation for a pure function.
+#[derive(Debug, Clone, Copy)]
+pub(crate) enum ConstEval {
     /// No compile-time evaluation will be done.
-    fn no_eval() -> ConstEval {
-        ConstEval(&|_| None)
-    }
-
-    /// Compile-time evalue for `fn(f64) -> f64`.
-    fn call1(f: fn(f64) -> f64) -> ConstEval {
-        let closure = move |args: &[f64]| {
-            assert_eq!(args.len(), 1);
-            Some(f(args[0]))
-        };
-
-        ConstEval(Box::leak(Box::new(closure)))
-    }
-
-    /// Compile-time evalue for `fn(f64, f64) -> f64`.
-    fn call2(f: fn(f64, f64) -> f64) -> ConstEval {
-        let closure = move |args: &[f64]| {
-            assert_eq!(args.len(), 2);
-            Some(f(args[0], args[1]))
-        };
-
-        ConstEval(Box::leak(Box::new(closure)))
-    }
+    NoEval,
+    /// Compile-time evaluation for `fn(f64) -> f64`.
+    Call1(fn(f64) -> f64),
+    /// Compile-time evaluation for `fn(f64, f64) -> f64`.
+    Call2(fn(f64, f64) -> f64),
 }
 
-impl std::fmt::Debug for ConstEval {
-    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
-        write!(f, "ConstEval")
+impl ConstEval {
+    /// Evaluates the function on constant arguments, if possible.
+    pub(crate) fn eval(self, args: &[f64]) -> Option<f64> {
+        match self {
+            ConstEval::NoEval => None,
+            ConstEval::Call1(f) => {
+                assert_eq!(args.len(), 1);
+                Some(f(args[0]))
+            }
+            ConstEval::Call2(f) => {
+                assert_eq!(args.len(), 2);
+                Some(f(args[0], args[1]))
+            }
+        }
     }
 }
 
@@ -98,59 +88,161 @@ impl PFunc {
     }
 
     /// Creates a [`PFunc`] for a `fn(f64) -> f64`.
-    fn call1(f: fn(f64) -> f64) -> PFunc {
+    const fn call1(f: fn(f64) -> f64) -> PFunc {
         PFunc {
             fn_ptr: ThreadsafePointer(f as *const ()),
             signature: &[Type::Float],
             returns: Type::Float,
-            const_eval: ConstEval::call1(f),
+            const_eval: ConstEval::Call1(f),
         }
     }
 
     /// Creates a [`PFunc`] for a `fn(f64, 64) -> f64`.
-    fn call2(f: fn(f64, f64) -> f64) -> PFunc {
+    const fn call2(f: fn(f64, f64) -> f64) -> PFunc {
         PFunc {
             fn_ptr: ThreadsafePointer(f as *const ()),
             signature: &[Type::Float, Type::Float],
             returns: Type::Float,
-            const_eval: ConstEval::call2(f),
+            const_eval: ConstEval::Call2(f),
         }
     }
 
     /// Creates a [`PFunc`] for a `fn(f64) -> bool`.
-    fn call_bool_to_f64(f: fn(f64) -> bool) -> PFunc {
+    const fn call_bool_to_f64(f: fn(f64) -> bool) -> PFunc {
         PFunc {
             fn_ptr: ThreadsafePointer(f as *const ()),
             signature: &[Type::Float],
             returns: Type::Bool,
-            const_eval: ConstEval::no_eval(),
+            const_eval: ConstEval::NoEval,
         }
     }
 
     /// Creates a [`PFunc`] for a `fn(i64) -> f64`, where the input is a timestamp.
-    pub fn call_dt_to_f64(f: fn(i64) -> f64) -> PFunc {
+    pub const fn call_dt_to_f64(f: fn(i64) -> f64) -> PFunc {
         PFunc {
             fn_ptr: ThreadsafePointer(f as *const ()),
             signature: &[Type::DateTime],
             returns: Type::Float,
-            const_eval: ConstEval::no_eval(),
+            const_eval: ConstEval::NoEval,
         }
     }
 
     /// Creates a [`PFunc`] for a `fn(f64) -> i64`, where the output is a timestamp.
-    pub fn call_f64_to_dt(f: fn(f64) -> i64) -> PFunc {
+    pub const fn call_f64_to_dt(f: fn(f64) -> i64) -> PFunc {
         PFunc {
             fn_ptr: ThreadsafePointer(f as *const ()),
             signature: &[Type::Float],
             returns: Type::DateTime,
-            const_eval: ConstEval::no_eval(),
+            const_eval: ConstEval::NoEval,
         }
     }
 }
 
-lazy_static::lazy_static! {
-    /// All the known [`PFunc`]s.
-    static ref P_FUNCS: RwLock<HashMap<&'static str, PFunc>> = RwLock::new(init());
+/// The standard pure functions provided by jyafn, sorted by name, so that lookups are a
+/// binary search on a table built at compile time, with no locking involved.
+#[allow(unstable_name_collisions)]
+const BUILTINS: &[(&str, PFunc)] = &[
+    ("acos", PFunc::call1(f64::acos)),
+    ("acosh", PFunc::call1(f64::acosh)),
+    ("asin", PFunc::call1(f64::asin)),
+    ("asinh", PFunc::call1(f64::asinh)),
+    ("atan", PFunc::call1(f64::atan)),
+    ("atan2", PFunc::call2(f64::atan2)),
+    ("atanh", PFunc::call1(f64::atanh)),
+    ("besseli", PFunc::call2(f64::besseli)),
+    ("besselj", PFunc::call2(f64::besselj)),
+    ("bessely", PFunc::call2(f64::bessely)),
+    ("beta", PFunc::call2(f64::beta)),
+    ("ceil", PFunc::call1(f64::ceil)),
+    ("cos", PFunc::call1(f64::cos)),
+    ("cosh", PFunc::call1(f64::cosh)),
+    ("day", PFunc::call_dt_to_f64(day)),
+    ("dayofyear", PFunc::call_dt_to_f64(dayofyear)),
+    ("digamma", PFunc::call1(f64::digamma)),
+    ("erf", PFunc::call1(f64::erf)),
+    ("erfc", PFunc::call1(f64::erfc)),
+    ("exp", PFunc::call1(f64::exp)),
+    ("exp_m1", PFunc::call1(f64::exp_m1)),
+    ("factorial", PFunc::call1(f64::factorial)),
+    ("floor", PFunc::call1(f64::floor)),
+    ("fromtimestamp", PFunc::call_f64_to_dt(fromtimestamp)),
+    ("gamma", PFunc::call1(f64::gamma)),
+    ("gammac", PFunc::call2(f64::gammac)),
+    ("gammac_inv", PFunc::call2(f64::gammac_inv)),
+    ("gammainc", PFunc::call2(f64::gammainc)),
+    ("hour", PFunc::call_dt_to_f64(hour)),
+    ("is_finite", PFunc::call_bool_to_f64(f64::is_finite)),
+    ("is_infinite", PFunc::call_bool_to_f64(f64::is_infinite)),
+    ("is_nan", PFunc::call_bool_to_f64(f64::is_nan)),
+    ("ln", PFunc::call1(f64::ln)),
+    ("ln_1p", PFunc::call1(f64::ln_1p)),
+    ("logbeta", PFunc::call2(f64::logbeta)),
+    ("loggamma", PFunc::call1(f64::loggamma)),
+    ("microsecond", PFunc::call_dt_to_f64(microsecond)),
+    ("minute", PFunc::call_dt_to_f64(minute)),
+    ("month", PFunc::call_dt_to_f64(month)),
+    ("norm", PFunc::call1(f64::norm)),
+    ("norm_inv", PFunc::call1(f64::norm_inv)),
+    ("powf", PFunc::call2(f64::powf)),
+    ("rem", PFunc::call2(f64::rem)),
+    ("rgamma", PFunc::call1(f64::rgamma)),
+    ("riemann_zeta", PFunc::call1(f64::riemann_zeta)),
+    ("round", PFunc::call1(f64::round)),
+    ("second", PFunc::call_dt_to_f64(second)),
+    ("sin", PFunc::call1(f64::sin)),
+    ("sinh", PFunc::call1(f64::sinh)),
+    ("sqrt", PFunc::call1(f64::sqrt)),
+    ("tan", PFunc::call1(f64::tan)),
+    ("tanh", PFunc::call1(f64::tanh)),
+    ("timestamp", PFunc::call_dt_to_f64(timestamp)),
+    ("trunc", PFunc::call1(f64::trunc)),
+    ("week", PFunc::call_dt_to_f64(week)),
+    ("weekday", PFunc::call_dt_to_f64(weekday)),
+    ("year", PFunc::call_dt_to_f64(year)),
+];
+
+/// Whether `a` comes strictly before `b`, byte by byte.
+const fn precedes(a: &str, b: &str) -> bool {
+    let (a, b) = (a.as_bytes(), b.as_bytes());
+    let mut i = 0;
+    while i < a.len() && i < b.len() {
+        if a[i] != b[i] {
+            return a[i] < b[i];
+        }
+        i += 1;
+    }
+    a.len() < b.len()
+}
+
+// The binary search on `BUILTINS` depends on this.
+const _: () = {
+    let mut i = 1;
+    while i < BUILTINS.len() {
+        assert!(
+            precedes(BUILTINS[i - 1].0, BUILTINS[i].0),
+            "BUILTINS must be sorted by name"
+        );
+        i += 1;
+    }
+};
+
+/// A pure function inscribed at runtime. These form a linked list that is only ever
+/// prepended to, so that it can be read without locking.
+struct Inscribed {
+    name: &'static str,
+    pfunc: PFunc,
+    next: *const Inscribed,
+}
+
+/// The most recently inscribed pure function, or null if none has been inscribed.
+static INSCRIBED: AtomicPtr<Inscribed> = AtomicPtr::new(std::ptr::null_mut());
+
+/// Iterates through all the inscribed pure functions, starting from `head`.
+fn inscribed_from(head: *const Inscribed) -> impl Iterator<Item = &'static Inscribed> {
+    // Safety: nodes are leaked when published and never mutated afterwards.
+    std::iter::successors(unsafe { head.as_ref() }, |node| unsafe {
+        node.next.as_ref()
+    })
 }
 
 /// Inscribes a new pure function.
@@ -163,86 +255,57 @@ lazy_static::lazy_static! {
 /// given and that the function that is being supplied actually obeys all the expectations
 /// on a pure function (see [`PFunc`] for the requirements.)
 ///
-/// # Panics
+/// # Errors
 ///
-/// This function panics if a pfunc of the given name has already been inscribed.
+/// This function errors if a pfunc of the given name has already been inscribed.
 pub unsafe fn inscribe(
     name: &str,
     fn_ptr: *const (),
     signature: &[Type],
     returns: Type,
 ) -> Result<(), Error> {
-    let mut guard = P_FUNCS.write().expect("poisoned");
-
-    if guard.contains_key(name) {
-        // This avoids poisoning the global lock.
-        drop(guard);
-        return Err("Function of name {name} already inscribed"
-            .to_string()
-            .into());
+    let already_inscribed = || Err(format!("Function of name {name} already inscribed").into());
+    if get(name).is_some() {
+        return already_inscribed();
     }
 
-    guard.insert(
-        Box::leak(name.to_string().into_boxed_str()),
-        PFunc {
+    let node = Box::into_raw(Box::new(Inscribed {
+        name: Box::leak(name.to_string().into_boxed_str()),
+        pfunc: PFunc {
             fn_ptr: ThreadsafePointer(fn_ptr),
             signature: Box::leak(signature.to_vec().into_boxed_slice()),
             returns,
-            const_eval: ConstEval::no_eval(),
+            const_eval: ConstEval::NoEval,
         },
-    );
+        next: std::ptr::null(),
+    }));
+
+    let mut head = INSCRIBED.load(Ordering::Acquire);
+    loop {
+        // Someone may have inscribed the same name since the last look.
+        if inscribed_from(head).any(|inscribed| inscribed.name == name) {
+            // Safety: the node was never published. (Its name and signature leak.)
+            drop(Box::from_raw(node));
+            return already_inscribed();
+        }
 
-    Ok(())
+        (*node).next = head;
+        match INSCRIBED.compare_exchange_weak(head, node, Ordering::AcqRel, Ordering::Acquire) {
+            Ok(_) => return Ok(()),
+            Err(current) => head = current,
+        }
+    }
 }
 
 /// Gets a pure function by name, returning `None` if none is found.
 pub fn get(name: &str) -> Option<PFunc> {
-    let guard = P_FUNCS.read().expect("poisoned");
-    guard.get(name).copied()
-}
-
-/// Initalizes the [`P_FUNCS`] static with the standard pure function provided by jyafn.
-#[allow(unstable_name_collisions)]
-fn init() -> HashMap<&'static str, PFunc> {
-    let mut map = HashMap::new();
-
-    macro_rules! pfuncs_f64 {
-        ($($method:ident : $($f:ident),*);*) => { $($(
-            map.insert(stringify!($f), PFunc::$method(f64::$f));
-        )*)* }
-    }
-
-    pfuncs_f64! {
-        call1:
-            floor, ceil, round, trunc,
-            sqrt, exp, ln, ln_1p, exp_m1,
-            sin, cos, tan, asin, acos, atan, sinh, cosh, tanh, asinh, acosh, atanh,
-            gamma, loggamma, factorial, rgamma, digamma,
-            erf, erfc, norm, norm_inv,
-            riemann_zeta;
-        call2:
-            powf, rem, atan2,
-            beta, logbeta, gammainc, gammac, gammac_inv,
-            besselj, bessely, besseli;
-        call_bool_to_f64:
-            is_nan, is_finite, is_infinite
-    }
-
-    macro_rules! pfuncs {
-        ($($method:ident : $($f:ident),*);*) => { $($(
-            map.insert(stringify!($f), PFunc::$method($f));
-        )*)* }
-    }
-
-    pfuncs! {
-        call_f64_to_dt:
-            fromtimestamp;
-        call_dt_to_f64:
-            timestamp, year, month, day, hour, minute, second, microsecond,
-            weekday, week, dayofyear
+    if let Ok(pos) = BUILTINS.binary_search_by(|(builtin, _)| builtin.cmp(&name)) {
+        return Some(BUILTINS[pos].1);
     }
 
-    map
+    inscribed_from(INSCRIBED.load(Ordering::Acquire))
+        .find(|inscribed| inscribed.name == name)
+        .map(|inscribed| inscribed.pfunc)
 }
 
 fn fromtimestamp(x: f64) -> i64 {
@@ -292,3 +355,35 @@ fn week(dt: i64) -> f64 {
 fn dayofyear(dt: i64) -> f64 {
     utils::int_to_datetime(dt).ordinal() as f64
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    extern "C" fn twice(x: f64) -> f64 {
+        2.0 * x
+    }
+
+    #[test]
+    fn test_get_builtin() {
+        for (name, _) in BUILTINS {
+            assert!(get(name).is_some(), "{name} not found");
+        }
+        assert_eq!(get("sqrt").unwrap().const_eval.eval(&[4.0]), Some(2.0));
+        assert!(get("not_a_pfunc").is_none());
+    }
+
+    #[test]
+    fn test_inscribe() {
+        let fn_ptr = twice as *const ();
+        unsafe {
+            inscribe("test_twice", fn_ptr, &[Type::Float], Type::Float).unwrap();
+            assert!(inscribe("test_twice", fn_ptr, &[Type::Float], Type::Float).is_err());
+            assert!(inscribe("sqrt", fn_ptr, &[Type::Float], Type::Float).is_err());
+        }
+
+        let pfunc = get("test_twice").unwrap();
+        assert_eq!(pfunc.location(), fn_ptr as usize);
+        assert_eq!(pfunc.signature(), &[Type::Float]);
+    }
+}
@@ -0,0 +1,180 @@
+//! A persistent pool of worker threads for data-parallel loops over rows.
+//!
+//! Rows are handed out in chunks from a shared cursor: each thread (including the caller,
+//! which also works) claims a chunk proportional to the work still left, so that chunks
+//! start big and get smaller towards the end. This balances the load even when the cost
+//! per row varies wildly, without the overhead of claiming rows one by one.
+
+use std::ops::Range;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+
+/// The smallest chunk worth handing out to a thread.
+const MIN_CHUNK: usize = 16;
+/// How many chunks each thread gets, on average, out of the remaining rows.
+const CHUNKS_PER_THREAD: usize = 4;
+
+lazy_static::lazy_static! {
+    static ref POOL: Pool = Pool::new();
+}
+
+/// The number of threads used by data-parallel loops, including the calling thread.
+/// This is given by the `JYAFN_NUM_THREADS` environment variable or, if not set, by the
+/// available parallelism of the machine.
+pub fn num_threads() -> usize {
+    POOL.n_threads
+}
+
+/// Runs `f` over chunks of `0..n`, in parallel, returning when all of `0..n` has been
+/// processed. Every index is processed exactly once. If `f` panics, the panic is
+/// resumed in the caller after all other chunks are done.
+pub(crate) fn for_each_chunk<F>(n: usize, f: F)
+where
+    F: Fn(Range<usize>) + Sync,
+{
+    if n == 0 {
+        return;
+    }
+
+    if POOL.n_threads == 1 || n <= MIN_CHUNK {
+        f(0..n);
+        return;
+    }
+
+    let f: &(dyn Fn(Range<usize>) + Sync) = &f;
+    let task = Arc::new(Task {
+        // Safety: the task never calls `f` once all rows are done and this function
+        // only returns after that. So, `f` outlives all its uses.
+        f: unsafe {
+            std::mem::transmute::<
+                &(dyn Fn(Range<usize>) + Sync),
+                &'static (dyn Fn(Range<usize>) + Sync),
+            >(f)
+        },
+        n,
+        n_threads: POOL.n_threads,
+        cursor: AtomicUsize::new(0),
+        done: Mutex::new(Done::default()),
+        all_done: Condvar::new(),
+    });
+
+    {
+        let sender = POOL.sender.lock().expect("poisoned");
+        for _ in 1..POOL.n_threads {
+            // If the pool is gone, the caller does all the work.
+            let _ = sender.send(task.clone());
+        }
+    }
+
+    task.work();
+
+    let mut done = task.done.lock().expect("poisoned");
+    while done.rows < n {
+        done = task.all_done.wait(done).expect("poisoned");
+    }
+    if let Some(payload) = done.panic.take() {
+        drop(done);
+        panic::resume_unwind(payload);
+    }
+}
+
+struct Pool {
+    n_threads: usize,
+    sender: Mutex<Sender<Arc<Task>>>,
+}
+
+impl Pool {
+    fn new() -> Pool {
+        let n_threads = std::env::var("JYAFN_NUM_THREADS")
+            .ok()
+            .and_then(|n| n.parse().ok())
+            .or_else(|| thread::available_parallelism().ok().map(usize::from))
+            .unwrap_or(1)
+            .max(1);
+
+        let (sender, receiver) = mpsc::channel();
+        let receiver = Arc::new(Mutex::new(receiver));
+        for i in 1..n_threads {
+            let receiver = receiver.clone();
+            thread::Builder::new()
+                .name(format!("jyafn-worker-{i}"))
+                .spawn(move || worker(receiver))
+                .expect("failed to spawn jyafn worker thread");
+        }
+
+        Pool {
+            n_threads,
+            sender: Mutex::new(sender),
+        }
+    }
+}
+
+fn worker(receiver: Arc<Mutex<Receiver<Arc<Task>>>>) {
+    loop {
+        let Ok(task) = receiver.lock().expect("poisoned").recv() else {
+            return;
+        };
+        task.work();
+    }
+}
+
+#[derive(Default)]
+struct Done {
+    rows: usize,
+    panic: Option<Box<dyn std::any::Any + Send>>,
+}
+
+struct Task {
+    f: &'static (dyn Fn(Range<usize>) + Sync),
+    n: usize,
+    n_threads: usize,
+    cursor: AtomicUsize,
+    done: Mutex<Done>,
+    all_done: Condvar,
+}
+
+impl Task {
+    /// Claims the next chunk of rows, if any is left.
+    fn claim(&self) -> Option<Range<usize>> {
+        let mut start = self.cursor.load(Ordering::Relaxed);
+        loop {
+            if start >= self.n {
+                return None;
+            }
+
+            let remaining = self.n - start;
+            let chunk = (remaining / (CHUNKS_PER_THREAD * self.n_threads))
+                .max(MIN_CHUNK)
+                .min(remaining);
+            match self.cursor.compare_exchange_weak(
+                start,
+                start + chunk,
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => return Some(start..start + chunk),
+                Err(current) => start = current,
+            }
+        }
+    }
+
+    /// Processes chunks until there are none left.
+    fn work(&self) {
+        while let Some(chunk) = self.claim() {
+            let len = chunk.len();
+            let outcome = panic::catch_unwind(AssertUnwindSafe(|| (self.f)(chunk)));
+
+            let mut done = self.done.lock().expect("poisoned");
+            done.rows += len;
+            if let Err(payload) = outcome {
+                done.panic.get_or_insert(payload);
+            }
+            if done.rows == self.n {
+                self.all_done.notify_all();
+            }
+        }
+    }
+}
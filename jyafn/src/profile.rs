@@ -0,0 +1,167 @@
+//! Profiling of compiled functions (see [`crate::Graph::compile_profiled`]).
+//!
+//! A profiled function counts, for each of its sites (the function itself, each call to
+//! a mapping, resource or subgraph and each side of a conditional), how many times it
+//! ran and how many clock ticks it took. The clock is the cheapest one the machine has:
+//! the time-stamp counter on x86_64, the virtual counter on aarch64 and a monotonic
+//! clock in nanoseconds elsewhere. Counters are updated without synchronization, so
+//! they are approximate when the function is called from many threads at once.
+
+use serde_derive::{Deserialize, Serialize};
+use std::sync::OnceLock;
+use std::time::{Duration, Instant};
+
+/// The name of the extern holding the address of [`now`].
+pub(crate) const NOW_EXTERN: &str = "jyafn.extern.profile.now";
+
+/// The name of the counters of a profiled function rendered under `namespace`: two
+/// longs per site, the ticks and the hits, plus a third for mapping calls, the misses.
+pub(crate) fn counters_name(namespace: &str) -> String {
+    format!("{namespace}.profile")
+}
+
+/// Reads the clock used by profiled functions.
+pub(crate) extern "C" fn now() -> u64 {
+    #[cfg(target_arch = "x86_64")]
+    {
+        // Safety: the time-stamp counter is always there in x86_64.
+        unsafe { std::arch::x86_64::_rdtsc() }
+    }
+
+    #[cfg(target_arch = "aarch64")]
+    {
+        let ticks: u64;
+        // Safety: the virtual counter is readable from user space.
+        unsafe {
+            std::arch::asm!("mrs {}, cntvct_el0", out(reg) ticks, options(nomem, nostack));
+        }
+        ticks
+    }
+
+    #[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+    {
+        static START: OnceLock<Instant> = OnceLock::new();
+        START.get_or_init(Instant::now).elapsed().as_nanos() as u64
+    }
+}
+
+/// How many ticks of [`now`] there are in a second, measured once against the system
+/// clock.
+fn ticks_per_second() -> f64 {
+    static TICKS_PER_SECOND: OnceLock<f64> = OnceLock::new();
+    *TICKS_PER_SECOND.get_or_init(|| {
+        let start = Instant::now();
+        let start_ticks = now();
+        std::thread::sleep(Duration::from_millis(10));
+        let ticks = now().wrapping_sub(start_ticks);
+        ticks as f64 / start.elapsed().as_secs_f64()
+    })
+}
+
+/// What a site of a profiled function measures.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum SiteKind {
+    /// The whole function, once the inputs are loaded and until the outputs are computed.
+    Function,
+    /// A call to a mapping, a resource method or a subgraph.
+    Call,
+    /// The side of a conditional taken when the condition holds.
+    IfTrue,
+    /// The side of a conditional taken when the condition does not hold.
+    IfFalse,
+}
+
+/// A site of a profiled function, with its counts.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct ProfileEntry {
+    /// What is measured.
+    pub kind: SiteKind,
+    /// The node of the call (or of the choice, for the sides of a conditional). This is
+    /// the id in the graph as it was compiled, i.e., after all optimizations.
+    pub node_id: Option<usize>,
+    /// The name of the operation of the node.
+    pub op: Option<String>,
+    /// The name of what is called: the mapping, the resource method (as
+    /// `resource.method`) or the subgraph.
+    pub name: Option<String>,
+    /// How many times the site completed. Runs that raised an error are not counted.
+    pub hits: u64,
+    /// The clock ticks spent in the site, in total. For mapping calls whose lookup is
+    /// prefetched ahead of time, this is only the time spent waiting for the result.
+    pub ticks: u64,
+    /// For mapping calls, how many times the key was not found.
+    pub misses: Option<u64>,
+}
+
+impl ProfileEntry {
+    /// Whether this site counts misses.
+    pub(crate) fn counts_misses(&self) -> bool {
+        self.op.as_deref() == Some("CallMapping")
+    }
+
+    /// How many counters (longs) this site has.
+    pub(crate) fn n_counters(&self) -> usize {
+        if self.counts_misses() {
+            3
+        } else {
+            2
+        }
+    }
+}
+
+/// The counts of all sites of a profiled function, since it was compiled (or since the
+/// last [`crate::Function::reset_profile`]).
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct ProfileReport {
+    /// How many clock ticks there are in a second (approximately).
+    pub ticks_per_second: f64,
+    /// The sites, in the order they were rendered. The first is the whole function.
+    pub entries: Vec<ProfileEntry>,
+}
+
+/// Where the counters of each site are, in longs from the start of the counters.
+pub(crate) fn offsets(sites: &[ProfileEntry]) -> impl '_ + Iterator<Item = usize> {
+    sites.iter().scan(0, |offset, site| {
+        let this = *offset;
+        *offset += site.n_counters();
+        Some(this)
+    })
+}
+
+/// Reads the counters of a profiled function into a report.
+///
+/// # Safety
+///
+/// `counters` must point to the counters rendered for exactly these sites.
+pub(crate) unsafe fn read(counters: *const u64, sites: &[ProfileEntry]) -> ProfileReport {
+    let entries = sites
+        .iter()
+        .zip(offsets(sites))
+        .map(|(site, offset)| {
+            let cell = counters.add(offset);
+            ProfileEntry {
+                ticks: cell.read_volatile(),
+                hits: cell.add(1).read_volatile(),
+                misses: site.counts_misses().then(|| cell.add(2).read_volatile()),
+                ..site.clone()
+            }
+        })
+        .collect();
+
+    ProfileReport {
+        ticks_per_second: ticks_per_second(),
+        entries,
+    }
+}
+
+/// Sets the counters of a profiled function back to zero.
+///
+/// # Safety
+///
+/// `counters` must point to the counters rendered for exactly these sites.
+pub(crate) unsafe fn reset(counters: *mut u64, sites: &[ProfileEntry]) {
+    for i in 0..sites.iter().map(ProfileEntry::n_counters).sum() {
+        counters.add(i).write_volatile(0);
+    }
+}
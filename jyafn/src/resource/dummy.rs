@@ -45,16 +45,19 @@ impl Resource for DummyResource {
         match method {
             "get" => Some(ResourceMethod {
                 fn_ptr: crate::safe_method!(dummy_get),
+                batch_fn_ptr: Some(crate::safe_batch_method!(dummy_get_batch)),
                 input_layout: Struct(vec![("x".to_string(), Layout::Scalar)]),
                 output_layout: Layout::Scalar,
             }),
             "error" => Some(ResourceMethod {
                 fn_ptr: crate::safe_method!(dummy_error),
+                batch_fn_ptr: None,
                 input_layout: Struct(vec![]),
                 output_layout: Layout::Scalar,
             }),
             "panic" => Some(ResourceMethod {
                 fn_ptr: crate::safe_method!(dummy_panic),
+                batch_fn_ptr: None,
                 input_layout: Struct(vec![]),
                 output_layout: Layout::Scalar,
             }),
@@ -76,6 +79,22 @@ fn dummy_get(
     Ok(())
 }
 
+fn dummy_get_batch(
+    resource: &DummyResource,
+    input: Input,
+    mut output_builder: OutputBuilder,
+    n_rows: usize,
+) -> Result<(), String> {
+    for row in 0..n_rows {
+        let result = input.get_f64(row) / resource.number_to_divide;
+        if !result.is_finite() {
+            return Err("result was not finite".to_string());
+        }
+        output_builder.push_f64(result);
+    }
+    Ok(())
+}
+
 fn dummy_error(
     _resource: &DummyResource,
     _input: Input,
@@ -91,3 +110,64 @@ fn dummy_panic(
 ) -> Result<(), String> {
     panic!("panic!")
 }
+
+#[cfg(test)]
+mod test {
+    use byte_slice_cast::*;
+
+    use super::*;
+    use crate::layout::RefValue;
+    use crate::Graph;
+
+    fn create_dummy_graph() -> Graph {
+        let mut graph = Graph::new();
+        graph.insert_resource_boxed("dummy".to_string(), Dummy.from_bytes(b"2").unwrap());
+        let a = graph.input("a".to_string(), Layout::Scalar);
+        let RefValue::Scalar(a_ref) = a else {
+            unreachable!()
+        };
+        let RefValue::Scalar(got) = graph
+            .call_resource(
+                "dummy",
+                "get",
+                RefValue::Struct([("x".to_string(), a)].into()),
+            )
+            .unwrap()
+        else {
+            unreachable!()
+        };
+        let sum = graph.insert(crate::op::Add, vec![got, a_ref]).unwrap();
+        graph.output(RefValue::Scalar(sum), Layout::Scalar).unwrap();
+
+        graph
+    }
+
+    #[test]
+    fn test_run_batch_staged_resource() {
+        let graph = create_dummy_graph();
+        assert!(graph
+            .render()
+            .unwrap()
+            .to_string()
+            .contains(".extern.batch_method."));
+        let func = graph.compile().unwrap();
+
+        // The row that fails makes its chunk fall back to one call per row.
+        let mut input = (0..150).map(f64::from).collect::<Vec<_>>();
+        input[70] = f64::INFINITY;
+        let mut output = vec![0.0; input.len()];
+        let errors = func.call_batch(input.as_byte_slice(), output.as_mut_byte_slice());
+
+        assert_eq!(errors.len(), 1);
+        assert_eq!(errors[0].0, 70);
+        for (row, (&x, &y)) in input.iter().zip(&output).enumerate() {
+            if row != 70 {
+                assert_eq!(y, x / 2.0 + x);
+            }
+        }
+
+        // The single-row entrypoint is not staged.
+        let y: f64 = func.eval(&serde_json::json!({ "a": 5.0 })).unwrap();
+        assert_eq!(y, 7.5);
+    }
+}
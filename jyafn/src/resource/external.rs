@@ -6,10 +6,11 @@ use std::ffi::{CStr, CString};
 use std::pin::Pin;
 use std::sync::{Arc, Mutex};
 
-use crate::extension::{Dumped, Extension, ExternalMethod, RawResource, ResourceSymbols};
+use crate::extension::{Dumped, Extension, ExternalMethod, Outcome, RawResource, ResourceSymbols};
+use crate::utils::mmap::MappedSlice;
 use crate::Error;
 
-use super::{RawResourceMethod, Resource, ResourceMethod, ResourceType};
+use super::{RawResourceBatchMethod, RawResourceMethod, Resource, ResourceMethod, ResourceType};
 
 #[serde_as]
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -59,19 +60,21 @@ impl External {
     }
 }
 
-#[typetag::serde]
-impl ResourceType for External {
-    fn from_bytes(&self, bytes: &[u8]) -> Result<Pin<Box<dyn Resource>>, Error> {
+impl External {
+    /// Creates the resource out of the outcome of one of the extension constructors.
+    /// `data` is kept alive for as long as the resource exists.
+    fn create(
+        &self,
+        construct: impl FnOnce(&ResourceSymbols) -> Outcome,
+        data: Option<MappedSlice>,
+    ) -> Result<Pin<Box<dyn Resource>>, Error> {
         // The _only_ way to create an `ExternalResource` is through this function. This
         // guarantees that the extension was initalized and that the resource exists.
         self.load_extension()?;
 
         let extension = self.extension();
         let resource = self.resource();
-        let outcome = unsafe {
-            // Safety: extension is correctly implemented.
-            (resource.fn_from_bytes)(bytes.as_ptr(), bytes.len())
-        };
+        let outcome = construct(&resource);
         let raw_ptr = unsafe {
             // Safety: the outcome wasjust generated by the extension and never used.
             extension.outcome_to_result(outcome)?
@@ -84,14 +87,56 @@ impl ResourceType for External {
         Ok(Box::pin(ExternalResource {
             r#type: self.clone(),
             ptr: RawResource(raw_ptr),
+            _data: data,
         }))
     }
 }
 
+#[typetag::serde]
+impl ResourceType for External {
+    fn from_bytes(&self, bytes: &[u8]) -> Result<Pin<Box<dyn Resource>>, Error> {
+        self.create(
+            |resource| unsafe {
+                // Safety: extension is correctly implemented.
+                (resource.fn_from_bytes)(bytes.as_ptr(), bytes.len())
+            },
+            None,
+        )
+    }
+
+    fn is_mappable(&self) -> bool {
+        // Storing the data uncompressed is only worth it if the extension can use it in
+        // place. Extensions without `fn_from_mapped` copy it anyway.
+        self.load_extension().is_ok() && self.resource().fn_from_mapped.is_some()
+    }
+
+    fn from_mapped(&self, data: MappedSlice) -> Result<Pin<Box<dyn Resource>>, Error> {
+        self.load_extension()?;
+        if self.resource().fn_from_mapped.is_none() {
+            // Older extension: the data will be copied.
+            return self.from_bytes(&data);
+        }
+
+        self.create(
+            |resource| {
+                let fn_from_mapped = resource.fn_from_mapped.expect("checked above");
+                unsafe {
+                    // Safety: extension is correctly implemented.
+                    fn_from_mapped(data.as_ptr(), data.len())
+                }
+            },
+            Some(data.clone()),
+        )
+    }
+}
+
 #[derive(Debug)]
 struct ExternalResource {
     r#type: External,
     ptr: RawResource,
+    /// The data this resource was created from, if the extension may still be using it.
+    /// This is only dropped after the resource itself.
+    _data: Option<MappedSlice>,
 }
 
 // Safety: all resources must be thread-safe.
@@ -178,6 +223,10 @@ impl Resource for ExternalResource {
                 // Safety: this should have been a valid address in the extension side.
                 std::mem::transmute::<usize, RawResourceMethod>(external_method.fn_ptr)
             },
+            batch_fn_ptr: external_method.batch_fn_ptr.map(|batch_fn_ptr| unsafe {
+                // Safety: same as above.
+                std::mem::transmute::<usize, RawResourceBatchMethod>(batch_fn_ptr)
+            }),
             input_layout: external_method.input_layout,
             output_layout: external_method.output_layout,
         })
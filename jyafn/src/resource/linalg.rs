@@ -21,10 +21,12 @@ struct SquareMatrix;
 #[typetag::serde]
 impl ResourceType for SquareMatrix {
     fn from_bytes(&self, bytes: &[u8]) -> Result<std::pin::Pin<Box<dyn Resource>>, crate::Error> {
+        let shape = String::from_utf8_lossy(bytes)
+            .parse::<usize>()
+            .map_err(|err| err.to_string())?;
         Ok(Box::pin(SquareMatrixResource {
-            shape: String::from_utf8_lossy(bytes)
-                .parse::<usize>()
-                .map_err(|err| err.to_string())?,
+            shape,
+            small: SMALL_KERNELS.get(shape.wrapping_sub(1)),
         }))
     }
 }
@@ -32,6 +34,8 @@ impl ResourceType for SquareMatrix {
 #[derive(Debug)]
 struct SquareMatrixResource {
     shape: usize,
+    /// The kernels specialized for this shape, if it is small enough to have them.
+    small: Option<&'static SmallKernels>,
 }
 
 impl Resource for SquareMatrixResource {
@@ -55,6 +59,7 @@ impl Resource for SquareMatrixResource {
                 ),
                 output_layout: layout!(scalar),
                 fn_ptr: safe_method!(matix_det),
+                batch_fn_ptr: None,
             },
             "inv" => ResourceMethod {
                 input_layout: r#struct!(
@@ -62,6 +67,7 @@ impl Resource for SquareMatrixResource {
                 ),
                 output_layout: layout!([[scalar; self.shape]; self.shape]),
                 fn_ptr: safe_method!(matrix_inv),
+                batch_fn_ptr: None,
             },
             "solve" => ResourceMethod {
                 input_layout: r#struct!(
@@ -70,6 +76,7 @@ impl Resource for SquareMatrixResource {
                 ),
                 output_layout: layout!([scalar; self.shape]),
                 fn_ptr: safe_method!(matrix_solve),
+                batch_fn_ptr: None,
             },
             "cholesky" => ResourceMethod {
                 input_layout: r#struct!(
@@ -77,6 +84,7 @@ impl Resource for SquareMatrixResource {
                 ),
                 output_layout: layout!([[scalar; self.shape]; self.shape]),
                 fn_ptr: safe_method!(matrix_cholesky),
+                batch_fn_ptr: None,
             },
             _ => return None,
         })
@@ -98,6 +106,11 @@ fn matix_det(
         ));
     }
 
+    if let Some(small) = resource.small {
+        output_builder.push_f64((small.det)(input.as_f64_slice()));
+        return Ok(());
+    }
+
     let mat = faer::mat::from_row_major_slice(input.as_f64_slice(), resource.shape, resource.shape);
     output_builder.push_f64(mat.determinant());
 
@@ -119,6 +132,14 @@ fn matrix_inv(
         ));
     }
 
+    if let Some(small) = resource.small {
+        let mut inv = [0.0; MAX_SMALL_SHAPE * MAX_SMALL_SHAPE];
+        let inv = &mut inv[..resource.shape * resource.shape];
+        (small.inv)(input.as_f64_slice(), inv);
+        output_builder.copy_from_f64(inv);
+        return Ok(());
+    }
+
     let mat = faer::mat::from_row_major_slice(input.as_f64_slice(), resource.shape, resource.shape);
     let inv = mat.col_piv_qr().inverse();
 
@@ -147,6 +168,15 @@ fn matrix_solve(
     }
 
     let input_slice = input.as_f64_slice();
+    if let Some(small) = resource.small {
+        let mut solved = [0.0; MAX_SMALL_SHAPE];
+        let solved = &mut solved[..resource.shape];
+        let (mat, vec) = input_slice.split_at(resource.shape * resource.shape);
+        (small.solve)(mat, vec, solved);
+        output_builder.copy_from_f64(solved);
+        return Ok(());
+    }
+
     let mat = faer::mat::from_row_major_slice(
         &input_slice[..resource.shape * resource.shape],
         resource.shape,
@@ -182,6 +212,16 @@ fn matrix_cholesky(
         ));
     }
 
+    if let Some(small) = resource.small {
+        let mut cholesky = [0.0; MAX_SMALL_SHAPE * MAX_SMALL_SHAPE];
+        let cholesky = &mut cholesky[..resource.shape * resource.shape];
+        if !(small.cholesky)(input.as_f64_slice(), cholesky) {
+            return Err("matrix is not cholesky decomposable".to_owned());
+        }
+        output_builder.copy_from_f64(cholesky);
+        return Ok(());
+    }
+
     let mat = faer::mat::from_row_major_slice(input.as_f64_slice(), resource.shape, resource.shape);
     let Ok(cholesky) = mat.cholesky(faer::Side::Lower) else {
         return Err("matrix is not cholesky decomposable".to_owned());
@@ -195,3 +235,178 @@ fn matrix_cholesky(
 
     Ok(())
 }
+
+/// The biggest shape with kernels of its own. These are the sizes of the matrices in most
+/// per-request computations (e.g., covariances of a few variables), for which the setup
+/// of the general routines of `faer` (and their scratch allocations) costs more than the
+/// computation itself.
+const MAX_SMALL_SHAPE: usize = 6;
+
+/// Kernels for a fixed shape, working on row-major matrices on the stack, without
+/// allocating. The shape being known at compile time, the loops are fully unrolled.
+#[derive(Debug)]
+struct SmallKernels {
+    det: fn(&[f64]) -> f64,
+    inv: fn(&[f64], &mut [f64]),
+    solve: fn(&[f64], &[f64], &mut [f64]),
+    /// Returns whether the matrix was decomposable.
+    cholesky: fn(&[f64], &mut [f64]) -> bool,
+}
+
+impl SmallKernels {
+    const fn of<const N: usize>() -> SmallKernels {
+        SmallKernels {
+            det: small_det::<N>,
+            inv: small_inv::<N>,
+            solve: small_solve::<N>,
+            cholesky: small_cholesky::<N>,
+        }
+    }
+}
+
+/// The kernels of each shape, from `1` to [`MAX_SMALL_SHAPE`].
+static SMALL_KERNELS: [SmallKernels; MAX_SMALL_SHAPE] = [
+    SmallKernels::of::<1>(),
+    SmallKernels::of::<2>(),
+    SmallKernels::of::<3>(),
+    SmallKernels::of::<4>(),
+    SmallKernels::of::<5>(),
+    SmallKernels::of::<6>(),
+];
+
+fn to_array<const N: usize>(slice: &[f64]) -> [[f64; N]; N] {
+    let mut mat = [[0.0; N]; N];
+    for (row, chunk) in mat.iter_mut().zip(slice.chunks_exact(N)) {
+        row.copy_from_slice(chunk);
+    }
+    mat
+}
+
+/// The row, from `k` on, with the biggest value in column `k`.
+fn pivot_row<const N: usize>(mat: &[[f64; N]; N], k: usize) -> usize {
+    let mut best = k;
+    for i in k + 1..N {
+        if mat[i][k].abs() > mat[best][k].abs() {
+            best = i;
+        }
+    }
+    best
+}
+
+/// Gaussian elimination with partial pivoting.
+fn small_det<const N: usize>(a: &[f64]) -> f64 {
+    let mut mat = to_array::<N>(a);
+    let mut det = 1.0;
+    for k in 0..N {
+        let best = pivot_row(&mat, k);
+        if best != k {
+            mat.swap(k, best);
+            det = -det;
+        }
+        det *= mat[k][k];
+        if mat[k][k] == 0.0 {
+            return det;
+        }
+        for i in k + 1..N {
+            let factor = mat[i][k] / mat[k][k];
+            for j in k + 1..N {
+                mat[i][j] -= factor * mat[k][j];
+            }
+        }
+    }
+    det
+}
+
+/// Gauss-Jordan elimination with partial pivoting. Like `faer`, singular matrices yield
+/// non-finite values instead of an error.
+fn small_inv<const N: usize>(a: &[f64], out: &mut [f64]) {
+    let mut mat = to_array::<N>(a);
+    let mut inv = [[0.0; N]; N];
+    for (i, row) in inv.iter_mut().enumerate() {
+        row[i] = 1.0;
+    }
+
+    for k in 0..N {
+        let best = pivot_row(&mat, k);
+        mat.swap(k, best);
+        inv.swap(k, best);
+
+        let scale = 1.0 / mat[k][k];
+        for j in 0..N {
+            mat[k][j] *= scale;
+            inv[k][j] *= scale;
+        }
+        for i in 0..N {
+            if i != k {
+                let factor = mat[i][k];
+                for j in 0..N {
+                    mat[i][j] -= factor * mat[k][j];
+                    inv[i][j] -= factor * inv[k][j];
+                }
+            }
+        }
+    }
+
+    for (chunk, row) in out.chunks_exact_mut(N).zip(&inv) {
+        chunk.copy_from_slice(row);
+    }
+}
+
+/// Gaussian elimination with partial pivoting, followed by back substitution.
+fn small_solve<const N: usize>(a: &[f64], v: &[f64], out: &mut [f64]) {
+    let mut mat = to_array::<N>(a);
+    let mut vec = [0.0; N];
+    vec.copy_from_slice(v);
+
+    for k in 0..N {
+        let best = pivot_row(&mat, k);
+        mat.swap(k, best);
+        vec.swap(k, best);
+
+        for i in k + 1..N {
+            let factor = mat[i][k] / mat[k][k];
+            for j in k + 1..N {
+                mat[i][j] -= factor * mat[k][j];
+            }
+            vec[i] -= factor * vec[k];
+        }
+    }
+
+    for k in (0..N).rev() {
+        let mut value = vec[k];
+        for j in k + 1..N {
+            value -= mat[k][j] * out[j];
+        }
+        out[k] = value / mat[k][k];
+    }
+}
+
+/// The Cholesky–Banachiewicz algorithm, reading only the lower half of the matrix. The
+/// upper half of the output is zero.
+fn small_cholesky<const N: usize>(a: &[f64], out: &mut [f64]) -> bool {
+    let mat = to_array::<N>(a);
+    let mut l = [[0.0; N]; N];
+
+    for i in 0..N {
+        for j in 0..=i {
+            let mut value = mat[i][j];
+            for k in 0..j {
+                value -= l[i][k] * l[j][k];
+            }
+            if i == j {
+                // Also fails on NaNs.
+                if !(value > 0.0) {
+                    return false;
+                }
+                l[i][i] = value.sqrt();
+            } else {
+                l[i][j] = value / l[j][j];
+            }
+        }
+    }
+
+    for (chunk, row) in out.chunks_exact_mut(N).zip(&l) {
+        chunk.copy_from_slice(row);
+    }
+    true
+}
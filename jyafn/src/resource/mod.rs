@@ -4,6 +4,7 @@
 pub mod dummy;
 pub mod external;
 pub mod linalg;
+pub mod tree_ensemble;
 
 use byte_slice_cast::*;
 use get_size::GetSize;
@@ -16,6 +17,7 @@ use std::sync::Arc;
 use zip::read::ZipFile;
 
 use crate::layout::{Layout, Struct};
+use crate::utils::mmap::{MappedFile, MappedSlice};
 use crate::Error;
 
 /// The signature of the function that will be invoked from inside the function code.
@@ -27,11 +29,30 @@ pub struct RawResourceMethod(
 
 impl GetSize for RawResourceMethod {}
 
+/// The signature of the batched version of a method, which computes many rows at once:
+/// `(resource, input, input_slots, output, output_slots, n_rows)`. Rows are contiguous
+/// in `input` and in `output`, with `input_slots` and `output_slots` slots each. This
+/// returns `0` on success. On failure, it returns anything else and the rows are then
+/// computed again, one by one, using the single-row method, which gives each row its
+/// own error. Therefore, batched methods need not say what went wrong. Rows that already
+/// failed before the call are also passed, but their inputs are unspecified and their
+/// outputs are ignored.
+#[repr(transparent)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub struct RawResourceBatchMethod(
+    pub unsafe extern "C" fn(*const (), *const u8, u64, *mut u8, u64, u64) -> u64,
+);
+
+impl GetSize for RawResourceBatchMethod {}
+
 /// A method from a resource.
 #[derive(Debug, Clone, PartialEq, GetSize)]
 pub struct ResourceMethod {
     /// The bare function that will be invoked from inside the function code.
     pub(crate) fn_ptr: RawResourceMethod,
+    /// The batched version of `fn_ptr`, if the resource has one. Batched function code
+    /// uses it to make a single call for many rows at once.
+    pub(crate) batch_fn_ptr: Option<RawResourceBatchMethod>,
     /// The input layout for the method.
     pub(crate) input_layout: Struct,
     /// The output layout for the method.
@@ -46,15 +67,35 @@ pub trait ResourceType: std::fmt::Debug + Send + Sync + UnwindSafe + RefUnwindSa
     #[allow(clippy::wrong_self_convention)]
     fn from_bytes(&self, bytes: &[u8]) -> Result<Pin<Box<dyn Resource>>, Error>;
 
-    /// Reads a resource from a zip file entry.
+    /// Reads a resource from an entry of a graph file.
     ///
     /// Override this method if you know a more efficient of loading the resource other
     /// than reading the file to a buffer and then parsing the resulting buffer.
-    fn read(&self, mut f: ZipFile<'_>) -> Result<Pin<Box<dyn Resource>>, Error> {
+    fn read(&self, f: &mut dyn Read) -> Result<Pin<Box<dyn Resource>>, Error> {
         let mut buffer = Vec::new();
         f.read_to_end(&mut buffer)?;
         self.from_bytes(&buffer)
     }
+
+    /// Whether resources of this type are better loaded straight from memory-mapped
+    /// files, with [`ResourceType::from_mapped`]. If so, they are always stored
+    /// uncompressed when dumping graphs. The default implementation returns `false`.
+    fn is_mappable(&self) -> bool {
+        false
+    }
+
+    /// Creates a resource out of binary data living in a memory-mapped file, when the
+    /// graph is loaded with [`crate::Graph::load_mapped`]. This is only called if
+    /// [`ResourceType::is_mappable`] returns `true`.
+    ///
+    /// The data is not copied anywhere beforehand. Implementations may keep `data` (and
+    /// therefore the file) alive for as long as the resource exists and use it in
+    /// place. The default implementation parses the mapped data with
+    /// [`ResourceType::from_bytes`].
+    #[allow(clippy::wrong_self_convention)]
+    fn from_mapped(&self, data: MappedSlice) -> Result<Pin<Box<dyn Resource>>, Error> {
+        self.from_bytes(&data)
+    }
 }
 
 /// A `Resource` is an amount of data associated with "methods", much like an object in
@@ -121,13 +162,44 @@ impl ResourceContainer {
         }
     }
 
-    /// Reads the resource from a zip file entry.
-    pub(crate) fn read(&self, f: ZipFile<'_>) -> Result<Self, Error> {
-        let resource = self.resource_type.read(f)?;
-        Ok(ResourceContainer {
+    /// Reads the resource from a zip file entry. If the archive is read from a
+    /// memory-mapped file, it is also supplied, so that resources supporting it are
+    /// created straight from the mapped data.
+    pub(crate) fn read(
+        &self,
+        mut f: ZipFile<'_>,
+        mapped: Option<&Arc<MappedFile>>,
+    ) -> Result<Self, Error> {
+        let resource = match mapped.filter(|file| file.is_mapped()) {
+            Some(mapped)
+                if self.is_mappable() && f.compression() == zip::CompressionMethod::Stored =>
+            {
+                let start = f.data_start() as usize;
+                self.resource_type
+                    .from_mapped(mapped.slice(start..start + f.size() as usize)?)?
+            }
+            _ => self.resource_type.read(&mut f)?,
+        };
+        Ok(self.with_resource(resource))
+    }
+
+    /// Reads the resource from an entry read out of a stream (see
+    /// [`crate::Graph::load_stream`]).
+    pub(crate) fn read_stream(&self, f: &mut dyn Read) -> Result<Self, Error> {
+        Ok(self.with_resource(self.resource_type.read(f)?))
+    }
+
+    /// A container like this one, but holding the supplied resource.
+    fn with_resource(&self, resource: Pin<Box<dyn Resource>>) -> Self {
+        ResourceContainer {
             resource_type: self.resource_type.clone(),
             resource: Some(resource),
-        })
+        }
+    }
+
+    /// Whether this resource is better loaded straight from memory-mapped files.
+    pub(crate) fn is_mappable(&self) -> bool {
+        self.resource_type.is_mappable()
     }
 
     /// Dumps this resource as binary information.
@@ -338,3 +410,63 @@ macro_rules! safe_method {
         $crate::resource::RawResourceMethod(safe_interface)
     }};
 }
+
+/// The same as [`safe_method!`], but for the batched version of a method (see
+/// [`RawResourceBatchMethod`]). The safe interface receives the input and the output of
+/// all rows at once, together with the number of rows.
+///
+/// # Usage
+///
+/// ```
+/// impl MyResource {
+///     fn something_safe_batch(
+///         &self,
+///         input: Input,   // `n_rows` rows, one after the other.
+///         output: OutputBuilder,
+///         n_rows: usize,
+///     ) -> Result<(), String> {
+///         // ...
+///         todo!()
+///     }
+///
+///     safe_batch_method!(something_safe_batch)
+/// }
+///
+/// ```
+#[macro_export]
+macro_rules! safe_batch_method {
+    ($safe_interface:ident) => {{
+        pub unsafe extern "C" fn safe_interface(
+            resource_ptr: *const (),
+            input_ptr: *const u8,
+            input_slots: u64,
+            output_ptr: *mut u8,
+            output_slots: u64,
+            n_rows: u64,
+        ) -> u64 {
+            match std::panic::catch_unwind(|| {
+                unsafe {
+                    // Safety: see `safe_method`.
+                    let resource = &*(resource_ptr as *const _);
+                    let n_rows = n_rows as usize;
+
+                    $safe_interface(
+                        resource,
+                        $crate::resource::Input::new(input_ptr, n_rows * input_slots as usize),
+                        $crate::resource::OutputBuilder::new(
+                            output_ptr,
+                            n_rows * output_slots as usize,
+                        ),
+                        n_rows,
+                    )
+                }
+            }) {
+                Ok(Ok(())) => 0,
+                // The rows are run again one by one, which reports the error.
+                Ok(Err(_)) | Err(_) => 1,
+            }
+        }
+
+        $crate::resource::RawResourceBatchMethod(safe_interface)
+    }};
+}
@@ -0,0 +1,766 @@
+//! A native evaluator of tree ensembles for jyafn, reading models in the text format
+//! of LightGBM (what `Booster::save_string` or the `dump` of the `Lightgbm` resource
+//! from the `lightgbm` extension gives).
+//!
+//! The trees are flattened into a single array of nodes, which is walked by plain Rust
+//! code, a few trees at a time, in lockstep: each step advances all trees of the group
+//! by one level, so that the loads of the nodes of different trees overlap instead of
+//! waiting on each other. There is no call into the LightGBM library, no lock and no
+//! allocation per prediction. The methods are the same as those of the `Lightgbm`
+//! resource:
+//! ```
+//! // Predicts the probability of each class, given a list of feature values.
+//! predict(x: [scalar; n_features]) -> [scalar; n_classes];
+//! // The number of features in this model.
+//! num_features() -> scalar;
+//! // The number of classes in this model.
+//! num_classes() -> scalar;
+//! ```
+//!
+//! Linear trees are not supported.
+
+use serde_derive::{Deserialize, Serialize};
+use std::collections::HashMap;
+use std::sync::Arc;
+
+use crate::{layout, r#struct, safe_batch_method, safe_method};
+
+use super::{Input, OutputBuilder, Resource, ResourceMethod, ResourceType};
+
+#[derive(Debug, Serialize, Deserialize)]
+struct TreeEnsemble;
+
+#[typetag::serde]
+impl ResourceType for TreeEnsemble {
+    fn from_bytes(&self, bytes: &[u8]) -> Result<std::pin::Pin<Box<dyn Resource>>, crate::Error> {
+        Ok(Box::pin(TreeEnsembleResource::parse(
+            String::from_utf8_lossy(bytes).into_owned(),
+        )?))
+    }
+}
+
+/// Set in the decision type of splits on categorical features.
+const CATEGORICAL_MASK: u8 = 1;
+/// Set in the decision type of splits sending missing values to the left.
+const DEFAULT_LEFT_MASK: u8 = 2;
+/// Values of numerical features that are seen as zero.
+const ZERO_THRESHOLD: f64 = 1e-35;
+
+/// What counts as a missing value in a numerical split. Missing values go to the default
+/// side of the split.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Missing {
+    None,
+    Zero,
+    NaN,
+}
+
+impl Missing {
+    fn of(decision_type: u8) -> Result<Missing, String> {
+        match (decision_type >> 2) & 3 {
+            0 => Ok(Missing::None),
+            1 => Ok(Missing::Zero),
+            2 => Ok(Missing::NaN),
+            other => Err(format!("unknown missing type {other} in decision type")),
+        }
+    }
+}
+
+/// An internal node of a tree. Children are either other nodes (non-negative indices
+/// into the array of nodes) or leaves (`!index` into the array of leaf values).
+#[derive(Debug, Clone, Copy)]
+struct Node {
+    /// The threshold of numerical splits or, for categorical splits, the index of the
+    /// set of categories going left, as in the model file.
+    threshold: f64,
+    /// The left and the right children.
+    children: [i32; 2],
+    feature: u32,
+    default_left: bool,
+    missing: Missing,
+    is_categorical: bool,
+}
+
+/// The transformation turning the raw scores of the trees into the prediction.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Transform {
+    Identity,
+    /// Of each class.
+    Sigmoid(f64),
+    Softmax,
+    Exp,
+    /// For regression on the square root of the label.
+    SignedSquare,
+}
+
+impl Transform {
+    fn parse(objective: &str) -> Result<Transform, String> {
+        let mut parts = objective.split_whitespace();
+        let name = parts.next().unwrap_or("");
+        let params = parts
+            .filter_map(|part| part.split_once(':'))
+            .collect::<HashMap<_, _>>();
+        let sigmoid = || {
+            params.get("sigmoid").map_or(Ok(1.0), |sigmoid| {
+                sigmoid
+                    .parse::<f64>()
+                    .map_err(|err| format!("bad sigmoid {sigmoid:?} in objective: {err}"))
+            })
+        };
+
+        Ok(match name {
+            "" | "custom" | "none" | "null" | "lambdarank" | "rank_xendcg" => Transform::Identity,
+            "regression" | "regression_l1" | "huber" | "fair" | "quantile" | "mape" => {
+                if objective.split_whitespace().any(|part| part == "sqrt") {
+                    Transform::SignedSquare
+                } else {
+                    Transform::Identity
+                }
+            }
+            "binary" | "multiclassova" => Transform::Sigmoid(sigmoid()?),
+            "cross_entropy" => Transform::Sigmoid(1.0),
+            "multiclass" => Transform::Softmax,
+            "poisson" | "gamma" | "tweedie" => Transform::Exp,
+            _ => return Err(format!("unsupported objective {objective:?}")),
+        })
+    }
+
+    fn apply(self, scores: &mut [f64]) {
+        match self {
+            Transform::Identity => {}
+            Transform::Sigmoid(sigmoid) => {
+                for score in scores {
+                    *score = 1.0 / (1.0 + (-sigmoid * *score).exp());
+                }
+            }
+            Transform::Softmax => {
+                let max = scores.iter().copied().fold(f64::NEG_INFINITY, f64::max);
+                let mut sum = 0.0;
+                for score in scores.iter_mut() {
+                    *score = (*score - max).exp();
+                    sum += *score;
+                }
+                for score in scores {
+                    *score /= sum;
+                }
+            }
+            Transform::Exp => {
+                for score in scores {
+                    *score = score.exp();
+                }
+            }
+            Transform::SignedSquare => {
+                for score in scores {
+                    *score = score.signum() * *score * *score;
+                }
+            }
+        }
+    }
+}
+
+/// The number of trees walked together, in lockstep.
+const LANES: usize = 8;
+
+#[derive(Debug)]
+struct TreeEnsembleResource {
+    /// The model, as it was read.
+    model: String,
+    n_features: usize,
+    n_classes: usize,
+    /// The internal nodes of all trees.
+    nodes: Vec<Node>,
+    /// The leaf values of all trees.
+    leaves: Vec<f64>,
+    /// The root of each tree: a node or, for trees with a single leaf, a leaf (see
+    /// [`Node::children`]). Trees of the same iteration are one after the other, one for
+    /// each class.
+    roots: Vec<i32>,
+    /// The sets of categories going left in categorical splits, as ranges of `bitsets`.
+    category_sets: Vec<(usize, usize)>,
+    bitsets: Vec<u32>,
+    /// Whether the prediction is the average of the iterations instead of their sum (for
+    /// random forests).
+    average_output: bool,
+    transform: Transform,
+}
+
+/// Parses a space-separated list of values of a tree, which must have `len` values.
+fn parse_list<T: std::str::FromStr>(
+    fields: &HashMap<&str, &str>,
+    key: &str,
+    len: usize,
+) -> Result<Vec<T>, String>
+where
+    T::Err: std::fmt::Display,
+{
+    let values = fields
+        .get(key)
+        .map_or(Ok(vec![]), |values| {
+            values
+                .split_whitespace()
+                .map(|value| value.parse::<T>())
+                .collect::<Result<Vec<_>, _>>()
+        })
+        .map_err(|err| format!("bad value in {key}: {err}"))?;
+    if values.len() != len {
+        return Err(format!(
+            "expected {len} values in {key}, but got {}",
+            values.len()
+        ));
+    }
+    Ok(values)
+}
+
+/// Parses a single value in a header or in a tree.
+fn parse_value<T: std::str::FromStr>(fields: &HashMap<&str, &str>, key: &str) -> Result<T, String>
+where
+    T::Err: std::fmt::Display,
+{
+    let value = fields.get(key).ok_or_else(|| format!("missing {key}"))?;
+    value
+        .trim()
+        .parse::<T>()
+        .map_err(|err| format!("bad value {value:?} for {key}: {err}"))
+}
+
+impl TreeEnsembleResource {
+    fn parse(model: String) -> Result<TreeEnsembleResource, String> {
+        // The header and then each tree, up to the end of the trees.
+        let mut sections = vec![HashMap::new()];
+        let mut flags = vec![];
+        for line in model.lines() {
+            let line = line.trim();
+            if line == "end of trees" {
+                break;
+            } else if line.starts_with("Tree=") {
+                sections.push(HashMap::new());
+            } else if let Some((key, value)) = line.split_once('=') {
+                sections.last_mut().expect("never empty").insert(key, value);
+            } else if sections.len() == 1 && !line.is_empty() {
+                flags.push(line);
+            }
+        }
+        let header = &sections[0];
+        let trees = &sections[1..];
+
+        let n_features = parse_value::<usize>(header, "max_feature_idx")? + 1;
+        let n_classes = parse_value::<usize>(header, "num_class")?;
+        let trees_per_iteration = parse_value::<usize>(header, "num_tree_per_iteration")?;
+        if n_classes == 0 || trees_per_iteration != n_classes {
+            return Err(format!(
+                "expected one tree per class in each iteration, but got {trees_per_iteration} \
+                 trees for {n_classes} classes"
+            ));
+        }
+        if trees.len() % trees_per_iteration != 0 {
+            return Err(format!(
+                "expected whole iterations of {trees_per_iteration} trees, but got {} trees",
+                trees.len()
+            ));
+        }
+
+        let mut ensemble = TreeEnsembleResource {
+            n_features,
+            n_classes,
+            nodes: vec![],
+            leaves: vec![],
+            roots: vec![],
+            category_sets: vec![],
+            bitsets: vec![],
+            average_output: flags.contains(&"average_output"),
+            transform: Transform::parse(header.get("objective").copied().unwrap_or(""))?,
+            model: String::new(),
+        };
+        for (tree_id, tree) in trees.iter().enumerate() {
+            ensemble
+                .push_tree(tree)
+                .map_err(|err| format!("in tree {tree_id}: {err}"))?;
+        }
+        ensemble.model = model;
+
+        Ok(ensemble)
+    }
+
+    fn push_tree(&mut self, tree: &HashMap<&str, &str>) -> Result<(), String> {
+        if tree
+            .get("is_linear")
+            .map_or(false, |is_linear| is_linear.trim() != "0")
+        {
+            return Err("linear trees are not supported".to_string());
+        }
+
+        let n_leaves = parse_value::<usize>(tree, "num_leaves")?;
+        if n_leaves == 0 {
+            return Err("tree has no leaves".to_string());
+        }
+        let leaf_offset = self.leaves.len() as i32;
+        self.leaves
+            .extend(parse_list::<f64>(tree, "leaf_value", n_leaves)?);
+        if n_leaves == 1 {
+            self.roots.push(!leaf_offset);
+            return Ok(());
+        }
+
+        let n_nodes = n_leaves - 1;
+        let node_offset = self.nodes.len() as i32;
+        let split_feature = parse_list::<u32>(tree, "split_feature", n_nodes)?;
+        let threshold = parse_list::<f64>(tree, "threshold", n_nodes)?;
+        let decision_type = parse_list::<u8>(tree, "decision_type", n_nodes)?;
+        let left_child = parse_list::<i32>(tree, "left_child", n_nodes)?;
+        let right_child = parse_list::<i32>(tree, "right_child", n_nodes)?;
+
+        let n_categorical = tree
+            .get("num_cat")
+            .map_or(Ok(0), |_| parse_value::<usize>(tree, "num_cat"))?;
+        let set_offset = self.category_sets.len();
+        if n_categorical > 0 {
+            let boundaries = parse_list::<usize>(tree, "cat_boundaries", n_categorical + 1)?;
+            let n_words = *boundaries.last().expect("never empty");
+            let words = parse_list::<u32>(tree, "cat_threshold", n_words)?;
+            let word_offset = self.bitsets.len();
+            for bounds in boundaries.windows(2) {
+                if bounds[0] > bounds[1] {
+                    return Err("cat_boundaries is not sorted".to_string());
+                }
+                self.category_sets
+                    .push((word_offset + bounds[0], bounds[1] - bounds[0]));
+            }
+            self.bitsets.extend(words);
+        }
+
+        // Checks a child of a node and makes it point into the whole ensemble. As in
+        // LightGBM, nodes only point to nodes after them, so walking a tree always ends
+        // at a leaf.
+        let child = |node: usize, child: i32| {
+            if child >= 0 && (child as usize) < n_nodes {
+                if child as usize <= node {
+                    return Err(format!(
+                        "child {child} of node {node} does not come after it"
+                    ));
+                }
+                Ok(node_offset + child)
+            } else if child < 0 && (!child as usize) < n_leaves {
+                Ok(!(leaf_offset + !child))
+            } else {
+                Err(format!("child {child} out of bounds"))
+            }
+        };
+
+        for node in 0..n_nodes {
+            let is_categorical = decision_type[node] & CATEGORICAL_MASK != 0;
+            if split_feature[node] as usize >= self.n_features {
+                return Err(format!(
+                    "split feature {} out of bounds",
+                    split_feature[node]
+                ));
+            }
+            let threshold = if is_categorical {
+                let set = threshold[node] as usize;
+                if set >= n_categorical {
+                    return Err(format!("category set {set} out of bounds"));
+                }
+                (set_offset + set) as f64
+            } else {
+                threshold[node]
+            };
+
+            self.nodes.push(Node {
+                threshold,
+                children: [
+                    child(node, left_child[node])?,
+                    child(node, right_child[node])?,
+                ],
+                feature: split_feature[node],
+                default_left: decision_type[node] & DEFAULT_LEFT_MASK != 0,
+                missing: Missing::of(decision_type[node])?,
+                is_categorical,
+            });
+        }
+        self.roots.push(node_offset);
+
+        Ok(())
+    }
+
+    /// Whether the value goes to the left child of the node. This follows what LightGBM
+    /// does.
+    #[inline(always)]
+    fn goes_left(&self, node: &Node, value: f64) -> bool {
+        if node.is_categorical {
+            // Missing and negative values are never in the set. Values are truncated to
+            // a category first, so that values in `(-1, 0)` are in category 0.
+            let category = value as i64;
+            if value.is_nan() || category < 0 {
+                return false;
+            }
+            let category = category as usize;
+            let (start, len) = self.category_sets[node.threshold as usize];
+            let word = category / 32;
+            word < len && (self.bitsets[start + word] >> (category % 32)) & 1 == 1
+        } else {
+            let value = if value.is_nan() && node.missing != Missing::NaN {
+                0.0
+            } else {
+                value
+            };
+            match node.missing {
+                Missing::Zero if value.abs() <= ZERO_THRESHOLD => node.default_left,
+                Missing::NaN if value.is_nan() => node.default_left,
+                _ => value <= node.threshold,
+            }
+        }
+    }
+
+    /// Adds up the leaves each tree reaches for the given features into the scores of
+    /// the classes.
+    fn add_leaves(&self, features: &[f64], scores: &mut [f64]) {
+        for (group, roots) in self.roots.chunks(LANES).enumerate() {
+            let mut cursors = [-1; LANES];
+            cursors[..roots.len()].copy_from_slice(roots);
+
+            // All trees of the group go down one level per step, until all are at a
+            // leaf.
+            let mut walking = true;
+            while walking {
+                walking = false;
+                for cursor in &mut cursors[..roots.len()] {
+                    if *cursor >= 0 {
+                        let node = &self.nodes[*cursor as usize];
+                        let value = features[node.feature as usize];
+                        *cursor = node.children[!self.goes_left(node, value) as usize];
+                        walking = true;
+                    }
+                }
+            }
+
+            for (lane, &cursor) in cursors[..roots.len()].iter().enumerate() {
+                scores[(group * LANES + lane) % self.n_classes] += self.leaves[!cursor as usize];
+            }
+        }
+    }
+
+    /// Predicts the output of each class for a single row of features.
+    fn predict_into(&self, features: &[f64], scores: &mut [f64]) {
+        scores.fill(0.0);
+        self.add_leaves(features, scores);
+        if self.average_output && !self.roots.is_empty() {
+            let n_iterations = (self.roots.len() / self.n_classes) as f64;
+            for score in scores.iter_mut() {
+                *score /= n_iterations;
+            }
+        }
+        self.transform.apply(scores);
+    }
+}
+
+impl Resource for TreeEnsembleResource {
+    fn r#type(&self) -> Arc<dyn ResourceType> {
+        Arc::new(TreeEnsemble)
+    }
+
+    fn dump(&self) -> Result<Vec<u8>, crate::Error> {
+        Ok(self.model.clone().into_bytes())
+    }
+
+    fn size(&self) -> usize {
+        self.model.capacity()
+            + self.nodes.capacity() * std::mem::size_of::<Node>()
+            + self.leaves.capacity() * std::mem::size_of::<f64>()
+            + self.roots.capacity() * std::mem::size_of::<i32>()
+            + self.category_sets.capacity() * std::mem::size_of::<(usize, usize)>()
+            + self.bitsets.capacity() * std::mem::size_of::<u32>()
+    }
+
+    fn get_method(&self, method: &str) -> Option<ResourceMethod> {
+        Some(match method {
+            "predict" => ResourceMethod {
+                input_layout: r#struct!(x: [scalar; self.n_features]),
+                output_layout: layout!([scalar; self.n_classes]),
+                fn_ptr: safe_method!(tree_ensemble_predict),
+                batch_fn_ptr: Some(safe_batch_method!(tree_ensemble_predict_batch)),
+            },
+            "num_features" => ResourceMethod {
+                input_layout: r#struct!(),
+                output_layout: layout!(scalar),
+                fn_ptr: safe_method!(tree_ensemble_num_features),
+                batch_fn_ptr: None,
+            },
+            "num_classes" => ResourceMethod {
+                input_layout: r#struct!(),
+                output_layout: layout!(scalar),
+                fn_ptr: safe_method!(tree_ensemble_num_classes),
+                batch_fn_ptr: None,
+            },
+            _ => return None,
+        })
+    }
+}
+
+/// The most classes predicted without allocating.
+const MAX_STACK_CLASSES: usize = 16;
+
+fn tree_ensemble_predict(
+    resource: &TreeEnsembleResource,
+    input: Input,
+    output_builder: OutputBuilder,
+) -> Result<(), String> {
+    tree_ensemble_predict_batch(resource, input, output_builder, 1)
+}
+
+fn tree_ensemble_predict_batch(
+    resource: &TreeEnsembleResource,
+    input: Input,
+    mut output_builder: OutputBuilder,
+    n_rows: usize,
+) -> Result<(), String> {
+    if resource.n_features * n_rows != input.len() {
+        return Err(format!(
+            "expected input length of {} features per row, but got {} for {n_rows} rows",
+            resource.n_features,
+            input.len(),
+        ));
+    }
+
+    let mut on_stack = [0.0; MAX_STACK_CLASSES];
+    let mut on_heap = vec![];
+    let scores = if resource.n_classes <= MAX_STACK_CLASSES {
+        &mut on_stack[..resource.n_classes]
+    } else {
+        on_heap.resize(resource.n_classes, 0.0);
+        &mut on_heap[..]
+    };
+
+    for features in input.as_f64_slice().chunks_exact(resource.n_features) {
+        resource.predict_into(features, scores);
+        output_builder.copy_from_f64(scores);
+    }
+
+    Ok(())
+}
+
+fn tree_ensemble_num_features(
+    resource: &TreeEnsembleResource,
+    _: Input,
+    mut output_builder: OutputBuilder,
+) -> Result<(), String> {
+    output_builder.push_f64(resource.n_features as f64);
+    Ok(())
+}
+
+fn tree_ensemble_num_classes(
+    resource: &TreeEnsembleResource,
+    _: Input,
+    mut output_builder: OutputBuilder,
+) -> Result<(), String> {
+    output_builder.push_f64(resource.n_classes as f64);
+    Ok(())
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    /// A binary model with a numerical split (missing values going left), a categorical
+    /// split (categories 0 and 2 going left) and a tree with a single leaf.
+    const MODEL: &str = "tree
+version=v4
+num_class=1
+num_tree_per_iteration=1
+label_index=0
+max_feature_idx=2
+objective=binary sigmoid:1
+feature_names=a b c
+feature_infos=[0:10] [0:10] 0:1:2
+tree_sizes=400 300
+
+Tree=0
+num_leaves=3
+num_cat=1
+split_feature=0 2
+split_gain=1 1
+threshold=5.5 0
+decision_type=10 1
+left_child=1 -1
+right_child=-3 -2
+leaf_value=0.5 -0.25 1
+leaf_weight=1 1 1
+leaf_count=1 1 1
+internal_value=0 0
+internal_weight=0 0
+internal_count=2 2
+cat_boundaries=0 1
+cat_threshold=5
+is_linear=0
+shrinkage=1
+
+
+Tree=1
+num_leaves=1
+num_cat=0
+split_feature=
+split_gain=
+threshold=
+decision_type=
+left_child=
+right_child=
+leaf_value=0.125
+leaf_weight=
+leaf_count=
+internal_value=
+internal_weight=
+internal_count=
+is_linear=0
+shrinkage=1
+
+
+end of trees
+
+feature_importances:
+a=1
+c=1
+
+parameters:
+[boosting: gbdt]
+end of parameters
+
+pandas_categorical:null
+";
+
+    fn predict(ensemble: &TreeEnsembleResource, features: [f64; 3]) -> f64 {
+        let mut scores = [0.0];
+        ensemble.predict_into(&features, &mut scores);
+        scores[0]
+    }
+
+    #[test]
+    fn test_tree_ensemble_predict() {
+        let ensemble = TreeEnsembleResource::parse(MODEL.to_string()).unwrap();
+        assert_eq!(ensemble.n_features, 3);
+        assert_eq!(ensemble.n_classes, 1);
+
+        let sigmoid = |x: f64| 1.0 / (1.0 + (-x).exp());
+        for (features, raw) in [
+            ([1.0, 0.0, 0.0], 0.625),
+            ([1.0, 0.0, 1.0], -0.125),
+            ([7.0, 0.0, 2.0], 1.125),
+            ([f64::NAN, 0.0, 2.0], 0.625),
+            ([1.0, 0.0, f64::NAN], -0.125),
+            ([1.0, 0.0, -1.0], -0.125),
+            ([1.0, 0.0, -0.5], 0.625),
+            ([1.0, 0.0, 64.0], -0.125),
+        ] {
+            assert_eq!(predict(&ensemble, features), sigmoid(raw), "{features:?}");
+        }
+    }
+
+    #[test]
+    fn test_tree_ensemble_dump() {
+        let ensemble = TreeEnsemble.from_bytes(MODEL.as_bytes()).unwrap();
+        assert_eq!(ensemble.dump().unwrap(), MODEL.as_bytes());
+        assert!(ensemble
+            .get_method("predict")
+            .unwrap()
+            .batch_fn_ptr
+            .is_some());
+    }
+
+    #[test]
+    fn test_tree_ensemble_bad_model() {
+        let linear = MODEL.replace("is_linear=0", "is_linear=1");
+        assert!(TreeEnsembleResource::parse(linear).is_err());
+        let out_of_bounds = MODEL.replace("left_child=1 -1", "left_child=2 -1");
+        assert!(TreeEnsembleResource::parse(out_of_bounds).is_err());
+        let self_loop = MODEL.replace("left_child=1 -1", "left_child=0 -1");
+        assert!(TreeEnsembleResource::parse(self_loop).is_err());
+        let back_edge = MODEL.replace("left_child=1 -1", "left_child=1 0");
+        assert!(TreeEnsembleResource::parse(back_edge).is_err());
+    }
+
+    /// A model with two classes and two iterations, with one tree per class each.
+    const MULTICLASS_MODEL: &str = "tree
+version=v4
+num_class=2
+num_tree_per_iteration=2
+label_index=0
+max_feature_idx=1
+objective=multiclass num_class:2
+feature_names=a b
+
+Tree=0
+num_leaves=2
+split_feature=0
+threshold=0.5
+decision_type=0
+left_child=-1
+right_child=-2
+leaf_value=1 -1
+
+Tree=1
+num_leaves=1
+leaf_value=0.5
+
+Tree=2
+num_leaves=1
+leaf_value=0.25
+
+Tree=3
+num_leaves=2
+split_feature=1
+threshold=2
+decision_type=0
+left_child=-1
+right_child=-2
+leaf_value=0 1
+
+end of trees
+";
+
+    /// Predicts many rows at once, with the batch method.
+    fn predict_batch(ensemble: &TreeEnsembleResource, rows: &[f64]) -> Vec<f64> {
+        let n_rows = rows.len() / ensemble.n_features;
+        let mut output = vec![0.0; n_rows * ensemble.n_classes];
+        // Safety: the slices have the sizes given.
+        let (input, output_builder) = unsafe {
+            (
+                Input::new(rows.as_ptr() as *const u8, rows.len()),
+                OutputBuilder::new(output.as_mut_ptr() as *mut u8, output.len()),
+            )
+        };
+        tree_ensemble_predict_batch(ensemble, input, output_builder, n_rows).unwrap();
+        output
+    }
+
+    #[test]
+    fn test_tree_ensemble_multiclass() {
+        let softmax = |raw: [f64; 2]| {
+            let exp = raw.map(f64::exp);
+            exp.map(|exp_class| exp_class / (exp[0] + exp[1]))
+        };
+        let averaged =
+            MULTICLASS_MODEL.replace("feature_names=a b\n", "feature_names=a b\naverage_output\n");
+
+        for (model, n_iterations) in [(MULTICLASS_MODEL.to_string(), 1.0), (averaged, 2.0)] {
+            let ensemble = TreeEnsembleResource::parse(model).unwrap();
+            assert_eq!(ensemble.n_classes, 2);
+            assert_eq!(ensemble.average_output, n_iterations > 1.0);
+
+            let rows = [[0.0, 0.0], [1.0, 3.0], [f64::NAN, 2.0]];
+            let raws = [[1.25, 0.5], [-0.75, 1.5], [1.25, 0.5]];
+            let mut expected = vec![];
+            for (features, raw) in rows.iter().zip(raws) {
+                let mut scores = [0.0; 2];
+                ensemble.predict_into(features, &mut scores);
+                let probabilities = softmax(raw.map(|raw| raw / n_iterations));
+                for (score, probability) in scores.iter().zip(probabilities) {
+                    assert!(
+                        (score - probability).abs() < 1e-12,
+                        "{features:?}: {scores:?}"
+                    );
+                }
+                expected.extend(scores);
+            }
+
+            // The batch method gives the same as each row on its own.
+            assert_eq!(predict_batch(&ensemble, &rows.concat()), expected);
+        }
+    }
+}
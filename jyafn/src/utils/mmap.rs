@@ -0,0 +1,175 @@
+//! Read-only views of whole files in memory.
+//!
+//! On Unix, files are memory-mapped, so that nothing is read until it is accessed and
+//! the pages are shared by every process mapping the same file. Elsewhere, the file is
+//! just read into memory.
+
+use std::ops::{Deref, Range};
+use std::path::Path;
+use std::sync::Arc;
+
+use crate::Error;
+
+/// A whole file, read-only, in memory.
+pub struct MappedFile(Inner);
+
+enum Inner {
+    #[cfg(unix)]
+    Mapped {
+        base: *const u8,
+        len: usize,
+        id: FileId,
+    },
+    Read(Vec<u8>),
+}
+
+/// What tells a file on disk apart from every other file, for as long as it is not
+/// modified.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct FileId {
+    device: u64,
+    inode: u64,
+    modified: (i64, i64),
+}
+
+// Safety: the mapping is read-only and owned by this struct.
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl std::fmt::Debug for MappedFile {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "MappedFile({} bytes)", self.len())
+    }
+}
+
+#[cfg(unix)]
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        if let Inner::Mapped { base, len, .. } = self.0 {
+            unsafe {
+                libc::munmap(base as *mut libc::c_void, len);
+            }
+        }
+    }
+}
+
+impl MappedFile {
+    /// Maps the file at the given path in memory.
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<MappedFile, Error> {
+        let file = std::fs::File::open(path)?;
+
+        #[cfg(unix)]
+        {
+            use std::os::fd::AsRawFd;
+            use std::os::unix::fs::MetadataExt;
+
+            let metadata = file.metadata()?;
+            let len = metadata.len() as usize;
+            // Empty mappings are not allowed.
+            if len == 0 {
+                return Ok(MappedFile(Inner::Read(vec![])));
+            }
+
+            let base = unsafe {
+                libc::mmap(
+                    std::ptr::null_mut(),
+                    len,
+                    libc::PROT_READ,
+                    libc::MAP_SHARED,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            if base == libc::MAP_FAILED {
+                return Err(std::io::Error::last_os_error().into());
+            }
+
+            Ok(MappedFile(Inner::Mapped {
+                base: base as *const u8,
+                len,
+                id: FileId {
+                    device: metadata.dev(),
+                    inode: metadata.ino(),
+                    modified: (metadata.mtime(), metadata.mtime_nsec()),
+                },
+            }))
+        }
+
+        #[cfg(not(unix))]
+        {
+            use std::io::Read;
+
+            let mut file = file;
+            let mut buffer = vec![];
+            file.read_to_end(&mut buffer)?;
+            Ok(MappedFile(Inner::Read(buffer)))
+        }
+    }
+
+    /// Whether the contents are backed by the file itself (and therefore shared with
+    /// other processes) instead of having been copied into memory.
+    pub fn is_mapped(&self) -> bool {
+        match self.0 {
+            #[cfg(unix)]
+            Inner::Mapped { .. } => true,
+            Inner::Read(_) => false,
+        }
+    }
+
+    /// The file that is mapped, if the contents are backed by it (see
+    /// [`MappedFile::is_mapped`]).
+    pub fn id(&self) -> Option<FileId> {
+        match self.0 {
+            #[cfg(unix)]
+            Inner::Mapped { id, .. } => Some(id),
+            Inner::Read(_) => None,
+        }
+    }
+
+    /// A shared view of a range of bytes of this file.
+    pub fn slice(self: &Arc<Self>, range: Range<usize>) -> Result<MappedSlice, Error> {
+        if range.start > range.end || range.end > self.len() {
+            return Err(format!("range {range:?} out of bounds of mapped file").into());
+        }
+
+        Ok(MappedSlice {
+            file: self.clone(),
+            range,
+        })
+    }
+}
+
+impl Deref for MappedFile {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match &self.0 {
+            #[cfg(unix)]
+            Inner::Mapped { base, len, .. } => unsafe { std::slice::from_raw_parts(*base, *len) },
+            Inner::Read(buffer) => buffer,
+        }
+    }
+}
+
+/// A range of bytes of a [`MappedFile`], which is kept alive for as long as this slice
+/// exists.
+#[derive(Debug, Clone)]
+pub struct MappedSlice {
+    file: Arc<MappedFile>,
+    range: Range<usize>,
+}
+
+impl MappedSlice {
+    /// The file this slice is part of.
+    pub fn file(&self) -> &Arc<MappedFile> {
+        &self.file
+    }
+}
+
+impl Deref for MappedSlice {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        &self.file[self.range.clone()]
+    }
+}
@@ -1,4 +1,5 @@
 //! Utilities for this crate.
+pub mod mmap;
 pub(crate) mod murmur;
 
 use std::ffi::CString;
@@ -105,6 +106,30 @@ pub(crate) fn make_safe_c_str(s: String) -> CString {
     }
 }
 
+/// Hints the processor that the memory at `ptr` is going to be read soon, so that it
+/// starts bringing it into the cache while other work is done. This never faults,
+/// whatever the address, and does nothing on architectures this is not implemented for.
+#[inline(always)]
+pub(crate) fn prefetch<T>(ptr: *const T) {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        use std::arch::x86_64::{_mm_prefetch, _MM_HINT_T0};
+        _mm_prefetch::<_MM_HINT_T0>(ptr as *const i8);
+    }
+
+    #[cfg(target_arch = "aarch64")]
+    unsafe {
+        std::arch::asm!(
+            "prfm pldl1keep, [{ptr}]",
+            ptr = in(reg) ptr,
+            options(nostack, readonly, preserves_flags)
+        );
+    }
+
+    #[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+    let _ = ptr;
+}
+
 #[cfg(test)]
 mod test {
     use super::*;
@@ -2,6 +2,11 @@
 //!
 //! From <https://github.com/badboy/murmurhash64-rs/blob/2b05c98d1289f2336a6dc045e54bd500dadcadda/src/lib.rs#L1>
 
+/// The multiplier of the Murmur-64A mixing function.
+pub const M: u64 = 0xc6a4a7935bd1e995;
+/// The shift of the Murmur-64A mixing function.
+pub const R: u8 = 47;
+
 /// Hash the given key and the given seed.
 ///
 /// Returns the resulting 64bit hash.
@@ -16,8 +21,8 @@
 /// let hash = murmur_hash64a(key.as_bytes(), seed);
 /// ```
 pub const fn murmur_hash64a(key: &[u8], seed: u64) -> u64 {
-    let m: u64 = 0xc6a4a7935bd1e995;
-    let r: u8 = 47;
+    let m: u64 = M;
+    let r: u8 = R;
 
     let len = key.len();
     let mut h: u64 = seed ^ ((len as u64).wrapping_mul(m));
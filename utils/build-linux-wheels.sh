@@ -8,7 +8,7 @@ docker run -i                                   \
 <<EOF
     cd vendored/qbe
     make clean
-    make qbe
+    make qbe libqbe.a
     ./qbe --help
     cd ../../jyafn-python
     maturin build --release -i=3.12
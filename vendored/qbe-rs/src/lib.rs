@@ -37,6 +37,17 @@ pub enum Cmp {
     Ne,
 }
 
+/// Element-wise operation of a packed vector instruction
+#[derive(Debug, Clone, Eq, PartialEq, Ord, PartialOrd, Hash, Copy)]
+pub enum VecOp {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Min,
+    Max,
+}
+
 /// QBE instruction
 #[derive(Debug, Clone, Eq, PartialEq, Ord, PartialOrd, Hash)]
 pub enum Instr<'a> {
@@ -59,6 +70,10 @@ pub enum Instr<'a> {
     /// Performs a bitwise OR on values
     Or(Value, Value),
     Xor(Value, Value),
+    /// Shifts the first value left by the second one
+    Shl(Value, Value),
+    /// Shifts the first value right by the second one, filling with zeros
+    Shr(Value, Value),
     /// Copies either a temporary or a literal value
     Copy(Value),
     Cast(Value),
@@ -91,8 +106,40 @@ pub enum Instr<'a> {
     /// ## Minimum supported QBE version
     /// `1.1`
     Blit(Value, Value, u64),
+    /// `(op, destination, lhs, rhs, n)`
+    ///
+    /// Applies `op` element-wise to the `n` doubles at the `lhs` and `rhs`
+    /// addresses, storing the results at the destination address.
+    ///
+    /// n must be a constant value and `rhs` must be 16-byte aligned.
+    ///
+    /// ## Minimum supported QBE version
+    /// The vendored QBE only.
+    Vec(VecOp, Value, Value, Value, u64),
     Ultof(Value),
     Dtoui(Value),
+    /// Takes the square root of a floating point value
+    ///
+    /// ## Minimum supported QBE version
+    /// The vendored QBE only.
+    Sqrt(Value),
+    /// Takes the absolute value of a floating point value
+    ///
+    /// ## Minimum supported QBE version
+    /// The vendored QBE only.
+    Abs(Value),
+    /// Returns the first value if it is less than the second one, or the second one
+    /// otherwise (so, the second one if either is NaN)
+    ///
+    /// ## Minimum supported QBE version
+    /// The vendored QBE only.
+    Min(Value, Value),
+    /// Returns the first value if it is greater than the second one, or the second one
+    /// otherwise (so, the second one if either is NaN)
+    ///
+    /// ## Minimum supported QBE version
+    /// The vendored QBE only.
+    Max(Value, Value),
 }
 
 impl<'a> fmt::Display for Instr<'a> {
@@ -137,6 +184,8 @@ impl<'a> fmt::Display for Instr<'a> {
             Self::And(lhs, rhs) => write!(f, "and {}, {}", lhs, rhs),
             Self::Or(lhs, rhs) => write!(f, "or {}, {}", lhs, rhs),
             Self::Xor(lhs, rhs) => write!(f, "xor {}, {}", lhs, rhs),
+            Self::Shl(lhs, rhs) => write!(f, "shl {}, {}", lhs, rhs),
+            Self::Shr(lhs, rhs) => write!(f, "shr {}, {}", lhs, rhs),
             Self::Copy(val) => write!(f, "copy {}", val),
             Self::Cast(val) => write!(f, "cast {}", val),
             Self::Ret(val) => match val {
@@ -176,8 +225,28 @@ impl<'a> fmt::Display for Instr<'a> {
                 write!(f, "load{} {}", ty, src)
             }
             Self::Blit(src, dst, n) => write!(f, "blit {}, {}, {}", src, dst, n),
+            Self::Vec(op, dst, lhs, rhs, n) => write!(
+                f,
+                "v{}d {}, {}, {}, {}",
+                match op {
+                    VecOp::Add => "add",
+                    VecOp::Sub => "sub",
+                    VecOp::Mul => "mul",
+                    VecOp::Div => "div",
+                    VecOp::Min => "min",
+                    VecOp::Max => "max",
+                },
+                dst,
+                lhs,
+                rhs,
+                n,
+            ),
             Self::Ultof(val) => write!(f, "ultof {val}"),
             Self::Dtoui(val) => write!(f, "dtoui {val}"),
+            Self::Sqrt(val) => write!(f, "sqrt {val}"),
+            Self::Abs(val) => write!(f, "abs {val}"),
+            Self::Min(lhs, rhs) => write!(f, "min {}, {}", lhs, rhs),
+            Self::Max(lhs, rhs) => write!(f, "max {}, {}", lhs, rhs),
         }
     }
 }
@@ -648,6 +717,48 @@ impl<'a> Module<'a> {
         self.data.push(data);
         self.data.last_mut().unwrap()
     }
+
+    /// Returns the size of the module's functions, in statements and blocks
+    pub fn size(&self) -> usize {
+        self.functions.iter().map(function_size).sum()
+    }
+
+    /// Splits the module into at most `n` modules, giving each about the same
+    /// size of functions. Data definitions go to the first module and type
+    /// definitions are copied into all of them. Symbols are global, so the
+    /// modules can be compiled apart and their assembly put back together, as
+    /// long as their local labels are different.
+    pub fn split(self, n: usize) -> Vec<Module<'a>> {
+        let n = n.clamp(1, self.functions.len().max(1));
+        let mut modules = vec![
+            Module {
+                functions: Vec::new(),
+                types: self.types,
+                data: Vec::new(),
+            };
+            n
+        ];
+        modules[0].data = self.data;
+
+        // Biggest functions first, each to the smallest module so far:
+        let mut functions = self.functions;
+        functions.sort_by_key(|func| std::cmp::Reverse(function_size(func)));
+        let mut sizes = vec![0; n];
+        for func in functions {
+            let smallest = (0..n).min_by_key(|&i| sizes[i]).unwrap();
+            sizes[smallest] += function_size(&func);
+            modules[smallest].functions.push(func);
+        }
+
+        modules
+    }
+}
+
+fn function_size(func: &Function) -> usize {
+    func.blocks
+        .iter()
+        .map(|block| block.statements.len() + 1)
+        .sum()
 }
 
 impl<'a> fmt::Display for Module<'a> {
@@ -52,6 +52,31 @@ fn block() {
     assert_eq!(lines.next().unwrap(), "\tret %foo");
 }
 
+#[test]
+fn instr_shifts() {
+    let blk = Block {
+        label: "start".into(),
+        statements: vec![
+            Statement::Assign(
+                Value::Temporary("left".into()),
+                Type::Long,
+                Instr::Shl(Value::Temporary("x".into()), Value::Const(3)),
+            ),
+            Statement::Assign(
+                Value::Temporary("right".into()),
+                Type::Long,
+                Instr::Shr(Value::Temporary("x".into()), Value::Const(47)),
+            ),
+        ],
+    };
+
+    let formatted = format!("{}", blk);
+    let mut lines = formatted.lines();
+    assert_eq!(lines.next().unwrap(), "@start");
+    assert_eq!(lines.next().unwrap(), "\t%left =l shl %x, 3");
+    assert_eq!(lines.next().unwrap(), "\t%right =l shr %x, 47");
+}
+
 #[test]
 fn instr_blit() {
     let blk = Block {
@@ -69,6 +94,62 @@ fn instr_blit() {
     assert_eq!(lines.next().unwrap(), "\tblit %src, %dst, 4");
 }
 
+#[test]
+fn instr_vec() {
+    let blk = Block {
+        label: "start".into(),
+        statements: vec![Statement::Volatile(Instr::Vec(
+            VecOp::Max,
+            Value::Temporary("dst".into()),
+            Value::Temporary("lhs".into()),
+            Value::Temporary("rhs".into()),
+            3,
+        ))],
+    };
+
+    let formatted = format!("{}", blk);
+    let mut lines = formatted.lines();
+    assert_eq!(lines.next().unwrap(), "@start");
+    assert_eq!(lines.next().unwrap(), "\tvmaxd %dst, %lhs, %rhs, 3");
+}
+
+#[test]
+fn instr_fmath() {
+    let blk = Block {
+        label: "start".into(),
+        statements: vec![
+            Statement::Assign(
+                Value::Temporary("root".into()),
+                Type::Double,
+                Instr::Sqrt(Value::Temporary("x".into())),
+            ),
+            Statement::Assign(
+                Value::Temporary("size".into()),
+                Type::Double,
+                Instr::Abs(Value::Temporary("x".into())),
+            ),
+            Statement::Assign(
+                Value::Temporary("low".into()),
+                Type::Double,
+                Instr::Min(Value::Temporary("x".into()), Value::Temporary("y".into())),
+            ),
+            Statement::Assign(
+                Value::Temporary("high".into()),
+                Type::Double,
+                Instr::Max(Value::Temporary("x".into()), Value::Temporary("y".into())),
+            ),
+        ],
+    };
+
+    let formatted = format!("{}", blk);
+    let mut lines = formatted.lines();
+    assert_eq!(lines.next().unwrap(), "@start");
+    assert_eq!(lines.next().unwrap(), "\t%root =d sqrt %x");
+    assert_eq!(lines.next().unwrap(), "\t%size =d abs %x");
+    assert_eq!(lines.next().unwrap(), "\t%low =d min %x, %y");
+    assert_eq!(lines.next().unwrap(), "\t%high =d max %x, %y");
+}
+
 #[test]
 fn function() {
     let func = Function {
@@ -254,3 +335,34 @@ fn add_function_to_module() {
 
     assert_eq!(module.functions.into_iter().next().unwrap(), function);
 }
+
+#[test]
+fn split_module() {
+    let function = |name: &str, n_statements: usize| {
+        let mut func = Function::new(Linkage::private(), name, Vec::new(), None);
+        let block = func.add_block("start");
+        for _ in 0..n_statements {
+            block.add_instr(Instr::Ret(None));
+        }
+        func
+    };
+
+    let mut module = Module::new();
+    module.add_function(function("a", 1));
+    module.add_function(function("b", 5));
+    module.add_function(function("c", 3));
+    module.add_data(DataDef::new(Linkage::private(), "d", None, vec![]));
+    assert_eq!(module.size(), 12);
+
+    let modules = module.split(2);
+    assert_eq!(modules.len(), 2);
+    assert_eq!(modules[0].functions.len(), 1);
+    assert_eq!(modules[0].functions[0].name, "b");
+    assert_eq!(modules[0].data.len(), 1);
+    assert_eq!(modules[1].functions.len(), 2);
+    assert_eq!(modules[1].size(), 6);
+    assert!(modules[1].data.is_empty());
+
+    // Never more modules than functions:
+    assert_eq!(Module::new().split(4).len(), 1);
+}
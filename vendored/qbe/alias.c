@@ -211,6 +211,12 @@ fillalias(Fn *fn)
 				sz = abs(rsval(i->arg[0]));
 				store((i-1)->arg[1], sz, fn);
 			}
+			if (i->op == Ovdst) {
+				/* the address arguments of
+				 * vector operations escape */
+				assert(rtype(i->arg[1]) == RInt);
+				store(i->arg[0], 8 * rsval(i->arg[1]), fn);
+			}
 			if (isstore(i->op))
 				store(i->arg[1], storesz(i), fn);
 		}
@@ -8,6 +8,19 @@
 #define MAKESURE(what, x) typedef char make_sure_##what[(x)?1:-1]
 #define die(...) die_(__FILE__, __VA_ARGS__)
 
+/* When built as a library (see libqbe.a in the
+ * Makefile), all the compilation state is kept
+ * per-thread, so that concurrent calls to
+ * qbe_compile() do not step on each other.
+ */
+#ifdef QBE_LIB
+#include <setjmp.h>
+#include <stdarg.h>
+#define TLS _Thread_local
+#else
+#define TLS
+#endif
+
 typedef unsigned char uchar;
 typedef unsigned int uint;
 typedef unsigned long ulong;
@@ -59,7 +72,7 @@ struct Target {
 	void (*isel)(Fn *);
 	void (*emitfn)(Fn *, FILE *);
 	void (*emitfin)(FILE *);
-	char asloc[4];
+	char asloc[16];
 	char assym[4];
 };
 
@@ -191,6 +204,8 @@ enum {
 #define isstore(o) INRANGE(o, Ostoreb, Ostored)
 #define isload(o) INRANGE(o, Oloadsb, Oload)
 #define isext(o) INRANGE(o, Oextsb, Oextuw)
+#define isvec(o) INRANGE(o, Ovaddd, Ovmaxd)
+#define ispacked(o) INRANGE(o, Opload, Opstore)
 #define ispar(o) INRANGE(o, Opar, Opare)
 #define isarg(o) INRANGE(o, Oarg, Oargv)
 #define isret(j) INRANGE(j, Jretw, Jret0)
@@ -439,8 +454,15 @@ struct Dat {
 };
 
 /* main.c */
-extern Target T;
+extern TLS Target T;
 extern char debug['Z'+1];
+#ifdef QBE_LIB
+void seterr(char *, ...);
+void vseterr(char *, va_list);
+void fail(void) __attribute__((noreturn));
+int qbe_compile(const char *, int, const char *, size_t, char **, size_t *);
+void qbe_free(char *);
+#endif
 
 /* util.c */
 typedef enum {
@@ -448,8 +470,12 @@ typedef enum {
 	PFn, /* discarded after processing the function */
 } Pool;
 
-extern Typ *typ;
+extern TLS Typ *typ;
+#ifdef QBE_LIB
+extern TLS Ins *insb, *curi;
+#else
 extern Ins insb[NIns], *curi;
+#endif
 uint32_t hash(char *);
 void die_(char *, char *, ...) __attribute__((noreturn));
 void *emalloc(size_t);
@@ -461,6 +487,7 @@ void vgrow(void *, ulong);
 void strf(char[NString], char *, ...);
 uint32_t intern(char *);
 char *str(uint32_t);
+void freeintern(void);
 int argcls(Ins *, int);
 int isreg(Ref);
 int iscmp(int, int *, int *);
@@ -566,11 +593,13 @@ void spill(Fn *);
 void rega(Fn *);
 
 /* emit.c */
+extern TLS int id0;
 void emitfnlnk(char *, Lnk *, FILE *);
 void emitdat(Dat *, FILE *);
 void emitdbgfile(char *, FILE *);
 void emitdbgloc(uint, uint, FILE *);
 int stashbits(void *, int);
+void emitreset(void);
 void elf_emitfnfin(char *, FILE *);
 void elf_emitfin(FILE *);
 void macho_emitfin(FILE *);
@@ -74,6 +74,9 @@ static struct {
 	{ Omul,    Ks, "+mulss %1, %=" },
 	{ Omul,    Kd, "+mulsd %1, %=" },
 	{ Odiv,    Ka, "-div%k %1, %=" },
+	{ Osqrt,   Ka, "sqrt%k %0, %=" },
+	{ Omin,    Ka, "-min%k %1, %=" },
+	{ Omax,    Ka, "-max%k %1, %=" },
 	{ Ostorel, Ka, "movq %L0, %M1" },
 	{ Ostorew, Ka, "movl %W0, %M1" },
 	{ Ostoreh, Ka, "movw %H0, %M1" },
@@ -114,6 +117,22 @@ static struct {
 	{ Oxcmp,   Kd, "ucomisd %D0, %D1" },
 	{ Oxcmp,   Ki, "cmp%k %0, %1" },
 	{ Oxtest,  Ki, "test%k %0, %1" },
+	{ Opload,  Ks, "movsd %M0, %%xmm15" },
+	{ Opload,  Kd, "movupd %M0, %%xmm15" },
+	{ Opadd,   Ks, "addsd %M0, %%xmm15" },
+	{ Opadd,   Kd, "addpd %M0, %%xmm15" },
+	{ Opsub,   Ks, "subsd %M0, %%xmm15" },
+	{ Opsub,   Kd, "subpd %M0, %%xmm15" },
+	{ Opmul,   Ks, "mulsd %M0, %%xmm15" },
+	{ Opmul,   Kd, "mulpd %M0, %%xmm15" },
+	{ Opdiv,   Ks, "divsd %M0, %%xmm15" },
+	{ Opdiv,   Kd, "divpd %M0, %%xmm15" },
+	{ Opmin,   Ks, "minsd %M0, %%xmm15" },
+	{ Opmin,   Kd, "minpd %M0, %%xmm15" },
+	{ Opmax,   Ks, "maxsd %M0, %%xmm15" },
+	{ Opmax,   Kd, "maxpd %M0, %%xmm15" },
+	{ Opstore, Ks, "movsd %%xmm15, %M0" },
+	{ Opstore, Kd, "movupd %%xmm15, %M0" },
 #define X(c, s) \
 	{ Oflag+c, Ki, "set" s " %B=\n\tmovzb%k %B=, %=" },
 	CMP(X)
@@ -187,7 +206,7 @@ emitcon(Con *con, FILE *f)
 static char *
 regtoa(int reg, int sz)
 {
-	static char buf[6];
+	static TLS char buf[6];
 
 	assert(reg <= XMM15);
 	if (reg >= XMM0) {
@@ -365,6 +384,11 @@ static void *negmask[4] = {
 	[Kd] = (uint64_t[2]){ 0x8000000000000000 },
 };
 
+static void *absmask[4] = {
+	[Ks] = (uint32_t[4]){ 0x7fffffff },
+	[Kd] = (uint64_t[2]){ 0x7fffffffffffffff },
+};
+
 static void
 emitins(Ins i, Fn *fn, FILE *f)
 {
@@ -438,6 +462,20 @@ emitins(Ins i, Fn *fn, FILE *f)
 				regtoa(i.to.val, SLong)
 			);
 		break;
+	case Oabs:
+		/* clear the sign bit */
+		if (!req(i.to, i.arg[0]))
+			emitf("mov%k %0, %=", &i, fn, f);
+		fprintf(f,
+			"\tandp%c %sfp%d(%%rip), %%%s\n",
+			"xxsd"[i.cls],
+			T.asloc,
+			stashbits(absmask[i.cls], 16),
+			regtoa(i.to.val, SLong)
+		);
+		break;
+	case Omin:
+	case Omax:
 	case Odiv:
 		/* use xmm15 to adjust the instruction when the
 		 * conversion to 2-address in emitf() would fail */
@@ -574,7 +612,6 @@ amd64_emitfn(Fn *fn, FILE *f)
 		CMP(X)
 	#undef X
 	};
-	static int id0;
 	Blk *b, *s;
 	Ins *i, itmp;
 	int *r, c, o, n, lbl;
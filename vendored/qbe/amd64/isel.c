@@ -417,6 +417,10 @@ sel(Ins i, ANum *an, Fn *fn)
 	case Osub:
 	case Oneg:
 	case Omul:
+	case Osqrt:
+	case Oabs:
+	case Omin:
+	case Omax:
 	case Oand:
 	case Oor:
 	case Oxor:
@@ -443,7 +447,7 @@ Emit:
 	default:
 		if (isext(i.op))
 			goto case_OExt;
-		if (isload(i.op))
+		if (isload(i.op) || ispacked(i.op))
 			goto case_Oload;
 		if (iscmp(i.op, &kc, &x)) {
 			switch (x) {
@@ -12,10 +12,10 @@ enum Arm64Reg {
 	V16, V17, V18, V19, V20, V21, V22, V23,
 	V24, V25, V26, V27, V28, V29, V30, /* V31, */
 
-	NFPR = V30 - V0 + 1,
+	NFPR = V29 - V0 + 1, /* reserve V30 and V31 */
 	NGPR = SP - R0 + 1,
 	NGPS = R18 - R0 + 1 /* LR */ + 1,
-	NFPS = (V7 - V0 + 1) + (V30 - V16 + 1),
+	NFPS = (V7 - V0 + 1) + (V29 - V16 + 1),
 	NCLR = (R28 - R19 + 1) + (V15 - V8 + 1),
 };
 MAKESURE(reg_not_tmp, V30 < (int)Tmp0);
@@ -55,6 +55,10 @@ static struct {
 	{ Omul,    Ka, "fmul %=, %0, %1" },
 	{ Odiv,    Ki, "sdiv %=, %0, %1" },
 	{ Odiv,    Ka, "fdiv %=, %0, %1" },
+	{ Osqrt,   Ka, "fsqrt %=, %0" },
+	{ Oabs,    Ka, "fabs %=, %0" },
+	{ Omin,    Ka, "fcmp %0, %1\n\tfcsel\t%=, %0, %1, mi" },
+	{ Omax,    Ka, "fcmp %0, %1\n\tfcsel\t%=, %0, %1, gt" },
 	{ Oudiv,   Ki, "udiv %=, %0, %1" },
 	{ Orem,    Ki, "sdiv %?, %0, %1\n\tmsub\t%=, %?, %1, %0" },
 	{ Ourem,   Ki, "udiv %?, %0, %1\n\tmsub\t%=, %?, %1, %0" },
@@ -102,6 +106,23 @@ static struct {
 	{ Oacmn,   Ki, "cmn %0, %1" },
 	{ Oafcmp,  Ka, "fcmpe %0, %1" },
 
+	{ Opload,  Ks, "ldr d31, %M0" },
+	{ Opload,  Kd, "ldr q31, %M0" },
+	{ Opadd,   Ks, "ldr d30, %M0\n\tfadd\td31, d31, d30" },
+	{ Opadd,   Kd, "ldr q30, %M0\n\tfadd\tv31.2d, v31.2d, v30.2d" },
+	{ Opsub,   Ks, "ldr d30, %M0\n\tfsub\td31, d31, d30" },
+	{ Opsub,   Kd, "ldr q30, %M0\n\tfsub\tv31.2d, v31.2d, v30.2d" },
+	{ Opmul,   Ks, "ldr d30, %M0\n\tfmul\td31, d31, d30" },
+	{ Opmul,   Kd, "ldr q30, %M0\n\tfmul\tv31.2d, v31.2d, v30.2d" },
+	{ Opdiv,   Ks, "ldr d30, %M0\n\tfdiv\td31, d31, d30" },
+	{ Opdiv,   Kd, "ldr q30, %M0\n\tfdiv\tv31.2d, v31.2d, v30.2d" },
+	{ Opmin,   Ks, "ldr d30, %M0\n\tfmin\td31, d31, d30" },
+	{ Opmin,   Kd, "ldr q30, %M0\n\tfmin\tv31.2d, v31.2d, v30.2d" },
+	{ Opmax,   Ks, "ldr d30, %M0\n\tfmax\td31, d31, d30" },
+	{ Opmax,   Kd, "ldr q30, %M0\n\tfmax\tv31.2d, v31.2d, v30.2d" },
+	{ Opstore, Ks, "str d31, %M0" },
+	{ Opstore, Kd, "str q31, %M0" },
+
 #define X(c, str) \
 	{ Oflag+c, Ki, "cset %=, " str },
 	CMP(X)
@@ -112,7 +133,7 @@ static struct {
 static char *
 rname(int r, int k)
 {
-	static char buf[4];
+	static TLS char buf[4];
 
 	if (r == SP) {
 		assert(k == Kl);
@@ -503,7 +524,6 @@ arm64_emitfn(Fn *fn, FILE *out)
 		CMP(X)
 	#undef X
 	};
-	static int id0;
 	int s, n, c, lbl, *r;
 	uint64_t o;
 	Blk *b, *t;
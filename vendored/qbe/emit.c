@@ -67,7 +67,7 @@ emitdat(Dat *d, FILE *f)
 		[DW] = "\t.int",
 		[DL] = "\t.quad"
 	};
-	static int64_t zero;
+	static TLS int64_t zero;
 	char *p;
 
 	switch (d->type) {
@@ -120,7 +120,9 @@ struct Asmbits {
 	Asmbits *link;
 };
 
-static Asmbits *stash;
+TLS int id0; /* first block label of the next function */
+
+static TLS Asmbits *stash;
 
 int
 stashbits(void *bits, int size)
@@ -208,9 +210,26 @@ macho_emitfin(FILE *f)
 	emitfin(f, sec);
 }
 
-static uint32_t *file;
-static uint nfile;
-static uint curfile;
+static TLS uint32_t *file;
+static TLS uint nfile;
+static TLS uint curfile;
+
+void
+emitreset()
+{
+	Asmbits *b;
+
+	while ((b=stash)) {
+		stash = b->link;
+		free(b);
+	}
+	if (file)
+		vfree(file);
+	file = 0;
+	nfile = 0;
+	curfile = 0;
+	id0 = 0;
+}
 
 void
 emitdbgfile(char *fn, FILE *f)
@@ -13,10 +13,10 @@ struct Edge {
 	Edge *work;
 };
 
-static int *val;
-static Edge *flowrk, (*edge)[2];
-static Use **usewrk;
-static uint nuse;
+static TLS int *val;
+static TLS Edge *flowrk, (*edge)[2];
+static TLS Use **usewrk;
+static TLS uint nuse;
 
 static int
 iscon(Con *c, int w, uint64_t k)
@@ -37,10 +37,10 @@ struct Insert {
 	} new;
 };
 
-static Fn *curf;
-static uint inum;    /* current insertion number */
-static Insert *ilog; /* global insertion log */
-static uint nlog;    /* number of entries in the log */
+static TLS Fn *curf;
+static TLS uint inum;    /* current insertion number */
+static TLS Insert *ilog; /* global insertion log */
+static TLS uint nlog;    /* number of entries in the log */
 
 int
 loadsz(Ins *l)
@@ -236,6 +236,17 @@ def(Slice sl, bits msk, Blk *b, Ins *i, Loc *il)
 		if (killsl(i->to, sl)
 		|| (i->op == Ocall && escapes(sl.ref, curf)))
 			goto Load;
+		if (i->op == Ovdst) {
+			/* the result of vector operations
+			 * is never forwarded to loads */
+			assert(rtype(i->arg[1]) == RInt);
+			sz = 8 * rsval(i->arg[1]);
+			r1 = i->arg[0];
+			if (alias(sl.ref, sl.off, sl.sz, r1, sz, &off, curf)
+			!= NoAlias)
+				goto Load;
+			continue;
+		}
 		ld = isload(i->op);
 		if (ld) {
 			sz = loadsz(i);
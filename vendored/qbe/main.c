@@ -1,9 +1,12 @@
+#ifdef QBE_LIB
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include "all.h"
 #include "config.h"
 #include <ctype.h>
 #include <getopt.h>
 
-Target T;
+TLS Target T;
 
 char debug['Z'+1] = {
 	['P'] = 0, /* parsing */
@@ -32,8 +35,8 @@ static Target *tlist[] = {
 	&T_rv64,
 	0
 };
-static FILE *outf;
-static int dbg;
+static TLS FILE *outf;
+static TLS int dbg;
 
 static void
 data(Dat *d)
@@ -113,6 +116,152 @@ dbgfile(char *fn)
 	emitdbgfile(fn, outf);
 }
 
+#ifdef QBE_LIB
+
+enum {
+	NErr = 1024,
+};
+
+static TLS jmp_buf failjmp;
+static TLS char errbuf[NErr];
+static TLS uint nerrbuf;
+
+void
+vseterr(char *s, va_list ap)
+{
+	int n;
+
+	n = vsnprintf(&errbuf[nerrbuf], NErr - nerrbuf, s, ap);
+	if (n > 0)
+		nerrbuf += n;
+	if (nerrbuf >= NErr)
+		nerrbuf = NErr - 1;
+}
+
+void
+seterr(char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	vseterr(s, ap);
+	va_end(ap);
+}
+
+void
+fail()
+{
+	longjmp(failjmp, 1);
+}
+
+static void
+cleanup()
+{
+	freeall();
+	emitreset();
+	freeintern();
+	free(insb);
+	insb = 0;
+	curi = 0;
+}
+
+/* Compiles the IR in ir[0..nir) for the target
+ * named tgt (the default target if null). If unit
+ * is not negative, the local labels get it as a
+ * prefix, so that the assembly of modules compiled
+ * as different units can be put together. On
+ * success, returns 0 and *out holds the assembly;
+ * on failure, returns 1 and *out holds the error
+ * message. Either way, *out is nul-terminated, is
+ * *nout bytes long and must be released with
+ * qbe_free(). All the state lives in thread-local
+ * storage, so different threads may compile at
+ * the same time.
+ */
+int
+qbe_compile(const char *tgt, int unit, const char *ir, size_t nir, char **out, size_t *nout)
+{
+	Target **t;
+	FILE *volatile inf;
+	char loc[32];
+
+	*out = 0;
+	*nout = 0;
+	nerrbuf = 0;
+	errbuf[0] = 0;
+	inf = 0;
+	outf = 0;
+	if (setjmp(failjmp)) {
+		if (inf)
+			fclose(inf);
+		if (outf) {
+			fclose(outf);
+			free(*out);
+		}
+		cleanup();
+		*nout = nerrbuf;
+		*out = malloc(nerrbuf + 1);
+		if (*out)
+			memcpy(*out, errbuf, nerrbuf + 1);
+		else
+			*nout = 0;
+		return 1;
+	}
+
+	T = Deftgt;
+	if (tgt)
+		for (t=tlist;; t++) {
+			if (!*t) {
+				seterr("unknown target '%s'", tgt);
+				fail();
+			}
+			if (strcmp(tgt, (*t)->name) == 0) {
+				T = **t;
+				break;
+			}
+		}
+	if (unit >= 0) {
+		snprintf(loc, sizeof loc, "%su%d_", T.asloc, unit);
+		if (strlen(loc) >= sizeof T.asloc) {
+			seterr("unit %d is too large", unit);
+			fail();
+		}
+		strcpy(T.asloc, loc);
+	}
+
+	insb = calloc(NIns, sizeof insb[0]);
+	if (!insb) {
+		seterr("out of memory");
+		fail();
+	}
+	inf = fmemopen((void *)ir, nir, "r");
+	if (!inf) {
+		seterr("cannot open input buffer");
+		fail();
+	}
+	outf = open_memstream(out, nout);
+	if (!outf) {
+		seterr("cannot open output buffer");
+		fail();
+	}
+
+	parse(inf, "-", dbgfile, data, func);
+	T.emitfin(outf);
+
+	fclose(inf);
+	fclose(outf);
+	cleanup();
+	return 0;
+}
+
+void
+qbe_free(char *p)
+{
+	free(p);
+}
+
+#else
+
 int
 main(int ac, char *av[])
 {
@@ -196,3 +345,5 @@ main(int ac, char *av[])
 
 	exit(0);
 }
+
+#endif
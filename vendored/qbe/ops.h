@@ -33,6 +33,12 @@ O(sar,     T(w,l,e,e, w,w,e,e), 1) X(1, 1, 0) V(1)
 O(shr,     T(w,l,e,e, w,w,e,e), 1) X(1, 1, 0) V(1)
 O(shl,     T(w,l,e,e, w,w,e,e), 1) X(1, 1, 0) V(1)
 
+/* Floating Point Functions */
+O(sqrt,    T(e,e,s,d, e,e,x,x), 0) X(0, 0, 0) V(0)
+O(abs,     T(e,e,s,d, e,e,x,x), 0) X(0, 0, 0) V(0)
+O(min,     T(e,e,s,d, e,e,s,d), 0) X(0, 0, 0) V(0)
+O(max,     T(e,e,s,d, e,e,s,d), 0) X(0, 0, 0) V(0)
+
 /* Comparisons */
 O(ceqw,    T(w,w,e,e, w,w,e,e), 1) X(0, 1, 0) V(0)
 O(cnew,    T(w,w,e,e, w,w,e,e), 1) X(0, 1, 0) V(0)
@@ -90,6 +96,14 @@ O(loadsw,  T(m,m,e,e, x,x,e,e), 0) X(0, 0, 1) V(0)
 O(loaduw,  T(m,m,e,e, x,x,e,e), 0) X(0, 0, 1) V(0)
 O(load,    T(m,m,m,m, x,x,x,x), 0) X(0, 0, 1) V(0)
 
+/* Packed Arithmetic (first half, see vdst) */
+O(vaddd,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+O(vsubd,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+O(vmuld,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+O(vdivd,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+O(vmind,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+O(vmaxd,   T(m,e,e,e, m,e,e,e), 0) X(0, 0, 1) V(0)
+
 /* Extensions and Truncations */
 O(extsb,   T(w,w,e,e, x,x,e,e), 1) X(0, 0, 1) V(0)
 O(extub,   T(w,w,e,e, x,x,e,e), 1) X(0, 0, 1) V(0)
@@ -133,6 +147,7 @@ O(nop,     T(x,x,x,x, x,x,x,x), 0) X(0, 0, 1) V(0)
 O(addr,    T(m,m,e,e, x,x,e,e), 0) X(0, 0, 1) V(0)
 O(blit0,   T(m,e,e,e, m,e,e,e), 0) X(0, 1, 0) V(0)
 O(blit1,   T(w,e,e,e, x,e,e,e), 0) X(0, 1, 0) V(0)
+O(vdst,    T(m,e,e,e, w,e,e,e), 0) X(0, 0, 1) V(0)
 O(swap,    T(w,l,s,d, w,l,s,d), 0) X(1, 0, 0) V(0)
 O(sign,    T(w,l,e,e, x,x,e,e), 0) X(0, 0, 0) V(0)
 O(salloc,  T(e,l,e,e, e,x,e,e), 0) X(0, 0, 0) V(0)
@@ -146,6 +161,18 @@ O(afcmp,   T(e,e,s,d, e,e,s,d), 0) X(0, 0, 0) V(0)
 O(reqz,    T(w,l,e,e, x,x,e,e), 0) X(0, 0, 0) V(0)
 O(rnez,    T(w,l,e,e, x,x,e,e), 0) X(0, 0, 0) V(0)
 
+/* Packed Operations on the Vector Scratch Register
+ * (introduced by simpl(); the class is Kd to work on
+ * two doubles and Ks to work on the low one only) */
+O(pload,   T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(padd,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(psub,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(pmul,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(pdiv,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(pmin,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(pmax,    T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+O(pstore,  T(e,e,m,m, e,e,x,x), 0) X(0, 0, 1) V(0)
+
 /* Arguments, Parameters, and Calls */
 O(par,     T(x,x,x,x, x,x,x,x), 0) X(0, 0, 0) V(0)
 O(parsb,   T(x,x,x,x, x,x,x,x), 0) X(0, 0, 0) V(0)
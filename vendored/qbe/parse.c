@@ -128,6 +128,7 @@ static char *kwmap[Ntok] = {
 
 enum {
 	NPred = 63,
+	NVec = 1 << 24, /* keeps vector sizes in bytes small */
 
 	TMask = 16383, /* for temps hash */
 	BMask = 8191, /* for blocks hash */
@@ -136,28 +137,28 @@ enum {
 	M = 23,
 };
 
-static uchar lexh[1 << (32-M)];
-static FILE *inf;
-static char *inpath;
-static int thead;
-static struct {
+static TLS uchar lexh[1 << (32-M)];
+static TLS FILE *inf;
+static TLS char *inpath;
+static TLS int thead;
+static TLS struct {
 	char chr;
 	double fltd;
 	float flts;
 	int64_t num;
 	char *str;
 } tokval;
-static int lnum;
-
-static Fn *curf;
-static int tmph[TMask+1];
-static Phi **plink;
-static Blk *curb;
-static Blk **blink;
-static Blk *blkh[BMask+1];
-static int nblk;
-static int rcls;
-static uint ntyp;
+static TLS int lnum;
+
+static TLS Fn *curf;
+static TLS int tmph[TMask+1];
+static TLS Phi **plink;
+static TLS Blk *curb;
+static TLS Blk **blink;
+static TLS Blk *blkh[BMask+1];
+static TLS int nblk;
+static TLS int rcls;
+static TLS uint ntyp;
 
 void
 err(char *s, ...)
@@ -165,17 +166,24 @@ err(char *s, ...)
 	va_list ap;
 
 	va_start(ap, s);
+#ifdef QBE_LIB
+	seterr("qbe:%s:%d: ", inpath, lnum);
+	vseterr(s, ap);
+	va_end(ap);
+	fail();
+#else
 	fprintf(stderr, "qbe:%s:%d: ", inpath, lnum);
 	vfprintf(stderr, s, ap);
 	fprintf(stderr, "\n");
 	va_end(ap);
 	exit(1);
+#endif
 }
 
 static void
 lexinit()
 {
-	static int done;
+	static TLS int done;
 	int i;
 	long h;
 
@@ -218,7 +226,7 @@ getint()
 static int
 lex()
 {
-	static char tok[NString];
+	static TLS char tok[NString];
 	int c, i, esc;
 	int t;
 
@@ -596,7 +604,7 @@ parseline(PState ps)
 		op = next();
 		break;
 	default:
-		if (isstore(t)) {
+		if (isstore(t) || isvec(t)) {
 		case Tblit:
 		case Tcall:
 		case Ovastart:
@@ -759,6 +767,31 @@ parseline(PState ps)
 		curi++;
 		return PIns;
 	default:
+		if (isvec(op)) {
+			if (i != 4)
+				err("%s expects 4 arguments", optab[op].name);
+			if (curi - insb >= NIns-1)
+				err("too many instructions");
+			memset(curi, 0, 2 * sizeof(Ins));
+			curi->op = op;
+			curi->arg[0] = arg[1];
+			curi->arg[1] = arg[2];
+			curi++;
+			if (rtype(arg[3]) != RCon)
+				err("vector length must be constant");
+			c = &curf->con[arg[3].val];
+			r = INT(c->bits.i);
+			if (c->type != CBits
+			|| rsval(r) < 0
+			|| rsval(r) != c->bits.i
+			|| c->bits.i > NVec)
+				err("invalid vector length");
+			curi->op = Ovdst;
+			curi->arg[0] = arg[0];
+			curi->arg[1] = r;
+			curi++;
+			return PIns;
+		}
 		if (op >= NPubOp)
 			err("invalid instruction");
 	Ins:
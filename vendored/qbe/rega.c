@@ -15,18 +15,18 @@ struct RMap {
 	int n;
 };
 
-static bits regu;      /* registers used */
-static Tmp *tmp;       /* function temporaries */
-static Mem *mem;       /* function mem references */
-static struct {
+static TLS bits regu;      /* registers used */
+static TLS Tmp *tmp;       /* function temporaries */
+static TLS Mem *mem;       /* function mem references */
+static TLS struct {
 	Ref src, dst;
 	int cls;
 } pm[Tmp0];            /* parallel move constructed */
-static int npm;        /* size of pm */
-static int loop;       /* current loop level */
+static TLS int npm;        /* size of pm */
+static TLS int loop;       /* current loop level */
 
-static uint stmov;     /* stats: added moves */
-static uint stblk;     /* stats: added blocks */
+static TLS uint stmov;     /* stats: added moves */
+static TLS uint stblk;     /* stats: added blocks */
 
 static int *
 hint(int t)
@@ -18,6 +18,8 @@ static struct {
 	{ Oneg,    Ka, "fneg.%k %=, %0" },
 	{ Odiv,    Ki, "div%k %=, %0, %1" },
 	{ Odiv,    Ka, "fdiv.%k %=, %0, %1" },
+	{ Osqrt,   Ka, "fsqrt.%k %=, %0" },
+	{ Oabs,    Ka, "fabs.%k %=, %0" },
 	{ Orem,    Ki, "rem%k %=, %0, %1" },
 	{ Orem,    Kl, "rem %=, %0, %1" },
 	{ Oudiv,   Ki, "divu%k %=, %0, %1" },
@@ -441,7 +443,6 @@ emitins(Ins *i, Fn *fn, FILE *f)
 void
 rv64_emitfn(Fn *fn, FILE *f)
 {
-	static int id0;
 	int lbl, neg, off, frame, *pr, r;
 	Blk *b, *s;
 	Ins *i;
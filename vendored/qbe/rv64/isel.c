@@ -187,6 +187,10 @@ sel(Ins i, Fn *fn)
 		selcmp(i, ck, cc, fn);
 		return;
 	}
+	if (ispacked(i.op))
+		err("vector instructions are not supported on rv64");
+	if (i.op == Omin || i.op == Omax)
+		err("%s is not supported on rv64", optab[i.op].name);
 	if (i.op != Onop) {
 		emiti(i);
 		i0 = curi; /* fixarg() can change curi */
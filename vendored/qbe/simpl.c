@@ -30,6 +30,38 @@ blit(Ref sd[2], int sz, Fn *fn)
 		}
 }
 
+static void
+vmem(int op, int k, Ref base, int off, Fn *fn)
+{
+	Ref r;
+
+	if (off == 0) {
+		emit(op, k, R, base, R);
+		return;
+	}
+	r = newtmp("vec", Kl, fn);
+	emit(op, k, R, r, R);
+	emit(Oadd, Kl, r, base, getcon(off, fn));
+}
+
+static void
+vec(int op, Ref d, Ref s[2], int n, Fn *fn)
+{
+	int k, off;
+
+	/* two doubles at a time in the vector
+	 * scratch register, and a last single
+	 * one if n is odd; emitted backwards */
+	op = Opadd + (op - Ovaddd);
+	for (off=8*n; off>0;) {
+		k = off % 16 ? Ks : Kd;
+		off -= k == Kd ? 16 : 8;
+		vmem(Opstore, k, d, off, fn);
+		vmem(op, k, s[1], off, fn);
+		vmem(Opload, k, s[0], off, fn);
+	}
+}
+
 static void
 ins(Ins **pi, int *new, Blk *b, Fn *fn)
 {
@@ -54,6 +86,19 @@ ins(Ins **pi, int *new, Blk *b, Fn *fn)
 		blit((i-1)->arg, rsval(i->arg[0]), fn);
 		*pi = i-1;
 		break;
+	case Ovdst:
+		assert(i > b->ins);
+		assert(isvec((i-1)->op));
+		if (!*new) {
+			curi = &insb[NIns];
+			ni = &b->ins[b->nins] - (i+1);
+			curi -= ni;
+			icpy(curi, i+1, ni);
+			*new = 1;
+		}
+		vec((i-1)->op, i->arg[0], (i-1)->arg, rsval(i->arg[1]), fn);
+		*pi = i-1;
+		break;
 	default:
 		if (*new)
 			emiti(*i);
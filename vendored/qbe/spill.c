@@ -94,13 +94,13 @@ fillcost(Fn *fn)
 	}
 }
 
-static BSet *fst; /* temps to prioritize in registers (for tcmp1) */
-static Tmp *tmp;  /* current temporaries (for tcmpX) */
-static int ntmp;  /* current # of temps (for limit) */
-static int locs;  /* stack size used by locals */
-static int slot4; /* next slot of 4 bytes */
-static int slot8; /* ditto, 8 bytes */
-static BSet mask[2][1]; /* class masks */
+static TLS BSet *fst; /* temps to prioritize in registers (for tcmp1) */
+static TLS Tmp *tmp;  /* current temporaries (for tcmpX) */
+static TLS int ntmp;  /* current # of temps (for limit) */
+static TLS int locs;  /* stack size used by locals */
+static TLS int slot4; /* next slot of 4 bytes */
+static TLS int slot8; /* ditto, 8 bytes */
+static TLS BSet mask[2][1]; /* class masks */
 
 static int
 tcmp0(const void *pa, const void *pb)
@@ -164,7 +164,7 @@ slot(int t)
 static void
 limit(BSet *b, int k, BSet *f)
 {
-	static int *tarr, maxt;
+	static TLS int *tarr, maxt;
 	int i, t, nt;
 
 	nt = bscount(b);
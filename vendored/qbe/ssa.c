@@ -207,7 +207,7 @@ struct Name {
 	Name *up;
 };
 
-static Name *namel;
+static TLS Name *namel;
 
 static Name *
 nnew(Ref r, Blk *b, Name *up)
@@ -24,6 +24,8 @@ char *tok[] = {
 	"cnes", "ceqs", "cos", "cuos", "cled", "cltd",
 	"cgtd", "cged", "cned", "ceqd", "cod", "cuod",
 	"vaarg", "vastart", "...", "env", "dbgloc",
+	"vaddd", "vsubd", "vmuld", "vdivd", "vmind", "vmaxd",
+	"sqrt", "abs", "min", "max",
 
 	"call", "phi", "jmp", "jnz", "ret", "hlt", "export",
 	"function", "type", "data", "section", "align", "dbgfile",
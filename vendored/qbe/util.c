@@ -30,14 +30,18 @@ enum {
 	IMask = (1<<IBits) - 1,
 };
 
-Typ *typ;
+TLS Typ *typ;
+#ifdef QBE_LIB
+TLS Ins *insb, *curi;
+#else
 Ins insb[NIns], *curi;
+#endif
 
-static void *ptr[NPtr];
-static void **pool = ptr;
-static int nptr = 1;
+static TLS void *ptr[NPtr];
+static TLS void **pool;
+static TLS int nptr = 1;
 
-static Bucket itbl[IMask+1]; /* string interning table */
+static TLS Bucket itbl[IMask+1]; /* string interning table */
 
 uint32_t
 hash(char *s)
@@ -54,12 +58,19 @@ die_(char *file, char *s, ...)
 {
 	va_list ap;
 
-	fprintf(stderr, "%s: dying: ", file);
 	va_start(ap, s);
+#ifdef QBE_LIB
+	seterr("%s: dying: ", file);
+	vseterr(s, ap);
+	va_end(ap);
+	fail();
+#else
+	fprintf(stderr, "%s: dying: ", file);
 	vfprintf(stderr, s, ap);
 	va_end(ap);
 	fputc('\n', stderr);
 	abort();
+#endif
 }
 
 void *
@@ -80,6 +91,8 @@ alloc(size_t n)
 
 	if (n == 0)
 		return 0;
+	if (!pool)
+		pool = ptr;
 	if (nptr >= NPtr) {
 		pp = emalloc(NPtr * sizeof(void *));
 		pp[0] = pool;
@@ -94,6 +107,8 @@ freeall()
 {
 	void **pp;
 
+	if (!pool)
+		return;
 	for (;;) {
 		for (pp = &pool[1]; pp < &pool[nptr]; pp++)
 			free(*pp);
@@ -199,6 +214,22 @@ str(uint32_t id)
 	return itbl[id&IMask].str[id>>IBits];
 }
 
+void
+freeintern()
+{
+	Bucket *b;
+	uint i;
+
+	for (b=itbl; b<&itbl[IMask+1]; b++) {
+		for (i=0; i<b->nstr; i++)
+			free(b->str[i]);
+		if (b->nstr)
+			vfree(b->str);
+		b->nstr = 0;
+		b->str = 0;
+	}
+}
+
 int
 isreg(Ref r)
 {
@@ -337,7 +368,7 @@ phicls(int t, Tmp *tmp)
 Ref
 newtmp(char *prfx, int k,  Fn *fn)
 {
-	static int n;
+	static TLS int n;
 	int t;
 
 	t = fn->ntmp++;